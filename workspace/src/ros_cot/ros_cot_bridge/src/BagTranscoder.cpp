@@ -0,0 +1,419 @@
+// BagTranscoder.cpp : encodes the fixes and contact lists of a bag as the CoT the bridge would have sent for them.
+//
+// For after-action review of a recorded run, and for building benchmark corpora from one. Every NavSatFix on the fix
+// topic becomes a self-report of [uid] and [type], and every contact of an AtakContactList (or StampedContactList) on
+// the contacts topic a contact report, with the how, errors and stale time the bridge gives them. Reports are timed by
+// the message's header.stamp (the bag time when it has none, or it is zero) rather than the wall clock, so transcoding
+// a bag twice gives the same bytes.
+//
+// The bag is read on the main thread and cut into batches of messages, which a pool of encoder threads turn into CoT
+// XML or TAK Protocol, each with its own writer; one thread takes the encoded batches back in the order they were
+// read and writes them out. Output is therefore in bag order whatever the thread count (so every uid's reports keep
+// their order), and the tool runs as fast as the bag can be read and the encoders keep up.
+//
+// The output is either a file of events, XML one per line or TAK Protocol stream framed (as Ingest::StreamFramer
+// splits a TCP stream), or, for an output ending in '/', a capture log directory holding them as datagrams sent to
+// 239.2.3.1:6969, which the bridge's replay/file (with replay/direction sent) and CaptureLogReader read.
+//
+// A message on either topic recorded with a definition this build cannot decode (another MD5) is skipped and counted,
+// and the tool then names the MD5 it found and exits with status 1, rather than quietly transcoding less of the bag.
+//
+//    ros_cot_bridge_bag_transcoder <bag> <file, or capture log directory/> [xml|tak]
+//        [encoder threads, 0 = a core each beyond the reader and writer] [fix topic] [contacts topic] [uid] [type]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include "ros_cot_msgs/AtakContactList.h"
+#include "ros_cot_msgs/StampedContactList.h"
+#include "sensor_msgs/NavSatFix.h"
+#include "Ingest/CaptureLog.hpp"
+#include "Messaging/CoTEventWriter.hpp"
+#include "Messaging/TakProtocolWriter.hpp"
+#include "Utility/FastHash.hpp"
+#include "Utility/SpscRing.hpp"
+
+using namespace std;
+using AIDTR::Ingest::CaptureLog;
+using Messaging::CoTEventWriter;
+using Messaging::TakProtocolParser;
+using Messaging::TakProtocolWriter;
+
+namespace {
+
+/// reports per batch: enough to amortize the hand-offs, few enough to keep every encoder busy on a short bag
+const size_t BatchReports = 256;
+/// batches queued in front of and behind each encoder
+const size_t QueueDepth = 8;
+/// what the bridge sends: how, errors of every report, and how long until it goes stale
+const char* const How = "m-f";
+const double Ce = 10, Le = 0.5;
+const int64_t StaleMicros = 60000000;
+
+/// one report to encode; uid and type unescaped, as in the messages
+struct Item
+{
+	int64_t nanos = 0;
+	string uid, type;
+	double lat = 0, lon = 0, hae = 0;
+};
+
+/// messages as read; slots are reused, so the strings keep their capacity
+struct Batch
+{
+	vector<Item> items;
+	size_t size = 0;
+};
+
+struct Record
+{
+	size_t end;	///< of the event in Encoded::data
+	int64_t nanos;
+	uint64_t uidHash;	///< as DecodePipeline keys the event
+};
+
+struct Encoded
+{
+	string data;
+	vector<Record> records;
+};
+
+/// spin, then yield, then sleep briefly while a thread waits on a ring
+struct Backoff
+{
+	unsigned idle = 0;
+	void reset() { idle = 0; }
+	void pause()
+	{
+		if (++idle < 64) return;
+		if (idle < 256) this_thread::yield();
+		else this_thread::sleep_for(chrono::microseconds(50));
+	}
+};
+
+class Transcoder
+{
+public:
+	Transcoder(bool tak, bool capture, size_t encoders) : tak(tak), capture(capture), readDone(false), batchesRead(0)
+	{
+		for (size_t i = 0; i < encoders; ++i)
+		{
+			input.emplace_back(new Utility::SpscRing<Batch>(QueueDepth));
+			output.emplace_back(new Utility::SpscRing<Encoded>(QueueDepth));
+		}
+	}
+
+	/// read the bag into batches for the encoders, round robin, and the writer takes them back in the same turn
+	void read(rosbag::View& view, const string& fixTopic, const string& contactsTopic, const string& uid, const string& type)
+	{
+		vector<thread> encoders;
+		for (size_t e = 0; e < input.size(); ++e)
+			encoders.emplace_back(&Transcoder::encodeLoop, this, e);
+
+		uint64_t batch = 0;
+		Batch* current = nullptr;
+		Backoff backoff;
+		auto next = [&]() -> Item& {
+			if (!current)
+			{
+				auto& ring = *input[batch % input.size()];
+				while (!(current = ring.beginPush()))
+					backoff.pause();
+				backoff.reset();
+				current->size = 0;
+			}
+			if (current->items.size() <= current->size)
+				current->items.resize(current->size + 1);
+			return current->items[current->size++];
+		};
+		auto commit = [&] {
+			if (!current) return;
+			input[batch % input.size()]->commitPush();
+			current = nullptr;
+			batchesRead.store(++batch, memory_order_release);
+		};
+
+		for (const rosbag::MessageInstance& m : view)
+		{
+			const int64_t bagNanos = static_cast<int64_t>(m.getTime().toNSec());
+			if (m.getTopic() == fixTopic)
+			{
+				const auto fix = m.instantiate<sensor_msgs::NavSatFix>();
+				if (!fix)
+				{
+					skip(m);
+					continue;
+				}
+				Item& item = next();
+				item.nanos = fix->header.stamp.isZero() ? bagNanos : static_cast<int64_t>(fix->header.stamp.toNSec());
+				item.uid = uid;
+				item.type = type;
+				item.lat = fix->latitude;
+				item.lon = fix->longitude;
+				item.hae = fix->altitude;
+				if (current->size == BatchReports) commit();
+				++fixes;
+			}
+			else if (m.getTopic() == contactsTopic)
+			{
+				// the contacts input as publishers send it, or a stamped list (stamped_contacts, or one the bridge published)
+				const auto list = m.instantiate<ros_cot_msgs::AtakContactList>();
+				const auto stamped = list ? nullptr : m.instantiate<ros_cot_msgs::StampedContactList>();
+				if (!list && !stamped)
+				{
+					skip(m);
+					continue;
+				}
+				const int64_t nanos = !stamped || stamped->header.stamp.isZero() ? bagNanos
+					: static_cast<int64_t>(stamped->header.stamp.toNSec());
+				for (const auto& contact : list ? list->contactList : stamped->contactList)
+				{
+					Item& item = next();
+					item.nanos = nanos;
+					item.uid = contact.uid;
+					item.type = contact.type;
+					item.lat = contact.latitude;
+					item.lon = contact.longitude;
+					item.hae = contact.altitude;
+					if (current->size == BatchReports) commit();
+				}
+				++contactLists;
+			}
+		}
+		commit();
+		readDone = true;
+		for (auto& t : encoders)
+			t.join();
+	}
+
+	/** take the encoded batches in read order, appending each event to os or, when log is given, to it
+	*
+	*	Runs beside read(), until every batch read has been written.
+	*/
+	void write(ostream* os, CaptureLog* log)
+	{
+		static const unsigned char group[] = { 239, 2, 3, 1 };
+		const boost::string_view address(reinterpret_cast<const char*>(group), sizeof(group));
+		Backoff backoff;
+		for (uint64_t batch = 0;; ++batch)
+		{
+			auto& ring = *output[batch % output.size()];
+			Encoded* encoded;
+			while (!(encoded = ring.front()))
+			{
+				if (readDone && batch >= batchesRead.load(memory_order_acquire))
+					return;
+				backoff.pause();
+			}
+			backoff.reset();
+			if (log)
+			{
+				size_t begin = 0;
+				for (const Record& r : encoded->records)
+				{
+					// offline there is no reason to lose a record: wait for the log's writer instead
+					if (r.end - begin > CaptureLog::MaxPayloadSize)
+						++oversize;
+					else while (!log->append(0, CaptureLog::Sent, r.nanos, address, 6969, r.uidHash,
+							encoded->data.data() + begin, r.end - begin))
+						this_thread::yield();
+					begin = r.end;
+				}
+			}
+			else
+				os->write(encoded->data.data(), encoded->data.size());
+			reports += encoded->records.size();
+			bytes += encoded->data.size();
+			ring.pop();
+		}
+	}
+
+	uint64_t fixes = 0, contactLists = 0;	///< read
+	uint64_t skipped = 0;	///< on the fix or contacts topic, but of a definition (MD5) this build cannot decode
+	string skippedType, skippedMd5;	///< the first of those
+	uint64_t reports = 0, bytes = 0, oversize = 0;	///< written
+
+protected:
+	void skip(const rosbag::MessageInstance& m)
+	{
+		if (skipped++ == 0)
+		{
+			skippedType = m.getDataType();
+			skippedMd5 = m.getMD5Sum();
+		}
+	}
+
+	void encodeLoop(size_t encoder)
+	{
+		CoTEventWriter xmlWriter;
+		TakProtocolWriter takWriter;
+		auto& in = *input[encoder];
+		auto& out = *output[encoder];
+		string escapedUid, escapedType;
+		Backoff backoff;
+		for (uint64_t batch = encoder;; batch += input.size())
+		{
+			Batch* items;
+			while (!(items = in.front()))
+			{
+				if (readDone && batch >= batchesRead.load(memory_order_acquire))
+					return;
+				backoff.pause();
+			}
+			Encoded* encoded;
+			while (!(encoded = out.beginPush()))
+				backoff.pause();
+			backoff.reset();
+			encoded->data.clear();
+			encoded->records.clear();
+			for (size_t i = 0; i < items->size; ++i)
+			{
+				const Item& item = items->items[i];
+				CoTEventWriter::Report r;
+				r.how = How;
+				r.simulation = true;
+				r.timeMicros = item.nanos / 1000;
+				r.staleMicros = r.timeMicros + StaleMicros;
+				r.lat = item.lat;
+				r.lon = item.lon;
+				r.hae = item.hae;
+				r.ce = Ce;
+				r.le = Le;
+				boost::string_view event;
+				if (tak)
+				{
+					r.uid = item.uid;
+					r.type = item.type;
+					event = takWriter.write(r, capture ? TakProtocolParser::Mesh : TakProtocolParser::Stream);
+				}
+				else
+				{
+					escapedUid = Messaging::CoTEvent::escape(item.uid);
+					escapedType = Messaging::CoTEvent::escape(item.type);
+					r.uid = escapedUid;
+					r.type = escapedType;
+					event = xmlWriter.write(r);
+				}
+				encoded->data.append(event.data(), event.size());
+				if (!tak && !capture)
+					encoded->data.push_back('\n');
+				const uint64_t uidHash = Utility::FastHash::hash(r.uid.data(), r.uid.size());
+				encoded->records.push_back(Record{ encoded->data.size(), item.nanos, uidHash ? uidHash : 1 });
+			}
+			in.pop();
+			out.commitPush();
+		}
+	}
+
+	const bool tak, capture;
+	vector<unique_ptr<Utility::SpscRing<Batch>>> input;
+	vector<unique_ptr<Utility::SpscRing<Encoded>>> output;
+	atomic<bool> readDone;
+	atomic<uint64_t> batchesRead;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		if (argc < 3)
+		{
+			cerr << "usage: " << argv[0] << " <bag> <file, or capture log directory/> [xml|tak] [encoder threads]"
+				" [fix topic] [contacts topic] [uid] [type]" << endl;
+			return 2;
+		}
+		const string output = argv[2];
+		const string format = argc > 3 ? argv[3] : "xml";
+		size_t encoders = argc > 4 ? strtoul(argv[4], nullptr, 10) : 0;
+		if (encoders == 0)
+			encoders = max(1u, thread::hardware_concurrency() > 2 ? thread::hardware_concurrency() - 2 : 1u);
+		const string fixTopic = argc > 5 ? argv[5] : "/fix";
+		const string contactsTopic = argc > 6 ? argv[6] : "/contacts";
+		const string uid = argc > 7 ? argv[7] : "AIDTR Gator 1";
+		const string type = argc > 8 ? argv[8] : "a-f-G-E-V";
+		if (format != "xml" && format != "tak")
+		{
+			cerr << "unknown format " << format << "; xml or tak" << endl;
+			return 2;
+		}
+		const bool capture = !output.empty() && output.back() == '/';
+
+		rosbag::Bag bag(argv[1], rosbag::bagmode::Read);
+		rosbag::View view(bag, rosbag::TopicQuery(vector<string>{ fixTopic, contactsTopic }));
+
+		unique_ptr<ofstream> file;
+		unique_ptr<CaptureLog> log;
+		if (capture)
+		{
+			log.reset(new CaptureLog(output.substr(0, output.size() - 1), 1));
+			log->start();
+		}
+		else
+		{
+			file.reset(new ofstream(output, ios::binary | ios::trunc));
+			if (!*file)
+			{
+				cerr << "cannot write " << output << endl;
+				return 1;
+			}
+		}
+
+		Transcoder transcoder(format == "tak", capture, encoders);
+		const auto start = chrono::steady_clock::now();
+		thread writer(&Transcoder::write, &transcoder, file.get(), log.get());
+		transcoder.read(view, fixTopic, contactsTopic, uid, type);
+		writer.join();
+		if (log)
+			log->stop();
+		else if (!file->flush())
+		{
+			cerr << "cannot write " << output << endl;
+			return 1;
+		}
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		cout << transcoder.fixes << " fixes and " << transcoder.contactLists << " contact lists to " << transcoder.reports
+			<< " " << format << " reports (" << transcoder.bytes << " bytes) with " << encoders << " encoder threads in "
+			<< seconds << " s, " << (seconds > 0 ? transcoder.reports / seconds : 0) << " reports/s" << endl;
+		if (transcoder.skipped)
+		{
+			// instantiate() only decodes a message whose MD5 matches the definition built in, so a bag recorded with
+			// another version of a message reads as nothing at all
+			cerr << "error: skipped " << transcoder.skipped << " messages whose definition this build cannot decode, the "
+				"first a " << transcoder.skippedType << " with MD5 " << transcoder.skippedMd5 << "; expected "
+				<< ros::message_traits::MD5Sum<sensor_msgs::NavSatFix>::value() << " (NavSatFix) on " << fixTopic << ", or "
+				<< ros::message_traits::MD5Sum<ros_cot_msgs::AtakContactList>::value() << " (AtakContactList) or "
+				<< ros::message_traits::MD5Sum<ros_cot_msgs::StampedContactList>::value() << " (StampedContactList) on "
+				<< contactsTopic << endl;
+			return 1;
+		}
+		if (log)
+		{
+			cout << log->getRecordCount() << " records written to " << log->getDirectory() << endl;
+			if (transcoder.oversize || log->getWriteErrorCount())
+			{
+				cerr << transcoder.oversize << " reports too long for the capture log, " << log->getWriteErrorCount()
+					<< " failed writes" << endl;
+				return 1;
+			}
+		}
+	}
+	catch (std::exception & e)
+	{
+		std::cerr << "Exception: " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
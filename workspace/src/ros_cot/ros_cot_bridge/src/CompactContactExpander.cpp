@@ -0,0 +1,54 @@
+// CompactContactExpander.cpp : turns the bridge's compact_contact_deltas and compact_contact_snapshot back into
+// contact_deltas and contact_snapshot, on a host the bridge reaches over a slower link. See launch/bridge.launch
+// (snapshot/compact).
+//
+
+#include <boost/make_shared.hpp>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include "ros/ros.h"
+#include "CompactContactCodec.hpp"
+
+namespace AIDTR {
+	/** Subscribes to compact_contact_deltas and compact_contact_snapshot and republishes them, decoded, as
+	*	contact_deltas and contact_snapshot (latched), with the same sequence numbers, so that subscribers of the full
+	*	messages work unchanged. A delta that follows a missed one is not republished; the gap then shows downstream too,
+	*	and is closed by the next snapshot, as it would be on the bridge's own topics.
+	*
+	*	Both subscriptions are on the nodelet's single-threaded handle, so the decoder is only used by one callback at a time.
+	*/
+	class CompactContactExpander : public nodelet::Nodelet {
+	protected:
+		void onInit() override {
+			ros::NodeHandle& n = getNodeHandle();
+			contactDeltasPub = n.advertise<ros_cot_msgs::ContactDelta>("contact_deltas", 100);
+			contactSnapshotPub = n.advertise<ros_cot_msgs::ContactSnapshot>("contact_snapshot", 1, true);
+			deltaSub = n.subscribe("compact_contact_deltas", 100, &CompactContactExpander::deltaCallback, this);
+			snapshotSub = n.subscribe("compact_contact_snapshot", 1, &CompactContactExpander::snapshotCallback, this);
+		}
+
+		void deltaCallback(const ros_cot_msgs::CompactContactDelta::ConstPtr& msg) {
+			auto delta = boost::make_shared<ros_cot_msgs::ContactDelta>();
+			const uint64_t gaps = decoder.getGapCount();
+			if (decoder.decode(*msg, *delta))
+				contactDeltasPub.publish(delta);
+			else if (decoder.getGapCount() != gaps)
+				NODELET_WARN("Missed a contact delta before %llu; waiting for the next snapshot", (unsigned long long)msg->sequence);
+		}
+
+		void snapshotCallback(const ros_cot_msgs::CompactContactSnapshot::ConstPtr& msg) {
+			auto snapshot = boost::make_shared<ros_cot_msgs::ContactSnapshot>();
+			decoder.decode(*msg, *snapshot);
+			if (!decoder.isSynchronized())
+				NODELET_WARN("Contact snapshot %llu refers to uids it does not index; ignored", (unsigned long long)msg->sequence);
+			else
+				contactSnapshotPub.publish(snapshot);
+		}
+
+		CompactContactDecoder decoder;
+		ros::Publisher contactDeltasPub, contactSnapshotPub;
+		ros::Subscriber deltaSub, snapshotSub;
+	};
+}
+
+PLUGINLIB_EXPORT_CLASS(AIDTR::CompactContactExpander, nodelet::Nodelet)
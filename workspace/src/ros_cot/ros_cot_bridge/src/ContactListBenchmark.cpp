@@ -0,0 +1,59 @@
+// ContactListBenchmark.cpp : publishes large, freshly stamped contact lists on "stamped_contacts", for measuring the
+// bridge's stamp-to-callback latency with the bridge as a node (serialized over TCPROS) and as a nodelet in the same
+// manager (the message pointer handed over). See launch/benchmark_node.launch and launch/benchmark_nodelet.launch.
+//
+
+#include <cmath>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include "ros/ros.h"
+#include "ros_cot_msgs/StampedContactList.h"
+
+namespace AIDTR {
+	/** Publishes a list of ~contacts contacts on a grid around (~latitude, ~longitude) at ~rate Hz.
+	*
+	*	Each list is a new message, stamped just before it is published and never touched after, so a subscriber in the
+	*	same manager receives it without a copy; the bridge records now - header.stamp as its callback starts and logs
+	*	the percentiles with its stats.
+	*/
+	class ContactListBenchmark : public nodelet::Nodelet {
+	protected:
+		void onInit() override {
+			ros::NodeHandle& n = getNodeHandle();
+			ros::NodeHandle& pn = getPrivateNodeHandle();
+			const int contacts = pn.param("contacts", 2000);
+			const double latitude = pn.param("latitude", 40.45932), longitude = pn.param("longitude", -79.78582);
+			const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(contacts))));
+			list.contactList.resize(contacts);
+			for (int i = 0; i < contacts; ++i)
+			{
+				auto& contact = list.contactList[i];
+				contact.uid = "benchmark-" + std::to_string(i);
+				contact.type = "a-u-G";
+				contact.how = "m-f";
+				contact.latitude = latitude + 0.001 * (i / side);
+				contact.longitude = longitude + 0.001 * (i % side);
+				contact.altitude = 300;
+				contact.ce = 10;
+				contact.le = 5;
+			}
+			contactsPub = n.advertise<ros_cot_msgs::StampedContactList>("stamped_contacts", 10);
+			timer = n.createWallTimer(ros::WallDuration(1.0 / pn.param("rate", 1.0)), &ContactListBenchmark::publish, this);
+			NODELET_INFO("Publishing %d contacts at %.2f Hz", contacts, pn.param("rate", 1.0));
+		}
+
+		void publish(const ros::WallTimerEvent&) {
+			auto msg = boost::make_shared<ros_cot_msgs::StampedContactList>(list);
+			msg->header.seq = ++sequence;
+			msg->header.stamp = ros::Time::now();
+			contactsPub.publish(msg);
+		}
+
+		ros_cot_msgs::StampedContactList list;
+		ros::Publisher contactsPub;
+		ros::WallTimer timer;
+		uint32_t sequence = 0;
+	};
+}
+
+PLUGINLIB_EXPORT_CLASS(AIDTR::ContactListBenchmark, nodelet::Nodelet)
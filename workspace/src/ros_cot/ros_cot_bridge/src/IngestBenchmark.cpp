@@ -0,0 +1,258 @@
+// IngestBenchmark.cpp : measures CoT ingest throughput.
+//
+// Compares the Xerces DOM path (XmlDecoder::Decode plus attribute lookups) against the in-situ CoTEventParser on a
+// synthetic corpus shaped like ATAK SA traffic, and both against TakProtocolParser on the same events sent as TAK
+// Protocol mesh and stream messages; feeds TakProtocolParser randomly corrupted and truncated messages; measures what eager and lazy <detail> parsing cost on that corpus and on a
+// detail-heavy one (routes and drawings with long link lists and remarks), then replays the SA corpus through
+// Ingest::DecodePipeline with 1, 2, 4 ... parser threads, up to [max parser threads] (default: the number of hardware
+// threads).
+//
+//    ros_cot_bridge_ingest_benchmark [events] [iterations] [max parser threads]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Messaging/XmlDecoder.hpp"
+#include "Messaging/CoTEventParser.hpp"
+#include "Messaging/TakCorpus.hpp"
+#include "Messaging/TakProtocolParser.hpp"
+#include "Ingest/DecodePipeline.hpp"
+
+XERCES_CPP_NAMESPACE_USE;
+using namespace std;
+
+namespace {
+
+	/// XmlDecoder keeps every document it parses until its pool is reset; expose that for a fair steady-state loop.
+	class BenchmarkDecoder : public Messaging::XmlDecoder {
+	public:
+		void reset() { pParser->resetDocumentPool(); }
+	};
+
+	vector<string> makeCorpus(size_t count) {
+		vector<string> corpus;
+		corpus.reserve(count);
+		char buffer[2048];
+		for (size_t i = 0; i < count; ++i) {
+			double lat = 40.45 + 0.0001 * (i % 1000);
+			double lon = -79.78 - 0.0001 * (i % 777);
+			snprintf(buffer, sizeof(buffer),
+				"<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>"
+				"<event version=\"2.0\" uid=\"ANDROID-%08zx\" type=\"a-f-G-U-C\" time=\"2020-03-12T18:05:41.332Z\" "
+				"start=\"2020-03-12T18:05:41.332Z\" stale=\"2020-03-12T18:07:41.332Z\" how=\"h-e\">"
+				"<point lat=\"%.7f\" lon=\"%.7f\" hae=\"312.4\" ce=\"4.9\" le=\"9999999.0\"/>"
+				"<detail><takv os=\"29\" version=\"4.1.0.231\" device=\"SAMSUNG SM-T733\" platform=\"ATAK-CIV\"/>"
+				"<contact endpoint=\"192.168.1.%zu:4242:tcp\" callsign=\"UNIT-%zu\"/>"
+				"<uid Droid=\"UNIT-%zu\"/><precisionlocation altsrc=\"GPS\" geopointsrc=\"GPS\"/>"
+				"<__group role=\"Team Member\" name=\"Cyan\"/><status battery=\"87\"/>"
+				"<track course=\"%.1f\" speed=\"1.2\"/></detail></event>",
+				i, lat, lon, i % 250, i, i, double(i % 360));
+			corpus.push_back(buffer);
+		}
+		return corpus;
+	}
+
+	/// routes and drawn shapes: dozens of <link> points and free-text remarks, with the contact at the end of the detail
+	vector<string> makeDetailHeavyCorpus(size_t count) {
+		vector<string> corpus;
+		corpus.reserve(count);
+		char buffer[512];
+		for (size_t i = 0; i < count; ++i) {
+			double lat = 40.45 + 0.0001 * (i % 1000);
+			double lon = -79.78 - 0.0001 * (i % 777);
+			snprintf(buffer, sizeof(buffer),
+				"<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>"
+				"<event version=\"2.0\" uid=\"ROUTE-%08zx\" type=\"b-m-r\" time=\"2020-03-12T18:05:41.332Z\" "
+				"start=\"2020-03-12T18:05:41.332Z\" stale=\"2020-03-13T18:05:41.332Z\" how=\"h-e\">"
+				"<point lat=\"%.7f\" lon=\"%.7f\" hae=\"312.4\" ce=\"9999999.0\" le=\"9999999.0\"/><detail>",
+				i, lat, lon);
+			string d = buffer;
+			const size_t links = 20 + i % 40;
+			for (size_t k = 0; k < links; ++k) {
+				snprintf(buffer, sizeof(buffer),
+					"<link uid=\"ROUTE-%08zx-%zu\" callsign=\"CP%zu\" type=\"b-m-p-w\" point=\"%.7f,%.7f,312.4\" "
+					"remarks=\"\" relation=\"c\"/>", i, k, k, lat + 0.001 * k, lon - 0.001 * k);
+				d += buffer;
+			}
+			d += "<link_attr planningmethod=\"Infil\" color=\"-1\" method=\"Walking\" prefix=\"CP\" type=\"On Foot\" "
+				"stroke=\"3\" direction=\"Infil\" routetype=\"Primary\" order=\"Ascending Check Points\"/>"
+				"<strokeColor value=\"-1\"/><strokeWeight value=\"3.0\"/>"
+				"<remarks>Primary route; hold at CP3 for the relief column, then continue to the objective.</remarks>"
+				"<archive/><__routeinfo><__navcues/></__routeinfo>";
+			snprintf(buffer, sizeof(buffer), "<contact callsign=\"Route %zu\"/></detail></event>", i);
+			d += buffer;
+			corpus.push_back(d);
+		}
+		return corpus;
+	}
+
+	template <typename F>
+	double timeIt(const vector<string>& corpus, size_t iterations, F&& f) {
+		auto start = chrono::steady_clock::now();
+		for (size_t it = 0; it < iterations; ++it)
+			for (const auto& datagram : corpus)
+				f(datagram);
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	void report(const char* name, double seconds, size_t events, size_t bytes) {
+		cout << name << ": " << events / seconds << " events/s, "
+			<< bytes / seconds / 1e6 << " MB/s, "
+			<< 1e9 * seconds / events << " ns/event" << endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+		size_t iterations = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10;
+		auto corpus = makeCorpus(count);
+		size_t bytes = 0;
+		for (const auto& d : corpus) bytes += d.size();
+		bytes *= iterations;
+		size_t events = count * iterations;
+		cout << "corpus: " << count << " events, " << bytes / events << " bytes/event, " << iterations << " iterations" << endl;
+
+		// Xerces DOM path: decode, then read the same fields CoTEventParser extracts
+		{
+			BenchmarkDecoder decoder;
+			XMLCh* xUid = XMLString::transcode("uid");
+			XMLCh* xType = XMLString::transcode("type");
+			XMLCh* xTime = XMLString::transcode("time");
+			XMLCh* xPoint = XMLString::transcode("point");
+			XMLCh* xLat = XMLString::transcode("lat");
+			XMLCh* xLon = XMLString::transcode("lon");
+			size_t checksum = 0, n = 0;
+			double seconds = timeIt(corpus, iterations, [&](const string& d) {
+				auto pDoc = decoder.Decode(const_cast<char*>(d.data()), d.size());
+				if (pDoc) {
+					auto pEvent = pDoc->getDocumentElement();
+					char* uid = XMLString::transcode(pEvent->getAttribute(xUid));
+					char* type = XMLString::transcode(pEvent->getAttribute(xType));
+					char* time = XMLString::transcode(pEvent->getAttribute(xTime));
+					auto pPoint = static_cast<DOMElement*>(pEvent->getElementsByTagName(xPoint)->item(0));
+					char* lat = XMLString::transcode(pPoint->getAttribute(xLat));
+					char* lon = XMLString::transcode(pPoint->getAttribute(xLon));
+					checksum += strlen(uid) + strlen(type) + strlen(time) + size_t(atof(lat) - atof(lon));
+					XMLString::release(&uid); XMLString::release(&type); XMLString::release(&time);
+					XMLString::release(&lat); XMLString::release(&lon);
+				}
+				if (++n % 1024 == 0) decoder.reset();
+			});
+			report("XmlDecoder     ", seconds, events, bytes);
+			cout << "  (checksum " << checksum << ")" << endl;
+			XMLString::release(&xUid); XMLString::release(&xType); XMLString::release(&xTime);
+			XMLString::release(&xPoint); XMLString::release(&xLat); XMLString::release(&xLon);
+		}
+
+		// in-situ path
+		{
+			Messaging::CoTEvent event;
+			size_t checksum = 0, failures = 0;
+			double seconds = timeIt(corpus, iterations, [&](const string& d) {
+				if (Messaging::CoTEventParser::Parse(d.data(), d.size(), event))
+					checksum += event.uid.size() + event.type.size() + size_t(event.lat - event.lon);
+				else
+					++failures;
+			});
+			report("CoTEventParser ", seconds, events, bytes);
+			cout << "  (checksum " << checksum << ", failures " << failures << ")" << endl;
+		}
+
+		// TAK Protocol: the same events as protobuf, decoded in place
+		for (bool mesh : { true, false })
+		{
+			auto tak = Messaging::TakCorpus::make(count, mesh);
+			size_t takBytes = 0;
+			for (const auto& d : tak) takBytes += d.size();
+			takBytes *= iterations;
+			Messaging::CoTEvent event;
+			size_t checksum = 0, failures = 0;
+			double seconds = timeIt(tak, iterations, [&](const string& d) {
+				if (Messaging::TakProtocolParser::Parse(d.data(), d.size(), event))
+					checksum += event.uid.size() + event.type.size() + size_t(event.lat - event.lon);
+				else
+					++failures;
+			});
+			report(mesh ? "TAK mesh       " : "TAK stream     ", seconds, events, takBytes);
+			cout << "  (" << takBytes / events << " bytes/event, checksum " << checksum << ", failures " << failures << ")" << endl;
+		}
+
+		// robustness: corrupt a few bytes of, truncate or extend each message (the test target asserts on this too)
+		{
+			const auto result = Messaging::TakCorpus::fuzz(events, 40);
+			cout << "TAK corrupted  : " << result.accepted << " accepted, " << result.rejected << " rejected, " << result.escaped
+				<< " views outside the datagram" << endl;
+		}
+
+		// eager versus lazy <detail>: parse every well-known field, only the contact, or none (kept as a byte range)
+		auto heavy = makeDetailHeavyCorpus(count);
+		size_t heavyBytes = 0;
+		for (const auto& d : heavy) heavyBytes += d.size();
+		heavyBytes *= iterations;
+		cout << "detail-heavy corpus: " << heavyBytes / events << " bytes/event" << endl;
+		const struct { const char* name; unsigned fields; } modes[] = {
+			{ "eager", Messaging::CoTEvent::AllDetail },
+			{ "contact only", Messaging::CoTEvent::Contact },
+			{ "lazy", Messaging::CoTEvent::NoDetail } };
+		for (const auto* c : { &corpus, &heavy })
+		{
+			for (const auto& mode : modes)
+			{
+				Messaging::CoTEvent event;
+				size_t checksum = 0, failures = 0;
+				double seconds = timeIt(*c, iterations, [&](const string& d) {
+					if (Messaging::CoTEventParser::Parse(d.data(), d.size(), event, mode.fields))
+						checksum += event.uid.size() + event.detail.size() + event.callsign.size();
+					else
+						++failures;
+				});
+				string name = string(c == &corpus ? "SA " : "heavy ") + mode.name;
+				name.resize(15, ' ');
+				report(name.c_str(), seconds, events, c == &corpus ? bytes : heavyBytes);
+				cout << "  (checksum " << checksum << ", failures " << failures << ")" << endl;
+			}
+		}
+
+		// parallel pipeline: one producer replaying the corpus, dedup off since the corpus repeats
+		size_t maxWorkers = argc > 3 ? strtoul(argv[3], nullptr, 10) : thread::hardware_concurrency();
+		if (maxWorkers == 0) maxWorkers = 1;
+		for (size_t workers = 1; workers <= maxWorkers; workers *= 2)
+		{
+			using AIDTR::Ingest::DecodePipeline;
+			DecodePipeline pipeline(1, workers, 4096, 0);
+			atomic<size_t> delivered(0);
+			pipeline.RegisterCallback([&](const Messaging::CoTEvent&) { delivered.fetch_add(1, memory_order_relaxed); });
+			pipeline.start();
+			auto start = chrono::steady_clock::now();
+			for (size_t it = 0; it < iterations; ++it)
+				for (const auto& d : corpus)
+					pipeline.submitWait(0, d.data(), d.size(), DecodePipeline::nowNanos()); // lossless: wait for room rather than drop
+			while (delivered.load(memory_order_relaxed) < events)
+				this_thread::yield();
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			pipeline.stop();
+			string name = "DecodePipeline x" + to_string(workers);
+			name.resize(15, ' ');
+			report(name.c_str(), seconds, events, bytes);
+			const auto& total = pipeline.getEndToEndLatency();
+			cout << "  (end-to-end latency us p50 " << total.percentile(0.5) / 1e3 << " p99 " << total.percentile(0.99) / 1e3
+				<< ", parse queue high water " << pipeline.getQueueHighWater(DecodePipeline::Parse) << ")" << endl;
+		}
+	}
+	catch (std::exception & e)
+	{
+		std::cerr << "Exception: " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
@@ -1,75 +1,1100 @@
-﻿// Bridge.cpp : Defines the entry point for the application.
+﻿// ROSCOTBridge.cpp : the bridge between ROS and CoT, shared by ros_cot_bridge_node and the nodelet.
 //
 
-#include <iostream>
-#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <sstream>
-#include <boost/asio.hpp>
-#include "CoTClient.hpp"
+#include <sys/stat.h>
+#include <boost/make_shared.hpp>
+#include "ROSCOTBridge.hpp"
+#include "Ingest/CaptureLogReader.hpp"
+#include "Ingest/CaptureReplay.hpp"
+#include "Ingest/PcapReader.hpp"
+#include "Utility/ThreadTuning.hpp"
+#ifdef WITH_ARL_MATH
+#include "Ingest/AreaFilterCompiler.hpp"
+#include "Messaging/XmlFileReader.hpp"
+#endif
 
-#include "ros/ros.h"
-#include "sensor_msgs/NavSatFix.h"
-
-#include "ros_cot_msgs/AtakContactList.h"
+#include "ros_cot_msgs/ContactDelta.h"
+#include "ros_cot_msgs/ContactSnapshot.h"
+#include "ros_cot_msgs/FusedTrackList.h"
 
 //  CoT Multicast
 //ATAK default for SA Multicast 239.2.3.1:6969
 //
 //MPU5 CoT Default 239.23.12.230:18999
 
-using namespace std;
+using namespace AIDTR;
+
+namespace {
+
+/// CoTClient reports go stale 60 s after they are sent
+const int64_t SentStaleMicros = 60000000;
+
+/// ce and le (meters) sent for a contact whose list gives none (0 or NaN), as CoTClient's reports default to
+const double DefaultContactCe = 10, DefaultContactLe = 0.5;
+
+/// meters we must move before the heading is updated, so GPS jitter at a standstill does not swing it
+const double MinCourseDistance = 2;
+
+const char* const InputNames[] = { "fix", "contacts", "fleet" };
+
+int64_t wallMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void fillContactMsg(const AIDTR::TrackRecord& record, ros_cot_msgs::AtakContact& contactMsg)
+{
+	contactMsg.uid = Messaging::CoTEvent::unescape(record.getUid());
+	contactMsg.type = Messaging::CoTEvent::unescape(record.getType());
+	contactMsg.how = Messaging::CoTEvent::unescape(record.getHow());
+	contactMsg.latitude = record.lat;
+	contactMsg.longitude = record.lon;
+	contactMsg.altitude = record.hae;
+	contactMsg.ce = record.ce;
+	contactMsg.le = record.le;
+}
+
+void fillTrackMsg(const AIDTR::Tracking::TrackAssociator::Track& track, ros_cot_msgs::FusedTrack& trackMsg)
+{
+	trackMsg.id = track.id;
+	trackMsg.type = Messaging::CoTEvent::unescape(track.type);
+	trackMsg.latitude = track.lat;
+	trackMsg.longitude = track.lon;
+	trackMsg.altitude = track.hae;
+	trackMsg.ce = track.ce;
+	trackMsg.memberUids.push_back(Messaging::CoTEvent::unescape(track.members[track.primary].uid));
+	for (size_t i = 0; i < track.members.size(); ++i)
+		if (i != track.primary)
+			trackMsg.memberUids.push_back(Messaging::CoTEvent::unescape(track.members[i].uid));
+}
+
+/// reads a list of polygons, each a flat [lat, lon, lat, lon, ...] list in degrees, as one area
+bool loadAreaParam(ros::NodeHandle& pn, const std::string& name, AIDTR::Ingest::AreaFilter::Area& area)
+{
+	XmlRpc::XmlRpcValue polygons;
+	if (!pn.getParam(name, polygons) || polygons.getType() != XmlRpc::XmlRpcValue::TypeArray)
+		return false;
+	auto toDouble = [](XmlRpc::XmlRpcValue& v) {
+		return v.getType() == XmlRpc::XmlRpcValue::TypeInt ? static_cast<double>(static_cast<int>(v)) : static_cast<double>(v);
+	};
+	for (int i = 0; i < polygons.size(); ++i)
+	{
+		std::vector<std::pair<double, double>> points;
+		for (int j = 0; j + 1 < polygons[i].size(); j += 2)
+			points.emplace_back(toDouble(polygons[i][j]), toDouble(polygons[i][j + 1]));
+		if (points.size() >= 3)
+			area.segments.emplace_back(points);
+		else
+			ROS_WARN("%s[%d] has fewer than 3 vertices; ignored", name.c_str(), i);
+	}
+	area.name = name;
+	return !area.segments.empty();
+}
+
+/// reads detail_fields, the names of the <detail> elements to parse on receipt, as CoTEvent::DetailFields
+unsigned loadDetailFields(ros::NodeHandle& pn)
+{
+	std::vector<std::string> names;
+	pn.getParam("detail_fields", names);
+	unsigned fields = Messaging::CoTEvent::NoDetail;
+	for (const auto& name : names)
+	{
+		if (name == "contact") fields |= Messaging::CoTEvent::Contact;
+		else if (name == "__group") fields |= Messaging::CoTEvent::Group;
+		else if (name == "track") fields |= Messaging::CoTEvent::Track;
+		else ROS_WARN("detail_fields: unknown element %s; ignored", name.c_str());
+	}
+	return fields;
+}
+
+/// records how long a callback ran, from construction to destruction
+class ScopedDuration
+{
+public:
+	explicit ScopedDuration(Utility::LatencyHistogram& histogram)
+		: histogram(histogram), start(std::chrono::steady_clock::now()) {}
+	~ScopedDuration()
+	{
+		histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+
+private:
+	Utility::LatencyHistogram& histogram;
+	const std::chrono::steady_clock::time_point start;
+};
+
+/// runs once, on whichever thread serves the queue it is added to
+class ThreadSetup : public ros::CallbackInterface
+{
+public:
+	explicit ThreadSetup(std::function<void()> setup) : setup(std::move(setup)) {}
+	CallResult call() override
+	{
+		setup();
+		return Success;
+	}
+
+private:
+	std::function<void()> setup;
+};
+
+std::string describeReplaySource(const AIDTR::Ingest::PcapReader& reader)
+{
+	return std::to_string(reader.getDatagramCount()) + " of " + std::to_string(reader.getPacketCount())
+		+ " packets were UDP datagrams (" + std::to_string(reader.getSkippedCount()) + " skipped)";
+}
+
+std::string describeReplaySource(const AIDTR::Ingest::CaptureLogReader& reader)
+{
+	return std::to_string(reader.getDatagramCount()) + " of " + std::to_string(reader.getRecordCount()) + " records in "
+		+ std::to_string(reader.getSegmentCount()) + " segments were in range (" + std::to_string(reader.getSkippedBlockCount())
+		+ " index blocks skipped, " + std::to_string(reader.getCorruptSegmentCount()) + " segments unreadable)";
+}
+
+}
+
+/// associate one report and publish the fused tracks it changed. A report from a track's secondary reporter that
+/// keeps it in the same track is folded in silently; the track is republished when its primary reports again.
+/// @returns whether the report went out on fused_tracks as part of a track with other members, so received_contacts
+/// need not carry it too
+bool ROSCOTBridge::associate(boost::string_view uid, boost::string_view type, double lat, double lon, double hae, double ce,
+	int64_t timeMicros, int64_t receivedNanos)
+{
+	if (associator == NULL)
+		return false;
+	auto msg = boost::make_shared<ros_cot_msgs::FusedTrackList>();
+	bool merged;
+	{
+		std::lock_guard<std::mutex> lock(associatorMutex);
+		const auto result = associator->update(uid, type, lat, lon, hae, ce, timeMicros);
+		if (result.track == NULL)
+			return false;
+		if (result.change == AIDTR::Tracking::TrackAssociator::Updated && !result.fromPrimary && result.left == NULL)
+			return false;
+		merged = result.track->members.size() > 1;
+		msg->tracks.resize(result.left != NULL ? 2 : 1);
+		fillTrackMsg(*result.track, msg->tracks[0]);
+		if (result.left != NULL)
+			fillTrackMsg(*result.left, msg->tracks[1]);
+	}
+	if (receivedNanos != Messaging::CoTEvent::NoTime)
+		msg->header.stamp.fromNSec(receivedNanos);
+	else
+		msg->header.stamp = ros::Time::now();
+	fusedTracksPub.publish(msg);
+	return merged;
+}
+
+/// @param course our estimated course, or NaN to take the heading from the fixes
+void ROSCOTBridge::updateOwnPose(double lat, double lon, double alt, double course)
+{
+	std::lock_guard<std::mutex> lock(ownPoseMutex);
+	ownPose.lat = lat;
+	ownPose.lon = lon;
+	ownPose.alt = alt;
+	if (course == course)
+	{
+		ownPose.heading = course;
+		ownPose.courseLat = lat;
+		ownPose.courseLon = lon;
+		return;
+	}
+	if (ownPose.courseLat != ownPose.courseLat)
+	{
+		ownPose.courseLat = lat;
+		ownPose.courseLon = lon;
+		return;
+	}
+	double range, bearing, relative;
+	ARL::Math::GeodeticKernels::LocalFrame(ownPose.courseLat, ownPose.courseLon).toPolar(&lat, &lon, NULL, 1, 0,
+		&range, &bearing, &relative);
+	if (range < MinCourseDistance)
+		return;
+	ownPose.heading = bearing;
+	ownPose.courseLat = lat;
+	ownPose.courseLon = lon;
+}
+
+/// fill in a contact list's range, bearing and relative bearing from our own pose, all from one local frame
+void ROSCOTBridge::enrich(ros_cot_msgs::StampedContactList& msg)
+{
+	OwnPose pose;
+	{
+		std::lock_guard<std::mutex> lock(ownPoseMutex);
+		pose = ownPose;
+	}
+	if (pose.lat != pose.lat)
+		return;
+	static thread_local std::vector<double> lat, lon, hae;
+	const size_t n = msg.contactList.size();
+	lat.resize(n);
+	lon.resize(n);
+	hae.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const auto& contactMsg = msg.contactList[i];
+		lat[i] = contactMsg.latitude;
+		lon[i] = contactMsg.longitude;
+		hae[i] = contactMsg.altitude < AIDTR::Tracking::FilterBank::Unknown ? contactMsg.altitude : pose.alt;
+	}
+	msg.ranges.resize(n);
+	msg.bearings.resize(n);
+	msg.relativeBearings.resize(n);
+	ARL::Math::GeodeticKernels::LocalFrame(pose.lat, pose.lon, pose.alt).toPolar(lat.data(), lon.data(), hae.data(), n,
+		pose.heading, msg.ranges.data(), msg.bearings.data(), msg.relativeBearings.data());
+}
 
-AIDTR::CoTClient *client = NULL;
+void ROSCOTBridge::recordInputLatency(Input input, const ros::Time& stamp, const ros::Time& receipt)
+{
+	const ros::Time now = ros::Time::now();
+	if (!stamp.isZero())
+		inputLatency[input].record((now - stamp).toNSec());
+	if (!receipt.isZero())
+		queueLatency[input].record((now - receipt).toNSec());
+}
 
+/// fill origin for a report made from an input with this stamp, when reports are traced
+const TransmitTrace::Origin* ROSCOTBridge::traceOrigin(TransmitTrace::Origin& origin, const ros::Time& stamp, int64_t callbackNanos) const
+{
+	if (transmitTrace == NULL)
+		return NULL;
+	origin.stampNanos = static_cast<int64_t>(stamp.toNSec());
+	origin.callbackNanos = callbackNanos;
+	return &origin;
+}
 
-void chatterCallback(const sensor_msgs::NavSatFix::ConstPtr& msg)
+void ROSCOTBridge::chatterCallback(const ros::MessageEvent<const sensor_msgs::NavSatFix>& event)
 {
+  const int64_t callbackNanos = TransmitTrace::wallNanos();
+  const sensor_msgs::NavSatFix::ConstPtr& msg = event.getConstMessage();
+  recordInputLatency(FixInput, msg->header.stamp, event.getReceiptTime());
+  ScopedDuration duration(callbackDuration[FixInput]);
   //ROS_INFO("ROS heard: [Lat: %f, Long: %f, Alt: %f]", msg->latitude, msg->longitude, msg->altitude);
+  double course = std::nan(""), speed = std::nan("");
+  if (courseEstimator != NULL)
+  {
+	const int64_t stampNanos = static_cast<int64_t>((msg->header.stamp.isZero() ? ros::Time::now() : msg->header.stamp).toNSec());
+	courseEstimator->addFix(stampNanos, msg->latitude, msg->longitude);
+	courseEstimator->get(stampNanos, course, speed);
+  }
+  updateOwnPose(msg->latitude, msg->longitude, msg->altitude, course);
   if (client!= NULL)
-	client->sendPositionReport(msg->latitude, msg->longitude, msg->altitude);
+  {
+	const int64_t nowNanos = TransmitTrace::wallNanos();
+	if (selfReportDue(msg->latitude, msg->longitude, nowNanos))
+	{
+		TransmitTrace::Origin origin;
+		client->sendPositionReport(msg->latitude, msg->longitude, msg->altitude, 10, 0.5, course, speed,
+			traceOrigin(origin, msg->header.stamp, callbackNanos));
+		selfReportCount.fetch_add(1, std::memory_order_relaxed);
+		lastSelfReport.lat = msg->latitude;
+		lastSelfReport.lon = msg->longitude;
+		lastSelfReport.course = course;
+		lastSelfReport.speed = speed == speed ? speed : 0;
+		lastSelfReport.timeNanos = nowNanos;
+	}
+	else
+		selfReportSkipped.fetch_add(1, std::memory_order_relaxed);
+	// our own entry follows every fix, reported or not; it goes stale with the last report we sent
+	const int64_t now = wallMicros();
+	trackStore->update(client->getUid(), "a-f-G-E-V", "m-f",
+		msg->latitude, msg->longitude, msg->altitude, 10, 0.5, now, lastSelfReport.timeNanos / 1000 + SentStaleMicros);
+	associate(client->getUid(), "a-f-G-E-V", msg->latitude, msg->longitude, msg->altitude, 10, now, Messaging::CoTEvent::NoTime);
+  }
   else
 	  ROS_INFO("Error: CoTClient not initialized, ROS is unable to forward message to CoTClient");
 }
 
-void atakContactsCallback(const ros_cot_msgs::AtakContactList::ConstPtr& msg)
+/** whether a fix must be reported: receivers dead-reckoning our last report from its course and speed would place us
+*	further than deadReckoningTolerance from it, or that report is maxSelfReportIntervalNanos old
+*/
+bool ROSCOTBridge::selfReportDue(double lat, double lon, int64_t nowNanos) const
 {
+	if (deadReckoningTolerance <= 0 || lastSelfReport.lat != lastSelfReport.lat
+			|| nowNanos - lastSelfReport.timeNanos >= maxSelfReportIntervalNanos)
+		return true;
+	using namespace ARL::Math::GeodeticKernels;
+	double predictedLat = lastSelfReport.lat, predictedLon = lastSelfReport.lon;
+	if (lastSelfReport.course == lastSelfReport.course)
+	{
+		const double distance = lastSelfReport.speed * (nowNanos - lastSelfReport.timeNanos) * 1e-9;
+		predictedLat += distance * std::cos(lastSelfReport.course * degToRad) / metersPerDegree;
+		predictedLon += distance * std::sin(lastSelfReport.course * degToRad) / (metersPerDegree * std::cos(lastSelfReport.lat * degToRad));
+	}
+	return flatDistance(predictedLat, predictedLon, lat, lon) > deadReckoningTolerance;
+}
+
+void ROSCOTBridge::odometryCallback(const nav_msgs::Odometry::ConstPtr& msg)
+{
+	const auto& q = msg->pose.pose.orientation;
+	const auto& v = msg->twist.twist.linear;
+	courseEstimator->addOdometry(static_cast<int64_t>((msg->header.stamp.isZero() ? ros::Time::now() : msg->header.stamp).toNSec()),
+		q.w, q.x, q.y, q.z, v.x, v.y, v.z);
+}
+
+void ROSCOTBridge::imuCallback(const sensor_msgs::Imu::ConstPtr& msg)
+{
+	if (msg->orientation_covariance[0] == -1) // no orientation estimate
+		return;
+	const auto& q = msg->orientation;
+	courseEstimator->addImu(static_cast<int64_t>((msg->header.stamp.isZero() ? ros::Time::now() : msg->header.stamp).toNSec()),
+		q.w, q.x, q.y, q.z);
+}
+
+/// contacts has no stamp, so only its queue wait is measured and traces start at the callback
+void ROSCOTBridge::atakContactsCallback(const ros::MessageEvent<const ros_cot_msgs::AtakContactList>& event)
+{
+	const int64_t callbackNanos = TransmitTrace::wallNanos();
+	sendContacts(event.getConstMessage()->contactList, ros::Time(), event.getReceiptTime(), callbackNanos);
+}
+
+void ROSCOTBridge::stampedContactsCallback(const ros::MessageEvent<const ros_cot_msgs::StampedContactList>& event)
+{
+	const int64_t callbackNanos = TransmitTrace::wallNanos();
+	const ros_cot_msgs::StampedContactList::ConstPtr& msg = event.getConstMessage();
+	sendContacts(msg->contactList, msg->header.stamp, event.getReceiptTime(), callbackNanos);
+}
+
+/// transmit a list from either contacts input; stamp is zero when the input has none
+void ROSCOTBridge::sendContacts(const std::vector<ros_cot_msgs::AtakContact>& contacts, const ros::Time& stamp,
+	const ros::Time& receipt, int64_t callbackNanos)
+{
+	recordInputLatency(ContactsInput, stamp, receipt);
+	ScopedDuration duration(callbackDuration[ContactsInput]);
+	TransmitTrace::Origin origin;
+	const auto* traced = traceOrigin(origin, stamp, callbackNanos);
 	std::stringstream msgBuilder;
-	msgBuilder << "Got contact list: " << msg->contactList.size();
-	for (size_t contactNum = 0; contactNum < msg->contactList.size(); ++ contactNum)
+	msgBuilder << "Got contact list: " << contacts.size();
+	for (size_t contactNum = 0; contactNum < contacts.size(); ++ contactNum)
 	{
-		const auto& contactMsg = msg->contactList.at(contactNum);
+		const auto& contactMsg = contacts.at(contactNum);
 		ROS_INFO_STREAM(msgBuilder.str());
+		// what we send is what we remember and associate
+		const double ce = contactMsg.ce > 0 ? contactMsg.ce : DefaultContactCe;
+		const double le = contactMsg.le > 0 ? contactMsg.le : DefaultContactLe;
+		const int64_t now = wallMicros();
+		// don't republish our own contacts when they echo back, for as long as the report we send is current
+		if (receiver != NULL)
+			receiver->addRelayedUid(contactMsg.uid, now + SentStaleMicros);
 		client->sendContactReport(contactMsg.uid.c_str(), contactMsg.type.c_str(),
-				contactMsg.latitude, contactMsg.longitude, contactMsg.altitude);
+				contactMsg.latitude, contactMsg.longitude, contactMsg.altitude, ce, le, "m-f", true, traced);
+		trackStore->update(contactMsg.uid, contactMsg.type, "m-f",
+			contactMsg.latitude, contactMsg.longitude, contactMsg.altitude, ce, le, now, now + SentStaleMicros);
+		associate(contactMsg.uid, contactMsg.type, contactMsg.latitude, contactMsg.longitude, contactMsg.altitude,
+			ce, now, Messaging::CoTEvent::NoTime);
+	}
+}
+
+void ROSCOTBridge::fleetFixCallback(const ros::MessageEvent<const sensor_msgs::NavSatFix>& event, size_t identity)
+{
+	const int64_t callbackNanos = TransmitTrace::wallNanos();
+	const sensor_msgs::NavSatFix::ConstPtr& msg = event.getConstMessage();
+	recordInputLatency(FleetInput, msg->header.stamp, event.getReceiptTime());
+	ScopedDuration duration(callbackDuration[FleetInput]);
+	const int64_t now = wallMicros();
+	TransmitTrace::Origin origin;
+	if (!fleet->report(identity, msg->latitude, msg->longitude, msg->altitude, 10, 0.5, now * 1000,
+			std::nan(""), std::nan(""), traceOrigin(origin, msg->header.stamp, callbackNanos)))
+		return;
+	trackStore->update(fleet->getUid(identity), fleet->getType(identity), "m-g",
+		msg->latitude, msg->longitude, msg->altitude, 10, 0.5, now, now + SentStaleMicros);
+	associate(fleet->getUid(identity), fleet->getType(identity), msg->latitude, msg->longitude, msg->altitude, 10, now,
+		Messaging::CoTEvent::NoTime);
+}
+
+void ROSCOTBridge::receivedEventCallback(const Messaging::CoTEvent& event)
+{
+	if (!event.hasPoint())
+		return;
+	if (areaFilter.getNumAreas() > 0 && areaFilter.check(event.lat, event.lon,
+			event.time != Messaging::CoTEvent::NoTime ? event.time : wallMicros()) != AIDTR::Ingest::AreaFilter::Pass)
+		return;
+	trackStore->update(event);
+	auto msg = boost::make_shared<ros_cot_msgs::StampedContactList>();
+	if (event.receivedNanos != Messaging::CoTEvent::NoTime)
+		msg->header.stamp.fromNSec(event.receivedNanos);
+	msg->contactList.resize(1);
+	auto& contactMsg = msg->contactList.front();
+	contactMsg.uid = Messaging::CoTEvent::unescape(event.uid);
+	contactMsg.type = Messaging::CoTEvent::unescape(event.type);
+	contactMsg.how = Messaging::CoTEvent::unescape(event.how);
+	contactMsg.latitude = event.lat;
+	contactMsg.longitude = event.lon;
+	contactMsg.altitude = event.hae;
+	contactMsg.ce = event.ce;
+	contactMsg.le = event.le;
+	// a duplicate of an object another uid already reports goes out once: as its fused track when associate published
+	// that, otherwise here
+	if (associate(event.uid, event.type, event.lat, event.lon, event.hae, event.ce,
+			event.time != Messaging::CoTEvent::NoTime ? event.time : wallMicros(), event.receivedNanos))
+		return;
+	enrich(*msg);
+	receivedContactsPub.publish(msg);
+}
+
+void ROSCOTBridge::loadAreaOfInterest(ros::NodeHandle& pn)
+{
+	AIDTR::Ingest::AreaFilter::Area area;
+	if (loadAreaParam(pn, "area_of_interest/inclusion", area))
+		areaFilter.addInclusionArea(area);
+	area = AIDTR::Ingest::AreaFilter::Area();
+	if (loadAreaParam(pn, "area_of_interest/exclusion", area))
+		areaFilter.addExclusionArea(area);
+	area = AIDTR::Ingest::AreaFilter::Area();
+	if (loadAreaParam(pn, "area_of_interest/warning", area))
+		areaFilter.addWarningArea(area);
+
+	std::string file;
+	if (pn.getParam("area_of_interest/file", file) && !file.empty())
+	{
+#ifdef WITH_ARL_MATH
+		Messaging::XmlFileReader reader;
+		auto pDoc = reader.OpenFile(file);
+		const XERCES_CPP_NAMESPACE::DOMElement* pElement = pDoc ? pDoc->getDocumentElement() : NULL;
+		if (pElement && !XERCES_CPP_NAMESPACE::XMLString::equals(pElement->getTagName(), Utility::xStr(L"SpatialConstraints")))
+			pElement = static_cast<const XERCES_CPP_NAMESPACE::DOMElement*>(pElement->getElementsByTagName(Utility::xStr(L"SpatialConstraints"))->item(0));
+		if (pElement)
+			AIDTR::Ingest::AreaFilterCompiler::Compile(ARL::Math::SpatialConstraints(pElement), areaFilter);
+		else
+			ROS_ERROR("No SpatialConstraints found in %s", file.c_str());
+#else
+		ROS_ERROR("area_of_interest/file needs the bridge built with WITH_ARL_MATH; ignoring %s", file.c_str());
+#endif
+	}
+	if (areaFilter.getNumAreas() > 0)
+		ROS_INFO("Area of interest: %zu areas", areaFilter.getNumAreas());
+}
+
+bool ROSCOTBridge::queryContactsCallback(ros_cot_msgs::QueryContacts::Request& request, ros_cot_msgs::QueryContacts::Response& response)
+{
+	std::vector<AIDTR::Tracking::GeoIndex::Hit> hits;
+	if (request.mode == ros_cot_msgs::QueryContacts::Request::NEAREST)
+		return queryNearest(request, response);
+	if (request.mode == ros_cot_msgs::QueryContacts::Request::RADIUS)
+		contactIndex->queryRadius(request.latitude, request.longitude, request.radius, request.type_prefix, hits, request.max_results);
+	else if (request.mode == ros_cot_msgs::QueryContacts::Request::BOX)
+		contactIndex->queryBox(request.min_latitude, request.min_longitude, request.max_latitude, request.max_longitude,
+			request.type_prefix, hits, request.max_results);
+	else
+		return false;
+	AIDTR::TrackRecord record;
+	for (const auto& hit : hits)
+	{
+		if (!trackStore->read(hit.handle, record))
+			continue; // removed since the query
+		ros_cot_msgs::AtakContact contactMsg;
+		fillContactMsg(record, contactMsg);
+		response.contacts.push_back(contactMsg);
+		if (request.mode == ros_cot_msgs::QueryContacts::Request::RADIUS)
+			response.distances.push_back(hit.distance);
 	}
+	return true;
 }
 
+/** the k nearest contacts from contactTree, k = max_results (0: all); with a type prefix, the search is widened until
+*	k contacts of that type are found or none are left
+*/
+bool ROSCOTBridge::queryNearest(ros_cot_msgs::QueryContacts::Request& request, ros_cot_msgs::QueryContacts::Response& response)
+{
+	if (contactTree == NULL)
+		return false;
+	std::lock_guard<std::mutex> lock(contactTreeMutex);
+	contactTree->flush();
+	const size_t available = contactTree->size();
+	const size_t k = request.max_results ? std::min<size_t>(request.max_results, available) : available;
+	const auto query = contactTree->toPoint(Tracking::KdTree::NoId, request.latitude, request.longitude, request.altitude);
+	AIDTR::TrackRecord record;
+	for (size_t wanted = k; ; wanted = std::min(2 * wanted, available))
+	{
+		response.contacts.clear();
+		response.distances.clear();
+		contactTree->nearest(query, wanted, neighbors);
+		for (const auto& neighbor : neighbors)
+		{
+			if (!trackStore->read(neighbor.id, record))
+				continue; // removed since the flush
+			if (!record.getType().starts_with(boost::string_view(request.type_prefix)))
+				continue;
+			ros_cot_msgs::AtakContact contactMsg;
+			fillContactMsg(record, contactMsg);
+			response.contacts.push_back(contactMsg);
+			response.distances.push_back(neighbor.distance);
+			if (response.contacts.size() == k)
+				return true;
+		}
+		if (request.type_prefix.empty() || wanted >= available)
+			return true;
+	}
+}
+
+void ROSCOTBridge::reclaimCallback(const ros::WallTimerEvent&)
+{
+	trackStore->reclaimStale(wallMicros());
+	if (contactTree != NULL)
+	{
+		// keep the queue of changes short, so that a nearest query only flushes the last second's
+		std::lock_guard<std::mutex> lock(contactTreeMutex);
+		contactTree->flush();
+	}
+	if (associator != NULL)
+	{
+		std::lock_guard<std::mutex> lock(associatorMutex);
+		associator->expire(wallMicros());
+	}
+}
+
+/// publish every filtered contact, predicted to now
+void ROSCOTBridge::smoothingCallback(const ros::WallTimerEvent&)
+{
+	filterBank->extrapolate(wallMicros(), estimates);
+	auto msg = boost::make_shared<ros_cot_msgs::StampedContactList>();
+	msg->header.stamp = ros::Time::now();
+	msg->contactList.reserve(estimates.size());
+	AIDTR::TrackRecord record;
+	for (const auto& estimate : estimates)
+	{
+		if (!trackStore->read(estimate.handle, record) || record.generation != estimate.generation)
+			continue; // removed or reused since it was last reported
+		ros_cot_msgs::AtakContact contactMsg;
+		fillContactMsg(record, contactMsg);
+		contactMsg.latitude = estimate.lat;
+		contactMsg.longitude = estimate.lon;
+		contactMsg.altitude = estimate.hae;
+		contactMsg.ce = estimate.ce;
+		contactMsg.le = estimate.le;
+		msg->contactList.push_back(contactMsg);
+	}
+	enrich(*msg);
+	smoothedContactsPub.publish(msg);
+}
+
+/// publish what changed among the known contacts since the last delta, if anything did
+void ROSCOTBridge::contactDeltaCallback(const ros::WallTimerEvent&)
+{
+	if (!contactSnapshot->takeDelta(delta))
+		return;
+	auto msg = boost::make_shared<ros_cot_msgs::ContactDelta>();
+	msg->header.stamp = ros::Time::now();
+	msg->sequence = delta.sequence;
+	msg->added.resize(delta.added.size());
+	for (size_t i = 0; i < delta.added.size(); ++i)
+		fillContactMsg(*delta.added[i], msg->added[i]);
+	msg->updated.resize(delta.updated.size());
+	for (size_t i = 0; i < delta.updated.size(); ++i)
+		fillContactMsg(*delta.updated[i], msg->updated[i]);
+	msg->removed.reserve(delta.removed.size());
+	for (const auto& uid : delta.removed)
+		msg->removed.push_back(Messaging::CoTEvent::unescape(uid));
+	if (compactEncoder != NULL)
+	{
+		auto compact = boost::make_shared<ros_cot_msgs::CompactContactDelta>();
+		compactEncoder->encode(*msg, *compact);
+		compactDeltasPub.publish(compact);
+	}
+	contactDeltasPub.publish(msg);
+}
+
+/// publish every known contact as of the last delta, for subscribers joining or resyncing after a gap
+void ROSCOTBridge::contactSnapshotCallback(const ros::WallTimerEvent&)
+{
+	const auto& contacts = contactSnapshot->getContacts();
+	auto msg = boost::make_shared<ros_cot_msgs::ContactSnapshot>();
+	msg->header.stamp = ros::Time::now();
+	msg->sequence = contactSnapshot->getSequence();
+	msg->contacts.resize(contacts.size());
+	for (size_t i = 0; i < contacts.size(); ++i)
+		fillContactMsg(contacts[i], msg->contacts[i]);
+	if (compactEncoder != NULL)
+	{
+		auto compact = boost::make_shared<ros_cot_msgs::CompactContactSnapshot>();
+		compactEncoder->encode(*msg, *compact);
+		compactSnapshotPub.publish(compact);
+	}
+	contactSnapshotPub.publish(msg);
+}
+
+void ROSCOTBridge::statsCallback(const ros::WallTimerEvent&)
+{
+	ROS_INFO("Track store: %zu entities, %llu insert failures, %llu reclaimed as stale",
+		trackStore->size(), (unsigned long long)trackStore->getInsertFailureCount(),
+		(unsigned long long)trackStore->getReclaimedCount());
+	for (int i = 0; i < NumInputs; ++i)
+	{
+		const auto& latency = inputLatency[i];
+		if (latency.count() > 0)
+			ROS_INFO("ROS input %s: %llu messages, stamp to callback latency us p50 %.1f p99 %.1f max %.1f",
+				InputNames[i], (unsigned long long)latency.count(),
+				latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3, latency.max() / 1e3);
+		const auto& wait = queueLatency[i];
+		const auto& duration = callbackDuration[i];
+		if (duration.count() > 0)
+			ROS_INFO("  %s queue: %llu callbacks, wait us p50 %.1f p99 %.1f max %.1f, run us p50 %.1f p99 %.1f max %.1f",
+				InputNames[i], (unsigned long long)duration.count(),
+				wait.percentile(0.5) / 1e3, wait.percentile(0.99) / 1e3, wait.max() / 1e3,
+				duration.percentile(0.5) / 1e3, duration.percentile(0.99) / 1e3, duration.max() / 1e3);
+	}
+	if (transmitTrace != NULL)
+		for (int i = 0; i < TransmitTrace::NumStages; ++i)
+		{
+			const auto stage = TransmitTrace::Stage(i);
+			const auto& latency = transmitTrace->getLatency(stage);
+			ROS_INFO("Transmit trace %-8s %llu reports, latency us p50 %.1f p99 %.1f max %.1f", TransmitTrace::toString(stage),
+				(unsigned long long)latency.count(), latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3, latency.max() / 1e3);
+		}
+	if (courseEstimator != NULL)
+		ROS_INFO("Self reports: %llu sent, %llu not needed (predicted within %.1f m by the last report)",
+			(unsigned long long)selfReportCount.load(), (unsigned long long)selfReportSkipped.load(), deadReckoningTolerance);
+	if (fleet != NULL)
+	{
+		const auto& latency = fleet->getSendLatency();
+		ROS_INFO("Fleet: %zu vehicles, %llu reports, %llu sent, %llu too soon, %llu send errors, encode and send us p50 %.1f p99 %.1f max %.1f",
+			fleet->size(), (unsigned long long)fleet->getReportCount(), (unsigned long long)fleet->getSendCount(),
+			(unsigned long long)fleet->getSkippedCount(), (unsigned long long)fleet->getErrorCount(),
+			latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3, latency.max() / 1e3);
+	}
+	if (areaFilter.getNumAreas() > 0)
+	{
+		using AIDTR::Ingest::AreaFilter;
+		ROS_INFO("Area of interest: pass rate %.3f, %s %llu, %s %llu, %s %llu, in warning areas %llu",
+			areaFilter.getPassRate(),
+			AreaFilter::toString(AreaFilter::Pass), (unsigned long long)areaFilter.getCount(AreaFilter::Pass),
+			AreaFilter::toString(AreaFilter::OutsideInclusion), (unsigned long long)areaFilter.getCount(AreaFilter::OutsideInclusion),
+			AreaFilter::toString(AreaFilter::InsideExclusion), (unsigned long long)areaFilter.getCount(AreaFilter::InsideExclusion),
+			(unsigned long long)areaFilter.getWarningCount());
+	}
+	if (associator != NULL)
+	{
+		std::lock_guard<std::mutex> lock(associatorMutex);
+		ROS_INFO("Track association: %zu fused tracks of %zu uids, %.2f candidates per report, %llu overflows",
+			associator->size(), associator->getMemberCount(),
+			associator->getUpdateCount() ? double(associator->getCandidateCount()) / associator->getUpdateCount() : 0.0,
+			(unsigned long long)associator->getOverflowCount());
+	}
+	if (filterBank != NULL)
+		ROS_INFO("Smoothing: %zu filters, %llu stale reports dropped",
+			filterBank->size(), (unsigned long long)filterBank->getStaleReportCount());
+	if (captureLog != NULL)
+		ROS_INFO("Capture log: %llu records, %llu bytes in %llu segments, %llu dropped, %llu write errors, %zu queued",
+			(unsigned long long)captureLog->getRecordCount(), (unsigned long long)captureLog->getWriteBytes(),
+			(unsigned long long)captureLog->getSegmentCount(), (unsigned long long)captureLog->getDropCount(),
+			(unsigned long long)captureLog->getWriteErrorCount(), captureLog->getQueueDepth());
+	if (streamReceiver != NULL)
+		ROS_INFO("CoT stream: %s, %llu connects, %llu bytes, %llu events, %llu oversize, %llu malformed runs, %llu parse errors",
+			streamReceiver->isConnected() ? "connected" : "disconnected", streamReceiver->getConnectCount(),
+			streamReceiver->getReceiveBytes(), streamReceiver->getEventCount(), streamReceiver->getOversizeCount(),
+			streamReceiver->getMalformedCount(),
+			(unsigned long long)streamReceiver->getPipeline().getDropCount(AIDTR::Ingest::DecodePipeline::ParseError));
+	if (receiver == NULL)
+		return;
+	using AIDTR::Ingest::DecodePipeline;
+	const auto& pipeline = receiver->getPipeline();
+	std::stringstream drops;
+	for (int reason = 0; reason < DecodePipeline::NumDropReasons; ++reason)
+		drops << " " << DecodePipeline::toString(DecodePipeline::DropReason(reason)) << "="
+			<< pipeline.getDropCount(DecodePipeline::DropReason(reason));
+	ROS_INFO("CoT ingest: received %llu in %llu calls (%llu without kernel timestamp), dropped%s, dedup overflows %llu",
+		receiver->getReceiveCount(), receiver->getReceiveCallCount(), receiver->getUntimestampedCount(),
+		drops.str().c_str(), (unsigned long long)pipeline.getDedupOverflowCount());
+	for (int i = 0; i < DecodePipeline::NumStages; ++i)
+	{
+		const auto stage = DecodePipeline::Stage(i);
+		const auto& latency = pipeline.getLatency(stage);
+		ROS_INFO("  %-8s out %llu, queue %zu (high water %zu), latency us p50 %.1f p99 %.1f max %.1f",
+			DecodePipeline::toString(stage), (unsigned long long)pipeline.getCount(stage),
+			pipeline.getQueueDepth(stage), pipeline.getQueueHighWater(stage),
+			latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3, latency.max() / 1e3);
+	}
+	const auto& total = pipeline.getEndToEndLatency();
+	ROS_INFO("  wire to published, latency us p50 %.1f p99 %.1f max %.1f",
+		total.percentile(0.5) / 1e3, total.percentile(0.99) / 1e3, total.max() / 1e3);
+	if (auto* limiter = pipeline.getRateLimiter())
+	{
+		using AIDTR::Ingest::RateLimiter;
+		ROS_INFO("  rate limits: source passed %llu dropped %llu, uid passed %llu dropped %llu, %llu evictions",
+			(unsigned long long)limiter->getPassCount(RateLimiter::Source), (unsigned long long)limiter->getDropCount(RateLimiter::Source),
+			(unsigned long long)limiter->getPassCount(RateLimiter::Uid), (unsigned long long)limiter->getDropCount(RateLimiter::Uid),
+			(unsigned long long)limiter->getEvictionCount());
+		for (const auto& sender : limiter->takeNoisySenders(5))
+			ROS_WARN("  noisy %s %s: dropped %llu, passed %llu this period", RateLimiter::toString(sender.kind),
+				sender.name.c_str(), (unsigned long long)sender.dropped, (unsigned long long)sender.passed);
+	}
+}
+
+/** feed a capture to the client's socket, or losslessly through replayPipeline, then report on it and optionally shut
+*	the node down
+*/
+template <typename Reader>
+void ROSCOTBridge::replayCapture(std::shared_ptr<Reader> reader, double speed, bool transmit, bool shutdownWhenDone)
+{
+	using AIDTR::Ingest::DecodePipeline;
+	AIDTR::Ingest::CaptureReplay replay(speed);
+	replay.run(*reader, [this, transmit](const typename Reader::Datagram& datagram, int64_t nanos) {
+		if (transmit)
+			client->sendRaw(datagram.payload.data(), datagram.payload.size());
+		else
+			replayPipeline->submitWait(0, datagram.payload.data(), datagram.payload.size(), nanos, datagram.source, &replayRunning);
+	}, &replayRunning);
+	// wait for the pipeline to deliver or drop everything submitted; each datagram is counted once either way
+	uint64_t settled = 0;
+	while (!transmit && replayRunning && settled < replay.getCount())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		settled = replayPipeline->getCount(DecodePipeline::Sequence);
+		for (int reason = 0; reason < DecodePipeline::NumDropReasons; ++reason)
+			settled += replayPipeline->getDropCount(DecodePipeline::DropReason(reason));
+	}
+	ROS_INFO("Capture replay: %s, replayed in %.3f s (%.0f/s)%s, %llu %s", describeReplaySource(*reader).c_str(),
+		replay.getSeconds(), replay.getSeconds() > 0 ? replay.getCount() / replay.getSeconds() : 0.0,
+		speed > 0 ? (", up to " + std::to_string(replay.getMaxLagNanos() / 1000000) + " ms behind schedule").c_str() : "",
+		(unsigned long long)(transmit ? replay.getCount() : replayPipeline->getCount(DecodePipeline::Sequence)),
+		transmit ? "sent" : "delivered");
+	if (shutdownWhenDone && replayRunning)
+		ros::shutdown();
+}
+
+ROSCOTBridge::ROSCOTBridge(ros::NodeHandle& n, ros::NodeHandle& pn)
+	: deadReckoningTolerance(0), maxSelfReportIntervalNanos(0), selfReportCount(0), selfReportSkipped(0), replayRunning(false)
+{
+	try
+	{
+		setUp(n, pn);
+	}
+	catch (...)
+	{
+		stop(); // join whatever threads were started before the failure
+		throw;
+	}
+}
 
-int main(int argc, char **argv)
+void ROSCOTBridge::setUp(ros::NodeHandle& n, ros::NodeHandle& pn)
 {
-    try
-    {
-        boost::asio::io_service io_service;
-        io_service.run();
+	client.reset(new CoTClient(io_service,
+		boost::asio::ip::address::from_string("239.2.3.1"), 6969));
+	if (pn.param("trace/enable", false))
+	{
+		transmitTrace.reset(new TransmitTrace(pn.param("trace/tag_events", false)));
+		traceCsv = pn.param<std::string>("trace/csv", "");
+		traceLabel = pn.param<std::string>("trace/label", "bridge");
+		client->setTrace(transmitTrace.get());
+	}
+
+	std::string captureLogDirectory;
+	if (pn.getParam("capture_log/directory", captureLogDirectory) && !captureLogDirectory.empty())
+	{
+		// producers: 0 the client, 1 the stream receiver, 2 the fleet, then one per receive thread
+		captureLog.reset(new Ingest::CaptureLog(captureLogDirectory, 3 + std::max(1, pn.param("receive_threads", 1)),
+			static_cast<size_t>(pn.param("capture_log/segment_size", 64.0) * (1 << 20)),
+			static_cast<int64_t>(pn.param("capture_log/index_interval", 1.0) * 1e9), pn.param("capture_log/max_segments", 0),
+			pn.param("capture_log/ring_capacity", 4096)));
+		client->setCaptureLog(captureLog.get(), 0);
+		captureLog->start();
+	}
+
+	loadAreaOfInterest(pn);
+	if (pn.param("association/enable", false))
+	{
+		Tracking::TrackAssociator::Config config;
+		config.gateSigma = pn.param("association/gate_sigma", config.gateSigma);
+		config.minGate = pn.param("association/min_gate", config.minGate);
+		config.maxGate = pn.param("association/max_gate", config.maxGate);
+		config.defaultCe = pn.param("association/default_ce", config.defaultCe);
+		config.memberTimeoutMicros = static_cast<int64_t>(pn.param("association/member_timeout", 60.0) * 1e6);
+		config.maxTracks = pn.param("association/max_tracks", 1 << 16);
+		associator.reset(new Tracking::TrackAssociator(config));
+		fusedTracksPub = n.advertise<ros_cot_msgs::FusedTrackList>("fused_tracks", 100);
+	}
+	trackStore.reset(new TrackStore(pn.param("track_store_capacity", 1 << 17), pn.param("keep_raw_events", true)));
+	contactIndex.reset(new Tracking::GeoIndex(trackStore->capacity(), pn.param("contact_index_precision", 6)));
+	trackStore->RegisterCallback([this](const TrackChange& change) { contactIndex->apply(change); });
+	if (pn.param("contact_tree/enable", true))
+	{
+		// distances in the tree's ENU frame are exact straight-line distances wherever its origin is
+		contactTree.reset(new Tracking::KdTree(pn.param("contact_tree/origin_lat", 0.0), pn.param("contact_tree/origin_lon", 0.0)));
+		trackStore->RegisterCallback([this](const TrackChange& change) { contactTree->apply(change); });
+	}
+	if (pn.param("smoothing/enable", true))
+	{
+		Tracking::FilterBank::Config config;
+		config.accelSigma = pn.param("smoothing/accel_sigma", config.accelSigma);
+		config.verticalAccelSigma = pn.param("smoothing/vertical_accel_sigma", config.verticalAccelSigma);
+		config.initialSpeedSigma = pn.param("smoothing/initial_speed_sigma", config.initialSpeedSigma);
+		config.defaultCe = pn.param("smoothing/default_ce", config.defaultCe);
+		config.defaultLe = pn.param("smoothing/default_le", config.defaultLe);
+		config.maxCoastMicros = static_cast<int64_t>(pn.param("smoothing/max_coast", 10.0) * 1e6);
+		filterBank.reset(new Tracking::FilterBank(trackStore->capacity(), config,
+			pn.param("smoothing/origin_lat", std::nan("")), pn.param("smoothing/origin_lon", 0.0), pn.param("smoothing/origin_alt", 0.0)));
+		trackStore->RegisterCallback([this](const TrackChange& change) { filterBank->apply(change); });
+		smoothedContactsPub = n.advertise<ros_cot_msgs::StampedContactList>("smoothed_contacts", 10);
+		smoothingTimer = n.createWallTimer(ros::WallDuration(1.0 / pn.param("smoothing/rate", 10.0)), &ROSCOTBridge::smoothingCallback, this);
+	}
+	if (pn.param("snapshot/enable", true))
+	{
+		contactSnapshot.reset(new ContactSnapshot(trackStore->capacity()));
+		trackStore->RegisterCallback([this](const TrackChange& change) { contactSnapshot->apply(change); });
+		contactDeltasPub = n.advertise<ros_cot_msgs::ContactDelta>("contact_deltas", 100);
+		contactSnapshotPub = n.advertise<ros_cot_msgs::ContactSnapshot>("contact_snapshot", 1, true);
+		if (pn.param("snapshot/compact", false))
+		{
+			// the same deltas and snapshots with uids, types and hows sent once, for subscribers on other hosts
+			compactEncoder.reset(new CompactContactEncoder());
+			compactDeltasPub = n.advertise<ros_cot_msgs::CompactContactDelta>("compact_contact_deltas", 100);
+			compactSnapshotPub = n.advertise<ros_cot_msgs::CompactContactSnapshot>("compact_contact_snapshot", 1, true);
+		}
+		// both run on the spinner thread, so a snapshot never interleaves with a delta
+		contactDeltaTimer = n.createWallTimer(ros::WallDuration(1.0 / pn.param("snapshot/delta_rate", 10.0)), &ROSCOTBridge::contactDeltaCallback, this);
+		contactSnapshotTimer = n.createWallTimer(ros::WallDuration(pn.param("snapshot/full_period", 5.0)), &ROSCOTBridge::contactSnapshotCallback, this);
+	}
+	queryService = n.advertiseService("query_contacts", &ROSCOTBridge::queryContactsCallback, this);
+	reclaimTimer = n.createWallTimer(ros::WallDuration(1.0), &ROSCOTBridge::reclaimCallback, this);
+	statsTimer = n.createWallTimer(ros::WallDuration(pn.param("stats_period", 10.0)), &ROSCOTBridge::statsCallback, this);
+	auto onEvent = [this](const Messaging::CoTEvent& event) { receivedEventCallback(event); };
+	if (pn.param("receive", true))
+	{
+		std::vector<std::string> interfaceNames;
+		pn.getParam("interfaces", interfaceNames);
+		std::vector<boost::asio::ip::address> interfaces;
+		for (const auto& name : interfaceNames)
+			interfaces.push_back(boost::asio::ip::address::from_string(name));
 
-		client = new AIDTR::CoTClient(io_service,
-			boost::asio::ip::address::from_string("239.2.3.1"), 6969);
+		receiver.reset(new CoTReceiver(io_service,
+			boost::asio::ip::address::from_string("239.2.3.1"), 6969,
+			interfaces, pn.param("multicast_loopback", true),
+			static_cast<int64_t>(pn.param("dedup_window", 5.0) * 1e6),
+			pn.param("receive_threads", 1), pn.param("parser_threads", 2), pn.param("receive_batch", 32),
+			loadDetailFields(pn)));
+		receiver->addSelfUid(client->getUid());
+		if (captureLog != NULL)
+			receiver->setCaptureLog(captureLog.get(), 3);
+		receiver->setRateLimits(
+			Ingest::RateLimiter::Limit(pn.param("rate_limit/source_rate", 2000.0), pn.param("rate_limit/source_burst", 4000.0)),
+			Ingest::RateLimiter::Limit(pn.param("rate_limit/uid_rate", 50.0), pn.param("rate_limit/uid_burst", 200.0)),
+			pn.param("rate_limit/table_size", 8192));
+		receiver->RegisterCallback(onEvent);
 
-		ros::init(argc, argv, "listener");
+		receivedContactsPub = n.advertise<ros_cot_msgs::StampedContactList>("received_contacts", 100);
+		receiver->start();
+	}
+	std::string streamHost;
+	if (pn.getParam("stream/host", streamHost) && !streamHost.empty())
+	{
+		streamReceiver.reset(new CoTStreamReceiver(io_service, streamHost,
+			static_cast<unsigned short>(pn.param("stream/port", 8088)),
+			static_cast<int64_t>(pn.param("dedup_window", 5.0) * 1e6), pn.param("stream/parser_threads", 1),
+			pn.param("stream/max_event_size", 1 << 20), loadDetailFields(pn)));
+		streamReceiver->addSelfUid(client->getUid());
+		if (captureLog != NULL)
+			streamReceiver->setCaptureLog(captureLog.get(), 1);
+		streamReceiver->RegisterCallback(onEvent);
+		receivedContactsPub = n.advertise<ros_cot_msgs::StampedContactList>("received_contacts", 100);
+		streamReceiver->start();
+	}
+	std::string replayFile;
+	if (pn.getParam("replay/file", replayFile) && !replayFile.empty())
+		startReplay(n, pn, replayFile);
 
-		ros::NodeHandle n;
+	// the client's sends complete on ioThread
+	ioWork.reset(new boost::asio::io_service::work(io_service));
+	ioThread = std::thread([this]() { io_service.run(); });
 
-		ros::Subscriber poseSub = n.subscribe("fix", 100, chatterCallback);
-		ros::Subscriber contactSub = n.subscribe("contacts", 100, atakContactsCallback);
+	// subscribe last, so that no callback sees the bridge half built
+	startFleet(n, pn);
+	startInputThread(FixInput, pn.param("callback_threads/fix_cpu", -1), pn.param("callback_threads/fix_priority", 0));
+	startInputThread(ContactsInput, pn.param("callback_threads/contacts_cpu", -1), 0);
+	ros::NodeHandle fixHandle(n), contactsHandle(n);
+	fixHandle.setCallbackQueue(&inputQueues[FixInput]);
+	contactsHandle.setCallbackQueue(&inputQueues[ContactsInput]);
+	startCourse(fixHandle, pn);
+	poseSub = fixHandle.subscribe("fix", 100, &ROSCOTBridge::chatterCallback, this);
+	contactSub = contactsHandle.subscribe("contacts", 100, &ROSCOTBridge::atakContactsCallback, this);
+	stampedContactSub = contactsHandle.subscribe("stamped_contacts", 100, &ROSCOTBridge::stampedContactsCallback, this);
+}
+
+/** our course and speed for our self-reports: from the fixes, and from odometry and an IMU if given, all served by the
+*	fix thread so that only it uses courseEstimator
+*/
+void ROSCOTBridge::startCourse(ros::NodeHandle& fixHandle, ros::NodeHandle& pn)
+{
+	if (!pn.param("course/enable", false))
+		return;
+	Tracking::CourseEstimator::Config config;
+	config.timeConstant = pn.param("course/time_constant", config.timeConstant);
+	config.minSpeed = pn.param("course/min_speed", config.minSpeed);
+	config.maxAge = pn.param("course/max_age", config.maxAge);
+	config.fixBaseline = pn.param("course/fix_baseline", config.fixBaseline);
+	config.headingOffset = pn.param("course/heading_offset", config.headingOffset);
+	const std::string frame = pn.param<std::string>("course/frame", "enu");
+	if (frame == "ned")
+		config.frame = Tracking::CourseEstimator::NED;
+	else if (frame != "enu")
+		ROS_WARN("course/frame must be enu or ned, not %s; using enu", frame.c_str());
+	courseEstimator.reset(new Tracking::CourseEstimator(config));
+	deadReckoningTolerance = pn.param("course/dead_reckoning_tolerance", 0.0);
+	maxSelfReportIntervalNanos = static_cast<int64_t>(pn.param("course/max_report_interval", 10.0) * 1e9);
+	if (maxSelfReportIntervalNanos > SentStaleMicros * 1000 / 2)
+	{
+		// a report must be refreshed well before it goes stale at its receivers
+		ROS_WARN("course/max_report_interval must be under %g s, half the stale time of our reports; clamping",
+			SentStaleMicros * 1e-6 / 2);
+		maxSelfReportIntervalNanos = SentStaleMicros * 1000 / 2;
+	}
 
-		ros::spin();
-    }
-    catch (std::exception & e)
-    {
-        std::cerr << "Exception: " << e.what() << "\n";
-    }
-	
+	std::string odometryTopic, imuTopic;
+	if (pn.getParam("course/odometry", odometryTopic) && !odometryTopic.empty())
+		odometrySub = fixHandle.subscribe(odometryTopic, 10, &ROSCOTBridge::odometryCallback, this);
+	if (pn.getParam("course/imu", imuTopic) && !imuTopic.empty())
+		imuSub = fixHandle.subscribe(imuTopic, 10, &ROSCOTBridge::imuCallback, this);
+}
 
-    
-    return 0;
+/** fleet mode: report the fixes of other vehicles of ours, each from its own topic as its own uid and type, through one
+*	FleetTransmitter served by the fleet input's thread
+*/
+void ROSCOTBridge::startFleet(ros::NodeHandle& n, ros::NodeHandle& pn)
+{
+	XmlRpc::XmlRpcValue identities;
+	if (!pn.getParam("fleet/identities", identities) || identities.getType() != XmlRpc::XmlRpcValue::TypeArray
+			|| identities.size() == 0)
+		return;
+	fleet.reset(new FleetTransmitter(io_service, boost::asio::ip::address::from_string("239.2.3.1"), 6969,
+		static_cast<int64_t>(pn.param("fleet/min_interval", 0.0) * 1e9), SentStaleMicros));
+	if (captureLog != NULL)
+		fleet->setCaptureLog(captureLog.get(), 2);
+	if (transmitTrace != NULL)
+		fleet->setTrace(transmitTrace.get());
+	std::vector<std::string> topics;
+	auto isString = [](XmlRpc::XmlRpcValue& entry, const std::string& name) {
+		return entry.hasMember(name) && entry[name].getType() == XmlRpc::XmlRpcValue::TypeString;
+	};
+	for (int i = 0; i < identities.size(); ++i)
+	{
+		auto& entry = identities[i];
+		if (entry.getType() != XmlRpc::XmlRpcValue::TypeStruct || !isString(entry, "topic") || !isString(entry, "uid"))
+		{
+			ROS_WARN("fleet/identities[%d] needs a topic and a uid; ignored", i);
+			continue;
+		}
+		const size_t identity = fleet->addIdentity(static_cast<std::string&>(entry["uid"]),
+			isString(entry, "type") ? static_cast<std::string&>(entry["type"]) : std::string("a-f-G-U-C"));
+		topics.push_back(static_cast<std::string&>(entry["topic"]));
+		// don't republish our vehicles' reports when they echo back
+		if (receiver != NULL)
+			receiver->addSelfUid(fleet->getUid(identity));
+		if (streamReceiver != NULL)
+			streamReceiver->addSelfUid(fleet->getUid(identity));
+	}
+	if (fleet->size() == 0)
+	{
+		fleet.reset();
+		return;
+	}
+	startInputThread(FleetInput, pn.param("callback_threads/fleet_cpu", -1), 0);
+	ros::NodeHandle fleetHandle(n);
+	fleetHandle.setCallbackQueue(&inputQueues[FleetInput]);
+	typedef boost::function<void(const ros::MessageEvent<const sensor_msgs::NavSatFix>&)> FleetCallback;
+	for (size_t i = 0; i < topics.size(); ++i)
+		fleetSubs.push_back(fleetHandle.subscribe(topics[i], 10, FleetCallback(
+			[this, i](const ros::MessageEvent<const sensor_msgs::NavSatFix>& event) { fleetFixCallback(event, i); })));
+	ROS_INFO("Fleet: reporting %zu vehicles", fleet->size());
+}
+
+/** start the one thread serving an input's queue, first pinning it to cpu (if >= 0) and moving it to SCHED_FIFO at
+*	priority (if > 0). Either failing is only logged: the input is still served, at normal scheduling.
+*/
+void ROSCOTBridge::startInputThread(Input input, int cpu, int priority)
+{
+	const char* name = InputNames[input];
+	inputQueues[input].addCallback(boost::make_shared<ThreadSetup>([name, cpu, priority]() {
+		int error;
+		if (cpu >= 0 && (error = Utility::pinCurrentThread(cpu)) != 0)
+			ROS_WARN("Cannot pin the %s callback thread to CPU %d: %s", name, cpu, std::strerror(error));
+		if (priority > 0 && (error = Utility::setCurrentThreadRealtime(priority)) != 0)
+			ROS_WARN("Cannot give the %s callback thread SCHED_FIFO priority %d: %s", name, priority, std::strerror(error));
+	}));
+	inputSpinners[input].reset(new ros::AsyncSpinner(1, &inputQueues[input]));
+	inputSpinners[input]->start();
+}
+
+ROSCOTBridge::~ROSCOTBridge()
+{
+	stop();
+}
+
+void ROSCOTBridge::stop()
+{
+	poseSub.shutdown();
+	odometrySub.shutdown();
+	imuSub.shutdown();
+	contactSub.shutdown();
+	for (auto& sub : fleetSubs)
+		sub.shutdown();
+	for (auto& spinner : inputSpinners)
+		if (spinner != NULL)
+			spinner->stop();
+	replayRunning = false;
+	if (replayThread.joinable())
+		replayThread.join();
+	if (replayPipeline != NULL)
+		replayPipeline->stop();
+	if (streamReceiver != NULL)
+		streamReceiver->stop();
+	if (receiver != NULL)
+		receiver->stop();
+	if (captureLog != NULL)
+		captureLog->stop();
+	ioWork.reset();
+	if (ioThread.joinable())
+		ioThread.join();
+	if (transmitTrace != NULL && !traceCsv.empty())
+	{
+		if (transmitTrace->exportCsv(traceCsv, traceLabel))
+			ROS_INFO("Transmit trace appended to %s as %s", traceCsv.c_str(), traceLabel.c_str());
+		else
+			ROS_ERROR("Cannot write the transmit trace to %s", traceCsv.c_str());
+		traceCsv.clear(); // once, though stop() runs again on destruction
+	}
+}
+
+void ROSCOTBridge::startReplay(ros::NodeHandle& n, ros::NodeHandle& pn, const std::string& file)
+{
+	const std::string sink = pn.param<std::string>("replay/sink", "publish");
+	const bool transmit = sink == "transmit";
+	if (!transmit)
+	{
+		// a capture is replayed as recorded, repeats and all, so duplicate suppression is off
+		replayPipeline.reset(new Ingest::DecodePipeline(1, pn.param("replay/parser_threads", 2), 4096, 0, loadDetailFields(pn)));
+		if (sink != "null")
+		{
+			replayPipeline->RegisterCallback([this](const Messaging::CoTEvent& event) { receivedEventCallback(event); });
+			receivedContactsPub = n.advertise<ros_cot_msgs::StampedContactList>("received_contacts", 100);
+		}
+		replayPipeline->start();
+	}
+	replayRunning = true;
+	const double speed = pn.param("replay/speed", 0.0);
+	const bool shutdownWhenDone = pn.param("replay/shutdown", false);
+	struct stat st;
+	if (::stat(file.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+	{
+		// a capture log directory: a time range of one or both directions
+		const double start = pn.param("replay/start", 0.0), end = pn.param("replay/end", 0.0);
+		const std::string direction = pn.param<std::string>("replay/direction", "received");
+		using Ingest::CaptureLog;
+		const unsigned directions = direction == "all" ? (1 << CaptureLog::Received) | (1 << CaptureLog::Sent)
+			: direction == "sent" ? 1 << CaptureLog::Sent : 1 << CaptureLog::Received;
+		auto reader = std::make_shared<Ingest::CaptureLogReader>(file,
+			start > 0 ? static_cast<int64_t>(start * 1e9) : std::numeric_limits<int64_t>::min(),
+			end > 0 ? static_cast<int64_t>(end * 1e9) : std::numeric_limits<int64_t>::max(), directions);
+		replayThread = std::thread(&ROSCOTBridge::replayCapture<Ingest::CaptureLogReader>, this, reader, speed, transmit, shutdownWhenDone);
+	}
+	else
+	{
+		auto reader = std::make_shared<Ingest::PcapReader>(file, static_cast<uint16_t>(pn.param("replay/port", 6969)));
+		replayThread = std::thread(&ROSCOTBridge::replayCapture<Ingest::PcapReader>, this, reader, speed, transmit, shutdownWhenDone);
+	}
 }
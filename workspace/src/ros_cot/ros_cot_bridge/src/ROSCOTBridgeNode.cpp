@@ -0,0 +1,28 @@
+// ROSCOTBridgeNode.cpp : Defines the entry point for ros_cot_bridge_node, the bridge in a process of its own.
+//
+
+#include <iostream>
+#include "ROSCOTBridge.hpp"
+
+int main(int argc, char **argv)
+{
+    try
+    {
+		ros::init(argc, argv, "listener");
+
+		ros::NodeHandle n;
+		ros::NodeHandle pn("~");
+
+		AIDTR::ROSCOTBridge bridge(n, pn);
+
+		ros::spin();
+
+		bridge.stop();
+    }
+    catch (std::exception & e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+// ROSCOTBridgeNodelet.cpp : the bridge as a nodelet, to load into the manager of the nodes it talks to.
+//
+
+#include <memory>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include "ROSCOTBridge.hpp"
+
+namespace AIDTR {
+	/** Runs a ROSCOTBridge in a nodelet manager, so fixes and contact lists from nodelets in the same manager arrive
+	*	as their publishers' ConstPtr, without being serialized, and what the bridge publishes reaches them the same way.
+	*
+	*	The bridge's timers and service run on the nodelet's single-threaded queue, as they do on ros_cot_bridge_node's
+	*	spinner; fixes and contact lists are served by threads of the bridge's own.
+	*/
+	class ROSCOTBridgeNodelet : public nodelet::Nodelet {
+	protected:
+		void onInit() override {
+			bridge.reset(new ROSCOTBridge(getNodeHandle(), getPrivateNodeHandle()));
+		}
+
+		std::unique_ptr<ROSCOTBridge> bridge;
+	};
+}
+
+PLUGINLIB_EXPORT_CLASS(AIDTR::ROSCOTBridgeNodelet, nodelet::Nodelet)
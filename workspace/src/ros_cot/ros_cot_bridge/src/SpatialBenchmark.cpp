@@ -0,0 +1,199 @@
+// SpatialBenchmark.cpp : measures the per-contact spatial structures.
+//
+// Places 1k, 10k and 100k synthetic contacts (clustered like units around a few objectives, with outliers) in a
+// Tracking::KdTree and compares single and threaded k-nearest queries against a brute-force scan over the same ENU
+// points, checks that both agree, then measures what batched moves cost as the tree absorbs them and rebuilds.
+// Then feeds the same contacts, moving, to a Tracking::FilterBank and times its update and 10 Hz extrapolation.
+//
+//    ros_cot_bridge_spatial_benchmark [k] [queries] [max query threads]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "Tracking/FilterBank.hpp"
+#include "Tracking/KdTree.hpp"
+
+using namespace std;
+using AIDTR::Tracking::FilterBank;
+using AIDTR::Tracking::KdTree;
+
+namespace {
+
+	const double OriginLat = 40.45, OriginLon = -79.78;
+
+	vector<KdTree::Point> makeContacts(const KdTree& tree, size_t count, mt19937& rng) {
+		uniform_real_distribution<double> uniform(-0.5, 0.5);
+		normal_distribution<double> spread(0, 0.01);
+		vector<KdTree::Point> points;
+		points.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			double lat = OriginLat, lon = OriginLon;
+			if (i % 10 == 0) { // outliers across the whole area
+				lat += uniform(rng);
+				lon += uniform(rng);
+			}
+			else { // clusters around 16 objectives
+				lat += 0.05 * (i % 4) + spread(rng);
+				lon += 0.05 * ((i / 4) % 4) + spread(rng);
+			}
+			points.push_back(tree.toPoint(static_cast<KdTree::Id>(i), lat, lon, 300 + 50 * uniform(rng)));
+		}
+		return points;
+	}
+
+	void bruteForce(const vector<KdTree::Point>& points, const KdTree::Point& query, size_t k,
+		vector<KdTree::Neighbor>& out) {
+		out.clear();
+		for (const auto& p : points) {
+			if (p.id == query.id) continue;
+			const double de = p.east - query.east, dn = p.north - query.north, du = p.up - query.up;
+			out.push_back(KdTree::Neighbor{ p.id, sqrt(de * de + dn * dn + du * du) });
+		}
+		const size_t n = min(k, out.size());
+		partial_sort(out.begin(), out.begin() + n, out.end(),
+			[](const KdTree::Neighbor& a, const KdTree::Neighbor& b) { return a.distance < b.distance; });
+		out.resize(n);
+	}
+
+	template <typename F>
+	double timeIt(F&& f) {
+		auto start = chrono::steady_clock::now();
+		f();
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	void report(const char* name, double seconds, size_t operations) {
+		cout << "  " << name << ": " << operations / seconds << " queries/s, " << 1e9 * seconds / operations << " ns/query" << endl;
+	}
+
+	/// contacts at 1 Hz for a minute, each moving at its own constant velocity with 5 m of noise, extrapolated at 10 Hz
+	void benchmarkFilterBank(size_t count) {
+		mt19937 rng(static_cast<unsigned>(count));
+		uniform_real_distribution<double> offset(-0.3, 0.3), speed(-20, 20);
+		normal_distribution<double> noise(0, 5);
+		vector<double> lat(count), lon(count), velocityEast(count), velocityNorth(count);
+		for (size_t i = 0; i < count; ++i) {
+			lat[i] = OriginLat + offset(rng);
+			lon[i] = OriginLon + offset(rng);
+			velocityEast[i] = speed(rng);
+			velocityNorth[i] = speed(rng);
+		}
+		FilterBank bank(count);
+		const double metersPerDegree = ARL::Math::GeodeticKernels::metersPerDegree;
+		const int64_t start = 1600000000000000LL;
+		vector<FilterBank::Estimate> estimates;
+		double flushSeconds = 0, extrapolateSeconds = 0, error = 0;
+		size_t reports = 0, ticks = 0;
+		for (int second = 0; second < 60; ++second) {
+			for (size_t i = 0; i < count; ++i) {
+				const double north = velocityNorth[i] * second + noise(rng), east = velocityEast[i] * second + noise(rng);
+				bank.report(static_cast<FilterBank::Handle>(i), 1, lat[i] + north / metersPerDegree,
+					lon[i] + east / (metersPerDegree * cos(lat[i] * ARL::Math::GeodeticKernels::degToRad)), 300, 10, 20,
+					start + second * 1000000LL);
+			}
+			reports += count;
+			flushSeconds += timeIt([&] { bank.flush(); });
+			for (int tick = 0; tick < 10; ++tick, ++ticks)
+				extrapolateSeconds += timeIt([&] { bank.extrapolate(start + second * 1000000LL + tick * 100000LL, estimates); });
+		}
+		for (const auto& e : estimates) {
+			const double t = 59.9;
+			error += ARL::Math::GeodeticKernels::greatCircleDistance(e.lat, e.lon, lat[e.handle] + velocityNorth[e.handle] * t / metersPerDegree,
+				lon[e.handle] + velocityEast[e.handle] * t / (metersPerDegree * cos(lat[e.handle] * ARL::Math::GeodeticKernels::degToRad)));
+		}
+		cout << "  update " << 1e9 * flushSeconds / reports << " ns/report, extrapolate "
+			<< 1e6 * extrapolateSeconds / ticks << " us/tick (" << 1e9 * extrapolateSeconds / ticks / count << " ns/contact), mean error "
+			<< error / estimates.size() << " m (reports: 5 m per axis)" << endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		const size_t k = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+		const size_t queryCount = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000;
+		const size_t maxThreads = argc > 3 ? strtoul(argv[3], nullptr, 10) : max(1u, thread::hardware_concurrency());
+
+		for (size_t count : { size_t(1000), size_t(10000), size_t(100000) }) {
+			mt19937 rng(static_cast<unsigned>(count));
+			KdTree tree(OriginLat, OriginLon);
+			auto contacts = makeContacts(tree, count, rng);
+			const double buildSeconds = timeIt([&] { tree.update(contacts); tree.rebalance(); });
+			cout << count << " contacts, k = " << k << ": build " << 1e3 * buildSeconds << " ms" << endl;
+
+			// query from the contacts themselves, as a vehicle asking for its neighbors would
+			vector<KdTree::Point> queries;
+			for (size_t i = 0; i < queryCount; ++i) queries.push_back(contacts[(i * 7919) % count]);
+
+			// brute force is quadratic; time it on a sample and check the tree against it there
+			const size_t bruteQueries = min(queryCount, max<size_t>(100, 10000000 / count));
+			vector<KdTree::Neighbor> expected, actual;
+			auto mismatches = [&] {
+				size_t count = 0;
+				for (size_t i = 0; i < bruteQueries; ++i) {
+					bruteForce(contacts, queries[i], k, expected);
+					tree.nearest(queries[i], k, actual, queries[i].id);
+					for (size_t j = 0; j < expected.size(); ++j)
+						if (j >= actual.size() || actual[j].distance != expected[j].distance) ++count;
+				}
+				return count;
+			};
+			const size_t builtMismatches = mismatches();
+			report("brute force      ", timeIt([&] {
+				for (size_t i = 0; i < bruteQueries; ++i) bruteForce(contacts, queries[i], k, expected);
+			}), bruteQueries);
+			report("k-d tree         ", timeIt([&] {
+				for (const auto& q : queries) tree.nearest(q, k, actual, q.id);
+			}), queryCount);
+
+			vector<vector<KdTree::Neighbor>> results;
+			for (size_t threads = 2; threads <= maxThreads; threads *= 2) {
+				string name = "k-d tree x" + to_string(threads);
+				name.resize(17, ' ');
+				report(name.c_str(), timeIt([&] { tree.nearest(queries, k, results, threads); }), queryCount);
+			}
+
+			// a round of position reports: every contact moves a little, in batches of 1% of the contacts
+			normal_distribution<double> step(0, 5);
+			const size_t batch = max<size_t>(1, count / 100);
+			vector<KdTree::Point> moves;
+			const uint64_t rebuildsBefore = tree.getRebuildCount();
+			const double moveSeconds = timeIt([&] {
+				for (size_t first = 0; first < count; first += batch) {
+					const size_t last = min(count, first + batch);
+					for (size_t i = first; i < last; ++i) {
+						contacts[i].east += step(rng);
+						contacts[i].north += step(rng);
+					}
+					moves.assign(contacts.begin() + first, contacts.begin() + last);
+					tree.update(moves);
+				}
+			});
+			cout << "  moves: " << 1e9 * moveSeconds / count << " ns/contact including "
+				<< tree.getRebuildCount() - rebuildsBefore << " sub-tree rebuilds; " << tree.getTreeCount() << " sub-trees and "
+				<< tree.getBufferSize() << " buffered after" << endl;
+			for (size_t i = 0; i < queryCount; ++i) queries[i] = contacts[(i * 7919) % count];
+			report("k-d tree, moved  ", timeIt([&] {
+				for (const auto& q : queries) tree.nearest(q, k, actual, q.id);
+			}), queryCount);
+			cout << "  (" << builtMismatches << " mismatches against brute force as built, " << mismatches() << " after moves)" << endl;
+		}
+
+		for (size_t count : { size_t(1000), size_t(10000), size_t(100000) }) {
+			cout << "filter bank, " << count << " contacts:" << endl;
+			benchmarkFilterBank(count);
+		}
+	}
+	catch (std::exception & e)
+	{
+		std::cerr << "Exception: " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+// TraceListener.cpp : measures how long the bridge's traced reports take to arrive, on the same host.
+//
+// Joins the SA multicast group with loopback on, as any other subscriber on the host would, and for every event
+// carrying a <__trace> tag (the bridge with trace/enable and trace/tag_events) records the time from the tag's origin
+// stamp (the input's header.stamp) to the kernel's receive timestamp of the datagram. Sequence numbers show how many
+// tagged reports never arrived. Prints a summary every 10 s and on exit, and optionally appends it to a CSV file in
+// the same format as the bridge's trace/csv, so runs can be compared across builds.
+//
+//    ros_cot_bridge_trace_listener [seconds, 0 = until interrupted] [CSV file] [label] [group] [port]
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "CoTReceiver.hpp"
+#include "TransmitTrace.hpp"
+
+using namespace std;
+using AIDTR::TransmitTrace;
+
+namespace {
+
+atomic<bool> interrupted(false);
+
+void onSignal(int)
+{
+	interrupted = true;
+}
+
+/// what arrived: latency from origin stamp to arrival, and the sequence numbers seen
+struct Arrivals
+{
+	Utility::LatencyHistogram latency;
+	atomic<uint64_t> tagged{ 0 }, untagged{ 0 };
+	atomic<uint64_t> firstSequence{ 0 }, lastSequence{ 0 };
+
+	/// tagged reports sent between the first and last seen that did not arrive
+	uint64_t missing() const
+	{
+		const uint64_t first = firstSequence, last = lastSequence, seen = tagged;
+		return first && last >= first && last - first + 1 > seen ? last - first + 1 - seen : 0;
+	}
+};
+
+void report(const Arrivals& arrivals)
+{
+	const auto& latency = arrivals.latency;
+	cout << arrivals.tagged << " tagged events (" << arrivals.untagged << " untagged), " << arrivals.missing()
+		<< " missing; stamp to arrival us p50 " << latency.percentile(0.5) / 1e3 << " p99 " << latency.percentile(0.99) / 1e3
+		<< " max " << latency.max() / 1e3 << endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		const double seconds = argc > 1 ? atof(argv[1]) : 0;
+		const string csv = argc > 2 ? argv[2] : "";
+		const string label = argc > 3 ? argv[3] : "listener";
+		const string group = argc > 4 ? argv[4] : "239.2.3.1";
+		const short port = static_cast<short>(argc > 5 ? strtoul(argv[5], nullptr, 10) : 6969);
+
+		signal(SIGINT, onSignal);
+		signal(SIGTERM, onSignal);
+
+		boost::asio::io_service io_service;
+		// duplicate suppression off, so every datagram is seen
+		AIDTR::CoTReceiver receiver(io_service, boost::asio::ip::address::from_string(group), port,
+			vector<boost::asio::ip::address>(), true, 0, 1, 1, 32, Messaging::CoTEvent::NoDetail);
+		Arrivals arrivals;
+		receiver.RegisterCallback([&arrivals](const Messaging::CoTEvent& event) {
+			uint64_t sequence;
+			int64_t stampNanos;
+			if (!TransmitTrace::parseTag(event, sequence, stampNanos))
+			{
+				arrivals.untagged.fetch_add(1, memory_order_relaxed);
+				return;
+			}
+			// callbacks run in order on the pipeline's one sequencer thread
+			if (arrivals.firstSequence == 0 || sequence < arrivals.firstSequence)
+				arrivals.firstSequence = sequence;
+			if (sequence > arrivals.lastSequence)
+				arrivals.lastSequence = sequence;
+			if (stampNanos != 0 && event.receivedNanos != Messaging::CoTEvent::NoTime)
+				arrivals.latency.record(event.receivedNanos - stampNanos);
+			arrivals.tagged.fetch_add(1, memory_order_relaxed);
+		});
+		receiver.start();
+		cout << "listening on " << group << ":" << port << (seconds > 0 ? " for " + to_string(seconds) + " s" : string()) << endl;
+
+		const auto start = chrono::steady_clock::now();
+		auto nextReport = start + chrono::seconds(10);
+		while (!interrupted && (seconds <= 0 || chrono::steady_clock::now() - start < chrono::duration<double>(seconds)))
+		{
+			this_thread::sleep_for(chrono::milliseconds(100));
+			if (chrono::steady_clock::now() >= nextReport)
+			{
+				report(arrivals);
+				nextReport += chrono::seconds(10);
+			}
+		}
+		receiver.stop();
+		report(arrivals);
+
+		if (!csv.empty())
+		{
+			ofstream os(csv, ios::app);
+			if (os.tellp() == 0)
+				TransmitTrace::writeCsvHeader(os);
+			TransmitTrace::writeCsvRow(os, label, "arrival", arrivals.latency);
+			if (!os.flush())
+			{
+				cerr << "cannot write " << csv << endl;
+				return 1;
+			}
+		}
+	}
+	catch (std::exception & e)
+	{
+		std::cerr << "Exception: " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
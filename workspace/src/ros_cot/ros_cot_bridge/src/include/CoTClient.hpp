@@ -1,12 +1,18 @@
 #pragma once
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <xercesc/framework/MemBufFormatTarget.hpp>
 #include <iostream>
 #include <iomanip>
+#include "Ingest/CaptureLog.hpp"
 #include "Messaging/XmlMessagingBase.hpp"
+#include "TransmitTrace.hpp"
 #include "Utility/xstr.hpp"
 #include "Utility/StringConversions.hpp"
 #include "Utility/timeStrings.hpp"
@@ -38,8 +44,10 @@ namespace AIDTR {
 			bool simulation = true
 		)
 			: XmlMessagingBase(), 
+			uid(uid),
 			endpoint(multicast_address, multicast_port),
 			socket(io_service, endpoint.protocol()),
+			captureLog(nullptr), captureLogProducer(0), trace(nullptr),
 			errorCount(0), sendCount(0) {
 
 			std::lock_guard<std::mutex> lock(positionMutex);
@@ -69,13 +77,32 @@ namespace AIDTR {
 		*	@hae the heigh in meters above the WGS84 ellispoid
 		*	@ce	the circular (horizontal) 1-sigma position error, in meters.
 		*	@le the altitude (vertical) 1-sigma position error, in meters.
+		*	@param course degrees clockwise from true north, and speed in meters per second, reported in a <track> element
+		*	so that receivers can dead-reckon us until our next report; no <track> when course is NaN
+		*	@param origin when the input this report is made from was stamped and handled, to trace it to the wire by
 		*/
-		void sendPositionReport(const double lat, const double lon, const double hae, const double ce = 10, const double le = 0.5) {
-			{
-				std::lock_guard<std::mutex> lock(positionMutex); //positionMutex protects against race conditions on the data in pPointEl... Only lock when changing this data.
-				setPosition(pPointEl, lat, lon, hae, ce, le);
+		void sendPositionReport(const double lat, const double lon, const double hae, const double ce = 10, const double le = 0.5,
+			const double course = std::numeric_limits<double>::quiet_NaN(), const double speed = std::numeric_limits<double>::quiet_NaN(),
+			const TransmitTrace::Origin* origin = nullptr) {
+			std::lock_guard<std::mutex> lock(positionMutex); //positionMutex protects the data in pPointEl, until it has been serialized by send
+			setPosition(pPointEl, lat, lon, hae, ce, le);
+			if (course == course) {
+				if (!pTrackEl)
+					pTrackEl = pPositionDoc->createElement(Utility::xStr("track"));
+				if (!pTrackEl->getParentNode())
+					pDetailEl->appendChild(pTrackEl);
+				setTrack(pTrackEl, course, speed == speed ? speed : 0);
+			}
+			else if (pTrackEl && pTrackEl->getParentNode())
+				pDetailEl->removeChild(pTrackEl); // kept by the document, for the next report with a course
+			if (trace && origin && trace->tagsEvents()) {
+				if (!pTraceEl) {
+					pTraceEl = pPositionDoc->createElement(Utility::xStr("__trace"));
+					pDetailEl->appendChild(pTraceEl);
+				}
+				setTraceTag(pTraceEl, trace->nextSequence(), origin->stampNanos);
 			}
-			send(pPositionDoc);
+			send(pPositionDoc, origin);
 		}
 
 		/**
@@ -89,39 +116,113 @@ namespace AIDTR {
 		*	@le the altitude (vertical) 1-sigma position error of the contact, in meters.
 		*	@param how The method through which position information is determined in CoT. "m-f" indicates 'machine fused' localization method. @see CoT documentation for more info.
 		*	@param simulation Boolean flag indicating if reports are for a simulation or from live action.
+		*	@param origin when the input this report is made from was stamped and handled, to trace it to the wire by
 		*/
 		void sendContactReport(const char* uid, const char* type,
 			const double lat, const double lon, const double hae, const double ce = 10, const double le = 0.5,
-			const char* how = "m-f", bool simulation = true)
+			const char* how = "m-f", bool simulation = true, const TransmitTrace::Origin* origin = nullptr)
 		{
 			auto r = createCoTDocument(uid, type, how, simulation);
 			setPosition(std::get<1>(r), lat, lon, hae, ce, le);
-			send(std::get<0>(r));
+			if (trace && origin && trace->tagsEvents()) {
+				auto pTagEl = std::get<0>(r)->createElement(Utility::xStr("__trace"));
+				std::get<2>(r)->appendChild(pTagEl);
+				setTraceTag(pTagEl, trace->nextSequence(), origin->stampNanos);
+			}
+			send(std::get<0>(r), origin);
+			std::get<0>(r)->release();
+		}
+
+		/** send an already encoded CoT message as it is, e.g. one replayed from a capture log; it is not logged again
+		*
+		*	@returns false if the send failed
+		*/
+		bool sendRaw(const char* data, size_t size) {
+			boost::system::error_code error;
+			socket.send_to(boost::asio::buffer(data, size), endpoint, 0, error);
+			if (error) {
+				errorCount++;
+				return false;
+			}
+			sendCount++;
+			return true;
+		}
+
+		/// log every message sent, under the log's producer index producer; call before sending
+		void setCaptureLog(Ingest::CaptureLog* log, size_t producer = 0) {
+			captureLog = log;
+			captureLogProducer = producer;
+			const auto address = endpoint.address();
+			if (address.is_v4()) {
+				const auto bytes = address.to_v4().to_bytes();
+				captureLogAddress.assign(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			}
+			else {
+				const auto bytes = address.to_v6().to_bytes();
+				captureLogAddress.assign(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			}
 		}
 
+		/** trace reports sent with an origin through encoding and the send into trace, tagging them if it asks; call
+		*	before sending. Send completions are only seen while the io_service is run.
+		*/
+		void setTrace(TransmitTrace* trace) {
+			this->trace = trace;
+		}
+
+		/// the uid this client uses for its self-reports
+		const std::string& getUid() const { return uid; }
+
 		unsigned int getSendCount() const { return sendCount; }
 		unsigned int getErrorCount() const { return errorCount; }
 	protected:
 
-		void send(xercesc_3_2::DOMDocument* pDoc) {
-			std::stringstream os;
+		void send(xercesc_3_2::DOMDocument* pDoc, const TransmitTrace::Origin* origin = nullptr) {
+			// owned by the completion handler, so the send may complete after we return
+			auto payload = std::make_shared<std::string>();
+			int64_t encodedNanos;
 			{
 				std::lock_guard<std::mutex> lock(serializerMutex);
 				pSerializer->write(pDoc, pOutput);
-				os.write((const char*)pTarget->getRawBuffer(), pTarget->getLen());
+				encodedNanos = TransmitTrace::wallNanos();
+				payload->assign((const char*)pTarget->getRawBuffer(), pTarget->getLen());
+				if (captureLog) // under serializerMutex, so only one thread at a time uses the producer
+					captureLog->append(captureLogProducer, Ingest::CaptureLog::Sent, encodedNanos,
+						captureLogAddress, endpoint.port(), 0, payload->data(), payload->size());
 				pTarget->reset();
 			}
 
-			std::cout << os.str() << std::endl << std::endl;
-
-			socket.async_send_to(boost::asio::buffer(os.str()),
-				endpoint,
-				boost::bind(&CoTClient::handle_send_to, this,
-					boost::asio::placeholders::error));
+			if (trace && origin) {
+				const TransmitTrace::Origin traced = *origin;
+				const int64_t issuedNanos = TransmitTrace::wallNanos();
+				socket.async_send_to(boost::asio::buffer(*payload), endpoint,
+					[this, payload, traced, encodedNanos, issuedNanos](const boost::system::error_code& error, size_t) {
+						handle_send_to(error);
+						if (!error)
+							trace->record(traced, encodedNanos, issuedNanos, TransmitTrace::wallNanos());
+					});
+			}
+			else
+				socket.async_send_to(boost::asio::buffer(*payload), endpoint,
+					[this, payload](const boost::system::error_code& error, size_t) { handle_send_to(error); });
 			sendCount++;
 
 		}
 
+		static void setTrack(xercesc_3_2::DOMElement* pTrackEl, const double course, const double speed) {
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << course;
+			pTrackEl->setAttribute(Utility::xStr("course"), Utility::xStr(ss.str().c_str())); //degrees true
+			ss.str(""); ss.clear(); ss << std::fixed << std::setprecision(2) << speed;
+			pTrackEl->setAttribute(Utility::xStr("speed"), Utility::xStr(ss.str().c_str())); //meters per second
+		}
+
+		/// set a <__trace> element's sequence number and origin stamp
+		static void setTraceTag(xercesc_3_2::DOMElement* pTraceEl, uint64_t sequence, int64_t stampNanos) {
+			pTraceEl->setAttribute(Utility::xStr("seq"), Utility::xStr(std::to_string(sequence).c_str()));
+			pTraceEl->setAttribute(Utility::xStr("stamp"), Utility::xStr(std::to_string(stampNanos).c_str()));
+		}
+
 		static std::tuple<xercesc_3_2::DOMDocument*, xercesc_3_2::DOMElement *, xercesc_3_2::DOMElement *> createCoTDocument(const char* uid = "AIDTR Gator 1",
 			const char* type = "a-f-G-E-V",
 			const char* how = "m-f",
@@ -152,7 +253,7 @@ namespace AIDTR {
 
 			pEventEl->appendChild(pPointEl);
 
-			auto pDetailEl = pPositionDoc->createElement(XMLString::transcode("point"));
+			auto pDetailEl = pPositionDoc->createElement(XMLString::transcode("detail"));
 			pEventEl->appendChild(pDetailEl);
 			pPositionDoc->appendChild(pEventEl);
 
@@ -181,17 +282,28 @@ namespace AIDTR {
 		xercesc_3_2::DOMDocument* pPositionDoc;
 		xercesc_3_2::DOMElement* pPointEl;
 		xercesc_3_2::DOMElement* pDetailEl;
+		xercesc_3_2::DOMElement* pTraceEl = nullptr;	///< pPositionDoc's <__trace>, once it is tagged
+		xercesc_3_2::DOMElement* pTrackEl = nullptr;	///< pPositionDoc's <track>, once a report has had a course
 
 		xercesc_3_2::DOMLSSerializer* pSerializer;
 		xercesc_3_2::DOMLSOutput* pOutput;
 		xercesc_3_2::MemBufFormatTarget* pTarget;
 
+		/// serializerMutex is shared by every sending thread, whatever its priority: a SCHED_FIFO fix thread can wait on a
+		/// normally scheduled contacts thread holding it (priority inversion), for as long as one report takes to encode
 		std::mutex positionMutex, serializerMutex;
+
+		const std::string uid;
 		
 	private:
 		boost::asio::ip::udp::endpoint endpoint;
 		boost::asio::ip::udp::socket socket;
 
-		unsigned int errorCount, sendCount;
+		Ingest::CaptureLog* captureLog;
+		size_t captureLogProducer;
+		std::string captureLogAddress;
+		TransmitTrace* trace;
+
+		std::atomic<unsigned int> errorCount, sendCount;	///< counted on the senders' threads and the io_service's
 	};
 }
\ No newline at end of file
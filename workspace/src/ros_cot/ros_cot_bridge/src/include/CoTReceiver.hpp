@@ -0,0 +1,198 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include "Ingest/DecodePipeline.hpp"
+#include "Utility/CallbackRegister.hpp"
+
+namespace AIDTR {
+	/** A class to receive CoT messages from a multicast group and produce callbacks with the parsed events.
+	*
+	*	One or more receive threads read the socket and feed an Ingest::DecodePipeline, which deduplicates (self echo and
+	*	cross-interface duplicates) and parses on a pool of worker threads and delivers each uid's events in arrival
+	*	order. Callbacks run on the pipeline's sequencer thread and receive a CoTEvent whose views are valid only for the
+	*	duration of the callback.
+	*
+	*	Each receive thread pulls up to receiveBatch datagrams per recvmmsg() call into its own preallocated buffers.
+	*	SO_TIMESTAMPNS is enabled on the socket, so every datagram carries the time the kernel received it; that stamp
+	*	becomes CoTEvent::receivedNanos and the start of the pipeline's latency measurements. Datagrams without a
+	*	kernel timestamp are stamped when recvmmsg() returns.
+	*
+	*	CoTReceiver
+	*/
+	class CoTReceiver : public ARL::Utility::CallbackRegister<Messaging::CoTEvent> {
+	public:
+		/** CoTReceiver Constructor - joins the multicast group; call start() to begin receiving
+		*
+		*	@param io_service Boost asio's ioservice instance to use for this object
+		*	@param multicast_address The multicast group to join.
+		*	@param multicast_port The port to listen on.
+		*	@param interfaces Addresses of the local interfaces to join the group on. Empty joins on the default interface.
+		*	@param loopback Whether datagrams sent from this host are looped back to us. Self echoes are dropped by the Deduplicator.
+		*	@param dedupWindowMicros How long an exact uid+time repeat is treated as a duplicate, in microseconds.
+		*	@param receiveThreads Number of threads reading the socket.
+		*	@param parserThreads Number of threads parsing datagrams.
+		*	@param receiveBatch Maximum datagrams read per recvmmsg() call; each receive thread keeps this many 64 KiB buffers.
+		*	@param detailFields Messaging::CoTEvent::DetailFields parsed before callbacks run; the rest of <detail> is left
+		*	for callbacks to parse on demand.
+		*/
+		CoTReceiver(boost::asio::io_service& io_service,
+			const boost::asio::ip::address& multicast_address,
+			const short multicast_port = 30001,
+			const std::vector<boost::asio::ip::address>& interfaces = std::vector<boost::asio::ip::address>(),
+			bool loopback = true,
+			int64_t dedupWindowMicros = 5000000,
+			size_t receiveThreads = 1,
+			size_t parserThreads = 2,
+			size_t receiveBatch = 32,
+			unsigned detailFields = Messaging::CoTEvent::AllDetail)
+			: socket(io_service), pipeline(receiveThreads ? receiveThreads : 1, parserThreads, 1024, dedupWindowMicros, detailFields),
+			receiveBatch(receiveBatch ? receiveBatch : 1), running(false), receiveCount(0), receiveCallCount(0),
+			untimestampedCount(0) {
+			using namespace boost::asio::ip;
+			udp::endpoint listen_endpoint(multicast_address.is_v6() ? udp::v6() : udp::v4(), multicast_port);
+			socket.open(listen_endpoint.protocol());
+			socket.set_option(udp::socket::reuse_address(true));
+			socket.bind(listen_endpoint);
+			socket.set_option(multicast::enable_loopback(loopback));
+			if (interfaces.empty())
+				socket.set_option(multicast::join_group(multicast_address));
+			for (const auto& iface : interfaces) {
+				if (multicast_address.is_v4() && iface.is_v4())
+					socket.set_option(multicast::join_group(multicast_address.to_v4(), iface.to_v4()));
+				else
+					socket.set_option(multicast::join_group(multicast_address));
+			}
+
+			// bound the blocking receive so stop() is observed promptly
+			timeval timeout{ 0, 200000 };
+			setsockopt(socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+			int on = 1;
+			setsockopt(socket.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+
+			pipeline.RegisterCallback([this](const Messaging::CoTEvent& event) { InvokeCallback(event); });
+		}
+
+		~CoTReceiver() {
+			stop();
+		}
+
+		void start() {
+			if (running.exchange(true)) return;
+			pipeline.start();
+			for (size_t i = 0; i < pipeline.getNumProducers(); ++i)
+				receiveThreads.emplace_back(&CoTReceiver::receiveLoop, this, i);
+		}
+
+		void stop() {
+			running = false;
+			for (auto& t : receiveThreads)
+				if (t.joinable()) t.join();
+			receiveThreads.clear();
+			pipeline.stop();
+		}
+
+		/// register a uid we transmit, so that its echo is dropped
+		bool addSelfUid(boost::string_view uid) { return pipeline.addSelfUid(uid); }
+
+		/// register a uid we relay, so that its echo is dropped until expiresMicros (wall clock); call from one thread
+		bool addRelayedUid(boost::string_view uid, int64_t expiresMicros) { return pipeline.addRelayedUid(uid, expiresMicros); }
+
+		/// limit each source address and each uid to a datagram rate, checked before parsing; call before start()
+		void setRateLimits(const Ingest::RateLimiter::Limit& source, const Ingest::RateLimiter::Limit& uid, size_t capacity = 8192) {
+			pipeline.setRateLimits(source, uid, capacity);
+		}
+
+		/// log every datagram received, using one producer per receive thread from firstProducer on; call before start()
+		void setCaptureLog(Ingest::CaptureLog* log, size_t firstProducer = 0) { pipeline.setCaptureLog(log, firstProducer); }
+
+		/// the decode stages, with their drop counts, queue depths and latencies
+		const Ingest::DecodePipeline& getPipeline() const { return pipeline; }
+
+		unsigned long long getReceiveCount() const { return receiveCount; }
+		/// recvmmsg() calls that returned at least one datagram
+		unsigned long long getReceiveCallCount() const { return receiveCallCount; }
+		/// datagrams that arrived without a kernel timestamp
+		unsigned long long getUntimestampedCount() const { return untimestampedCount; }
+
+	protected:
+		static const size_t MaxDatagramSize = 65536;
+
+		/// ancillary data space for one SCM_TIMESTAMPNS message, aligned for cmsghdr
+		union ControlBuffer {
+			cmsghdr align;
+			char data[CMSG_SPACE(sizeof(timespec))];
+		};
+
+		void receiveLoop(size_t producer) {
+			// one buffer, iovec, control block and header per batch slot, set up once and reused by every call
+			std::vector<char> buffers(receiveBatch * MaxDatagramSize);
+			std::vector<iovec> iovecs(receiveBatch);
+			std::vector<ControlBuffer> controls(receiveBatch);
+			std::vector<sockaddr_storage> senders(receiveBatch);
+			std::vector<mmsghdr> messages(receiveBatch);
+			for (size_t i = 0; i < receiveBatch; ++i) {
+				iovecs[i].iov_base = &buffers[i * MaxDatagramSize];
+				iovecs[i].iov_len = MaxDatagramSize;
+				messages[i] = mmsghdr();
+				messages[i].msg_hdr.msg_iov = &iovecs[i];
+				messages[i].msg_hdr.msg_iovlen = 1;
+				messages[i].msg_hdr.msg_control = controls[i].data;
+				messages[i].msg_hdr.msg_name = &senders[i];
+			}
+
+			while (running) {
+				for (auto& m : messages) {
+					m.msg_hdr.msg_controllen = sizeof(ControlBuffer); // the kernel shrinks these to what it wrote
+					m.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+				}
+				const int n = ::recvmmsg(socket.native_handle(), messages.data(), static_cast<unsigned int>(receiveBatch), MSG_WAITFORONE, nullptr);
+				if (n <= 0) continue; // timeout or transient error
+				++receiveCallCount;
+				receiveCount += n;
+				const int64_t returnedNanos = Ingest::DecodePipeline::nowNanos();
+				for (int i = 0; i < n; ++i)
+					pipeline.submit(producer, &buffers[i * MaxDatagramSize], messages[i].msg_len,
+						kernelTimestamp(messages[i].msg_hdr, returnedNanos), senderAddress(messages[i].msg_hdr));
+			}
+		}
+
+		/// @returns the sender's address bytes in network order, or an empty view if the kernel reported none
+		static boost::string_view senderAddress(const msghdr& header) {
+			const auto* address = static_cast<const sockaddr*>(header.msg_name);
+			if (address->sa_family == AF_INET && header.msg_namelen >= sizeof(sockaddr_in))
+				return boost::string_view(reinterpret_cast<const char*>(&reinterpret_cast<const sockaddr_in*>(address)->sin_addr), 4);
+			if (address->sa_family == AF_INET6 && header.msg_namelen >= sizeof(sockaddr_in6))
+				return boost::string_view(reinterpret_cast<const char*>(&reinterpret_cast<const sockaddr_in6*>(address)->sin6_addr), 16);
+			return boost::string_view();
+		}
+
+		/// @returns the SCM_TIMESTAMPNS receive time of a message in nanoseconds since the Unix epoch, or fallback
+		int64_t kernelTimestamp(msghdr& header, int64_t fallback) {
+			for (cmsghdr* c = CMSG_FIRSTHDR(&header); c; c = CMSG_NXTHDR(&header, c)) {
+				if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+					timespec ts;
+					std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+					return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+				}
+			}
+			++untimestampedCount;
+			return fallback;
+		}
+
+		boost::asio::ip::udp::socket socket;
+		Ingest::DecodePipeline pipeline;
+
+		const size_t receiveBatch;
+		std::vector<std::thread> receiveThreads;
+		std::atomic<bool> running;
+		std::atomic<unsigned long long> receiveCount, receiveCallCount, untimestampedCount;
+	};
+}
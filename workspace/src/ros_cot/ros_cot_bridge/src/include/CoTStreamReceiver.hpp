@@ -0,0 +1,185 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "Ingest/DecodePipeline.hpp"
+#include "Ingest/StreamFramer.hpp"
+#include "Utility/CallbackRegister.hpp"
+
+namespace AIDTR {
+	/** A class to receive CoT events from a TCP stream, e.g. a TAK server's streaming port, and produce callbacks with
+	*	the parsed events.
+	*
+	*	One thread connects (and reconnects, after a second, whenever the connection fails or closes), reads into an
+	*	Ingest::StreamFramer and submits each framed event, XML or TAK Protocol, to its own Ingest::DecodePipeline. A
+	*	full pipeline is waited on rather than dropped from, so a slow consumer pushes back on the sender through TCP
+	*	flow control. Events are stamped with the time the read that completed them returned. Callbacks run on the
+	*	pipeline's sequencer thread, as with CoTReceiver.
+	*
+	*	stop() returns within a fifth of a second, even while a connect is outstanding; only a host name lookup in
+	*	progress holds it until the resolver gives up.
+	*
+	*	CoTStreamReceiver
+	*/
+	class CoTStreamReceiver : public ARL::Utility::CallbackRegister<Messaging::CoTEvent> {
+	public:
+		/** CoTStreamReceiver Constructor - call start() to connect
+		*
+		*	@param io_service Boost asio's ioservice instance to use for this object
+		*	@param host The host name or address to connect to.
+		*	@param port The TCP port to connect to.
+		*	@param dedupWindowMicros How long an exact uid+time repeat is treated as a duplicate, in microseconds.
+		*	@param parserThreads Number of threads parsing events.
+		*	@param maxEventSize Longest event buffered until complete; longer ones are discarded.
+		*	@param detailFields Messaging::CoTEvent::DetailFields parsed before callbacks run.
+		*/
+		CoTStreamReceiver(boost::asio::io_service& io_service,
+			const std::string& host,
+			unsigned short port = 8088,
+			int64_t dedupWindowMicros = 5000000,
+			size_t parserThreads = 1,
+			size_t maxEventSize = 1 << 20,
+			unsigned detailFields = Messaging::CoTEvent::AllDetail)
+			: socket(io_service), resolver(io_service), host(host), port(port),
+			pipeline(1, parserThreads, 1024, dedupWindowMicros, detailFields), framer(maxEventSize),
+			running(false), connected(false), connectCount(0), receiveBytes(0), eventCount(0), oversizeCount(0),
+			malformedCount(0) {
+			pipeline.RegisterCallback([this](const Messaging::CoTEvent& event) { InvokeCallback(event); });
+		}
+
+		~CoTStreamReceiver() {
+			stop();
+		}
+
+		void start() {
+			if (running.exchange(true)) return;
+			pipeline.start();
+			receiveThread = std::thread(&CoTStreamReceiver::receiveLoop, this);
+		}
+
+		void stop() {
+			running = false;
+			if (receiveThread.joinable()) receiveThread.join();
+			pipeline.stop();
+		}
+
+		/// register a uid we transmit, so that its echo is dropped
+		bool addSelfUid(boost::string_view uid) { return pipeline.addSelfUid(uid); }
+
+		/// log every event framed from the stream, as the log's producer firstProducer; call before start()
+		void setCaptureLog(Ingest::CaptureLog* log, size_t firstProducer = 0) { pipeline.setCaptureLog(log, firstProducer); }
+
+		/// the decode stages, with their drop counts, queue depths and latencies
+		const Ingest::DecodePipeline& getPipeline() const { return pipeline; }
+
+		bool isConnected() const { return connected; }
+		unsigned long long getConnectCount() const { return connectCount; }
+		unsigned long long getReceiveBytes() const { return receiveBytes; }
+		/// events framed from the stream
+		unsigned long long getEventCount() const { return eventCount; }
+		/// events discarded by the framer for exceeding maxEventSize
+		unsigned long long getOversizeCount() const { return oversizeCount; }
+		/// runs of bytes discarded by the framer as not part of any event
+		unsigned long long getMalformedCount() const { return malformedCount; }
+
+	protected:
+		void receiveLoop() {
+			while (running) {
+				if (!connect()) {
+					for (int i = 0; i < 10 && running; ++i)
+						std::this_thread::sleep_for(std::chrono::milliseconds(100));
+					continue;
+				}
+				framer.reset();
+				while (running) {
+					size_t space;
+					char* p = framer.prepare(space);
+					const ssize_t n = ::recv(socket.native_handle(), p, space, 0);
+					if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue; // timeout
+					if (n <= 0) break; // closed or failed
+					receiveBytes += n;
+					const int64_t receivedNanos = Ingest::DecodePipeline::nowNanos();
+					// TCP has already delivered these events, so wait for room rather than drop; submitWait logs each once
+					framer.commit(static_cast<size_t>(n), [this, receivedNanos](const char* data, size_t size) {
+						pipeline.submitWait(0, data, size, receivedNanos, boost::string_view(), &running);
+					});
+					eventCount = framer.getEventCount();
+					oversizeCount = framer.getErrorCount(Ingest::StreamFramer::Oversize);
+					malformedCount = framer.getErrorCount(Ingest::StreamFramer::Malformed);
+				}
+				connected = false;
+				boost::system::error_code ignored;
+				socket.close(ignored);
+			}
+		}
+
+		bool connect() {
+			using boost::asio::ip::tcp;
+			boost::system::error_code error;
+			auto endpoints = resolver.resolve(tcp::resolver::query(host, std::to_string(port)), error);
+			if (error) return false;
+			for (tcp::resolver::iterator end; endpoints != end && running; ++endpoints) {
+				socket.close(error);
+				if (connect(*endpoints, error)) break;
+			}
+			if (error || !running) return false;
+			// bound the blocking receive so stop() is observed promptly
+			timeval timeout{ 0, PollMillis * 1000 };
+			setsockopt(socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			++connectCount;
+			connected = true;
+			return true;
+		}
+
+		/** connect to one endpoint, checking for stop() while the handshake is outstanding
+		*
+		*	A blocking connect to an unreachable host waits out the kernel's SYN retries, minutes, and stop() with it.
+		*	(asio's own connect polls without a timeout even on a non-blocking socket, hence the plain connect().)
+		*/
+		bool connect(const boost::asio::ip::tcp::endpoint& endpoint, boost::system::error_code& error) {
+			socket.open(endpoint.protocol(), error);
+			if (!error) socket.non_blocking(true, error);
+			if (error) return false;
+			if (::connect(socket.native_handle(), endpoint.data(), static_cast<socklen_t>(endpoint.size())) != 0) {
+				if (errno != EINPROGRESS) {
+					error.assign(errno, boost::system::system_category());
+					return false;
+				}
+				pollfd pending{ socket.native_handle(), POLLOUT, 0 };
+				int ready = 0;
+				while (running && ((ready = ::poll(&pending, 1, PollMillis)) == 0 || (ready < 0 && errno == EINTR))) {}
+				if (ready <= 0) {
+					error = ready < 0 ? boost::system::error_code(errno, boost::system::system_category())
+						: boost::asio::error::operation_aborted;
+					return false;
+				}
+				int result = 0;
+				socklen_t length = sizeof(result);
+				getsockopt(socket.native_handle(), SOL_SOCKET, SO_ERROR, &result, &length);
+				error.assign(result, boost::system::system_category());
+				if (error) return false;
+			}
+			socket.non_blocking(false, error);
+			return !error;
+		}
+
+		enum { PollMillis = 200 };	///< longest a blocked receive or connect goes without checking for stop()
+
+		boost::asio::ip::tcp::socket socket;
+		boost::asio::ip::tcp::resolver resolver;
+		const std::string host;
+		const unsigned short port;
+		Ingest::DecodePipeline pipeline;
+		Ingest::StreamFramer framer;	///< receive thread only
+
+		std::thread receiveThread;
+		std::atomic<bool> running, connected;
+		std::atomic<unsigned long long> connectCount, receiveBytes, eventCount, oversizeCount, malformedCount;
+	};
+}
@@ -0,0 +1,398 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Messaging/macro.h"
+
+#include "ros_cot_msgs/StampedContactList.h"
+#include "ros_cot_msgs/CompactContactDelta.h"
+#include "ros_cot_msgs/CompactContactSnapshot.h"
+#include "ros_cot_msgs/ContactDelta.h"
+#include "ros_cot_msgs/ContactSnapshot.h"
+
+namespace AIDTR {
+
+	/// the fixed-point position of a ros_cot_msgs::CompactContact
+	namespace CompactPosition {
+		const double Scale = 1e7;	///< units per degree
+		const int32_t Unknown = std::numeric_limits<int32_t>::min();
+
+		inline int32_t encode(double degrees) {
+			return std::isfinite(degrees) && std::fabs(degrees) <= 180 ? static_cast<int32_t>(std::lround(degrees * Scale)) : Unknown;
+		}
+
+		inline double decode(int32_t scaled) {
+			return scaled == Unknown ? std::nan("") : scaled / Scale;
+		}
+	}
+
+	/** Turns contacts from the full messages (ContactDelta, ContactSnapshot, StampedContactList) into their compact forms
+	*	(CompactContactDelta, CompactContactSnapshot), for subscribers across slower links.
+	*
+	*	The encoder gives each uid a handle, and each distinct type and how a small code, and sends each of those table
+	*	entries in the index of the first delta that uses it. A removed uid's handle is freed and may be given to the next
+	*	new uid. The encoder keeps every contact it has encoded, as it was encoded, so it can also turn a series of full
+	*	StampedContactLists into deltas between them (only contacts whose compact form changed are updates), and make a
+	*	snapshot of its own.
+	*
+	*	Type and how codes are never reused. A table that is full (65535 types, 255 hows) encodes further strings as 0,
+	*	the empty string, and counts them in getOverflowCount(). Not thread-safe.
+	*
+	*	CompactContactEncoder
+	*/
+	class CompactContactEncoder {
+	public:
+		CompactContactEncoder() : mSequence(0), mMark(0), mOverflowCount(0) {
+			mTypeNames.push_back("");
+			mTypeCodes[""] = 0;
+			mHowNames.push_back("");
+			mHowCodes[""] = 0;
+		}
+
+		/// a delta of the bridge's contacts; out keeps its sequence
+		void encode(const ros_cot_msgs::ContactDelta& in, ros_cot_msgs::CompactContactDelta& out) {
+			clear(out);
+			out.header = in.header;
+			out.sequence = mSequence = in.sequence;
+			for (const auto& uid : in.removed)
+				remove(uid, out);
+			for (const auto& contact : in.added)
+				out.added.push_back(put(contact, out.index).contact);
+			for (const auto& contact : in.updated)
+				out.updated.push_back(put(contact, out.index).contact);
+		}
+
+		/** a full list, as the delta from the list (or delta) encoded before it: contacts not in it are removed
+		*
+		*	@returns false, leaving the sequence number alone, if nothing changed
+		*/
+		bool encode(const ros_cot_msgs::StampedContactList& in, ros_cot_msgs::CompactContactDelta& out) {
+			clear(out);
+			out.header = in.header;
+			++mMark;
+			for (const auto& contact : in.contactList) {
+				const bool known = find(contact.uid) != None;
+				const Entry& entry = put(contact, out.index);
+				if (!known)
+					out.added.push_back(entry.contact);
+				else if (entry.changed)
+					out.updated.push_back(entry.contact);
+			}
+			sweep(&out);
+			if (out.added.empty() && out.updated.empty() && out.removed.empty())
+				return false;
+			out.sequence = ++mSequence;
+			return true;
+		}
+
+		/** a snapshot of the bridge's contacts; the encoder's contacts become these, and out's index holds every table
+		*	entry they use, so that a subscriber can start from it
+		*/
+		void encode(const ros_cot_msgs::ContactSnapshot& in, ros_cot_msgs::CompactContactSnapshot& out) {
+			out.header = in.header;
+			out.sequence = mSequence = in.sequence;
+			++mMark;
+			clear(mScratch);
+			for (const auto& contact : in.contacts)
+				put(contact, mScratch);
+			sweep(NULL);
+			snapshot(out);
+		}
+
+		/// every contact encoded so far, as of getSequence(), e.g. between lists encoded as deltas
+		void snapshot(ros_cot_msgs::CompactContactSnapshot& out) const {
+			out.sequence = mSequence;
+			auto& index = out.index;
+			index.handles.clear();
+			index.uids.clear();
+			out.contacts.clear();
+			for (size_t handle = 0; handle < mEntries.size(); ++handle) {
+				const Entry& entry = mEntries[handle];
+				if (!entry.present)
+					continue;
+				index.handles.push_back(static_cast<uint32_t>(handle));
+				index.uids.push_back(entry.uid);
+				out.contacts.push_back(entry.contact);
+			}
+			index.typeCodes.resize(mTypeNames.size());
+			for (size_t i = 0; i < mTypeNames.size(); ++i)
+				index.typeCodes[i] = static_cast<uint16_t>(i);
+			index.types = mTypeNames;
+			index.howCodes.resize(mHowNames.size());
+			for (size_t i = 0; i < mHowNames.size(); ++i)
+				index.howCodes[i] = static_cast<uint8_t>(i);
+			index.hows = mHowNames;
+		}
+
+		uint64_t getSequence() const { return mSequence; }
+		/// contacts encoded and not removed since
+		size_t size() const { return mUids.size(); }
+		/// types and hows encoded as 0 because their table was full
+		uint64_t getOverflowCount() const { return mOverflowCount; }
+
+	protected:
+		enum : uint32_t { None = 0xffffffffu };
+
+		struct Entry {
+			std::string uid;
+			ros_cot_msgs::CompactContact contact;
+			bool present = false;
+			bool changed = false;	///< by the last put()
+			uint64_t mark = 0;	///< the last list or snapshot the contact was in
+		};
+
+		static void clear(ros_cot_msgs::CompactIndex& index) {
+			index.handles.clear();
+			index.uids.clear();
+			index.typeCodes.clear();
+			index.types.clear();
+			index.howCodes.clear();
+			index.hows.clear();
+		}
+
+		static void clear(ros_cot_msgs::CompactContactDelta& out) {
+			clear(out.index);
+			out.added.clear();
+			out.updated.clear();
+			out.removed.clear();
+		}
+
+		uint32_t find(const std::string& uid) const {
+			const auto i = mUids.find(uid);
+			return i == mUids.end() ? None : i->second;
+		}
+
+		/// store a contact, binding its uid and codes first if they are new (adding them to index)
+		const Entry& put(const ros_cot_msgs::AtakContact& in, ros_cot_msgs::CompactIndex& index) {
+			uint32_t handle = find(in.uid);
+			if (handle == None) {
+				if (!mFree.empty()) {
+					handle = mFree.back();
+					mFree.pop_back();
+				}
+				else {
+					handle = static_cast<uint32_t>(mEntries.size());
+					mEntries.emplace_back();
+				}
+				mUids[in.uid] = handle;
+				mEntries[handle].uid = in.uid;
+				index.handles.push_back(handle);
+				index.uids.push_back(in.uid);
+			}
+			ros_cot_msgs::CompactContact c;
+			c.handle = handle;
+			c.type = static_cast<uint16_t>(code(in.type, mTypeCodes, mTypeNames, 0xffff, index.typeCodes, index.types));
+			c.how = static_cast<uint8_t>(code(in.how, mHowCodes, mHowNames, 0xff, index.howCodes, index.hows));
+			c.latitude = CompactPosition::encode(in.latitude);
+			c.longitude = CompactPosition::encode(in.longitude);
+			c.altitude = static_cast<float>(in.altitude);
+			c.ce = static_cast<float>(in.ce);
+			c.le = static_cast<float>(in.le);
+			Entry& entry = mEntries[handle];
+			const auto& old = entry.contact;
+			entry.changed = !entry.present || old.type != c.type || old.how != c.how || old.latitude != c.latitude
+				|| old.longitude != c.longitude || old.altitude != c.altitude || old.ce != c.ce || old.le != c.le;
+			entry.contact = c;
+			entry.present = true;
+			entry.mark = mMark;
+			return entry;
+		}
+
+		template <typename Code>
+		uint32_t code(const std::string& name, std::unordered_map<std::string, uint32_t>& codes, std::vector<std::string>& names,
+				uint32_t maxCode, std::vector<Code>& newCodes, std::vector<std::string>& newNames) {
+			const auto i = codes.find(name);
+			if (i != codes.end())
+				return i->second;
+			if (names.size() > maxCode) {
+				++mOverflowCount;
+				return 0;
+			}
+			const auto c = static_cast<uint32_t>(names.size());
+			codes[name] = c;
+			names.push_back(name);
+			newCodes.push_back(static_cast<Code>(c));
+			newNames.push_back(name);
+			return c;
+		}
+
+		void remove(const std::string& uid, ros_cot_msgs::CompactContactDelta& out) {
+			const uint32_t handle = find(uid);
+			if (handle == None)
+				return;
+			out.removed.push_back(handle);
+			release(handle);
+		}
+
+		void release(uint32_t handle) {
+			Entry& entry = mEntries[handle];
+			mUids.erase(entry.uid);
+			entry.uid.clear();
+			entry.present = false;
+			mFree.push_back(handle);
+		}
+
+		/// remove every contact not in the last list or snapshot
+		void sweep(ros_cot_msgs::CompactContactDelta* out) {
+			for (size_t handle = 0; handle < mEntries.size(); ++handle) {
+				if (!mEntries[handle].present || mEntries[handle].mark == mMark)
+					continue;
+				if (out)
+					out->removed.push_back(static_cast<uint32_t>(handle));
+				release(static_cast<uint32_t>(handle));
+			}
+		}
+
+		std::vector<Entry> mEntries;	///< by handle
+		std::unordered_map<std::string, uint32_t> mUids;	///< uid -> handle, for every handle in use
+		std::vector<uint32_t> mFree;	///< handles to reuse
+		std::unordered_map<std::string, uint32_t> mTypeCodes, mHowCodes;
+		std::vector<std::string> mTypeNames, mHowNames;	///< by code
+		ros_cot_msgs::CompactIndex mScratch;
+		uint64_t mSequence, mMark, mOverflowCount;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(CompactContactEncoder);
+	};
+
+	/** Turns CompactContactDeltas and CompactContactSnapshots back into ContactDeltas and ContactSnapshots, keeping the
+	*	tables and the contacts they describe.
+	*
+	*	The decoder starts from no contacts as of sequence 0, as a bridge does. A snapshot always replaces what it has (so
+	*	a restarted bridge is followed from its first snapshot), a delta it has already seen the effect of is ignored, and
+	*	after a missed delta it decodes no more until the next snapshot, as the messages' sequence rules ask. Not
+	*	thread-safe.
+	*
+	*	CompactContactDecoder
+	*/
+	class CompactContactDecoder {
+	public:
+		CompactContactDecoder() : mSequence(0), mSynchronized(true), mGapCount(0) {}
+
+		/** @returns false, leaving out unfilled, if the delta was not applied: it is not newer than what the decoder has,
+		*	or one before it was missed (now or since the last snapshot)
+		*/
+		bool decode(const ros_cot_msgs::CompactContactDelta& in, ros_cot_msgs::ContactDelta& out) {
+			if (!mSynchronized || in.sequence <= mSequence)
+				return false;
+			if (in.sequence != mSequence + 1) {
+				lose();
+				return false;
+			}
+			out.header = in.header;
+			out.sequence = mSequence = in.sequence;
+			out.removed.clear();
+			for (const uint32_t handle : in.removed) {
+				const auto i = mEntries.find(handle);
+				if (i == mEntries.end())
+					continue;
+				out.removed.push_back(i->second.uid);
+				mEntries.erase(i);
+			}
+			bind(in.index);
+			if (!apply(in.added, out.added) || !apply(in.updated, out.updated)) {
+				lose();
+				return false;
+			}
+			return true;
+		}
+
+		/// replace the tables and contacts with a snapshot's
+		void decode(const ros_cot_msgs::CompactContactSnapshot& in, ros_cot_msgs::ContactSnapshot& out) {
+			mEntries.clear();
+			mTypes.assign(1, std::string());
+			mHows.assign(1, std::string());
+			bind(in.index);
+			out.header = in.header;
+			out.sequence = mSequence = in.sequence;
+			mSynchronized = apply(in.contacts, out.contacts);
+			if (!mSynchronized)
+				mEntries.clear();
+		}
+
+		/// every contact, as of the last delta or snapshot applied
+		void getContacts(ros_cot_msgs::StampedContactList& out) const {
+			out.contactList.clear();
+			out.contactList.reserve(mEntries.size());
+			for (const auto& i : mEntries)
+				if (i.second.present) {
+					out.contactList.emplace_back();
+					expand(i.second, out.contactList.back());
+				}
+		}
+
+		uint64_t getSequence() const { return mSequence; }
+		/// false from a missed delta to the next snapshot
+		bool isSynchronized() const { return mSynchronized; }
+		/// deltas missed, or referring to handles never bound
+		uint64_t getGapCount() const { return mGapCount; }
+
+	protected:
+		struct Entry {
+			std::string uid;
+			ros_cot_msgs::CompactContact contact;
+			bool present = false;
+		};
+
+		void lose() {
+			mSynchronized = false;
+			++mGapCount;
+		}
+
+		void bind(const ros_cot_msgs::CompactIndex& index) {
+			for (size_t i = 0; i < index.handles.size() && i < index.uids.size(); ++i) {
+				Entry& entry = mEntries[index.handles[i]];
+				entry.uid = index.uids[i];
+				entry.present = false;
+			}
+			for (size_t i = 0; i < index.typeCodes.size() && i < index.types.size(); ++i) {
+				if (index.typeCodes[i] >= mTypes.size())
+					mTypes.resize(index.typeCodes[i] + 1);
+				mTypes[index.typeCodes[i]] = index.types[i];
+			}
+			for (size_t i = 0; i < index.howCodes.size() && i < index.hows.size(); ++i) {
+				if (index.howCodes[i] >= mHows.size())
+					mHows.resize(index.howCodes[i] + 1);
+				mHows[index.howCodes[i]] = index.hows[i];
+			}
+		}
+
+		/// @returns false if a contact's handle was never bound
+		bool apply(const std::vector<ros_cot_msgs::CompactContact>& in, std::vector<ros_cot_msgs::AtakContact>& out) {
+			out.resize(in.size());
+			for (size_t i = 0; i < in.size(); ++i) {
+				const auto e = mEntries.find(in[i].handle);
+				if (e == mEntries.end())
+					return false;
+				e->second.contact = in[i];
+				e->second.present = true;
+				expand(e->second, out[i]);
+			}
+			return true;
+		}
+
+		void expand(const Entry& entry, ros_cot_msgs::AtakContact& out) const {
+			const auto& c = entry.contact;
+			out.uid = entry.uid;
+			out.type = c.type < mTypes.size() ? mTypes[c.type] : std::string();
+			out.how = c.how < mHows.size() ? mHows[c.how] : std::string();
+			out.latitude = CompactPosition::decode(c.latitude);
+			out.longitude = CompactPosition::decode(c.longitude);
+			out.altitude = c.altitude;
+			out.ce = c.ce;
+			out.le = c.le;
+		}
+
+		std::unordered_map<uint32_t, Entry> mEntries;	///< by handle; bound handles, with or without a contact yet
+		std::vector<std::string> mTypes = std::vector<std::string>(1), mHows = std::vector<std::string>(1);	///< by code
+		uint64_t mSequence;
+		bool mSynchronized;
+		uint64_t mGapCount;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(CompactContactDecoder);
+	};
+}
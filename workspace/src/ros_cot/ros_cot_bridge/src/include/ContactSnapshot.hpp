@@ -0,0 +1,151 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Messaging/macro.h"
+#include "TrackStore.hpp"
+
+namespace AIDTR {
+
+	/** The set of contacts as last published, kept up to date from a TrackStore as a sequence of deltas.
+	*
+	*	apply() (register it as a TrackStore callback) records each write in a back buffer holding at most one change per
+	*	handle, the latest. takeDelta() swaps that buffer with the front one under a brief lock, so writers never wait on
+	*	publication, then folds the front buffer into the published set and reports which uids were added, updated or
+	*	removed. Its cost is proportional to the number of contacts that changed, not to the number known. A write that
+	*	changes nothing a subscriber sees (type, how, position, errors) is not an update. A uid whose entity was
+	*	reclaimed and then reported again under a new handle within one delta is both removed and added, so a delta
+	*	must be applied removed first.
+	*
+	*	Each non-empty delta gets the next sequence number. getContacts() is the full set as of getSequence(); a
+	*	subscriber that starts from such a snapshot and then sees a delta whose sequence is not one more than the last it
+	*	applied has missed one and should wait for the next snapshot.
+	*
+	*	takeDelta() and the readers must be called from one thread (or serialized by the caller); apply() may be called
+	*	from any thread.
+	*/
+	class ContactSnapshot {
+	public:
+		using Handle = TrackStore::Handle;
+
+		struct Delta {
+			uint64_t sequence = 0;
+			std::vector<const TrackRecord*> added;	///< valid until the next takeDelta()
+			std::vector<const TrackRecord*> updated;	///< valid until the next takeDelta()
+			std::vector<std::string> removed;	///< uids; apply before added, which may hold the same uid again
+
+			bool empty() const { return added.empty() && updated.empty() && removed.empty(); }
+		};
+
+		/// @param capacity handles must be below this, e.g. TrackStore::capacity()
+		explicit ContactSnapshot(size_t capacity)
+			: mIndex(capacity, None), mBackSlot(capacity, None), mSequence(0) {}
+
+		/// record one TrackStore write; pass to TrackStore::RegisterCallback
+		void apply(const TrackChange& change) {
+			if (change.handle >= mIndex.size()) return;
+			std::lock_guard<std::mutex> lock(mBackMutex);
+			uint32_t& slot = mBackSlot[change.handle];
+			if (slot == None) {
+				slot = static_cast<uint32_t>(mBack.size());
+				mBack.push_back(Change{ change.handle, false, TrackRecord() });
+			}
+			Change& c = mBack[slot];
+			c.present = change.record != nullptr;
+			if (c.present) c.record = *change.record;
+		}
+
+		/** fold every change recorded since the last call into the published set
+		*
+		*	@returns false, leaving the sequence number alone, if nothing a subscriber sees changed
+		*/
+		bool takeDelta(Delta& delta) {
+			{
+				std::lock_guard<std::mutex> lock(mBackMutex);
+				mFront.swap(mBack);
+				for (const Change& c : mFront) mBackSlot[c.handle] = None;
+			}
+			delta.added.clear();
+			delta.updated.clear();
+			delta.removed.clear();
+			mAdded.clear();
+			mUpdated.clear();
+			for (const Change& c : mFront) {
+				const uint32_t i = mIndex[c.handle];
+				if (i != None && (!c.present || mContacts[i].generation != c.record.generation)) {
+					delta.removed.push_back(std::string(mContacts[i].getUid()));
+					erase(i);
+				}
+				if (!c.present) continue;
+				if (mIndex[c.handle] == None) {
+					mIndex[c.handle] = static_cast<uint32_t>(mContacts.size());
+					mHandles.push_back(c.handle);
+					mContacts.push_back(c.record);
+					mAdded.push_back(c.handle);
+				}
+				else if (visiblyDifferent(mContacts[mIndex[c.handle]], c.record)) {
+					mContacts[mIndex[c.handle]] = c.record;
+					mUpdated.push_back(c.handle);
+				}
+			}
+			mFront.clear();
+			// resolve pointers only now: erase() moves records
+			for (Handle h : mAdded) delta.added.push_back(&mContacts[mIndex[h]]);
+			for (Handle h : mUpdated) delta.updated.push_back(&mContacts[mIndex[h]]);
+			if (delta.empty()) return false;
+			delta.sequence = ++mSequence;
+			return true;
+		}
+
+		/// every published contact, as of getSequence(); valid until the next takeDelta()
+		const std::vector<TrackRecord>& getContacts() const { return mContacts; }
+		/// the sequence number of the last delta taken; 0 before the first
+		uint64_t getSequence() const { return mSequence; }
+		size_t size() const { return mContacts.size(); }
+
+	protected:
+		enum : uint32_t { None = 0xffffffffu };
+
+		struct Change {
+			Handle handle;
+			bool present;	///< false if the entity was removed
+			TrackRecord record;
+		};
+
+		static bool visiblyDifferent(const TrackRecord& a, const TrackRecord& b) {
+			return a.lat != b.lat || a.lon != b.lon || a.hae != b.hae || a.ce != b.ce || a.le != b.le
+				|| std::strcmp(a.type, b.type) != 0 || std::strcmp(a.how, b.how) != 0;
+		}
+
+		/// drop published contact i, moving the last one into its place
+		void erase(uint32_t i) {
+			mIndex[mHandles[i]] = None;
+			if (i + 1 != mContacts.size()) {
+				mContacts[i] = mContacts.back();
+				mHandles[i] = mHandles.back();
+				mIndex[mHandles[i]] = i;
+			}
+			mContacts.pop_back();
+			mHandles.pop_back();
+		}
+
+		// published set, dense
+		std::vector<TrackRecord> mContacts;
+		std::vector<Handle> mHandles;
+		std::vector<uint32_t> mIndex;	///< [handle] -> index in mContacts, or None
+
+		// changes since the last delta, at most one per handle
+		std::mutex mBackMutex;
+		std::vector<Change> mBack;	///< filled by apply()
+		std::vector<uint32_t> mBackSlot;	///< [handle] -> index in mBack, or None
+		std::vector<Change> mFront;	///< being folded in by takeDelta()
+
+		std::vector<Handle> mAdded, mUpdated;
+		uint64_t mSequence;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(ContactSnapshot);
+	};
+}
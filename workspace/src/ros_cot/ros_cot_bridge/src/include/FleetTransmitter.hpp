@@ -0,0 +1,189 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Ingest/CaptureLog.hpp"
+#include "Messaging/CoTEventWriter.hpp"
+#include "TransmitTrace.hpp"
+#include "Utility/LatencyHistogram.hpp"
+#include "Messaging/macro.h"
+
+namespace AIDTR {
+	/** Sends position reports for many identities of ours (a fleet of vehicles) through one socket and one encoder.
+	*
+	*	Where a CoTClient per identity brings its own socket, DOM document and serializer, the fleet keeps per identity
+	*	only what a report needs: offsets of its escaped uid and type in one shared string pool, the time of its last
+	*	report and its counters, in a vector indexed by the identity number addIdentity returned. A report is encoded by
+	*	a Messaging::CoTEventWriter into its reused buffer and sent at once, so reporting allocates nothing.
+	*
+	*	Identities that report more often than minInterval have the extra reports dropped (the next one after the
+	*	interval goes out), to bound what a runaway fix topic costs the group.
+	*
+	*	report() must be called from one thread at a time; the counters may be read from any thread.
+	*
+	*	FleetTransmitter
+	*/
+	class FleetTransmitter {
+	public:
+		/**
+		*	@param io_service Boost asio's ioservice instance for the socket
+		*	@param multicast_address, multicast_port where reports are sent
+		*	@param minIntervalNanos shortest time between two reports of one identity; 0 sends every report
+		*	@param staleMicros how long after it is sent a report goes stale
+		*	@param simulation whether reports are marked as from a simulation (opex "s")
+		*/
+		FleetTransmitter(boost::asio::io_service& io_service,
+			const boost::asio::ip::address& multicast_address, const unsigned short multicast_port,
+			int64_t minIntervalNanos = 0, int64_t staleMicros = 60000000, bool simulation = true)
+			: endpoint(multicast_address, multicast_port), socket(io_service, endpoint.protocol()),
+			minIntervalNanos(minIntervalNanos), staleMicros(staleMicros), simulation(simulation),
+			captureLog(nullptr), captureLogProducer(0), trace(nullptr), reportCount(0), sendCount(0), skippedCount(0), errorCount(0) {}
+
+		/** add an identity
+		*
+		*	@param uid, type as they are to appear on the wire, unescaped
+		*	@returns the identity's number, for report()
+		*/
+		size_t addIdentity(boost::string_view uid, boost::string_view type) {
+			Identity identity;
+			identity.uid = pool(Messaging::CoTEvent::escape(uid), identity.uidSize);
+			identity.type = pool(Messaging::CoTEvent::escape(type), identity.typeSize);
+			identities.push_back(identity);
+			return identities.size() - 1;
+		}
+
+		size_t size() const { return identities.size(); }
+		/// an identity's uid and type, XML-escaped as sent
+		boost::string_view getUid(size_t identity) const {
+			return boost::string_view(strings.data() + identities[identity].uid, identities[identity].uidSize);
+		}
+		boost::string_view getType(size_t identity) const {
+			return boost::string_view(strings.data() + identities[identity].type, identities[identity].typeSize);
+		}
+
+		/** send an identity's position, unless it last reported less than minIntervalNanos ago
+		*
+		*	@param nowNanos the time of the report, nanoseconds since the Unix epoch
+		*	@param origin when the input this report is made from was stamped and handled, to trace it to the wire by
+		*	@returns true if the report was sent
+		*/
+		bool report(size_t identity, double lat, double lon, double hae, double ce, double le, int64_t nowNanos,
+			double course = std::numeric_limits<double>::quiet_NaN(), double speed = std::numeric_limits<double>::quiet_NaN(),
+			const TransmitTrace::Origin* origin = nullptr) {
+			const auto start = std::chrono::steady_clock::now();
+			reportCount.fetch_add(1, std::memory_order_relaxed);
+			Identity& state = identities.at(identity);
+			if (minIntervalNanos > 0 && state.reports > 0 && nowNanos - state.lastReportNanos < minIntervalNanos) {
+				skippedCount.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			Messaging::CoTEventWriter::Report r;
+			r.uid = getUid(identity);
+			r.type = getType(identity);
+			r.simulation = simulation;
+			r.timeMicros = nowNanos / 1000;
+			r.staleMicros = r.timeMicros + staleMicros;
+			r.lat = lat;
+			r.lon = lon;
+			r.hae = hae;
+			r.ce = ce;
+			r.le = le;
+			r.course = course;
+			r.speed = speed;
+			const bool traced = trace && origin;
+			if (traced && trace->tagsEvents()) {
+				tag = TransmitTrace::tag(trace->nextSequence(), origin->stampNanos);
+				r.detail = tag;
+			}
+			const auto text = writer.write(r);
+			const int64_t encodedNanos = traced ? TransmitTrace::wallNanos() : 0;
+			if (captureLog)
+				captureLog->append(captureLogProducer, Ingest::CaptureLog::Sent, nowNanos, captureLogAddress, endpoint.port(),
+					0, text.data(), text.size());
+			boost::system::error_code error;
+			socket.send_to(boost::asio::buffer(text.data(), text.size()), endpoint, 0, error);
+			if (traced && !error)
+				trace->record(*origin, encodedNanos, encodedNanos, TransmitTrace::wallNanos());
+			state.lastReportNanos = nowNanos;
+			++state.reports;
+			if (error)
+				errorCount.fetch_add(1, std::memory_order_relaxed);
+			else
+				sendCount.fetch_add(1, std::memory_order_relaxed);
+			sendLatency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			return !error;
+		}
+
+		/// log every report sent, under the log's producer index producer; call before reporting
+		void setCaptureLog(Ingest::CaptureLog* log, size_t producer) {
+			captureLog = log;
+			captureLogProducer = producer;
+			const auto address = endpoint.address();
+			if (address.is_v4()) {
+				const auto bytes = address.to_v4().to_bytes();
+				captureLogAddress.assign(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			}
+			else {
+				const auto bytes = address.to_v6().to_bytes();
+				captureLogAddress.assign(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			}
+		}
+
+		/// trace reports sent with an origin into trace, tagging them if it asks; call before reporting
+		void setTrace(TransmitTrace* trace) {
+			this->trace = trace;
+		}
+
+		/// reports asked for, sent, dropped as too soon after the identity's last, and failed to send
+		uint64_t getReportCount() const { return reportCount.load(std::memory_order_relaxed); }
+		uint64_t getSendCount() const { return sendCount.load(std::memory_order_relaxed); }
+		uint64_t getSkippedCount() const { return skippedCount.load(std::memory_order_relaxed); }
+		uint64_t getErrorCount() const { return errorCount.load(std::memory_order_relaxed); }
+		/// time to encode and send a report
+		const Utility::LatencyHistogram& getSendLatency() const { return sendLatency; }
+
+	protected:
+		/// per-identity state: 32 bytes
+		struct Identity {
+			uint32_t uid, uidSize;	///< offset and length of the escaped uid in strings
+			uint32_t type, typeSize;
+			int64_t lastReportNanos = 0;
+			uint64_t reports = 0;	///< sent or failed
+		};
+
+		uint32_t pool(const std::string& s, uint32_t& size) {
+			if (strings.size() + s.size() > std::numeric_limits<uint32_t>::max())
+				throw std::runtime_error("FleetTransmitter: too many identities");
+			const auto offset = static_cast<uint32_t>(strings.size());
+			strings += s;
+			size = static_cast<uint32_t>(s.size());
+			return offset;
+		}
+
+		boost::asio::ip::udp::endpoint endpoint;
+		boost::asio::ip::udp::socket socket;
+		const int64_t minIntervalNanos, staleMicros;
+		const bool simulation;
+
+		std::vector<Identity> identities;
+		std::string strings;	///< escaped uids and types of every identity
+		Messaging::CoTEventWriter writer;
+		std::string tag;	///< the traced report's <__trace>
+
+		Ingest::CaptureLog* captureLog;
+		size_t captureLogProducer;
+		std::string captureLogAddress;
+		TransmitTrace* trace;
+
+		std::atomic<uint64_t> reportCount, sendCount, skippedCount, errorCount;
+		Utility::LatencyHistogram sendLatency;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(FleetTransmitter);
+	};
+}
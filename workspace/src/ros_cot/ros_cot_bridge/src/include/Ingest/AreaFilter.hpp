@@ -0,0 +1,212 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Math/GeodeticKernels.hpp"
+#include "Messaging/macro.h"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** A precompiled area of interest for received contacts.
+		*
+		*	This is the flat, evaluation-only form of an ARL::Math::SpatialConstraints (see AreaFilterCompiler). A contact
+		*	passes when it is within every inclusion area and within no exclusion area, where an area contains a point if
+		*	any of its segments (polygons with a time interval) does. Warning areas never reject; warningAt() reports the
+		*	first one a contact is in.
+		*
+		*	Evaluation cost is kept well under a microsecond per contact:
+		*	- every segment carries a lat/lon bounding box and is tried only during its time interval, so most contacts are
+		*	  decided on a few comparisons;
+		*	- segment vertices are pre-projected into the segment's local East-North plane (the frame GeoPolygon::within
+		*	  builds on every call), so a contact that gets past the boxes costs one geodetic-to-ECEF conversion, shared by
+		*	  all segments, plus a rotation and a crossing-number test per candidate segment.
+		*
+		*	Building (add*Area) is not thread-safe; check(), within() and warningAt() may run concurrently once built.
+		*/
+		class AreaFilter {
+		public:
+			/// [begin, end) in microseconds since the Unix epoch
+			struct TimeInterval {
+				int64_t begin = std::numeric_limits<int64_t>::min();
+				int64_t end = std::numeric_limits<int64_t>::max();
+
+				bool contains(int64_t t) const { return t >= begin && t < end; }
+
+				static TimeInterval always() { return TimeInterval(); }
+				static TimeInterval never() {
+					TimeInterval t;
+					std::swap(t.begin, t.end);
+					return t;
+				}
+			};
+
+			/// a polygon in lat/lon degrees, with the time interval during which it applies
+			struct Segment {
+				TimeInterval time;
+				double minLat, maxLat, minLon, maxLon;
+				bool wrapsLon = false;	///< the polygon crosses the antimeridian; longitudes are stored in [0, 360)
+				ARL::Math::GeodeticKernels::LocalFrame frame;
+				std::vector<double> east, north;	///< vertices in frame
+
+				/// @param points vertices as (latitude, longitude) in degrees; the first vertex is the frame origin
+				Segment(const std::vector<std::pair<double, double>>& points, const TimeInterval& time = TimeInterval::always())
+					: time(time), frame(points.empty() ? 0 : points.front().first, points.empty() ? 0 : points.front().second) {
+					minLat = minLon = std::numeric_limits<double>::infinity();
+					maxLat = maxLon = -std::numeric_limits<double>::infinity();
+					double lonMin = minLon, lonMax = maxLon;
+					for (const auto& p : points) {
+						lonMin = std::min(lonMin, p.second);
+						lonMax = std::max(lonMax, p.second);
+					}
+					wrapsLon = lonMax - lonMin > 180;
+					for (const auto& p : points) {
+						const double lon = wrapLon(p.second);
+						minLat = std::min(minLat, p.first); maxLat = std::max(maxLat, p.first);
+						minLon = std::min(minLon, lon); maxLon = std::max(maxLon, lon);
+						double e, n;
+						frame.toEN(ARL::Math::GeodeticKernels::toECEF(p.first, p.second), e, n);
+						east.push_back(e);
+						north.push_back(n);
+					}
+				}
+
+				double wrapLon(double lon) const { return wrapsLon && lon < 0 ? lon + 360 : lon; }
+
+				bool inBox(double lat, double lon) const {
+					lon = wrapLon(lon);
+					return lat >= minLat && lat <= maxLat && lon >= minLon && lon <= maxLon;
+				}
+
+				/// crossing-number test in the local plane
+				bool contains(const ARL::Math::GeodeticKernels::ECEF& p) const {
+					if (east.size() < 3) return false;
+					double x, y;
+					frame.toEN(p, x, y);
+					bool inside = false;
+					for (size_t i = 0, j = east.size() - 1; i < east.size(); j = i++) {
+						if ((north[i] > y) != (north[j] > y)
+							&& x < (east[j] - east[i]) * (y - north[i]) / (north[j] - north[i]) + east[i])
+							inside = !inside;
+					}
+					return inside;
+				}
+			};
+
+			/// a union of segments. A timeOnly area contains every point during its time interval (as TacticalArea::within).
+			struct Area {
+				std::string name;
+				bool timeOnly = false;
+				TimeInterval time;
+				std::vector<Segment> segments;
+			};
+
+			enum Verdict { Pass = 0, OutsideInclusion, InsideExclusion, NumVerdicts };
+
+			AreaFilter() : mWarningHits(0) {
+				for (auto& c : mCounts) c.store(0, std::memory_order_relaxed);
+			}
+
+			void addInclusionArea(const Area& area) { mInclusion.push_back(area); }
+			void addExclusionArea(const Area& area) { mExclusion.push_back(area); }
+			void addWarningArea(const Area& area) { mWarning.push_back(area); }
+
+			/// true if no inclusion or exclusion areas are defined, i.e. every contact passes
+			bool empty() const { return mInclusion.empty() && mExclusion.empty(); }
+
+			size_t getNumAreas() const { return mInclusion.size() + mExclusion.size() + mWarning.size(); }
+
+			/** classify a contact and count the result
+			*
+			*	@param lat, lon position in degrees
+			*	@param timeMicros report time, microseconds since the Unix epoch
+			*/
+			Verdict check(double lat, double lon, int64_t timeMicros) {
+				const Verdict v = classify(lat, lon, timeMicros);
+				mCounts[v].fetch_add(1, std::memory_order_relaxed);
+				if (!mWarning.empty() && warningAt(lat, lon, timeMicros) >= 0)
+					mWarningHits.fetch_add(1, std::memory_order_relaxed);
+				return v;
+			}
+
+			/// equivalent to SpatialConstraints::within; does not count
+			bool within(double lat, double lon, int64_t timeMicros) const { return classify(lat, lon, timeMicros) == Pass; }
+
+			/// @returns the index of the first warning area containing the contact, or -1
+			int warningAt(double lat, double lon, int64_t timeMicros) const {
+				Query q(lat, lon);
+				for (size_t i = 0; i < mWarning.size(); ++i)
+					if (contains(mWarning[i], q, timeMicros)) return static_cast<int>(i);
+				return -1;
+			}
+
+			const Area& getWarningArea(size_t i) const { return mWarning[i]; }
+
+			uint64_t getCount(Verdict v) const { return mCounts[v].load(std::memory_order_relaxed); }
+			uint64_t getWarningCount() const { return mWarningHits.load(std::memory_order_relaxed); }
+
+			/// fraction of checked contacts that passed, 0 if none were checked
+			double getPassRate() const {
+				uint64_t total = 0;
+				for (const auto& c : mCounts) total += c.load(std::memory_order_relaxed);
+				return total ? static_cast<double>(getCount(Pass)) / total : 0.0;
+			}
+
+			static const char* toString(Verdict v) {
+				switch (v) {
+				case Pass: return "pass";
+				case OutsideInclusion: return "outside_inclusion";
+				case InsideExclusion: return "inside_exclusion";
+				default: return "unknown";
+				}
+			}
+
+		protected:
+			/// the contact's position, with its ECEF form computed at most once
+			struct Query {
+				double lat, lon;
+				bool haveECEF = false;
+				ARL::Math::GeodeticKernels::ECEF ecef;
+
+				Query(double lat, double lon) : lat(lat), lon(lon) {}
+
+				const ARL::Math::GeodeticKernels::ECEF& getECEF() {
+					if (!haveECEF) {
+						ecef = ARL::Math::GeodeticKernels::toECEF(lat, lon);
+						haveECEF = true;
+					}
+					return ecef;
+				}
+			};
+
+			static bool contains(const Area& area, Query& q, int64_t t) {
+				if (area.timeOnly) return area.time.contains(t);
+				for (const auto& s : area.segments)
+					if (s.time.contains(t) && s.inBox(q.lat, q.lon) && s.contains(q.getECEF())) return true;
+				return false;
+			}
+
+			Verdict classify(double lat, double lon, int64_t t) const {
+				if (!(lat == lat && lon == lon)) return mInclusion.empty() ? Pass : OutsideInclusion;
+				Query q(lat, lon);
+				for (const auto& a : mInclusion)
+					if (!contains(a, q, t)) return OutsideInclusion;
+				for (const auto& a : mExclusion)
+					if (contains(a, q, t)) return InsideExclusion;
+				return Pass;
+			}
+
+			std::vector<Area> mInclusion, mExclusion, mWarning;
+
+			std::atomic<uint64_t> mCounts[NumVerdicts];
+			std::atomic<uint64_t> mWarningHits;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(AreaFilter);
+		};
+	}
+}
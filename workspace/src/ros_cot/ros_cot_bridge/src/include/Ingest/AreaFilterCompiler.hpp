@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "Ingest/AreaFilter.hpp"
+#include "Math/SpatialConstraints.hpp"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** Compiles an ARL::Math::SpatialConstraints into an AreaFilter.
+		*
+		*	The compiled filter answers exactly what SpatialConstraints::within answers, including its treatment of time:
+		*	- a TacticalArea with a non-special starting or ending time is decided by that time period alone;
+		*	- otherwise each TacticalSegment contains a point only during its own time period, so a segment whose
+		*	  starting time is not_a_date_time never matches (use neg_infin/pos_infin for an always-on segment).
+		*
+		*	Requires the ARL Math library (CGAL, Eigen); only built when WITH_ARL_MATH is defined.
+		*/
+		class AreaFilterCompiler {
+		public:
+			/// add the inclusion, exclusion and warning areas of constraints to filter
+			static void Compile(const ARL::Math::SpatialConstraints& constraints, AreaFilter& filter) {
+				for (const auto& a : constraints.getInclusionAreas())
+					filter.addInclusionArea(CompileArea(a));
+				for (const auto& a : constraints.getExclusionAreas())
+					filter.addExclusionArea(CompileArea(a));
+				for (const auto& w : constraints.getWarningAreas()) {
+					for (const auto& a : w.getWarningAreas()) {
+						AreaFilter::Area area = CompileArea(a);
+						area.name = ARL::Math::WarningArea::toString(w.getPrimaryWarning());
+						filter.addWarningArea(area);
+					}
+				}
+			}
+
+			static AreaFilter::Area CompileArea(const ARL::Math::TacticalArea& tacticalArea) {
+				AreaFilter::Area area;
+				area.name = tacticalArea.getIdentifierAsString();
+				const auto& tc = tacticalArea.getTimeConstraints();
+				if (!tc.getStartingTime().is_special() || !tc.getEndingTime().is_special()) {
+					area.timeOnly = true;
+					area.time = CompileTimePeriod(tc.getStartingTime(), tc.getEndingTime());
+					return area;
+				}
+				for (const auto& segment : tacticalArea.getSegments()) {
+					std::vector<std::pair<double, double>> points;
+					for (const auto& p : segment.getPoints())
+						points.emplace_back(p.latitude.getValue(ARL::Math::Degrees), p.longitude.getValue(ARL::Math::Degrees));
+					const auto& sc = segment.getTimeConstraints();
+					area.segments.emplace_back(points, CompileTimePeriod(sc.getStartingTime(), sc.getEndingTime()));
+				}
+				return area;
+			}
+
+			/// the interval boost::posix_time::time_period(start, end).contains() tests
+			static AreaFilter::TimeInterval CompileTimePeriod(const boost::posix_time::ptime& start, const boost::posix_time::ptime& end) {
+				AreaFilter::TimeInterval interval;
+				if (start.is_not_a_date_time() || start.is_pos_infinity() || end.is_neg_infinity())
+					return AreaFilter::TimeInterval::never();
+				if (!start.is_neg_infinity()) interval.begin = toMicros(start);
+				if (!end.is_special()) interval.end = toMicros(end); // not_a_date_time and pos_infin leave it open
+				return interval;
+			}
+
+		protected:
+			static int64_t toMicros(const boost::posix_time::ptime& t) {
+				static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+				return (t - epoch).total_microseconds();
+			}
+		};
+	}
+}
@@ -0,0 +1,377 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/utility/string_view.hpp>
+#include "Messaging/TakProtocolParser.hpp"
+#include "Messaging/macro.h"
+#include "Utility/FastHash.hpp"
+#include "Utility/SpscRing.hpp"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** An append-only log of every CoT datagram sent and received, in fixed-size segments with a sparse time index.
+		*
+		*	Producers (receive threads, the transmit path) call append(), which only copies the datagram into that
+		*	producer's single-producer single-consumer ring; a full ring drops the record (counted) rather than wait. One
+		*	writer thread merges the rings oldest-first, lays the records out in a buffer and writes it with one write()
+		*	call per batch, so the hot path never touches a file.
+		*
+		*	On disk, a directory holds segments cot-NNNNNNNN.log, each up to segmentBytes, numbered on from whatever the
+		*	directory already holds; with maxSegments set, the oldest are deleted as new ones are opened. A segment is a
+		*	SegmentHeader followed by records, each a RecordHeader then its payload, padded to 8 bytes, in host byte
+		*	order so that CaptureLogReader can map the file and hand out views of it without copying. Beside each segment,
+		*	cot-NNNNNNNN.idx lists IndexEntry blocks: the span of the segment holding about indexIntervalNanos of records,
+		*	with the earliest and latest timestamp in it, so a reader can skip to a time range. Records of different
+		*	producers can be slightly out of timestamp order, which the per-block minimum and maximum account for. The
+		*	block being written when the process stops is not indexed; readers scan it.
+		*/
+		class CaptureLog {
+		public:
+			enum Direction { Received = 0, Sent, NumDirections };
+
+			enum { Version = 1 };
+
+			static const char* toString(Direction direction) { return direction == Sent ? "sent" : "received"; }
+
+			struct SegmentHeader {
+				char magic[8];	///< "CoTLOG\0\0"
+				uint32_t version;
+				uint32_t headerSize;	///< sizeof(SegmentHeader)
+				uint64_t segment;	///< the segment's number
+				uint64_t reserved;
+			};
+
+			struct RecordHeader {
+				int64_t timestampNanos;	///< received or sent, nanoseconds since the Unix epoch
+				uint64_t uidHash;	///< Utility::FastHash of the event's uid as DecodePipeline keys it; 0 if it had none
+				uint32_t size;	///< payload bytes following the header
+				uint8_t direction;	///< Direction
+				uint8_t addressSize;	///< bytes of address in use: 0, 4 or 16
+				uint16_t port;	///< the remote port, 0 if unknown
+				char address[16];	///< the remote address in network order: sender when received, destination when sent
+			};
+
+			struct IndexEntry {
+				uint64_t offset;	///< of the block's first record in the segment
+				uint64_t size;	///< bytes of records in the block
+				int64_t minNanos, maxNanos;	///< earliest and latest record timestamps in the block
+			};
+
+			/**
+			*	@param directory where segments are written; created if missing
+			*	@param numProducers number of threads that will call append(), each with its own producer index
+			*	@param segmentBytes size at which a segment is closed and the next opened
+			*	@param indexIntervalNanos span of record timestamps covered by each index entry
+			*	@param maxSegments segments kept, oldest deleted first; 0 keeps all
+			*	@param ringCapacity records buffered per producer before append() drops
+			*	@throws std::runtime_error if the directory cannot be created or read
+			*/
+			CaptureLog(const std::string& directory, size_t numProducers = 1, size_t segmentBytes = 64 << 20,
+				int64_t indexIntervalNanos = 1000000000, size_t maxSegments = 0, size_t ringCapacity = 4096)
+				: mDirectory(directory), mSegmentBytes(std::max<size_t>(segmentBytes, 1 << 16)),
+				mIndexIntervalNanos(indexIntervalNanos > 0 ? indexIntervalNanos : 1), mMaxSegments(maxSegments),
+				mRunning(false), mSegmentFd(-1), mIndexFd(-1), mSegmentOffset(0), mBlockOpen(false),
+				mRecordCount(0), mWriteBytes(0), mDropCount(0), mSegmentCount(0), mWriteErrorCount(0) {
+				if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+					throw std::runtime_error("CaptureLog: cannot create " + directory + ": " + std::strerror(errno));
+				for (uint64_t segment : listSegments(directory))
+					mSegments.push_back(segment);
+				mNextSegment = mSegments.empty() ? 1 : mSegments.back() + 1;
+				for (size_t i = 0; i < (numProducers ? numProducers : 1); ++i)
+					mRings.emplace_back(new Utility::SpscRing<Pending>(ringCapacity));
+				mBuffer.reserve(2 * FlushBytes);
+			}
+
+			~CaptureLog() {
+				stop();
+			}
+
+			/// start the writer thread
+			void start() {
+				if (mRunning.exchange(true)) return;
+				mWriter = std::thread(&CaptureLog::writerLoop, this);
+			}
+
+			/// write out whatever is still queued, close the segment and join the writer
+			void stop() {
+				if (!mRunning.exchange(false)) return;
+				if (mWriter.joinable()) mWriter.join();
+			}
+
+			/** queue one datagram for the log; the data is copied before this returns
+			*
+			*	@param producer index in [0, numProducers) unique to the calling thread
+			*	@param address the remote address bytes in network order, or empty
+			*	@param uidHash as computed by DecodePipeline, or 0 to have the writer thread compute it
+			*	@returns false if the producer's ring was full, or the datagram longer than MaxPayloadSize, and the record
+			*	was dropped
+			*/
+			bool append(size_t producer, Direction direction, int64_t timestampNanos, boost::string_view address, uint16_t port,
+				uint64_t uidHash, const char* data, size_t size) {
+				auto& ring = *mRings[producer];
+				Pending* pending = size <= MaxPayloadSize ? ring.beginPush() : nullptr;
+				if (!pending) {
+					mDropCount.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				RecordHeader& header = pending->header;
+				header.timestampNanos = timestampNanos;
+				header.uidHash = uidHash;
+				header.size = static_cast<uint32_t>(size);
+				header.direction = static_cast<uint8_t>(direction);
+				header.addressSize = static_cast<uint8_t>(std::min<size_t>(address.size(), sizeof(header.address)));
+				header.port = port;
+				std::memset(header.address, 0, sizeof(header.address));
+				if (header.addressSize) std::memcpy(header.address, address.data(), header.addressSize);
+				if (pending->data.size() < size) pending->data.resize(size);
+				std::memcpy(pending->data.data(), data, size);
+				ring.commitPush();
+				return true;
+			}
+
+			const std::string& getDirectory() const { return mDirectory; }
+			size_t getNumProducers() const { return mRings.size(); }
+
+			/// records written to segments
+			uint64_t getRecordCount() const { return mRecordCount.load(std::memory_order_relaxed); }
+			/// bytes written to segments, headers and padding included
+			uint64_t getWriteBytes() const { return mWriteBytes.load(std::memory_order_relaxed); }
+			/// records dropped because a producer's ring was full or the datagram too long
+			uint64_t getDropCount() const { return mDropCount.load(std::memory_order_relaxed); }
+			/// segments opened by this log
+			uint64_t getSegmentCount() const { return mSegmentCount.load(std::memory_order_relaxed); }
+			/// failed writes; the batch is lost and the segment closed
+			uint64_t getWriteErrorCount() const { return mWriteErrorCount.load(std::memory_order_relaxed); }
+
+			/// records queued and not yet written
+			size_t getQueueDepth() const {
+				size_t n = 0;
+				for (const auto& r : mRings) n += r->size();
+				return n;
+			}
+
+			//---------------------------------------------------------------------------------------------------- layout
+
+			static size_t padded(size_t n) { return (n + 7) & ~size_t(7); }
+
+			static size_t recordSize(const RecordHeader& header) { return sizeof(RecordHeader) + padded(header.size); }
+
+			static std::string segmentPath(const std::string& directory, uint64_t segment, const char* extension = "log") {
+				char name[32];
+				std::snprintf(name, sizeof(name), "cot-%08llu.%s", static_cast<unsigned long long>(segment), extension);
+				return directory + "/" + name;
+			}
+
+			/// @returns the numbers of the segments in a directory, in order
+			static std::vector<uint64_t> listSegments(const std::string& directory) {
+				std::vector<uint64_t> segments;
+				DIR* dir = ::opendir(directory.c_str());
+				if (!dir) throw std::runtime_error("CaptureLog: cannot read " + directory + ": " + std::strerror(errno));
+				while (const dirent* entry = ::readdir(dir)) {
+					unsigned long long segment;
+					char extension[4] = {};
+					if (std::sscanf(entry->d_name, "cot-%8llu.%3s", &segment, extension) == 2 && std::strcmp(extension, "log") == 0)
+						segments.push_back(segment);
+				}
+				::closedir(dir);
+				std::sort(segments.begin(), segments.end());
+				return segments;
+			}
+
+			static void initSegmentHeader(SegmentHeader& header, uint64_t segment) {
+				std::memset(&header, 0, sizeof(header));
+				std::memcpy(header.magic, "CoTLOG", 6);
+				header.version = Version;
+				header.headerSize = sizeof(SegmentHeader);
+				header.segment = segment;
+			}
+
+			/// longest datagram append() accepts
+			enum : size_t { MaxPayloadSize = 1 << 20 };
+
+		protected:
+			enum : size_t { FlushBytes = 256 << 10 };
+
+			struct Pending {
+				RecordHeader header;
+				std::vector<char> data;
+			};
+
+			/// the ring whose oldest record has the earliest timestamp, or nullptr if all are empty
+			Utility::SpscRing<Pending>* oldestRing() {
+				Utility::SpscRing<Pending>* oldest = nullptr;
+				int64_t oldestNanos = 0;
+				for (auto& ring : mRings) {
+					const Pending* head = ring->front();
+					if (head && (!oldest || head->header.timestampNanos < oldestNanos)) {
+						oldest = ring.get();
+						oldestNanos = head->header.timestampNanos;
+					}
+				}
+				return oldest;
+			}
+
+			void writerLoop() {
+				for (;;) {
+					const bool running = mRunning.load(std::memory_order_acquire);
+					size_t batch = 0;
+					while (auto* ring = oldestRing()) {
+						add(*ring->front());
+						ring->pop();
+						++batch;
+						if (mBuffer.size() >= FlushBytes) flush();
+					}
+					flush();
+					if (!running) break; // drained after stop() was seen, so nothing appended before stop() is lost
+					if (!batch) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+				closeSegment();
+			}
+
+			/// lay one record out in the buffer, opening a segment or index block as needed
+			void add(Pending& pending) {
+				RecordHeader& header = pending.header;
+				if (!header.uidHash) {
+					boost::string_view uid, time;
+					if (Messaging::TakProtocolParser::ScanKey(pending.data.data(), header.size, uid, time)) {
+						const uint64_t hash = Utility::FastHash::hash(uid.data(), uid.size());
+						header.uidHash = hash ? hash : 1;
+					}
+				}
+				const size_t size = recordSize(header);
+				if (mSegmentFd >= 0 && mSegmentOffset + mBuffer.size() + size > mSegmentBytes) {
+					flush();
+					closeSegment();
+				}
+				if (mSegmentFd < 0 && !openSegment()) return;
+
+				const int64_t nanos = header.timestampNanos;
+				if (mBlockOpen && nanos - mBlock.minNanos >= mIndexIntervalNanos && nanos >= mBlock.maxNanos)
+					closeBlock();
+				if (!mBlockOpen) {
+					mBlock.offset = mSegmentOffset + mBuffer.size();
+					mBlock.size = 0;
+					mBlock.minNanos = mBlock.maxNanos = nanos;
+					mBlockOpen = true;
+				}
+				mBlock.minNanos = std::min(mBlock.minNanos, nanos);
+				mBlock.maxNanos = std::max(mBlock.maxNanos, nanos);
+				mBlock.size += size;
+
+				const size_t at = mBuffer.size();
+				mBuffer.resize(at + size);
+				std::memcpy(&mBuffer[at], &header, sizeof(header));
+				std::memcpy(&mBuffer[at + sizeof(header)], pending.data.data(), header.size);
+				std::memset(&mBuffer[at + sizeof(header) + header.size], 0, size - sizeof(header) - header.size);
+				mRecordCount.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			void closeBlock() {
+				if (!mBlockOpen) return;
+				mIndexBuffer.push_back(mBlock);
+				mBlockOpen = false;
+			}
+
+			/// write the buffered records, then the index entries of blocks they complete
+			void flush() {
+				if (mSegmentFd < 0 || (mBuffer.empty() && mIndexBuffer.empty())) return;
+				if (!writeAll(mSegmentFd, mBuffer.data(), mBuffer.size())
+					|| !writeAll(mIndexFd, reinterpret_cast<const char*>(mIndexBuffer.data()), mIndexBuffer.size() * sizeof(IndexEntry))) {
+					mWriteErrorCount.fetch_add(1, std::memory_order_relaxed);
+					mBuffer.clear();
+					mIndexBuffer.clear();
+					mBlockOpen = false;
+					closeSegment();
+					return;
+				}
+				mSegmentOffset += mBuffer.size();
+				mWriteBytes.fetch_add(mBuffer.size(), std::memory_order_relaxed);
+				mBuffer.clear();
+				mIndexBuffer.clear();
+			}
+
+			bool openSegment() {
+				const uint64_t segment = mNextSegment++;
+				mSegmentFd = ::open(segmentPath(mDirectory, segment).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				mIndexFd = ::open(segmentPath(mDirectory, segment, "idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				SegmentHeader header;
+				initSegmentHeader(header, segment);
+				if (mSegmentFd < 0 || mIndexFd < 0 || !writeAll(mSegmentFd, reinterpret_cast<const char*>(&header), sizeof(header))) {
+					mWriteErrorCount.fetch_add(1, std::memory_order_relaxed);
+					closeSegment();
+					return false;
+				}
+				mSegmentOffset = sizeof(header);
+				mSegments.push_back(segment);
+				mSegmentCount.fetch_add(1, std::memory_order_relaxed);
+				while (mMaxSegments && mSegments.size() > mMaxSegments) {
+					::unlink(segmentPath(mDirectory, mSegments.front()).c_str());
+					::unlink(segmentPath(mDirectory, mSegments.front(), "idx").c_str());
+					mSegments.pop_front();
+				}
+				return true;
+			}
+
+			void closeSegment() {
+				if (mSegmentFd >= 0) {
+					closeBlock();
+					flush();
+				}
+				if (mSegmentFd >= 0) ::close(mSegmentFd);
+				if (mIndexFd >= 0) ::close(mIndexFd);
+				mSegmentFd = mIndexFd = -1;
+				mBlockOpen = false;
+			}
+
+			static bool writeAll(int fd, const char* data, size_t size) {
+				while (size) {
+					const ssize_t n = ::write(fd, data, size);
+					if (n < 0 && errno == EINTR) continue;
+					if (n <= 0) return false;
+					data += n;
+					size -= static_cast<size_t>(n);
+				}
+				return true;
+			}
+
+			const std::string mDirectory;
+			const size_t mSegmentBytes;
+			const int64_t mIndexIntervalNanos;
+			const size_t mMaxSegments;
+			std::vector<std::unique_ptr<Utility::SpscRing<Pending>>> mRings;	///< one per producer, drained by the writer
+			std::atomic<bool> mRunning;
+			std::thread mWriter;
+
+			// writer thread only
+			int mSegmentFd, mIndexFd;
+			size_t mSegmentOffset;	///< bytes written to the open segment
+			std::vector<char> mBuffer;	///< records laid out for the next write
+			std::vector<IndexEntry> mIndexBuffer;	///< blocks closed since the last write
+			IndexEntry mBlock;
+			bool mBlockOpen;
+			std::deque<uint64_t> mSegments;	///< on disk, oldest first
+			uint64_t mNextSegment;
+
+			std::atomic<uint64_t> mRecordCount, mWriteBytes, mDropCount, mSegmentCount, mWriteErrorCount;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(CaptureLog);
+		};
+	}
+}
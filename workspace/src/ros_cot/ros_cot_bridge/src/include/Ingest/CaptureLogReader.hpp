@@ -0,0 +1,225 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/utility/string_view.hpp>
+#include "Ingest/CaptureLog.hpp"
+#include "Messaging/macro.h"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** Reads the records of a CaptureLog directory in a time range, for replay or inspection.
+		*
+		*	Each segment is mapped read-only in turn and its records handed out as views of the mapping, without copying;
+		*	a Datagram is valid until the next call to next(). The segment's index is used to skip blocks that lie wholly
+		*	outside the range; records past the last indexed block (a segment still being written, or one whose writer
+		*	stopped) are scanned. A segment being written is read up to its size when it was mapped. Records are returned in
+		*	log order, which is timestamp order to within what the writer's merge of its producers allowed.
+		*
+		*	Has the same next(Datagram&) shape as PcapReader, so CaptureReplay can pace it.
+		*/
+		class CaptureLogReader {
+		public:
+			struct Datagram {
+				int64_t timestampNanos;	///< received or sent, nanoseconds since the Unix epoch
+				CaptureLog::Direction direction;
+				uint64_t uidHash;	///< 0 if the datagram had no uid
+				boost::string_view source;	///< the remote address bytes in network order: sender when received, destination when sent
+				uint16_t port;	///< the remote port, 0 if unknown
+				boost::string_view payload;
+			};
+
+			/**
+			*	@param directory a CaptureLog directory
+			*	@param startNanos, endNanos only records with startNanos <= timestamp < endNanos are returned
+			*	@param directions bit (1 << CaptureLog::Direction) set for each direction returned
+			*	@throws std::runtime_error if the directory cannot be read
+			*/
+			explicit CaptureLogReader(const std::string& directory,
+				int64_t startNanos = std::numeric_limits<int64_t>::min(), int64_t endNanos = std::numeric_limits<int64_t>::max(),
+				unsigned directions = (1 << CaptureLog::NumDirections) - 1)
+				: mDirectory(directory), mSegments(CaptureLog::listSegments(directory)), mStartNanos(startNanos), mEndNanos(endNanos),
+				mDirections(directions), mNextSegment(0), mMap(nullptr), mMapSize(0), mBlock(0), mOffset(0), mBlockEnd(0),
+				mRecords(0), mDatagrams(0), mSkippedBlocks(0), mCorruptSegments(0) {}
+
+			~CaptureLogReader() {
+				unmap();
+			}
+
+			/** the next record in the range
+			*
+			*	@returns false once every segment has been read; segments that cannot be opened or are not CaptureLog segments
+			*	are skipped, and a segment ends at its first malformed record
+			*/
+			bool next(Datagram& datagram) {
+				for (;;) {
+					if (mOffset >= mBlockEnd && !nextBlock()) {
+						if (!openNextSegment()) return false;
+						continue;
+					}
+					if (mMapSize - mOffset < sizeof(CaptureLog::RecordHeader)) {
+						endSegment(true);
+						continue;
+					}
+					CaptureLog::RecordHeader header;
+					std::memcpy(&header, mMap + mOffset, sizeof(header));
+					const size_t size = CaptureLog::recordSize(header);
+					if (header.size > CaptureLog::MaxPayloadSize || size > mMapSize - mOffset || header.addressSize > sizeof(header.address)
+						|| header.direction >= CaptureLog::NumDirections) {
+						endSegment(true);
+						continue;
+					}
+					const char* record = mMap + mOffset;
+					mOffset += size;
+					++mRecords;
+					if (header.timestampNanos < mStartNanos || header.timestampNanos >= mEndNanos || !(mDirections & (1u << header.direction)))
+						continue;
+					datagram.timestampNanos = header.timestampNanos;
+					datagram.direction = CaptureLog::Direction(header.direction);
+					datagram.uidHash = header.uidHash;
+					datagram.source = boost::string_view(record + offsetof(CaptureLog::RecordHeader, address), header.addressSize);
+					datagram.port = header.port;
+					datagram.payload = boost::string_view(record + sizeof(header), header.size);
+					++mDatagrams;
+					return true;
+				}
+			}
+
+			/// segments in the directory when the reader was created
+			size_t getSegmentCount() const { return mSegments.size(); }
+			/// records read, in range or not
+			uint64_t getRecordCount() const { return mRecords; }
+			/// records returned
+			uint64_t getDatagramCount() const { return mDatagrams; }
+			/// index blocks skipped as wholly outside the range
+			uint64_t getSkippedBlockCount() const { return mSkippedBlocks; }
+			/// segments that could not be read, or ended in a malformed record
+			uint64_t getCorruptSegmentCount() const { return mCorruptSegments; }
+
+		protected:
+			/// map the next segment and load its index; false when there are none left
+			bool openNextSegment() {
+				unmap();
+				while (mNextSegment < mSegments.size()) {
+					const uint64_t segment = mSegments[mNextSegment++];
+					if (!map(CaptureLog::segmentPath(mDirectory, segment))) {
+						++mCorruptSegments;
+						continue;
+					}
+					loadIndex(CaptureLog::segmentPath(mDirectory, segment, "idx"));
+					mBlock = 0;
+					mOffset = mBlockEnd = sizeof(CaptureLog::SegmentHeader);
+					return true;
+				}
+				return false;
+			}
+
+			/** move to the next index block that overlaps the range, or to the unindexed tail
+			*
+			*	@returns false when the segment is exhausted
+			*/
+			bool nextBlock() {
+				if (!mMap) return false;
+				while (mBlock < mIndex.size()) {
+					const auto& entry = mIndex[mBlock++];
+					if (entry.offset < mBlockEnd || entry.offset > mMapSize || entry.size > mMapSize - entry.offset)
+						break; // not an index of this segment; scan the rest
+					if (entry.maxNanos < mStartNanos || entry.minNanos >= mEndNanos) {
+						++mSkippedBlocks;
+						mOffset = mBlockEnd = entry.offset + entry.size;
+						continue;
+					}
+					mOffset = entry.offset;
+					mBlockEnd = entry.offset + entry.size;
+					return true;
+				}
+				mIndex.clear();
+				if (mBlockEnd >= mMapSize) return false;
+				mOffset = mBlockEnd;
+				mBlockEnd = mMapSize;
+				return true;
+			}
+
+			void endSegment(bool corrupt) {
+				if (corrupt && mOffset < mMapSize) ++mCorruptSegments;
+				mIndex.clear();
+				mOffset = mBlockEnd = mMapSize;
+			}
+
+			bool map(const std::string& path) {
+				const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+				if (fd < 0) return false;
+				struct stat st;
+				bool ok = ::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(CaptureLog::SegmentHeader);
+				if (ok) {
+					void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+					ok = p != MAP_FAILED;
+					if (ok) {
+						mMap = static_cast<const char*>(p);
+						mMapSize = static_cast<size_t>(st.st_size);
+						::madvise(p, mMapSize, MADV_SEQUENTIAL);
+					}
+				}
+				::close(fd);
+				if (!ok) return false;
+				CaptureLog::SegmentHeader header, expected;
+				std::memcpy(&header, mMap, sizeof(header));
+				CaptureLog::initSegmentHeader(expected, header.segment);
+				if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version
+					|| header.headerSize != expected.headerSize) {
+					unmap();
+					return false;
+				}
+				return true;
+			}
+
+			void unmap() {
+				if (mMap) ::munmap(const_cast<char*>(mMap), mMapSize);
+				mMap = nullptr;
+				mMapSize = 0;
+				mIndex.clear();
+				mOffset = mBlockEnd = 0;
+			}
+
+			/// read the index entries whole; a missing or torn index only means more of the segment is scanned
+			void loadIndex(const std::string& path) {
+				mIndex.clear();
+				const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+				if (fd < 0) return;
+				struct stat st;
+				if (::fstat(fd, &st) == 0) {
+					mIndex.resize(static_cast<size_t>(st.st_size) / sizeof(CaptureLog::IndexEntry));
+					const size_t bytes = mIndex.size() * sizeof(CaptureLog::IndexEntry);
+					if (::pread(fd, mIndex.data(), bytes, 0) != static_cast<ssize_t>(bytes)) mIndex.clear();
+				}
+				::close(fd);
+			}
+
+			const std::string mDirectory;
+			const std::vector<uint64_t> mSegments;
+			const int64_t mStartNanos, mEndNanos;
+			const unsigned mDirections;
+			size_t mNextSegment;
+
+			const char* mMap;	///< the current segment
+			size_t mMapSize;
+			std::vector<CaptureLog::IndexEntry> mIndex;
+			size_t mBlock;	///< next index entry
+			size_t mOffset, mBlockEnd;	///< next record, and the end of the span being scanned
+
+			uint64_t mRecords, mDatagrams, mSkippedBlocks, mCorruptSegments;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(CaptureLogReader);
+		};
+	}
+}
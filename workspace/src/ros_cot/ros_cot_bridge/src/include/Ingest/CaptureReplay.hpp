@@ -0,0 +1,80 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include "Messaging/macro.h"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** Paces the datagrams of a capture into a sink, as fast as possible or on the capture's own clock.
+		*
+		*	The source is anything with bool next(Datagram&) whose Datagram has a timestampNanos capture time, e.g.
+		*	PcapReader. With a speed of 0 every datagram is handed on as soon as the previous one has been; with speed N > 0
+		*	each one is held until (its capture time - the first one's) / N has passed since the replay began, so 1 replays
+		*	with the original timing. A sink that falls behind is not caught up on by skipping: the lag is recorded instead.
+		*
+		*	The sink is called as sink(datagram, replayNanos), where replayNanos is the wall time of the hand-off in
+		*	nanoseconds since the Unix epoch, to stand in for a receive timestamp.
+		*/
+		class CaptureReplay {
+		public:
+			/// @param speed multiple of the original timing; 0 for as fast as possible
+			explicit CaptureReplay(double speed = 0) : mSpeed(speed > 0 ? speed : 0), mCount(0), mSeconds(0), mMaxLagNanos(0) {}
+
+			/** replay until the source ends or running turns false
+			*
+			*	@returns the number of datagrams handed on
+			*/
+			template <typename Source, typename Sink>
+			uint64_t run(Source& source, Sink&& sink, const std::atomic<bool>* running = nullptr) {
+				typename Source::Datagram datagram;
+				const auto start = std::chrono::steady_clock::now();
+				bool first = true;
+				int64_t firstNanos = 0;
+				mCount = 0;
+				mMaxLagNanos = 0;
+				while ((!running || running->load(std::memory_order_relaxed)) && source.next(datagram)) {
+					if (first) {
+						firstNanos = datagram.timestampNanos;
+						first = false;
+					}
+					if (mSpeed > 0 && datagram.timestampNanos > firstNanos) {
+						const auto due = start + std::chrono::nanoseconds(static_cast<int64_t>((datagram.timestampNanos - firstNanos) / mSpeed));
+						const auto now = std::chrono::steady_clock::now();
+						if (due > now) std::this_thread::sleep_until(due);
+						else mMaxLagNanos = std::max<int64_t>(mMaxLagNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count());
+					}
+					sink(datagram, wallNanos());
+					++mCount;
+				}
+				mSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				return mCount;
+			}
+
+			double getSpeed() const { return mSpeed; }
+			/// datagrams handed on by the last run
+			uint64_t getCount() const { return mCount; }
+			/// how long the last run took
+			double getSeconds() const { return mSeconds; }
+			/// the furthest behind schedule the last paced run handed a datagram on
+			int64_t getMaxLagNanos() const { return mMaxLagNanos; }
+
+			static int64_t wallNanos() {
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+			}
+
+		protected:
+			const double mSpeed;
+			uint64_t mCount;
+			double mSeconds;
+			int64_t mMaxLagNanos;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(CaptureReplay);
+		};
+	}
+}
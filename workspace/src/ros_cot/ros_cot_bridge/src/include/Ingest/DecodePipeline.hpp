@@ -0,0 +1,441 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+#include "Messaging/TakProtocolParser.hpp"
+#include "Messaging/macro.h"
+#include "Ingest/CaptureLog.hpp"
+#include "Ingest/Deduplicator.hpp"
+#include "Ingest/RateLimiter.hpp"
+#include "Utility/CallbackRegister.hpp"
+#include "Utility/FastHash.hpp"
+#include "Utility/LatencyHistogram.hpp"
+#include "Utility/SpscRing.hpp"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** Multi-threaded decode of received CoT datagrams that keeps each uid's events in arrival order.
+		*
+		*	Datagrams may be CoT XML or TAK Protocol (mesh or stream framed), detected per datagram by
+		*	Messaging::TakProtocolParser.
+		*
+		*	Stages:
+		*	- Receive: any number of producers (receive threads, or a capture replay) call submit(). Each datagram is keyed
+		*	  by uid with TakProtocolParser::ScanKey, checked against the per-sender rate limits if enabled, stamped with a
+		*	  global arrival sequence number, and copied into the single-producer single-consumer ring from that producer to
+		*	  the worker that owns the uid.
+		*	- Parse: a pool of workers. Each drains its input rings oldest-sequence-first, runs its own Deduplicator (a uid
+		*	  always maps to the same worker, so the dedup state partitions cleanly) and TakProtocolParser, and hands the event
+		*	  to the sequencer through another SPSC ring. The datagram buffer is swapped, not copied, between the rings.
+		*	- Sequence: one thread drains the workers' output rings, drops an event if a later-arriving event of the same
+		*	  uid has already been delivered, and invokes the callbacks.
+		*
+		*	Since every event of a uid goes through one worker's FIFO rings, per-uid order is preserved by construction; the
+		*	sequencer check only catches the rare inversion between two producers that stamped and pushed in opposite orders.
+		*	Events of different uids may be delivered in any order. Callbacks run on the sequencer thread and receive a
+		*	CoTEvent whose views are valid only for the duration of the callback.
+		*
+		*	Every stage exposes its queue depth, queue high-water mark and a latency histogram: Receive from the datagram's
+		*	receive time to its push, Parse from the push to parse completion (queueing plus parsing), Sequence from parse
+		*	completion to callback return. getEndToEndLatency() covers receive time to callback return; when producers pass
+		*	kernel receive timestamps, that includes the time datagrams spent in the socket buffer.
+		*
+		*	When a worker's input ring is full the datagram is dropped (counted as QueueFull), as the socket would have
+		*	done; a full output ring instead stalls its worker, which backs pressure up to the input rings.
+		*/
+		class DecodePipeline : public ARL::Utility::CallbackRegister<Messaging::CoTEvent> {
+		public:
+			enum Stage { Receive = 0, Parse, Sequence, NumStages };
+
+			enum DropReason { QueueFull = 0, RateLimited, SelfEcho, Duplicate, ParseError, OutOfOrder, NumDropReasons };
+
+			/**
+			*	@param numProducers number of threads that will call submit(), each with its own producer index
+			*	@param numWorkers number of parser threads
+			*	@param ringCapacity slots in each producer->worker and worker->sequencer ring
+			*	@param dedupWindowMicros duplicate window passed to each worker's Deduplicator; <= 0 disables duplicate and
+			*	self-echo suppression (e.g. for replaying a capture)
+			*	@param detailFields Messaging::CoTEvent::DetailFields the workers parse out of <detail>; callbacks may parse
+			*	the rest with CoTEventParser::ParseDetail
+			*/
+			DecodePipeline(size_t numProducers = 1, size_t numWorkers = 2, size_t ringCapacity = 1024, int64_t dedupWindowMicros = 5000000,
+				unsigned detailFields = Messaging::CoTEvent::AllDetail)
+				: mNumProducers(numProducers ? numProducers : 1), mNumWorkers(numWorkers ? numWorkers : 1),
+				mDedupEnabled(dedupWindowMicros > 0), mDetailFields(detailFields), mCaptureLog(nullptr), mCaptureLogProducer(0),
+				mRunning(false), mSequence(0), mOrderMask(OrderTableSize - 1) {
+				for (size_t i = 0; i < mNumProducers * mNumWorkers; ++i)
+					mInput.emplace_back(new Utility::SpscRing<Packet>(ringCapacity));
+				for (size_t w = 0; w < mNumWorkers; ++w) {
+					mOutput.emplace_back(new Utility::SpscRing<Decoded>(ringCapacity));
+					mDeduplicators.emplace_back(new Deduplicator(mDedupEnabled ? dedupWindowMicros : 1));
+				}
+				mOrder.assign(OrderTableSize, OrderEntry{ 0, 0 });
+				for (auto& c : mProcessed) c.store(0, std::memory_order_relaxed);
+				for (auto& c : mDropped) c.store(0, std::memory_order_relaxed);
+			}
+
+			~DecodePipeline() {
+				stop();
+			}
+
+			/// start the worker and sequencer threads
+			void start() {
+				if (mRunning.exchange(true)) return;
+				for (size_t w = 0; w < mNumWorkers; ++w)
+					mWorkers.emplace_back(&DecodePipeline::workerLoop, this, w);
+				mSequencer = std::thread(&DecodePipeline::sequencerLoop, this);
+			}
+
+			/// stop and join the threads; datagrams still queued are discarded
+			void stop() {
+				mRunning = false;
+				for (auto& t : mWorkers)
+					if (t.joinable()) t.join();
+				mWorkers.clear();
+				if (mSequencer.joinable()) mSequencer.join();
+			}
+
+			/** drop datagrams from senders that exceed these rates, before they are queued for parsing
+			*
+			*	Not thread-safe; call before start().
+			*	@param capacity buckets in the rate limiter's table
+			*/
+			void setRateLimits(const RateLimiter::Limit& source, const RateLimiter::Limit& uid, size_t capacity = 8192) {
+				mRateLimiter.reset(source.enabled() || uid.enabled() ? new RateLimiter(source, uid, capacity) : nullptr);
+			}
+
+			/** append every submitted datagram, before any rate limit or drop, to a CaptureLog as received
+			*
+			*	Each call to submit() or submitWait() logs its datagram once, so producers that must not lose datagrams
+			*	use submitWait(): retrying submit() would log a copy per try, which a replay of the log would then inject.
+			*	Not thread-safe; call before start().
+			*	@param firstProducer the log's producer index for this pipeline's producer 0; the pipeline uses numProducers
+			*	of them from there
+			*/
+			void setCaptureLog(CaptureLog* log, size_t firstProducer = 0) {
+				mCaptureLog = log;
+				mCaptureLogProducer = firstProducer;
+			}
+
+			/** hand one datagram to the pipeline; the data is copied before this returns
+			*
+			*	@param producer index in [0, numProducers) unique to the calling thread
+			*	@param receivedNanos when the datagram was received (ideally the kernel receive timestamp), nanoseconds since
+			*	the Unix epoch; carried on the event as CoTEvent::receivedNanos
+			*	@param source the sender's address bytes in network order, for per-source rate limits; empty if unknown
+			*	@returns false if the datagram was dropped because its sender is over its rate or the owning worker's ring
+			*	is full
+			*/
+			bool submit(size_t producer, const char* data, size_t size, int64_t receivedNanos,
+				boost::string_view source = boost::string_view()) {
+				return push(producer, data, size, receivedNanos, source, false, nullptr);
+			}
+
+			/** hand one datagram to the pipeline like submit(), but wait for room in the owning worker's ring rather than
+			*	drop it, for producers that must not lose datagrams (a capture replay, a TCP stream)
+			*
+			*	Retrying submit() instead would count QueueFull for every failed try, though nothing is lost, and would
+			*	throw off anyone settling delivered plus dropped against what was submitted.
+			*	@param keepWaiting if given, the wait is abandoned once it reads false (e.g. the producer's running flag);
+			*	it is also abandoned when the pipeline stops
+			*	@returns false if the datagram was dropped because its sender is over its rate, or the wait was abandoned
+			*	(counted as QueueFull)
+			*/
+			bool submitWait(size_t producer, const char* data, size_t size, int64_t receivedNanos,
+				boost::string_view source = boost::string_view(), const std::atomic<bool>* keepWaiting = nullptr) {
+				return push(producer, data, size, receivedNanos, source, true, keepWaiting);
+			}
+
+			/// register a uid we transmit with every worker, so that its echo is dropped. Safe to call at any time.
+			bool addSelfUid(boost::string_view uid) {
+				bool ok = true;
+				for (auto& d : mDeduplicators)
+					ok = d->addSelfUid(uid) && ok;
+				return ok;
+			}
+
+			/** register a uid we relay with every worker, so that its echo is dropped until expiresMicros (wall clock
+			*	microseconds, as the datagrams' receive times); see Deduplicator::addRelayedUid. Call from one thread.
+			*/
+			bool addRelayedUid(boost::string_view uid, int64_t expiresMicros) {
+				const int64_t now = nowNanos() / 1000;
+				bool ok = true;
+				for (auto& d : mDeduplicators)
+					ok = d->addRelayedUid(uid, now, expiresMicros) && ok;
+				return ok;
+			}
+
+			/// nullptr unless rate limits were set
+			RateLimiter* getRateLimiter() const { return mRateLimiter.get(); }
+
+			size_t getNumProducers() const { return mNumProducers; }
+			size_t getNumWorkers() const { return mNumWorkers; }
+
+			/// events that left the stage: pushed to a worker, parsed, or delivered
+			uint64_t getCount(Stage stage) const { return mProcessed[stage].load(std::memory_order_relaxed); }
+			uint64_t getDropCount(DropReason reason) const { return mDropped[reason].load(std::memory_order_relaxed); }
+
+			uint64_t getDedupOverflowCount() const {
+				uint64_t n = 0;
+				for (const auto& d : mDeduplicators) n += d->getOverflowCount();
+				return n;
+			}
+
+			/// datagrams currently queued in front of the stage (always 0 for Receive, whose queue is the socket)
+			size_t getQueueDepth(Stage stage) const {
+				size_t n = 0;
+				if (stage == Parse) for (const auto& r : mInput) n += r->size();
+				if (stage == Sequence) for (const auto& r : mOutput) n += r->size();
+				return n;
+			}
+
+			/// largest depth any single ring in front of the stage has reached
+			size_t getQueueHighWater(Stage stage) const {
+				size_t n = 0;
+				if (stage == Parse) for (const auto& r : mInput) n = std::max(n, r->getHighWater());
+				if (stage == Sequence) for (const auto& r : mOutput) n = std::max(n, r->getHighWater());
+				return n;
+			}
+
+			const Utility::LatencyHistogram& getLatency(Stage stage) const { return mLatency[stage]; }
+			const Utility::LatencyHistogram& getEndToEndLatency() const { return mEndToEnd; }
+
+			static const char* toString(Stage stage) {
+				switch (stage) {
+				case Receive: return "receive";
+				case Parse: return "parse";
+				case Sequence: return "sequence";
+				default: return "unknown";
+				}
+			}
+
+			static const char* toString(DropReason reason) {
+				switch (reason) {
+				case QueueFull: return "queue_full";
+				case RateLimited: return "rate_limited";
+				case SelfEcho: return "self_echo";
+				case Duplicate: return "duplicate";
+				case ParseError: return "parse_error";
+				case OutOfOrder: return "out_of_order";
+				default: return "unknown";
+				}
+			}
+
+			/// the pipeline's clock: wall time in nanoseconds since the Unix epoch, the clock of SO_TIMESTAMPNS
+			static int64_t nowNanos() {
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+			}
+
+		protected:
+			struct Packet {
+				std::vector<char> data;	///< grows to the largest datagram seen in this slot, then is reused
+				size_t size = 0;
+				uint64_t sequence = 0;
+				uint64_t uidHash = 0;	///< 0 when the datagram had no uid
+				int64_t receivedNanos = 0;
+				int64_t stageNanos = 0;	///< when the packet entered its current ring
+			};
+
+			struct Decoded {
+				std::vector<char> data;	///< the datagram; event's views point into it
+				Messaging::CoTEvent event;
+				uint64_t sequence = 0;
+				uint64_t uidHash = 0;
+				int64_t stageNanos = 0;
+			};
+
+			struct OrderEntry {
+				uint64_t uidHash;
+				uint64_t sequence;
+			};
+
+			/// the sequencer remembers the last delivered sequence for this many uids (direct mapped; a collision forgets)
+			static constexpr size_t OrderTableSize = 1 << 16;
+
+			/// spin, then yield, then sleep briefly while a consumer has nothing to do
+			struct Backoff {
+				unsigned idle = 0;
+				void reset() { idle = 0; }
+				void pause() {
+					if (++idle < 64) return;
+					if (idle < 256) std::this_thread::yield();
+					else std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			};
+
+			static uint64_t nonZero(uint64_t h) { return h ? h : 1; }
+
+			/// submit() and submitWait(): key, log, rate-limit and queue one datagram
+			bool push(size_t producer, const char* data, size_t size, int64_t receivedNanos, boost::string_view source,
+				bool wait, const std::atomic<bool>* keepWaiting) {
+				boost::string_view uid, time;
+				const uint64_t uidHash = Messaging::TakProtocolParser::ScanKey(data, size, uid, time)
+					? nonZero(Utility::FastHash::hash(uid.data(), uid.size())) : 0;
+				if (mCaptureLog)
+					mCaptureLog->append(mCaptureLogProducer + producer, CaptureLog::Received, receivedNanos, source, 0, uidHash, data, size);
+				if (mRateLimiter && !mRateLimiter->allow(source, uid, receivedNanos)) {
+					count(RateLimited);
+					return false;
+				}
+				const size_t worker = static_cast<size_t>(uidHash % mNumWorkers);
+				auto& ring = *mInput[producer * mNumWorkers + worker];
+				Packet* packet;
+				Backoff backoff;
+				while (!(packet = ring.beginPush())) {
+					if (!wait || !mRunning || (keepWaiting && !keepWaiting->load(std::memory_order_relaxed))) {
+						count(QueueFull);
+						return false;
+					}
+					backoff.pause();
+				}
+				// stamped once there is room, so that a wait cannot put this datagram behind later ones of its uid
+				const uint64_t sequence = mSequence.fetch_add(1, std::memory_order_relaxed);
+				if (packet->data.size() < size) packet->data.resize(size);
+				std::memcpy(packet->data.data(), data, size);
+				packet->size = size;
+				packet->sequence = sequence;
+				packet->uidHash = uidHash;
+				packet->receivedNanos = receivedNanos;
+				packet->stageNanos = nowNanos();
+				ring.commitPush();
+				mProcessed[Receive].fetch_add(1, std::memory_order_relaxed);
+				mLatency[Receive].record(packet->stageNanos - receivedNanos);
+				return true;
+			}
+
+			void count(DropReason reason) { mDropped[reason].fetch_add(1, std::memory_order_relaxed); }
+
+			/// the input ring of this worker whose head arrived first, or nullptr if all are empty
+			Utility::SpscRing<Packet>* oldestInput(size_t worker) {
+				Utility::SpscRing<Packet>* oldest = nullptr;
+				uint64_t oldestSequence = 0;
+				for (size_t p = 0; p < mNumProducers; ++p) {
+					auto* ring = mInput[p * mNumWorkers + worker].get();
+					const Packet* head = ring->front();
+					if (head && (!oldest || head->sequence < oldestSequence)) {
+						oldest = ring;
+						oldestSequence = head->sequence;
+					}
+				}
+				return oldest;
+			}
+
+			void workerLoop(size_t worker) {
+				Deduplicator& dedup = *mDeduplicators[worker];
+				auto& output = *mOutput[worker];
+				Backoff backoff;
+				while (mRunning) {
+					auto* input = oldestInput(worker);
+					if (!input) { backoff.pause(); continue; }
+					backoff.reset();
+					Packet& packet = *input->front();
+
+					if (mDedupEnabled && packet.uidHash) {
+						boost::string_view uid, time;
+						Messaging::TakProtocolParser::ScanKey(packet.data.data(), packet.size, uid, time);
+						const auto verdict = dedup.check(uid, time, packet.receivedNanos / 1000);
+						if (verdict != Deduplicator::Accept) {
+							count(verdict == Deduplicator::DropSelfEcho ? SelfEcho : Duplicate);
+							input->pop();
+							continue;
+						}
+					}
+
+					Decoded* out;
+					while (!(out = output.beginPush())) {
+						if (!mRunning) return;
+						backoff.pause();
+					}
+					backoff.reset();
+					std::swap(out->data, packet.data);
+					const bool parsed = Messaging::TakProtocolParser::Parse(out->data.data(), packet.size, out->event, mDetailFields);
+					out->sequence = packet.sequence;
+					out->uidHash = packet.uidHash;
+					out->event.receivedNanos = packet.receivedNanos;
+					const int64_t queuedNanos = packet.stageNanos;
+					input->pop();
+					if (!parsed) {
+						count(ParseError);
+						continue;
+					}
+					out->stageNanos = nowNanos();
+					output.commitPush();
+					mProcessed[Parse].fetch_add(1, std::memory_order_relaxed);
+					mLatency[Parse].record(out->stageNanos - queuedNanos);
+				}
+			}
+
+			/// @returns false if an event of this uid that arrived later has already been delivered
+			bool admit(uint64_t uidHash, uint64_t sequence) {
+				if (!uidHash) return true;
+				OrderEntry& entry = mOrder[uidHash & mOrderMask];
+				if (entry.uidHash == uidHash && entry.sequence > sequence) return false;
+				entry.uidHash = uidHash;
+				entry.sequence = sequence;
+				return true;
+			}
+
+			void sequencerLoop() {
+				static const size_t MaxBatch = 64; // per ring per pass, so one busy worker cannot starve the others
+				Backoff backoff;
+				while (mRunning) {
+					bool idle = true;
+					for (auto& ring : mOutput) {
+						for (size_t n = 0; n < MaxBatch; ++n) {
+							Decoded* d = ring->front();
+							if (!d) break;
+							idle = false;
+							if (admit(d->uidHash, d->sequence)) {
+								InvokeCallback(d->event);
+								mProcessed[Sequence].fetch_add(1, std::memory_order_relaxed);
+							}
+							else {
+								count(OutOfOrder);
+							}
+							const int64_t now = nowNanos();
+							mLatency[Sequence].record(now - d->stageNanos);
+							mEndToEnd.record(now - d->event.receivedNanos);
+							ring->pop();
+						}
+					}
+					if (idle) backoff.pause();
+					else backoff.reset();
+				}
+			}
+
+			const size_t mNumProducers, mNumWorkers;
+			const bool mDedupEnabled;
+			const unsigned mDetailFields;
+
+			std::vector<std::unique_ptr<Utility::SpscRing<Packet>>> mInput;	///< [producer * numWorkers + worker]
+			std::vector<std::unique_ptr<Utility::SpscRing<Decoded>>> mOutput;	///< [worker]
+			std::vector<std::unique_ptr<Deduplicator>> mDeduplicators;	///< [worker]
+			std::unique_ptr<RateLimiter> mRateLimiter;
+			CaptureLog* mCaptureLog;	///< not owned; nullptr unless set
+			size_t mCaptureLogProducer;
+
+			std::vector<std::thread> mWorkers;
+			std::thread mSequencer;
+			std::atomic<bool> mRunning;
+			std::atomic<uint64_t> mSequence;
+
+			const size_t mOrderMask;
+			std::vector<OrderEntry> mOrder;	///< sequencer thread only
+
+			std::atomic<uint64_t> mProcessed[NumStages];
+			std::atomic<uint64_t> mDropped[NumDropReasons];
+			Utility::LatencyHistogram mLatency[NumStages];
+			Utility::LatencyHistogram mEndToEnd;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(DecodePipeline);
+		};
+	}
+}
@@ -0,0 +1,235 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+#include "Messaging/macro.h"
+#include "Utility/FastHash.hpp"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** Pre-parse duplicate suppression for received CoT datagrams.
+		*
+		*	With multicast loopback on, and with several interfaces joined to the same group, the receive path sees our
+		*	own events and multiple copies of everyone else's. Deduplicator keys each datagram by a hash of its uid and time
+		*	attributes (see CoTEventParser::ScanKey) and drops
+		*	- datagrams whose uid belongs to us (self echo), or that we are relaying for someone else until it ages out,
+		*	- exact uid+time repeats seen within the dedup window.
+		*
+		*	Seen keys live in a ring of fixed-size, open-addressed hash sets, one per time bucket; the oldest bucket is
+		*	cleared as the clock advances, so memory is fixed and no per-datagram allocation occurs. A bucket that fills up
+		*	stops remembering keys (fail open) and counts an overflow rather than dropping traffic.
+		*
+		*	Our own uids are few and permanent; relayed ones (the contacts we forward) come and go, so they are kept in a
+		*	table of their own where each entry expires and its slot is reused, and a stream of relayed uids can never
+		*	crowd out ours.
+		*
+		*	check() must be called from a single thread. addSelfUid() and the counters may be used from any thread;
+		*	addRelayedUid() from one thread at a time, concurrently with check().
+		*/
+		class Deduplicator {
+		public:
+			using string_view = boost::string_view;
+
+			enum DropReason { SelfEcho = 0, Duplicate, NumDropReasons };
+
+			enum Verdict { Accept = -1, DropSelfEcho = SelfEcho, DropDuplicate = Duplicate };
+
+			/**
+			*	@param windowMicros how long an exact repeat is considered a duplicate, in microseconds
+			*	@param numBuckets number of time buckets the window is divided into (>= 2)
+			*	@param bucketCapacity keys per bucket; rounded up to a power of two
+			*	@param selfCapacity maximum number of distinct uids that can be registered as our own
+			*	@param relayedCapacity slots for relayed uids, rounded up to a power of two; keep the uids live at once under half
+			*/
+			Deduplicator(int64_t windowMicros = 5000000, size_t numBuckets = 5, size_t bucketCapacity = 8192, size_t selfCapacity = 4096,
+				size_t relayedCapacity = 8192)
+				: mBucketWidth(windowMicros / static_cast<int64_t>(numBuckets < 2 ? 1 : numBuckets - 1)),
+				mBucketMask(roundUpPow2(bucketCapacity) - 1),
+				mBuckets(numBuckets < 2 ? 2 : numBuckets),
+				mSelfMask(roundUpPow2(selfCapacity) - 1),
+				mSelf(mSelfMask + 1),
+				mRelayedMask(roundUpPow2(relayedCapacity) - 1),
+				mRelayed(mRelayedMask + 1) {
+				if (mBucketWidth <= 0) mBucketWidth = 1;
+				for (auto& b : mBuckets) {
+					b.epoch = -1;
+					b.keys.assign(mBucketMask + 1, 0);
+				}
+				for (auto& s : mSelf) s.store(0, std::memory_order_relaxed);
+				for (auto& r : mRelayed) {
+					r.key.store(0, std::memory_order_relaxed);
+					r.expiresMicros.store(0, std::memory_order_relaxed);
+				}
+				for (auto& c : mDropped) c.store(0, std::memory_order_relaxed);
+			}
+
+			/// register a uid we transmit, so that its echo is dropped. Safe to call concurrently with check().
+			/// @returns false if the self table is full
+			bool addSelfUid(string_view uid) {
+				const uint64_t key = nonZero(Utility::FastHash::hash(uid.data(), uid.size()));
+				for (size_t i = 0, slot = key & mSelfMask; i <= mSelfMask; ++i, slot = (slot + 1) & mSelfMask) {
+					uint64_t current = mSelf[slot].load(std::memory_order_acquire);
+					if (current == key) return true;
+					if (current == 0 && mSelf[slot].compare_exchange_strong(current, key, std::memory_order_acq_rel))
+						return true;
+					if (current == key) return true; // lost the race to the same uid
+				}
+				return false;
+			}
+
+			/** register a uid we relay, so that its echo is dropped until expiresMicros (on check()'s clock); a uid
+			*	already registered has its expiry moved. Safe to call concurrently with check(), from one thread at a time.
+			*	@returns false if every slot the uid may take holds a relayed uid that has not yet expired
+			*/
+			bool addRelayedUid(string_view uid, int64_t nowMicros, int64_t expiresMicros) {
+				const uint64_t key = nonZero(Utility::FastHash::hash(uid.data(), uid.size()));
+				Relayed* free = nullptr;
+				for (size_t i = 0, slot = key & mRelayedMask; i < MaxProbe && i <= mRelayedMask; ++i, slot = (slot + 1) & mRelayedMask) {
+					Relayed& r = mRelayed[slot];
+					const uint64_t current = r.key.load(std::memory_order_relaxed);
+					if (current == key) {
+						r.expiresMicros.store(expiresMicros, std::memory_order_relaxed);
+						return true;
+					}
+					if (!free && (current == 0 || r.expiresMicros.load(std::memory_order_relaxed) < nowMicros))
+						free = &r;
+					if (current == 0) break;	// slots are never emptied, so the uid is not further on
+				}
+				if (!free) return false;
+				// a reader between these stores may take the slot's old, expired uid as relayed for a moment longer
+				free->expiresMicros.store(expiresMicros, std::memory_order_relaxed);
+				free->key.store(key, std::memory_order_release);
+				return true;
+			}
+
+			bool isSelfUid(string_view uid) const {
+				return isSelfKey(nonZero(Utility::FastHash::hash(uid.data(), uid.size())));
+			}
+
+			/** classify one datagram by its uid and time attributes
+			*
+			*	@param nowMicros monotonic receive time, in microseconds
+			*/
+			Verdict check(string_view uid, string_view time, int64_t nowMicros) {
+				const uint64_t uidHash = Utility::FastHash::hash(uid.data(), uid.size());
+				if (isSelfKey(nonZero(uidHash)) || isRelayedKey(nonZero(uidHash), nowMicros)) return count(DropSelfEcho);
+
+				const uint64_t key = nonZero(Utility::FastHash::combine(uidHash, Utility::FastHash::hash(time.data(), time.size())));
+				const int64_t epoch = nowMicros / mBucketWidth;
+				const int64_t oldest = epoch - static_cast<int64_t>(mBuckets.size()) + 1;
+
+				Bucket& current = mBuckets[static_cast<size_t>(epoch % static_cast<int64_t>(mBuckets.size()))];
+				if (current.epoch != epoch) {
+					std::fill(current.keys.begin(), current.keys.end(), 0);
+					current.epoch = epoch;
+					current.size = 0;
+				}
+				for (const auto& b : mBuckets)
+					if (b.epoch >= oldest && b.epoch <= epoch && contains(b, key))
+						return count(DropDuplicate);
+
+				if (!insert(current, key)) mOverflows.fetch_add(1, std::memory_order_relaxed);
+				mAccepted.fetch_add(1, std::memory_order_relaxed);
+				return Accept;
+			}
+
+			uint64_t getDropCount(DropReason reason) const { return mDropped[reason].load(std::memory_order_relaxed); }
+			uint64_t getAcceptCount() const { return mAccepted.load(std::memory_order_relaxed); }
+			uint64_t getOverflowCount() const { return mOverflows.load(std::memory_order_relaxed); }
+
+			static const char* toString(DropReason reason) {
+				switch (reason) {
+				case SelfEcho: return "self_echo";
+				case Duplicate: return "duplicate";
+				default: return "unknown";
+				}
+			}
+
+		protected:
+			struct Bucket {
+				int64_t epoch;
+				size_t size = 0;
+				std::vector<uint64_t> keys; ///< 0 marks an empty slot
+			};
+
+			/// longest probe sequence searched; buckets also stop accepting keys once half full to keep probes short
+			static constexpr size_t MaxProbe = 32;
+
+			static size_t roundUpPow2(size_t n) {
+				size_t p = 1;
+				while (p < n) p <<= 1;
+				return p;
+			}
+
+			static uint64_t nonZero(uint64_t h) { return h ? h : 1; }
+
+			bool isSelfKey(uint64_t key) const {
+				for (size_t i = 0, slot = key & mSelfMask; i <= mSelfMask; ++i, slot = (slot + 1) & mSelfMask) {
+					uint64_t current = mSelf[slot].load(std::memory_order_acquire);
+					if (current == key) return true;
+					if (current == 0) return false;
+				}
+				return false;
+			}
+
+			bool isRelayedKey(uint64_t key, int64_t nowMicros) const {
+				for (size_t i = 0, slot = key & mRelayedMask; i < MaxProbe && i <= mRelayedMask; ++i, slot = (slot + 1) & mRelayedMask) {
+					const Relayed& r = mRelayed[slot];
+					const uint64_t current = r.key.load(std::memory_order_acquire);
+					if (current == key) return r.expiresMicros.load(std::memory_order_relaxed) >= nowMicros;
+					if (current == 0) return false;
+				}
+				return false;
+			}
+
+			bool contains(const Bucket& b, uint64_t key) const {
+				for (size_t i = 0, slot = key & mBucketMask; i < MaxProbe; ++i, slot = (slot + 1) & mBucketMask) {
+					if (b.keys[slot] == key) return true;
+					if (b.keys[slot] == 0) return false;
+				}
+				return false;
+			}
+
+			bool insert(Bucket& b, uint64_t key) {
+				if (2 * b.size > mBucketMask) return false; // over half full
+				for (size_t i = 0, slot = key & mBucketMask; i < MaxProbe; ++i, slot = (slot + 1) & mBucketMask) {
+					if (b.keys[slot] == 0) {
+						b.keys[slot] = key;
+						++b.size;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			Verdict count(Verdict v) {
+				mDropped[v].fetch_add(1, std::memory_order_relaxed);
+				return v;
+			}
+
+			int64_t mBucketWidth;
+			const size_t mBucketMask;
+			std::vector<Bucket> mBuckets;
+
+			const size_t mSelfMask;
+			std::vector<std::atomic<uint64_t>> mSelf; ///< open-addressed set of self uid hashes, 0 marks an empty slot
+
+			struct Relayed {
+				std::atomic<uint64_t> key;	///< uid hash; 0 marks a slot never used, and a used slot is only ever reused
+				std::atomic<int64_t> expiresMicros;
+			};
+			const size_t mRelayedMask;
+			std::vector<Relayed> mRelayed;
+
+			std::atomic<uint64_t> mDropped[NumDropReasons];
+			std::atomic<uint64_t> mAccepted{ 0 };
+			std::atomic<uint64_t> mOverflows{ 0 };
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(Deduplicator);
+		};
+	}
+}
@@ -0,0 +1,333 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+#include "Messaging/macro.h"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** Reads the UDP datagrams out of a packet capture, for replaying exercise traffic through the ingest pipeline.
+		*
+		*	Understands classic pcap (either byte order, microsecond or nanosecond timestamps) and pcapng (section header,
+		*	interface description with its timestamp resolution, enhanced and simple packet blocks; other blocks are
+		*	skipped), with Ethernet (including 802.1Q/802.1ad tags), Linux cooked (SLL and SLL2), BSD loopback and raw IP
+		*	link layers, over IPv4 or IPv6. Packets that are not UDP, are IP fragments, were truncated by the capture's
+		*	snap length or do not match the port filter are skipped and counted.
+		*
+		*	Records are read one at a time into a reused buffer, so captures larger than memory replay fine; the payload of
+		*	a Datagram is valid until the next call to next().
+		*/
+		class PcapReader {
+		public:
+			struct Datagram {
+				int64_t timestampNanos;	///< capture time, nanoseconds since the Unix epoch
+				boost::string_view payload;	///< the UDP payload
+				boost::string_view source;	///< the sender's address bytes in network order (4 or 16)
+				uint16_t sourcePort, destinationPort;
+			};
+
+			/**
+			*	@param path the capture file
+			*	@param port only datagrams to this UDP port are returned; 0 returns all
+			*	@throws std::runtime_error if the file cannot be opened or is not a pcap or pcapng capture
+			*/
+			explicit PcapReader(const std::string& path, uint16_t port = 0)
+				: mFile(std::fopen(path.c_str(), "rb")), mPort(port), mNg(false), mSwap(false), mLinkType(0), mTicksPerSecond(1000000), mRecordOffset(0),
+				mPackets(0), mDatagrams(0), mSkipped(0) {
+				if (!mFile) throw std::runtime_error("PcapReader: cannot open " + path);
+				uint32_t magic;
+				if (!readExact(&magic, 4)) fail("empty file");
+				if (magic == 0x0A0D0D0A) {
+					mNg = true;
+					readSectionHeader();
+				}
+				else {
+					readClassicHeader(magic);
+				}
+			}
+
+			~PcapReader() {
+				if (mFile) std::fclose(mFile);
+			}
+
+			/** the next UDP datagram in the capture
+			*
+			*	@returns false at the end of the capture
+			*	@throws std::runtime_error if the capture is malformed before its end; a truncated last record ends it
+			*/
+			bool next(Datagram& datagram) {
+				for (;;) {
+					uint32_t interface = 0;
+					int64_t nanos = 0;
+					size_t captured = 0, original = 0;
+					if (!(mNg ? nextNgPacket(interface, nanos, captured, original) : nextClassicPacket(nanos, captured, original)))
+						return false;
+					++mPackets;
+					const uint32_t linkType = mNg ? (interface < mInterfaces.size() ? mInterfaces[interface].linkType : UINT32_MAX) : mLinkType;
+					if (captured < original || !decodeLink(linkType, mRecord.data() + mRecordOffset, captured, datagram)) {
+						++mSkipped;
+						continue;
+					}
+					datagram.timestampNanos = nanos;
+					++mDatagrams;
+					return true;
+				}
+			}
+
+			/// packet records read so far, returned or not
+			uint64_t getPacketCount() const { return mPackets; }
+			uint64_t getDatagramCount() const { return mDatagrams; }
+			/// packets that were not returned: not UDP, fragmented, truncated, filtered out or of an unknown link type
+			uint64_t getSkippedCount() const { return mSkipped; }
+
+		protected:
+			enum LinkType : uint32_t { Null = 0, Ethernet = 1, Raw = 101, Loop = 108, LinuxSll = 113, Ipv4 = 228, Ipv6 = 229, LinuxSll2 = 276 };
+
+			struct Interface {
+				uint32_t linkType;
+				uint64_t ticksPerSecond;
+			};
+
+			void fail(const char* why) {
+				throw std::runtime_error(std::string("PcapReader: ") + why);
+			}
+
+			bool readExact(void* out, size_t n) {
+				return std::fread(out, 1, n, mFile) == n;
+			}
+
+			uint16_t get16(const void* p) const {
+				uint16_t v;
+				std::memcpy(&v, p, 2);
+				return mSwap ? static_cast<uint16_t>(v >> 8 | v << 8) : v;
+			}
+
+			uint32_t get32(const void* p) const {
+				uint32_t v;
+				std::memcpy(&v, p, 4);
+				return mSwap ? __builtin_bswap32(v) : v;
+			}
+
+			static uint16_t big16(const char* p) {
+				return static_cast<uint16_t>(static_cast<unsigned char>(p[0]) << 8 | static_cast<unsigned char>(p[1]));
+			}
+
+			void readClassicHeader(uint32_t magic) {
+				switch (magic) {
+				case 0xA1B2C3D4: mTicksPerSecond = 1000000; break;
+				case 0xA1B23C4D: mTicksPerSecond = 1000000000; break;
+				case 0xD4C3B2A1: mTicksPerSecond = 1000000; mSwap = true; break;
+				case 0x4D3CB2A1: mTicksPerSecond = 1000000000; mSwap = true; break;
+				default: fail("not a pcap or pcapng capture");
+				}
+				char header[20];
+				if (!readExact(header, sizeof(header))) fail("truncated file header");
+				mLinkType = get32(header + 16) & 0x0FFFFFFF; // the upper bits carry FCS information
+			}
+
+			bool nextClassicPacket(int64_t& nanos, size_t& captured, size_t& original) {
+				char header[16];
+				if (!readExact(header, sizeof(header))) return false;
+				captured = get32(header + 8);
+				original = get32(header + 12);
+				if (captured > MaxRecord) fail("packet record longer than any packet");
+				mRecord.resize(captured);
+				if (!readExact(mRecord.data(), captured)) return false;
+				mRecordOffset = 0;
+				nanos = static_cast<int64_t>(get32(header)) * 1000000000 + static_cast<int64_t>(get32(header + 4)) * (1000000000 / static_cast<int64_t>(mTicksPerSecond));
+				return true;
+			}
+
+			/// the block type has been read; reads the rest of a section header block
+			void readSectionHeader() {
+				char fixed[8];
+				if (!readExact(fixed, sizeof(fixed))) fail("truncated section header");
+				mSwap = false;
+				const uint32_t byteOrder = get32(fixed + 4);
+				if (byteOrder == 0x4D3C2B1A) mSwap = true;
+				else if (byteOrder != 0x1A2B3C4D) fail("bad pcapng byte-order magic");
+				const uint32_t length = get32(fixed);
+				if (length < 28 || length > MaxRecord || length % 4) fail("bad section header length");
+				mBlock.resize(length - 12);
+				if (!readExact(mBlock.data(), mBlock.size())) fail("truncated section header");
+				mInterfaces.clear(); // interface ids are per section
+			}
+
+			bool nextNgPacket(uint32_t& interface, int64_t& nanos, size_t& captured, size_t& original) {
+				for (;;) {
+					char fixed[8];
+					if (!readExact(fixed, 4)) return false;
+					if (get32(fixed) == 0x0A0D0D0A) {
+						readSectionHeader();
+						continue;
+					}
+					if (!readExact(fixed + 4, 4)) return false;
+					const uint32_t type = get32(fixed), length = get32(fixed + 4);
+					if (length < 12 || length > MaxRecord || length % 4) fail("bad block length");
+					std::vector<char>& body = type == EnhancedPacket || type == SimplePacket ? mRecord : mBlock;
+					body.resize(length - 8); // the body and the trailing length
+					if (!readExact(body.data(), body.size())) return false;
+					const size_t bodySize = length - 12;
+					if (type == InterfaceDescription) {
+						if (bodySize < 8) fail("bad interface description");
+						mInterfaces.push_back(Interface{ get16(body.data()), interfaceTicks(body.data() + 8, bodySize - 8) });
+					}
+					else if (type == EnhancedPacket) {
+						if (bodySize < 20) fail("bad enhanced packet block");
+						interface = get32(body.data());
+						const uint64_t ticks = static_cast<uint64_t>(get32(body.data() + 4)) << 32 | get32(body.data() + 8);
+						captured = get32(body.data() + 12);
+						original = get32(body.data() + 16);
+						if (captured > bodySize - 20) fail("enhanced packet longer than its block");
+						const uint64_t perSecond = interface < mInterfaces.size() ? mInterfaces[interface].ticksPerSecond : 1000000;
+						nanos = static_cast<int64_t>(ticks / perSecond * 1000000000 + ticks % perSecond * 1000000000 / perSecond);
+						mRecordOffset = 20;
+						return true;
+					}
+					else if (type == SimplePacket) {
+						if (bodySize < 4) fail("bad simple packet block");
+						interface = 0;
+						original = get32(body.data());
+						captured = std::min<size_t>(original, bodySize - 4);
+						nanos = 0; // simple packets carry no timestamp
+						mRecordOffset = 4;
+						return true;
+					}
+				}
+			}
+
+			/// the if_tsresol option of an interface description, in ticks per second; microseconds if absent
+			uint64_t interfaceTicks(const char* options, size_t size) const {
+				for (size_t i = 0; i + 4 <= size;) {
+					const uint16_t code = get16(options + i), length = get16(options + i + 2);
+					if (code == 0) break;
+					if (code == 9 && length >= 1 && i + 5 <= size) {
+						const unsigned char r = static_cast<unsigned char>(options[i + 4]);
+						uint64_t ticks = 1;
+						const unsigned exponent = r & 0x7f;
+						if (exponent > (r & 0x80 ? 63u : 19u)) return 1000000;
+						for (unsigned k = 0; k < exponent; ++k) ticks *= r & 0x80 ? 2 : 10;
+						return ticks;
+					}
+					i += 4 + (length + 3u) / 4 * 4;
+				}
+				return 1000000;
+			}
+
+			bool decodeLink(uint32_t linkType, const char* p, size_t size, Datagram& datagram) {
+				uint16_t etherType;
+				switch (linkType) {
+				case Ethernet:
+					if (size < 14) return false;
+					etherType = big16(p + 12);
+					p += 14;
+					size -= 14;
+					while ((etherType == 0x8100 || etherType == 0x88A8) && size >= 4) {
+						etherType = big16(p + 2);
+						p += 4;
+						size -= 4;
+					}
+					break;
+				case LinuxSll:
+					if (size < 16) return false;
+					etherType = big16(p + 14);
+					p += 16;
+					size -= 16;
+					break;
+				case LinuxSll2:
+					if (size < 20) return false;
+					etherType = big16(p);
+					p += 20;
+					size -= 20;
+					break;
+				case Null:
+				case Loop: {
+					if (size < 4) return false;
+					uint32_t family; // host order of the capturing machine for Null, network order for Loop
+					std::memcpy(&family, p, 4);
+					if (family > 0xFFFF) family = __builtin_bswap32(family);
+					etherType = family == 2 ? 0x0800 : 0x86DD; // AF_INET, else one of the platforms' AF_INET6 values
+					p += 4;
+					size -= 4;
+					break;
+				}
+				case Raw:
+					if (size < 1) return false;
+					etherType = (static_cast<unsigned char>(p[0]) >> 4) == 6 ? 0x86DD : 0x0800;
+					break;
+				case Ipv4: etherType = 0x0800; break;
+				case Ipv6: etherType = 0x86DD; break;
+				default: return false;
+				}
+				if (etherType == 0x0800) return decodeIpv4(p, size, datagram);
+				if (etherType == 0x86DD) return decodeIpv6(p, size, datagram);
+				return false;
+			}
+
+			bool decodeIpv4(const char* p, size_t size, Datagram& datagram) {
+				if (size < 20 || (static_cast<unsigned char>(p[0]) >> 4) != 4) return false;
+				const size_t headerSize = (p[0] & 0x0f) * 4u;
+				const size_t total = big16(p + 2);
+				if (headerSize < 20 || total < headerSize || total > size) return false;
+				if (big16(p + 6) & 0x3fff) return false; // a fragment: more fragments follow, or an offset
+				if (p[9] != 17) return false;
+				datagram.source = boost::string_view(p + 12, 4);
+				return decodeUdp(p + headerSize, total - headerSize, datagram);
+			}
+
+			bool decodeIpv6(const char* p, size_t size, Datagram& datagram) {
+				if (size < 40 || (static_cast<unsigned char>(p[0]) >> 4) != 6) return false;
+				const size_t payload = big16(p + 4);
+				if (payload > size - 40) return false;
+				datagram.source = boost::string_view(p + 8, 16);
+				unsigned char next = static_cast<unsigned char>(p[6]);
+				const char* q = p + 40;
+				const char* end = q + payload;
+				while (next == 0 || next == 43 || next == 60) { // hop-by-hop, routing and destination options
+					if (end - q < 8) return false;
+					const size_t length = (static_cast<unsigned char>(q[1]) + 1u) * 8;
+					if (static_cast<size_t>(end - q) < length) return false;
+					next = static_cast<unsigned char>(q[0]);
+					q += length;
+				}
+				if (next != 17) return false; // not UDP, or a fragment (44)
+				return decodeUdp(q, static_cast<size_t>(end - q), datagram);
+			}
+
+			bool decodeUdp(const char* p, size_t size, Datagram& datagram) {
+				if (size < 8) return false;
+				const size_t length = big16(p + 4);
+				if (length < 8 || length > size) return false;
+				datagram.sourcePort = big16(p);
+				datagram.destinationPort = big16(p + 2);
+				if (mPort && datagram.destinationPort != mPort) return false;
+				datagram.payload = boost::string_view(p + 8, length - 8);
+				return true;
+			}
+
+			enum BlockType : uint32_t { InterfaceDescription = 1, SimplePacket = 3, EnhancedPacket = 6 };
+
+			enum : size_t { MaxRecord = 1 << 24 };
+
+			std::FILE* mFile;
+			const uint16_t mPort;
+			bool mNg, mSwap;
+			uint32_t mLinkType;	///< classic pcap
+			uint64_t mTicksPerSecond;	///< classic pcap
+			std::vector<Interface> mInterfaces;	///< pcapng, current section
+			std::vector<char> mRecord;	///< the current packet, from mRecordOffset on
+			size_t mRecordOffset;
+			std::vector<char> mBlock;	///< other pcapng blocks
+			uint64_t mPackets, mDatagrams, mSkipped;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(PcapReader);
+		};
+	}
+}
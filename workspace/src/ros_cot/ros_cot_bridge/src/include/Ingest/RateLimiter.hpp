@@ -0,0 +1,220 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <boost/utility/string_view.hpp>
+#include "Messaging/macro.h"
+#include "Utility/FastHash.hpp"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** Per-sender token buckets for received CoT datagrams, applied before any parsing.
+		*
+		*	Every datagram spends one token from its source address's bucket and one from its uid's bucket (uid as found by
+		*	CoTEventParser::ScanKey); an empty bucket drops it. A bucket refills at its Limit's rate up to its burst size,
+		*	so a sender may burst (e.g. a map sync on connect) but cannot sustain more than the rate. Source limits bound a
+		*	whole host or gateway, uid limits bound a single identity, which keeps one chatty uid behind a gateway from
+		*	starving the others.
+		*
+		*	Buckets live in a fixed-size, 4-way set-associative table. A sender not in its set takes the way that was used
+		*	least recently (approximate LRU), starting with a full bucket, so memory stays fixed however many senders there
+		*	are; with far more active senders than slots, evicted senders are effectively unlimited. Each set has its own
+		*	spinlock, so allow() may be called from any number of receive threads.
+		*
+		*	Drops are counted per bucket, and takeNoisySenders() reports the senders that lost the most traffic since it was
+		*	last called.
+		*/
+		class RateLimiter {
+		public:
+			using string_view = boost::string_view;
+
+			enum KeyKind { Source = 0, Uid, NumKeyKinds };
+
+			/// a token bucket's refill rate in datagrams per second and its size; rate <= 0 means unlimited
+			struct Limit {
+				double rate = 0;
+				double burst = 0;
+
+				Limit() {}
+				Limit(double rate, double burst) : rate(rate), burst(std::max(burst, 1.0)) {}
+				bool enabled() const { return rate > 0; }
+			};
+
+			/// a sender that had datagrams dropped
+			struct NoisySender {
+				KeyKind kind;
+				std::string name;	///< the uid, or the source address as text
+				uint64_t dropped;	///< since the previous takeNoisySenders()
+				uint64_t passed;	///< since the previous takeNoisySenders()
+			};
+
+			/**
+			*	@param sourceLimit bucket per source address
+			*	@param uidLimit bucket per uid
+			*	@param capacity buckets in the table, shared by sources and uids; rounded up to a power of two
+			*/
+			RateLimiter(const Limit& sourceLimit, const Limit& uidLimit, size_t capacity = 8192)
+				: mSetMask(roundUpPow2(std::max<size_t>(capacity / Ways, 1)) - 1),
+				mEntries((mSetMask + 1) * Ways), mLocks(mSetMask + 1) {
+				mLimits[Source] = sourceLimit;
+				mLimits[Uid] = uidLimit;
+				for (auto& l : mLocks) l.clear();
+				for (int k = 0; k < NumKeyKinds; ++k) {
+					mPassed[k].store(0, std::memory_order_relaxed);
+					mDropped[k].store(0, std::memory_order_relaxed);
+				}
+			}
+
+			/** spend a token for one datagram
+			*
+			*	@param source the sender's address bytes in network order (4 for IPv4, 16 for IPv6); empty if unknown
+			*	@param uid the event uid; empty if it could not be found
+			*	@param nowNanos receive time in nanoseconds; need not be strictly monotonic across threads
+			*	@returns false if the datagram should be dropped
+			*/
+			bool allow(string_view source, string_view uid, int64_t nowNanos) {
+				if (mLimits[Source].enabled() && !source.empty() && !spend(Source, source, nowNanos))
+					return false;
+				if (mLimits[Uid].enabled() && !uid.empty() && !spend(Uid, uid, nowNanos))
+					return false;
+				return true;
+			}
+
+			const Limit& getLimit(KeyKind kind) const { return mLimits[kind]; }
+			size_t capacity() const { return mEntries.size(); }
+
+			uint64_t getPassCount(KeyKind kind) const { return mPassed[kind].load(std::memory_order_relaxed); }
+			uint64_t getDropCount(KeyKind kind) const { return mDropped[kind].load(std::memory_order_relaxed); }
+			/// buckets given to a new sender by evicting another
+			uint64_t getEvictionCount() const { return mEvictions.load(std::memory_order_relaxed); }
+
+			/** the senders with the most drops since the previous call, most dropped first; restarts the per-sender counts
+			*
+			*	Walks the whole table, so call it at reporting rate, not per datagram.
+			*/
+			std::vector<NoisySender> takeNoisySenders(size_t max = 10) {
+				std::vector<NoisySender> senders;
+				for (size_t set = 0; set <= mSetMask; ++set) {
+					lock(set);
+					for (size_t w = 0; w < Ways; ++w) {
+						Entry& e = mEntries[set * Ways + w];
+						if (e.key && e.dropped)
+							senders.push_back(NoisySender{ e.kind, label(e), e.dropped, e.passed });
+						e.dropped = e.passed = 0;
+					}
+					unlock(set);
+				}
+				const size_t n = std::min(max, senders.size());
+				std::partial_sort(senders.begin(), senders.begin() + n, senders.end(),
+					[](const NoisySender& a, const NoisySender& b) { return a.dropped > b.dropped; });
+				senders.resize(n);
+				return senders;
+			}
+
+			static const char* toString(KeyKind kind) {
+				switch (kind) {
+				case Source: return "source";
+				case Uid: return "uid";
+				default: return "unknown";
+				}
+			}
+
+		protected:
+			static constexpr size_t Ways = 4;
+			/// bytes of a sender's name kept for reporting; longer uids are truncated in reports only
+			static constexpr size_t NameCapacity = 47;
+
+			struct Entry {
+				uint64_t key = 0;	///< hash of kind and name; 0 marks an empty way
+				int64_t lastNanos = 0;	///< last refill, also the LRU age
+				double tokens = 0;
+				uint32_t passed = 0, dropped = 0;	///< since the last takeNoisySenders()
+				KeyKind kind = Source;
+				uint8_t nameSize = 0;
+				char name[NameCapacity];
+			};
+
+			static size_t roundUpPow2(size_t n) {
+				size_t p = 1;
+				while (p < n) p <<= 1;
+				return p;
+			}
+
+			void lock(size_t set) { while (mLocks[set].test_and_set(std::memory_order_acquire)) {} }
+			void unlock(size_t set) { mLocks[set].clear(std::memory_order_release); }
+
+			bool spend(KeyKind kind, string_view name, int64_t nowNanos) {
+				uint64_t key = Utility::FastHash::hash(name.data(), name.size(), 0x9e3779b97f4a7c15ULL + kind);
+				if (!key) key = 1;
+				const Limit& limit = mLimits[kind];
+				const size_t set = static_cast<size_t>(key >> 32) & mSetMask;
+				Entry* ways = &mEntries[set * Ways];
+
+				lock(set);
+				Entry* e = nullptr;
+				Entry* victim = ways;
+				for (size_t w = 0; w < Ways; ++w) {
+					if (ways[w].key == key) {
+						e = &ways[w];
+						break;
+					}
+					if (ways[w].key == 0 || (victim->key != 0 && ways[w].lastNanos < victim->lastNanos))
+						victim = &ways[w];
+				}
+				if (e) {
+					if (nowNanos > e->lastNanos) {
+						e->tokens = std::min(limit.burst, e->tokens + (nowNanos - e->lastNanos) * 1e-9 * limit.rate);
+						e->lastNanos = nowNanos;
+					}
+				}
+				else {
+					e = victim;
+					if (e->key) mEvictions.fetch_add(1, std::memory_order_relaxed);
+					e->key = key;
+					e->lastNanos = nowNanos;
+					e->tokens = limit.burst;
+					e->passed = e->dropped = 0;
+					e->kind = kind;
+					e->nameSize = static_cast<uint8_t>(name.size() < NameCapacity ? name.size() : NameCapacity);
+					std::memcpy(e->name, name.data(), e->nameSize);
+				}
+				const bool pass = e->tokens >= 1;
+				if (pass) {
+					e->tokens -= 1;
+					++e->passed;
+				}
+				else ++e->dropped;
+				unlock(set);
+
+				(pass ? mPassed : mDropped)[kind].fetch_add(1, std::memory_order_relaxed);
+				return pass;
+			}
+
+			static std::string label(const Entry& e) {
+				if (e.kind == Source && (e.nameSize == 4 || e.nameSize == 16)) {
+					char text[INET6_ADDRSTRLEN];
+					if (inet_ntop(e.nameSize == 4 ? AF_INET : AF_INET6, e.name, text, sizeof(text)))
+						return text;
+				}
+				return std::string(e.name, e.nameSize);
+			}
+
+			Limit mLimits[NumKeyKinds];
+			const size_t mSetMask;
+			std::vector<Entry> mEntries;	///< [set * Ways + way]
+			std::vector<std::atomic_flag> mLocks;	///< [set]
+
+			std::atomic<uint64_t> mPassed[NumKeyKinds];
+			std::atomic<uint64_t> mDropped[NumKeyKinds];
+			std::atomic<uint64_t> mEvictions{ 0 };
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(RateLimiter);
+		};
+	}
+}
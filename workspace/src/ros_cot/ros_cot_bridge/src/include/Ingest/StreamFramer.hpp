@@ -0,0 +1,388 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "Messaging/TakProtocolParser.hpp"
+#include "Messaging/macro.h"
+#include "Utility/CharScan.hpp"
+
+namespace AIDTR {
+	namespace Ingest {
+
+		/** Splits a TCP byte stream of back-to-back CoT events into one slice per event.
+		*
+		*	TAK servers and gateways write events one after another with nothing between them but, at most, whitespace
+		*	and an XML declaration per event. Bytes are read straight into the framer's buffer (prepare(), then commit())
+		*	and scanned once: the framer remembers where it stopped and in what lexical state (in content, in a tag, in a
+		*	quoted attribute value, in a comment, CDATA section or processing instruction), so no byte is looked at again
+		*	however the stream is split between reads. It only tracks what it needs to find the end of the root <event>:
+		*	the nesting of <event> elements and the constructs that may hide a '<' or '>'. The event's well-formedness is
+		*	left to the parser.
+		*
+		*	Each complete event is passed to the callback as a slice of the buffer, from its <event> start tag through
+		*	its end tag, without copying; the XML declaration and comments between events are dropped. TAK Protocol
+		*	stream-framed messages (Messaging::TakProtocolParser) are recognized between events too and passed on whole,
+		*	header included.
+		*
+		*	The buffer holds at most maxEventSize bytes of a pending event plus one read. An event that grows beyond that
+		*	is discarded (Oversize). Bytes between events that cannot start one are discarded (Malformed, counted once per
+		*	run), as is a partial event interrupted by a '<' inside a tag or by a new XML declaration, which is where a
+		*	truncated event meets the next one; scanning resumes at that '<'.
+		*
+		*	Not thread-safe: one framer per connection, driven by the thread that reads it.
+		*/
+		class StreamFramer {
+		public:
+			enum Error { Oversize = 0, Malformed, NumErrors };
+
+			/**
+			*	@param maxEventSize the longest event that is buffered until complete
+			*	@param readSize the space prepare() offers by default
+			*/
+			explicit StreamFramer(size_t maxEventSize = 1 << 20, size_t readSize = 65536)
+				: mMaxEventSize(maxEventSize), mReadSize(readSize ? readSize : 1), mEvents(0), mDiscarded(0) {
+				mBuffer.resize(mReadSize);
+				reset();
+				for (auto& c : mErrors) c = 0;
+			}
+
+			/// forget any partial event, e.g. when the connection is reestablished
+			void reset() {
+				mStart = mScan = mEnd = 0;
+				mState = Between;
+				mDepth = 0;
+				mKind = OtherTag;
+				mQuote = '"';
+				mSkipping = false;
+			}
+
+			/** space to read into; invalidates slices passed to earlier callbacks
+			*
+			*	@param space receives the number of bytes that may be written, at least minSpace
+			*/
+			char* prepare(size_t& space, size_t minSpace = 0) {
+				if (minSpace == 0) minSpace = mReadSize;
+				if (mBuffer.size() - mEnd < minSpace) {
+					if (mStart > 0) {
+						std::memmove(mBuffer.data(), mBuffer.data() + mStart, mEnd - mStart);
+						mScan -= mStart;
+						mEnd -= mStart;
+						mStart = 0;
+					}
+					if (mBuffer.size() - mEnd < minSpace) mBuffer.resize(mEnd + minSpace);
+				}
+				space = mBuffer.size() - mEnd;
+				return mBuffer.data() + mEnd;
+			}
+
+			/** take n bytes written into the space from prepare() and pass every event they complete to
+			*	onEvent(const char* data, size_t size), oldest first
+			*
+			*	@returns the number of events passed on
+			*/
+			template <typename F>
+			size_t commit(size_t n, F&& onEvent) {
+				mEnd += n;
+				return scan(onEvent);
+			}
+
+			/// copy size bytes in and frame them, as prepare() and commit()
+			template <typename F>
+			size_t feed(const char* data, size_t size, F&& onEvent) {
+				size_t events = 0;
+				while (size > 0) {
+					size_t space;
+					char* p = prepare(space, std::min(size, mReadSize));
+					const size_t n = std::min(space, size);
+					std::memcpy(p, data, n);
+					events += commit(n, onEvent);
+					data += n;
+					size -= n;
+				}
+				return events;
+			}
+
+			/// bytes held for an event not yet complete
+			size_t getBuffered() const { return mEnd - mStart; }
+			uint64_t getEventCount() const { return mEvents; }
+			/// bytes dropped as malformed or oversize
+			uint64_t getDiscardedBytes() const { return mDiscarded; }
+			uint64_t getErrorCount(Error error) const { return mErrors[error]; }
+
+			static const char* toString(Error error) {
+				switch (error) {
+				case Oversize: return "oversize";
+				case Malformed: return "malformed";
+				default: return "unknown";
+				}
+			}
+
+		protected:
+			enum State : uint8_t { Between, Content, Tag, Quoted, Comment, CData, Instruction, Declaration };
+
+			/// what the tag being scanned does to the <event> nesting
+			enum TagKind : uint8_t { OtherTag, EventStart, EventEnd };
+
+			enum Match { No = 0, Yes, NeedMore };
+
+			/// whether [p, end) starts with literal[0, n)
+			static Match match(const char* p, const char* end, const char* literal, size_t n) {
+				const size_t available = static_cast<size_t>(end - p);
+				if (std::memcmp(p, literal, std::min(available, n)) != 0) return No;
+				return available < n ? NeedMore : Yes;
+			}
+
+			/// whether [p, end) starts with literal[0, n) followed by the end of an element name
+			static Match matchName(const char* p, const char* end, const char* literal, size_t n) {
+				const Match m = match(p, end, literal, n);
+				if (m != Yes) return m;
+				if (end - p == static_cast<ptrdiff_t>(n)) return NeedMore;
+				const char c = p[n];
+				return c == '>' || c == '/' || Utility::CharScan::isSpace(c) ? Yes : No;
+			}
+
+			/// drop everything from the pending event's start to p and look for the next event at p
+			void resync(const char* base, const char* p, Error error) {
+				mDiscarded += static_cast<size_t>(p - base) - mStart;
+				if (!mSkipping) ++mErrors[error];
+				mSkipping = true;
+				mStart = static_cast<size_t>(p - base);
+				mState = Between;
+				mDepth = 0;
+			}
+
+			template <typename F>
+			size_t scan(F& onEvent) {
+				using namespace Utility::CharScan;
+				const char* base = mBuffer.data();
+				const char* end = base + mEnd;
+				const char* p = base + mScan;
+				size_t events = 0;
+				auto emit = [&](const char* begin, const char* last) {
+					onEvent(begin, static_cast<size_t>(last - begin));
+					++events;
+					++mEvents;
+					mStart = static_cast<size_t>(last - base);
+					mState = Between;
+					mDepth = 0;
+					mSkipping = false;
+				};
+				while (p < end) {
+					const char* q;
+					Match m;
+					switch (mState) {
+					case Between: // at the top level, nothing pending
+						p = skipSpace(p, end);
+						mStart = static_cast<size_t>(p - base);
+						if (p == end) break;
+						if (static_cast<unsigned char>(*p) == Messaging::TakProtocolParser::Magic) {
+							size_t headerSize, messageSize;
+							const auto status = Messaging::TakProtocolParser::ReadStreamHeader(p, static_cast<size_t>(end - p),
+								headerSize, messageSize, mMaxEventSize);
+							if (status == Messaging::TakProtocolParser::Invalid) {
+								++p;
+								resync(base, p, Malformed);
+								continue;
+							}
+							if (status == Messaging::TakProtocolParser::Incomplete || static_cast<size_t>(end - p) < headerSize + messageSize)
+								goto wait; // re-reading a header of at most 11 bytes keeps the scan linear
+							emit(p, p + headerSize + messageSize);
+							p += headerSize + messageSize;
+							continue;
+						}
+						if (*p != '<') {
+							p = findEither(p, end, '<', static_cast<char>(Messaging::TakProtocolParser::Magic));
+							resync(base, p, Malformed);
+							continue;
+						}
+						if ((m = matchName(p, end, "<event", 6)) == Yes) {
+							mState = Tag;
+							mKind = EventStart;
+							p += 6;
+						}
+						else if (m == NeedMore) goto wait;
+						else if ((m = match(p, end, "<!--", 4)) == Yes) {
+							mState = Comment;
+							p += 4;
+						}
+						else if (m == NeedMore) goto wait;
+						else if ((m = match(p, end, "<?", 2)) == Yes) {
+							mState = Instruction;
+							p += 2;
+						}
+						else if (m == NeedMore) goto wait;
+						else if ((m = match(p, end, "<!", 2)) == Yes) {
+							mState = Declaration;
+							p += 2;
+						}
+						else if (m == NeedMore) goto wait;
+						else {
+							++p;
+							resync(base, p, Malformed);
+							continue;
+						}
+						mSkipping = false;
+						continue;
+					case Content: // inside an <event>
+						p = find(p, end, '<');
+						if (p == end) break;
+						if ((m = matchName(p, end, "</event", 7)) == Yes) {
+							mState = Tag;
+							mKind = EventEnd;
+							p += 7;
+						}
+						else if (m == NeedMore) goto wait;
+						else if ((m = matchName(p, end, "<event", 6)) == Yes) {
+							mState = Tag;
+							mKind = EventStart;
+							p += 6;
+						}
+						else if (m == NeedMore) goto wait;
+						else if ((m = match(p, end, "<?xml", 5)) == Yes)
+							resync(base, p, Malformed); // the next document began before this one ended
+						else if (m == NeedMore) goto wait;
+						else if ((m = match(p, end, "<!--", 4)) == Yes) {
+							mState = Comment;
+							p += 4;
+						}
+						else if (m == NeedMore) goto wait;
+						else if ((m = match(p, end, "<![CDATA[", 9)) == Yes) {
+							mState = CData;
+							p += 9;
+						}
+						else if (m == NeedMore) goto wait;
+						else if ((m = match(p, end, "<?", 2)) == Yes) {
+							mState = Instruction;
+							p += 2;
+						}
+						else if (m == NeedMore) goto wait;
+						else if ((m = match(p, end, "<!", 2)) == Yes) {
+							mState = Declaration;
+							p += 2;
+						}
+						else if (m == NeedMore) goto wait;
+						else {
+							mState = Tag;
+							mKind = OtherTag;
+							++p;
+						}
+						continue;
+					case Tag: // between the element name and the closing '>'
+						q = findAnyOf(p, end, '>', '"', '\'', '<');
+						if (q == end) {
+							p = end;
+							break;
+						}
+						if (*q == '<') {
+							resync(base, q, Malformed);
+							p = q;
+						}
+						else if (*q != '>') {
+							mQuote = *q;
+							mState = Quoted;
+							p = q + 1;
+						}
+						else {
+							p = q + 1;
+							const bool selfClosing = q[-1] == '/';
+							if (mKind == EventStart && !selfClosing) ++mDepth;
+							else if (mKind == EventEnd) --mDepth;
+							if (mDepth == 0 && mKind != OtherTag) emit(base + mStart, p);
+							else mState = Content;
+						}
+						continue;
+					case Quoted:
+						q = findEither(p, end, mQuote, '<');
+						if (q == end) {
+							p = end;
+							break;
+						}
+						if (*q == '<') {
+							resync(base, q, Malformed);
+							p = q;
+						}
+						else {
+							mState = Tag;
+							p = q + 1;
+						}
+						continue;
+					case Comment:
+						q = findString(p, end, "-->", 3);
+						if (q == end) {
+							p = std::max(p, end - 2); // a split terminator is found whole next time
+							goto wait;
+						}
+						p = q + 3;
+						afterMarkup(base, p);
+						continue;
+					case CData:
+						q = findString(p, end, "]]>", 3);
+						if (q == end) {
+							p = std::max(p, end - 2);
+							goto wait;
+						}
+						p = q + 3;
+						afterMarkup(base, p);
+						continue;
+					case Instruction:
+						q = findString(p, end, "?>", 2);
+						if (q == end) {
+							p = std::max(p, end - 1);
+							goto wait;
+						}
+						p = q + 2;
+						afterMarkup(base, p);
+						continue;
+					case Declaration:
+						q = find(p, end, '>');
+						if (q == end) {
+							p = end;
+							break;
+						}
+						p = q + 1;
+						afterMarkup(base, p);
+						continue;
+					}
+					break;
+				}
+			wait:
+				mScan = static_cast<size_t>(p - base);
+				if (mEnd - mStart > mMaxEventSize) {
+					resync(base, end, Oversize);
+					mScan = mEnd;
+				}
+				return events;
+			}
+
+			/// a comment, CDATA section, processing instruction or declaration ended just before p
+			void afterMarkup(const char* base, const char* p) {
+				if (mDepth > 0) {
+					mState = Content;
+				}
+				else {
+					mState = Between;
+					mStart = static_cast<size_t>(p - base); // markup between events is not passed on
+					mSkipping = false;
+				}
+			}
+
+			const size_t mMaxEventSize, mReadSize;
+			std::vector<char> mBuffer;
+			size_t mStart;	///< where the pending event (or whatever is being scanned between events) begins
+			size_t mScan;	///< where scanning resumes
+			size_t mEnd;	///< end of the bytes read
+			State mState;
+			TagKind mKind;
+			char mQuote;
+			unsigned mDepth;	///< <event> elements open
+			bool mSkipping;	///< discarding; further discards are the same error
+
+			uint64_t mEvents, mDiscarded;
+			uint64_t mErrors[NumErrors];
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(StreamFramer);
+		};
+	}
+}
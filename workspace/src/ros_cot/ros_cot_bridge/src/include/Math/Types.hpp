@@ -216,8 +216,8 @@ namespace ARL {
 			EulerAngles3D(const Quaternion& quaternion) {
 				auto eulerAngles = quaternion.toRotationMatrix().eulerAngles(2,1,0);
 				pitch = eulerAngles[2]; roll = eulerAngles[1], yaw = -eulerAngles[0];
-				if (pitch > 0.5*pi) {
-					pitch = -pi + pitch; // map [0,pi) to [-pi/2,pi)
+				if (pitch > 0.5*pi || pitch < -0.5*pi) {
+					pitch += pitch > 0 ? -pi : pi; // map (pi/2,pi] and [-pi,-pi/2) to [-pi/2,pi/2]
 					assert(-0.5*pi <= pitch && pitch <= 0.5*pi);
 					if (roll < 0)
 						roll = -pi - roll;
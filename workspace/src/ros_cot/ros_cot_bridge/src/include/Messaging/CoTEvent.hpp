@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <boost/utility/string_view.hpp>
+
+namespace Messaging {
+
+	/** A flat, allocation-free view of one received CoT event.
+	*
+	*	String fields are views into the datagram the event was parsed from, so a CoTEvent is only valid for as long as
+	*	that buffer is. Attribute values are raw: XML entities (e.g. &amp;) are left as they appear on the wire; use
+	*	CoTEvent::unescape to obtain a decoded copy. Numeric fields that were absent or malformed are NaN (doubles) or
+	*	CoTEvent::NoTime (timestamps).
+	*/
+	struct CoTEvent {
+		using string_view = boost::string_view;
+
+		static constexpr int64_t NoTime = std::numeric_limits<int64_t>::min();
+
+		/// groups of well-known <detail> fields, for choosing which of them CoTEventParser fills
+		enum DetailFields : unsigned {
+			NoDetail = 0,
+			Contact = 1 << 0,	///< callsign, endpoint
+			Group = 1 << 1,	///< groupName, groupRole
+			Track = 1 << 2,	///< course, speed
+			AllDetail = Contact | Group | Track
+		};
+
+		string_view raw;	///< the whole datagram the event was parsed from
+		int64_t receivedNanos = NoTime;	///< when the datagram reached this host (kernel timestamp where available), nanoseconds since the Unix epoch
+
+		// <event> attributes
+		string_view version;
+		string_view uid;
+		string_view type;
+		string_view how;
+		string_view access;
+		string_view qos;
+		string_view opex;
+		int64_t time = NoTime;	///< microseconds since the Unix epoch, UTC
+		int64_t start = NoTime;	///< microseconds since the Unix epoch, UTC
+		int64_t stale = NoTime;	///< microseconds since the Unix epoch, UTC
+
+		// <point> attributes
+		double lat = std::numeric_limits<double>::quiet_NaN();
+		double lon = std::numeric_limits<double>::quiet_NaN();
+		double hae = std::numeric_limits<double>::quiet_NaN();
+		double ce = std::numeric_limits<double>::quiet_NaN();
+		double le = std::numeric_limits<double>::quiet_NaN();
+
+		// <detail> subtree: raw bytes between <detail> and </detail>, plus the commonly used fields. Only the groups in
+		// detailParsed have been looked for; the rest are filled on demand by CoTEventParser::ParseDetail.
+		string_view detail;
+		unsigned detailParsed = NoDetail;	///< DetailFields bits already parsed from detail
+		string_view callsign;	///< contact@callsign
+		string_view endpoint;	///< contact@endpoint
+		string_view groupName;	///< __group@name
+		string_view groupRole;	///< __group@role
+		double course = std::numeric_limits<double>::quiet_NaN();	///< track@course, degrees true
+		double speed = std::numeric_limits<double>::quiet_NaN();	///< track@speed, meters per second
+
+		void clear() { *this = CoTEvent(); }
+
+		bool hasPoint() const { return lat == lat && lon == lon; }
+
+		/// @returns a copy of a raw attribute value with the five predefined XML entities decoded
+		static std::string unescape(string_view raw) {
+			std::string s;
+			s.reserve(raw.size());
+			for (size_t i = 0; i < raw.size(); ++i) {
+				if (raw[i] != '&') { s.push_back(raw[i]); continue; }
+				string_view rest = raw.substr(i);
+				if (rest.starts_with("&amp;")) { s.push_back('&'); i += 4; }
+				else if (rest.starts_with("&lt;")) { s.push_back('<'); i += 3; }
+				else if (rest.starts_with("&gt;")) { s.push_back('>'); i += 3; }
+				else if (rest.starts_with("&quot;")) { s.push_back('"'); i += 5; }
+				else if (rest.starts_with("&apos;")) { s.push_back('\''); i += 5; }
+				else s.push_back('&');
+			}
+			return s;
+		}
+
+		/// @returns a copy of text with the characters that may not appear in an attribute value as XML entities
+		static std::string escape(string_view text) {
+			std::string s;
+			s.reserve(text.size());
+			for (const char c : text) {
+				switch (c) {
+				case '&': s += "&amp;"; break;
+				case '<': s += "&lt;"; break;
+				case '>': s += "&gt;"; break;
+				case '"': s += "&quot;"; break;
+				case '\'': s += "&apos;"; break;
+				default: s.push_back(c);
+				}
+			}
+			return s;
+		}
+	};
+}
@@ -0,0 +1,440 @@
+#pragma once
+#include "CoTEvent.hpp"
+#include "Utility/CharScan.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace Messaging {
+
+	/** In-situ parser for CoT <event> datagrams.
+	*
+	*	Unlike XmlDecoder, which builds a full Xerces DOMDocument per datagram, CoTEventParser walks the bytes once and
+	*	fills a flat CoTEvent whose string fields point back into the input buffer. It is not a general XML parser: it
+	*	understands exactly the shape of a CoT event (an <event> root, a <point> child and an optional <detail> subtree),
+	*	skips the prolog, comments and CDATA, and rejects anything it cannot make sense of.
+	*
+	*	The <event> and <point> attributes are always decoded. The <detail> subtree, which is usually most of an ATAK
+	*	datagram, is located and kept as a byte range, and only the field groups asked for are parsed out of it; the
+	*	rest can be parsed later with ParseDetail, or looked up one attribute at a time with FindDetailAttribute.
+	*
+	*	The input need not be NUL-terminated and is never modified.
+	*/
+	class CoTEventParser {
+	public:
+		using string_view = boost::string_view;
+
+		/** parse one CoT event
+		*
+		*	@param data the datagram payload; must outlive the views stored in event
+		*	@param size length of data in bytes
+		*	@param event receives the parsed fields; it is cleared first
+		*	@param detailFields CoTEvent::DetailFields to parse from <detail> now. The subtree is only checked for well
+		*	formedness as far as these are parsed, so with NoDetail a malformed detail is not reported until ParseDetail.
+		*	@returns true iff an <event> element with a uid was found and its tags were well formed
+		*/
+		static bool Parse(const char* data, size_t size, CoTEvent& event, unsigned detailFields = CoTEvent::AllDetail) {
+			event.clear();
+			event.raw = string_view(data, size);
+			const char* end = data + size;
+			const char* p = findEventTag(data, end);
+			if (!p) return false;
+
+			bool selfClosing = false;
+			p = parseAttributes(p + 6, end, selfClosing, [&event](string_view name, string_view value) {
+				setEventAttribute(event, name, value);
+			});
+			if (!p) return false;
+			if (selfClosing) return !event.uid.empty();
+
+			// children of <event>
+			for (;;) {
+				p = Utility::CharScan::find(p, end, '<');
+				if (end - p < 2) return false; // unterminated event
+				if (p[1] == '/') {
+					if (nameIs(p + 2, end, "event", 5)) return !event.uid.empty();
+					p = Utility::CharScan::find(p, end, '>');
+					continue;
+				}
+				if (p[1] == '?' || p[1] == '!') {
+					p = skipMarkup(p, end);
+					if (!p) return false;
+					continue;
+				}
+				if (nameIs(p + 1, end, "point", 5)) {
+					p = parseAttributes(p + 6, end, selfClosing, [&event](string_view name, string_view value) {
+						setPointAttribute(event, name, value);
+					});
+				}
+				else if (nameIs(p + 1, end, "detail", 6)) {
+					p = parseAttributes(p + 7, end, selfClosing, ignoreAttribute);
+					if (p && !selfClosing) {
+						const char* detailEnd = Utility::CharScan::findString(p, end, "</detail", 8);
+						if (detailEnd == end) return false;
+						event.detail = string_view(p, static_cast<size_t>(detailEnd - p));
+						if (detailFields && !parseDetail(p, detailEnd, event, detailFields)) return false;
+						event.detailParsed = detailFields;
+						p = Utility::CharScan::find(detailEnd, end, '>');
+					}
+				}
+				else {
+					p = skipStartTag(p + 1, end, selfClosing);
+				}
+				if (!p) return false;
+			}
+		}
+
+		/** pre-parse fast path: read only the uid and time attributes of the <event> start tag
+		*
+		*	Used to key datagrams (deduplication, rate limiting, routing) before committing to a full Parse.
+		*	@returns true iff the start tag was well formed and carried a uid; time is left empty if absent
+		*/
+		static bool ScanKey(const char* data, size_t size, string_view& uid, string_view& time) {
+			uid.clear();
+			time.clear();
+			const char* end = data + size;
+			const char* p = findEventTag(data, end);
+			if (!p) return false;
+			bool selfClosing = false;
+			p = parseAttributes(p + 6, end, selfClosing, [&uid, &time](string_view name, string_view value) {
+				if (name == "uid") uid = value;
+				else if (name == "time") time = value;
+			});
+			return p && !uid.empty();
+		}
+
+		/** parse the groups of well-known detail fields that Parse left out
+		*
+		*	@param event an event filled by Parse, whose input buffer is still valid
+		*	@param fields CoTEvent::DetailFields wanted; groups already in event.detailParsed are not parsed again
+		*	@returns false if the detail subtree is malformed
+		*/
+		static bool ParseDetail(CoTEvent& event, unsigned fields = CoTEvent::AllDetail) {
+			const unsigned wanted = fields & ~event.detailParsed;
+			if (!wanted) return true;
+			event.detailParsed |= wanted;
+			if (event.detail.empty()) return true;
+			return parseDetail(event.detail.data(), event.detail.data() + event.detail.size(), event, wanted);
+		}
+
+		/** look up one attribute of the first detail child element with the given name, without parsing anything else
+		*
+		*	For fields not covered by CoTEvent::DetailFields, e.g. FindDetailAttribute(event.detail, "takv", "platform").
+		*	@returns the raw attribute value, or an empty view if the element or attribute is absent
+		*/
+		static string_view FindDetailAttribute(string_view detail, string_view element, string_view attribute) {
+			const char* p = detail.data();
+			const char* end = p + detail.size();
+			bool selfClosing = false;
+			for (;;) {
+				p = Utility::CharScan::find(p, end, '<');
+				if (end - p < 2) return string_view();
+				if (p[1] == '/') {
+					p = Utility::CharScan::find(p, end, '>');
+					continue;
+				}
+				if (p[1] == '?' || p[1] == '!') {
+					p = skipMarkup(p, end);
+					if (!p) return string_view();
+					continue;
+				}
+				if (nameIs(p + 1, end, element.data(), element.size())) {
+					string_view found;
+					p = parseAttributes(p + 1 + element.size(), end, selfClosing, [&](string_view name, string_view value) {
+						if (name == attribute && found.empty()) found = value;
+					});
+					return found;
+				}
+				p = skipStartTag(p + 1, end, selfClosing);
+				if (!p) return string_view();
+			}
+		}
+
+		/** parse a decimal floating point attribute value
+		*
+		*	Handles [sign] digits [. digits] [e|E [sign] digits] directly; anything longer or unusual is handed to strtod.
+		*	@returns true iff the whole of s was consumed; out is NaN otherwise.
+		*/
+		static bool ParseDouble(string_view s, double& out) {
+			static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+				1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+			out = std::numeric_limits<double>::quiet_NaN();
+			const char* p = s.data();
+			const char* end = p + s.size();
+			if (p == end) return false;
+
+			bool negative = false;
+			if (*p == '-' || *p == '+') negative = (*p++ == '-');
+
+			uint64_t mantissa = 0;
+			int digits = 0, fractionDigits = 0;
+			for (; p < end && unsigned(*p - '0') < 10; ++p, ++digits)
+				mantissa = mantissa * 10 + unsigned(*p - '0');
+			if (p < end && *p == '.') {
+				for (++p; p < end && unsigned(*p - '0') < 10; ++p, ++digits, ++fractionDigits)
+					mantissa = mantissa * 10 + unsigned(*p - '0');
+			}
+			if (digits == 0) return slowParseDouble(s, out);
+
+			int exponent = 0;
+			if (p < end && (*p == 'e' || *p == 'E')) {
+				++p;
+				bool negativeExponent = false;
+				if (p < end && (*p == '-' || *p == '+')) negativeExponent = (*p++ == '-');
+				if (p == end || unsigned(*p - '0') >= 10) return false;
+				for (; p < end && unsigned(*p - '0') < 10 && exponent < 1000; ++p)
+					exponent = exponent * 10 + (*p - '0');
+				if (negativeExponent) exponent = -exponent;
+			}
+			if (p != end) return false;
+
+			exponent -= fractionDigits;
+			if (digits > 19 || exponent < -22 || exponent > 22) return slowParseDouble(s, out);
+
+			double v = static_cast<double>(mantissa);
+			v = exponent < 0 ? v / pow10[-exponent] : v * pow10[exponent];
+			out = negative ? -v : v;
+			return true;
+		}
+
+		/** parse a CoT xs:dateTime value, e.g. 2020-03-12T18:05:41.332Z
+		*
+		*	@returns microseconds since the Unix epoch (UTC), or CoTEvent::NoTime if s is not a valid timestamp
+		*/
+		static int64_t ParseTime(string_view s) {
+			const char* p = s.data();
+			const size_t n = s.size();
+			if (n < 19 || p[4] != '-' || p[7] != '-' || (p[10] != 'T' && p[10] != ' ') || p[13] != ':' || p[16] != ':')
+				return CoTEvent::NoTime;
+			int year, month, day, hour, minute, second;
+			if (!digitsAt(p, 0, 4, year) || !digitsAt(p, 5, 2, month) || !digitsAt(p, 8, 2, day) ||
+				!digitsAt(p, 11, 2, hour) || !digitsAt(p, 14, 2, minute) || !digitsAt(p, 17, 2, second))
+				return CoTEvent::NoTime;
+			if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+				return CoTEvent::NoTime;
+
+			size_t i = 19;
+			int64_t micros = 0;
+			if (i < n && p[i] == '.') {
+				int64_t scale = 100000;
+				for (++i; i < n && unsigned(p[i] - '0') < 10; ++i) {
+					micros += (p[i] - '0') * scale;
+					scale /= 10;
+				}
+			}
+			int64_t offsetSeconds = 0;
+			if (i < n && (p[i] == '+' || p[i] == '-')) {
+				int oh, om;
+				if (n - i < 6 || p[i + 3] != ':' || !digitsAt(p, i + 1, 2, oh) || !digitsAt(p, i + 4, 2, om))
+					return CoTEvent::NoTime;
+				offsetSeconds = (p[i] == '-' ? -1 : 1) * (oh * 3600 + om * 60);
+				i += 6;
+			}
+			else if (i < n && p[i] == 'Z') ++i;
+			if (i != n) return CoTEvent::NoTime;
+
+			int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offsetSeconds;
+			return seconds * 1000000 + micros;
+		}
+
+	protected:
+		/** parse the detail subtree of an event, filling the well-known fields in the given groups
+		*
+		*	Stops as soon as one element of every wanted group has been seen.
+		*	@param begin first byte after <detail>
+		*	@param end the '<' of </detail>
+		*	@param fields CoTEvent::DetailFields to fill
+		*/
+		static bool parseDetail(const char* begin, const char* end, CoTEvent& event, unsigned fields) {
+			const char* p = begin;
+			bool selfClosing = false;
+			while (fields) {
+				p = Utility::CharScan::find(p, end, '<');
+				if (end - p < 2) return true;
+				if (p[1] == '/') {
+					p = Utility::CharScan::find(p, end, '>');
+					continue;
+				}
+				if (p[1] == '?' || p[1] == '!') {
+					p = skipMarkup(p, end);
+					if (!p) return false;
+					continue;
+				}
+				if ((fields & CoTEvent::Contact) && nameIs(p + 1, end, "contact", 7)) {
+					fields &= ~CoTEvent::Contact;
+					p = parseAttributes(p + 8, end, selfClosing, [&event](string_view name, string_view value) {
+						if (name == "callsign") event.callsign = value;
+						else if (name == "endpoint") event.endpoint = value;
+					});
+				}
+				else if ((fields & CoTEvent::Group) && nameIs(p + 1, end, "__group", 7)) {
+					fields &= ~CoTEvent::Group;
+					p = parseAttributes(p + 8, end, selfClosing, [&event](string_view name, string_view value) {
+						if (name == "name") event.groupName = value;
+						else if (name == "role") event.groupRole = value;
+					});
+				}
+				else if ((fields & CoTEvent::Track) && nameIs(p + 1, end, "track", 5)) {
+					fields &= ~CoTEvent::Track;
+					p = parseAttributes(p + 6, end, selfClosing, [&event](string_view name, string_view value) {
+						if (name == "course") ParseDouble(value, event.course);
+						else if (name == "speed") ParseDouble(value, event.speed);
+					});
+				}
+				else {
+					p = skipStartTag(p + 1, end, selfClosing);
+				}
+				if (!p) return false;
+			}
+			return true;
+		}
+
+		static void setEventAttribute(CoTEvent& event, string_view name, string_view value) {
+			switch (name.size()) {
+			case 3:
+				if (name == "uid") event.uid = value;
+				else if (name == "how") event.how = value;
+				else if (name == "qos") event.qos = value;
+				break;
+			case 4:
+				if (name == "type") event.type = value;
+				else if (name == "time") event.time = ParseTime(value);
+				else if (name == "opex") event.opex = value;
+				break;
+			case 5:
+				if (name == "start") event.start = ParseTime(value);
+				else if (name == "stale") event.stale = ParseTime(value);
+				break;
+			case 6:
+				if (name == "access") event.access = value;
+				break;
+			case 7:
+				if (name == "version") event.version = value;
+				break;
+			}
+		}
+
+		static void setPointAttribute(CoTEvent& event, string_view name, string_view value) {
+			if (name.size() == 2) {
+				if (name == "ce") ParseDouble(value, event.ce);
+				else if (name == "le") ParseDouble(value, event.le);
+			}
+			else if (name.size() == 3) {
+				if (name == "lat") ParseDouble(value, event.lat);
+				else if (name == "lon") ParseDouble(value, event.lon);
+				else if (name == "hae") ParseDouble(value, event.hae);
+			}
+		}
+
+		static void ignoreAttribute(string_view, string_view) {}
+
+		/// @returns pointer to the '<' of the root <event> start tag, skipping the prolog and any comments
+		static const char* findEventTag(const char* p, const char* end) {
+			for (;;) {
+				p = Utility::CharScan::find(p, end, '<');
+				if (end - p < 7) return nullptr;
+				if (p[1] == '?' || p[1] == '!') {
+					p = skipMarkup(p, end);
+					if (!p) return nullptr;
+					continue;
+				}
+				return nameIs(p + 1, end, "event", 5) ? p : nullptr;
+			}
+		}
+
+		/// @returns true iff the element name starting at p is exactly name[0, n)
+		static bool nameIs(const char* p, const char* end, const char* name, size_t n) {
+			if (static_cast<size_t>(end - p) <= n || std::memcmp(p, name, n) != 0) return false;
+			char c = p[n];
+			return c == '>' || c == '/' || Utility::CharScan::isSpace(c);
+		}
+
+		/** walk the attributes of a start tag, invoking onAttribute(name, value) for each
+		*
+		*	@param p first byte after the element name
+		*	@returns pointer to the first byte after the tag, or nullptr if the tag is malformed
+		*/
+		template <typename F>
+		static const char* parseAttributes(const char* p, const char* end, bool& selfClosing, F&& onAttribute) {
+			for (;;) {
+				p = Utility::CharScan::skipSpace(p, end);
+				if (p >= end) return nullptr;
+				if (*p == '>') {
+					selfClosing = false;
+					return p + 1;
+				}
+				if (*p == '/') {
+					if (end - p < 2 || p[1] != '>') return nullptr;
+					selfClosing = true;
+					return p + 2;
+				}
+				const char* nameBegin = p;
+				p = Utility::CharScan::findEither(p, end, '=', '>');
+				if (p == end || *p == '>') return nullptr;
+				const char* nameEnd = p;
+				while (nameEnd > nameBegin && Utility::CharScan::isSpace(nameEnd[-1])) --nameEnd;
+				p = Utility::CharScan::skipSpace(p + 1, end);
+				if (p >= end || (*p != '"' && *p != '\'')) return nullptr;
+				const char* valueBegin = p + 1;
+				const char* valueEnd = Utility::CharScan::find(valueBegin, end, *p);
+				if (valueEnd == end) return nullptr;
+				onAttribute(string_view(nameBegin, static_cast<size_t>(nameEnd - nameBegin)),
+					string_view(valueBegin, static_cast<size_t>(valueEnd - valueBegin)));
+				p = valueEnd + 1;
+			}
+		}
+
+		/// skip an uninteresting start tag; p is the first byte of its name
+		static const char* skipStartTag(const char* p, const char* end, bool& selfClosing) {
+			while (p < end && *p != '>' && *p != '/' && !Utility::CharScan::isSpace(*p)) ++p;
+			return parseAttributes(p, end, selfClosing, ignoreAttribute);
+		}
+
+		/// skip <?...?>, <!--...-->, <![CDATA[...]]> and <!DOCTYPE ...>; p points at the '<'
+		static const char* skipMarkup(const char* p, const char* end) {
+			const char* r;
+			if (end - p >= 4 && std::memcmp(p, "<!--", 4) == 0) {
+				r = Utility::CharScan::findString(p + 4, end, "-->", 3);
+				return r == end ? nullptr : r + 3;
+			}
+			if (end - p >= 9 && std::memcmp(p, "<![CDATA[", 9) == 0) {
+				r = Utility::CharScan::findString(p + 9, end, "]]>", 3);
+				return r == end ? nullptr : r + 3;
+			}
+			r = Utility::CharScan::find(p, end, '>');
+			return r == end ? nullptr : r + 1;
+		}
+
+		static bool digitsAt(const char* p, size_t offset, int count, int& out) {
+			out = 0;
+			for (int i = 0; i < count; ++i) {
+				unsigned d = unsigned(p[offset + i] - '0');
+				if (d >= 10) return false;
+				out = out * 10 + int(d);
+			}
+			return true;
+		}
+
+		/// days since 1970-01-01 of a proleptic Gregorian date (H. Hinnant's days_from_civil)
+		static int64_t daysFromCivil(int y, int m, int d) {
+			y -= m <= 2;
+			const int64_t era = (y >= 0 ? y : y - 399) / 400;
+			const unsigned yoe = static_cast<unsigned>(y - era * 400);
+			const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+			const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+			return era * 146097 + static_cast<int64_t>(doe) - 719468;
+		}
+
+		static bool slowParseDouble(string_view s, double& out) {
+			char buffer[64];
+			if (s.size() >= sizeof(buffer)) return false;
+			std::memcpy(buffer, s.data(), s.size());
+			buffer[s.size()] = '\0';
+			char* parsedEnd = nullptr;
+			double v = std::strtod(buffer, &parsedEnd);
+			if (parsedEnd != buffer + s.size()) return false;
+			out = v;
+			return true;
+		}
+	};
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <boost/utility/string_view.hpp>
+#include "CoTEvent.hpp"
+#include "Messaging/macro.h"
+
+namespace Messaging {
+
+	/** Encodes CoT position reports as XML text straight into a reused buffer, without building a DOM.
+	*
+	*	This is the sending counterpart of CoTEventParser, for when many reports must be sent cheaply (one writer serves
+	*	any number of identities). The output carries the same <event> and <point> attributes as CoTClient's reports,
+	*	with millisecond timestamps, and a <detail> holding <track course= speed=/> when a course is given.
+	*
+	*	String fields are written as given, so they must already be XML-escaped (CoTEvent::escape): identities are
+	*	escaped once, when they are configured, not on every report. The text of the last second's timestamps is cached,
+	*	so reports written within the same second only format their milliseconds. Not thread-safe; use a writer per thread.
+	*/
+	class CoTEventWriter {
+	public:
+		using string_view = boost::string_view;
+
+		/// written for an unknown hae, ce or le, as CoT expects
+		static constexpr double Unknown = 9999999.0;
+
+		struct Report {
+			string_view uid, type;	///< XML-escaped
+			string_view how = "m-g";
+			bool simulation = false;	///< opex "s" rather than "e"
+			int64_t timeMicros = 0;	///< time and start, microseconds since the Unix epoch
+			int64_t staleMicros = 0;
+			double lat = 0, lon = 0;
+			double hae = Unknown, ce = Unknown, le = Unknown;	///< meters; NaN is written as Unknown
+			double course = std::numeric_limits<double>::quiet_NaN();	///< degrees true; no <track> when NaN
+			double speed = std::numeric_limits<double>::quiet_NaN();	///< meters per second
+			string_view detail;	///< more <detail> children, as XML
+		};
+
+		CoTEventWriter() {
+			mBuffer.reserve(512);
+		}
+
+		/** encode a report
+		*
+		*	@returns the encoded event, valid until the next write
+		*/
+		string_view write(const Report& report) {
+			mBuffer.clear();
+			mBuffer += "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?><event version=\"2.0\" uid=\"";
+			append(report.uid);
+			mBuffer += "\" type=\"";
+			append(report.type);
+			mBuffer += "\" time=\"";
+			appendTime(report.timeMicros, mTimeCache);
+			const size_t timeBegin = mBuffer.size() - TimeLength;
+			mBuffer += "\" start=\"";
+			mBuffer.append(mBuffer, timeBegin, TimeLength);
+			mBuffer += "\" stale=\"";
+			appendTime(report.staleMicros, mStaleCache);
+			mBuffer += "\" how=\"";
+			append(report.how);
+			mBuffer += "\" access=\"unrestricted\" qos=\"7-r-c\" opex=\"";
+			mBuffer += report.simulation ? "s" : "e";
+			mBuffer += "\"><point lat=\"";
+			appendNumber(report.lat, 7);
+			mBuffer += "\" lon=\"";
+			appendNumber(report.lon, 7);
+			mBuffer += "\" hae=\"";
+			appendNumber(report.hae == report.hae ? report.hae : Unknown, 3);
+			mBuffer += "\" ce=\"";
+			appendNumber(report.ce == report.ce ? report.ce : Unknown, 2);
+			mBuffer += "\" le=\"";
+			appendNumber(report.le == report.le ? report.le : Unknown, 2);
+			mBuffer += "\"/><detail>";
+			if (report.course == report.course) {
+				mBuffer += "<track course=\"";
+				appendNumber(report.course, 2);
+				mBuffer += "\" speed=\"";
+				appendNumber(report.speed == report.speed ? report.speed : 0.0, 2);
+				mBuffer += "\"/>";
+			}
+			append(report.detail);
+			mBuffer += "</detail></event>";
+			return string_view(mBuffer);
+		}
+
+	protected:
+		/// "YYYY-MM-DDThh:mm:ss.sssZ"
+		enum { TimeLength = 24, SecondsLength = 19 };
+
+		struct TimeCache {
+			int64_t second = std::numeric_limits<int64_t>::min();
+			char text[SecondsLength + 1];
+		};
+
+		void append(string_view s) {
+			mBuffer.append(s.data(), s.size());
+		}
+
+		void appendTime(int64_t micros, TimeCache& cache) {
+			int64_t second = micros / 1000000;
+			int64_t millis = (micros % 1000000) / 1000;
+			if (millis < 0) {
+				--second;
+				millis += 1000;
+			}
+			if (second != cache.second) {
+				const std::time_t t = static_cast<std::time_t>(second);
+				std::tm tm;
+				if (!gmtime_r(&t, &tm) || std::strftime(cache.text, sizeof(cache.text), "%Y-%m-%dT%H:%M:%S", &tm) != SecondsLength)
+					std::snprintf(cache.text, sizeof(cache.text), "1970-01-01T00:00:00");
+				cache.second = second;
+			}
+			mBuffer.append(cache.text, SecondsLength);
+			char fraction[8];
+			std::snprintf(fraction, sizeof(fraction), ".%03dZ", static_cast<int>(millis));
+			mBuffer.append(fraction, 5);
+		}
+
+		void appendNumber(double value, int decimals) {
+			char text[40];
+			const int n = std::snprintf(text, sizeof(text), "%.*f", decimals, std::isfinite(value) ? value : Unknown);
+			mBuffer.append(text, n > 0 && n < static_cast<int>(sizeof(text)) ? static_cast<size_t>(n) : 0);
+		}
+
+		std::string mBuffer;
+		TimeCache mTimeCache, mStaleCache;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(CoTEventWriter);
+	};
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "CoTEvent.hpp"
+#include "TakProtocolParser.hpp"
+
+namespace Messaging {
+
+	/** Synthetic TAK Protocol traffic shaped like ATAK SA, for the ingest benchmark and the parser tests: every message
+	*	carries the detail groups TAK sends as protobuf (contact, group, precision location, status, takv, track) as
+	*	well as an xmlDetail, so a parse walks every field TakProtocolParser reads.
+	*/
+	namespace TakCorpus {
+
+		/// just enough of a protobuf writer to build TAK Protocol messages
+		struct TakWriter {
+			std::string out;
+
+			void varint(uint64_t v) {
+				for (; v >= 0x80; v >>= 7) out.push_back(char(v | 0x80));
+				out.push_back(char(v));
+			}
+			void key(unsigned field, unsigned wire) { varint(field << 3 | wire); }
+			void number(unsigned field, uint64_t v) { key(field, 0); varint(v); }
+			void real(unsigned field, double d) {
+				uint64_t bits;
+				std::memcpy(&bits, &d, sizeof(bits));
+				key(field, 1);
+				for (int i = 0; i < 8; ++i) out.push_back(char(bits >> (8 * i)));
+			}
+			void bytes(unsigned field, const std::string& s) { key(field, 2); varint(s.size()); out += s; }
+		};
+
+		/// an ATAK SA event as a TakMessage, with the detail elements TAK has fields for moved out of xmlDetail
+		inline std::string makeMessage(size_t i) {
+			const double lat = 40.45 + 0.0001 * (i % 1000), lon = -79.78 - 0.0001 * (i % 777);
+			const uint64_t time = 1584036341332ULL;
+			char buffer[64];
+			TakWriter contact, group, takv, track, precision, status, detail, cot, message;
+			std::snprintf(buffer, sizeof(buffer), "192.168.1.%zu:4242:tcp", i % 250);
+			contact.bytes(1, buffer);
+			std::snprintf(buffer, sizeof(buffer), "UNIT-%zu", i);
+			contact.bytes(2, buffer);
+			group.bytes(1, "Cyan");
+			group.bytes(2, "Team Member");
+			precision.bytes(1, "GPS");
+			precision.bytes(2, "GPS");
+			status.number(1, 87);
+			takv.bytes(1, "SAMSUNG SM-T733");
+			takv.bytes(2, "ATAK-CIV");
+			takv.bytes(3, "29");
+			takv.bytes(4, "4.1.0.231");
+			track.real(1, 1.2);
+			track.real(2, double(i % 360));
+			std::snprintf(buffer, sizeof(buffer), "<uid Droid=\"UNIT-%zu\"/>", i);
+			detail.bytes(1, buffer);
+			detail.bytes(2, contact.out);
+			detail.bytes(3, group.out);
+			detail.bytes(4, precision.out);
+			detail.bytes(5, status.out);
+			detail.bytes(6, takv.out);
+			detail.bytes(7, track.out);
+			cot.bytes(1, "a-f-G-U-C");
+			std::snprintf(buffer, sizeof(buffer), "ANDROID-%08zx", i);
+			cot.bytes(5, buffer);
+			cot.number(6, time);
+			cot.number(7, time);
+			cot.number(8, time + 120000);
+			cot.bytes(9, "h-e");
+			cot.real(10, lat);
+			cot.real(11, lon);
+			cot.real(12, 312.4);
+			cot.real(13, 4.9);
+			cot.real(14, 9999999.0);
+			cot.bytes(15, detail.out);
+			message.bytes(2, cot.out);
+			return message.out;
+		}
+
+		/// TAK Protocol datagrams: mesh framing as sent to multicast, or stream framing as sent over TCP
+		inline std::vector<std::string> make(size_t count, bool mesh) {
+			std::vector<std::string> corpus;
+			corpus.reserve(count);
+			for (size_t i = 0; i < count; ++i) {
+				const std::string message = makeMessage(i);
+				TakWriter header;
+				header.out.push_back(char(0xBF));
+				header.varint(mesh ? 1 : message.size());
+				if (mesh) header.out.push_back(char(0xBF));
+				corpus.push_back(header.out + message);
+			}
+			return corpus;
+		}
+
+		struct FuzzResult {
+			size_t accepted = 0, rejected = 0;
+			size_t escaped = 0;	///< string views of accepted events pointing outside their datagram
+		};
+
+		/** parse count corrupted messages of make(1000, mesh) and make(1000, stream): each truncated, with a few bytes
+		*	overwritten, or extended with random bytes
+		*
+		*	Every outcome must be a clean accept or reject with every view inside the datagram. Each datagram is copied to
+		*	a heap block of exactly its size, so that under AddressSanitizer any read past its end is caught.
+		*/
+		inline FuzzResult fuzz(size_t count, unsigned seed) {
+			auto corpus = make(1000, true), stream = make(1000, false);
+			corpus.insert(corpus.end(), stream.begin(), stream.end());
+			std::mt19937 rng(seed);
+			CoTEvent event;
+			FuzzResult result;
+			std::string d;
+			for (size_t i = 0; i < count; ++i) {
+				d = corpus[rng() % corpus.size()];
+				switch (rng() % 3) {
+				case 0: d.resize(rng() % (d.size() + 1)); break;
+				case 1: for (unsigned n = 1 + rng() % 4; n > 0; --n) d[rng() % d.size()] = char(rng()); break;
+				default: d.append(1 + rng() % 8, char(rng())); break;
+				}
+				std::unique_ptr<char[]> datagram(new char[d.size() ? d.size() : 1]);
+				std::memcpy(datagram.get(), d.data(), d.size());
+				const char* begin = datagram.get();
+				if (!TakProtocolParser::Parse(begin, d.size(), event)) {
+					++result.rejected;
+					continue;
+				}
+				++result.accepted;
+				for (auto v : { event.uid, event.type, event.how, event.detail, event.callsign })
+					if (!v.empty() && (v.data() < begin || v.data() + v.size() > begin + d.size())) ++result.escaped;
+			}
+			return result;
+		}
+	}
+}
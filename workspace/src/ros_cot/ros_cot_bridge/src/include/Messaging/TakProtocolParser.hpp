@@ -0,0 +1,349 @@
+#pragma once
+#include "CoTEvent.hpp"
+#include "CoTEventParser.hpp"
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace Messaging {
+
+	/** Parser for TAK Protocol Version 1 datagrams, falling back to CoTEventParser for plain CoT XML.
+	*
+	*	TAK Protocol messages start with the magic byte 0xBF and come in two framings:
+	*	- mesh (UDP multicast): 0xBF, the protocol version as a varint (1), 0xBF, then a TakMessage;
+	*	- stream (TCP): 0xBF, the TakMessage length as a varint, then the TakMessage.
+	*	Anything else is taken to be an XML event. Detect() tells the framings apart per datagram; a byte stream is split
+	*	with ReadStreamHeader().
+	*
+	*	TakMessage is a protobuf (takmessage.proto and the files it imports). It is decoded with a minimal wire-format
+	*	reader straight into a CoTEvent, without generated code, a protobuf library or any allocation: string fields become
+	*	views into the datagram, like the attribute views CoTEventParser produces. Unknown fields are skipped, so newer
+	*	senders still parse. The fields used are:
+	*
+	*	    TakMessage { TakControl takControl = 1; CotEvent cotEvent = 2; }
+	*	    CotEvent   { string type = 1; string access = 2; string qos = 3; string opex = 4; string uid = 5;
+	*	                 uint64 sendTime = 6; uint64 startTime = 7; uint64 staleTime = 8; string how = 9;
+	*	                 double lat = 10; double lon = 11; double hae = 12; double ce = 13; double le = 14; Detail detail = 15; }
+	*	    Detail     { string xmlDetail = 1; Contact contact = 2; Group group = 3; Track track = 7; }
+	*	    Contact    { string endpoint = 1; string callsign = 2; }
+	*	    Group      { string name = 1; string role = 2; }
+	*	    Track      { double speed = 1; double course = 2; }
+	*
+	*	Differences from an XML event: times are whole milliseconds; proto3 does not send zeros, so an absent hae, error,
+	*	course or speed is 0 rather than NaN (an absent lat or lon is still NaN, so that an event without a point fails
+	*	hasPoint(), at the cost of a point exactly on the equator or prime meridian, and absent times are still
+	*	CoTEvent::NoTime); version is empty; and string values are not XML-escaped, so CoTEvent::unescape only changes
+	*	those that happen to contain an entity. detail is xmlDetail, the elements the sender could not express as
+	*	protobuf fields; groups of well-known fields sent as protobuf are marked parsed, and the rest are looked for in
+	*	xmlDetail as CoTEventParser would.
+	*/
+	class TakProtocolParser {
+	public:
+		using string_view = boost::string_view;
+
+		enum Framing { Xml = 0, Mesh, Stream, Unknown };
+
+		enum : unsigned char { Magic = 0xBF };
+
+		enum { MeshVersion = 1 };
+
+		enum StreamStatus { Complete = 0, Incomplete, Invalid };
+
+		/** work out how a datagram is framed
+		*
+		*	@param payload receives the TakMessage bytes for Mesh and Stream, or the whole datagram for Xml
+		*	@returns Unknown for a TAK header with an unsupported version or a length that does not match the datagram
+		*/
+		static Framing Detect(const char* data, size_t size, string_view& payload) {
+			payload = string_view(data, size);
+			if (size == 0 || static_cast<unsigned char>(data[0]) != Magic) return Xml;
+			Reader r(data + 1, data + size);
+			uint64_t value;
+			if (!r.varint(value)) return Unknown;
+			if (r.p < r.end && static_cast<unsigned char>(*r.p) == Magic) {
+				if (value != MeshVersion) return Unknown;
+				payload = r.rest(1);
+				return Mesh;
+			}
+			if (value != static_cast<uint64_t>(r.end - r.p)) return Unknown;
+			payload = r.rest(0);
+			return Stream;
+		}
+
+		/** parse one datagram in any of the framings
+		*
+		*	@param data the datagram; must outlive the views stored in event
+		*	@param detailFields CoTEvent::DetailFields wanted now, as for CoTEventParser::Parse
+		*	@returns true iff the datagram held an event with a uid and was well formed
+		*/
+		static bool Parse(const char* data, size_t size, CoTEvent& event, unsigned detailFields = CoTEvent::AllDetail) {
+			string_view payload;
+			switch (Detect(data, size, payload)) {
+			case Xml:
+				return CoTEventParser::Parse(data, size, event, detailFields);
+			case Mesh:
+			case Stream:
+				if (!ParseTakMessage(payload.data(), payload.size(), event, detailFields)) return false;
+				event.raw = string_view(data, size);
+				return true;
+			default:
+				event.clear();
+				return false;
+			}
+		}
+
+		/** decode an unframed TakMessage
+		*
+		*	@returns true iff it was well formed and carried a CotEvent with a uid
+		*/
+		static bool ParseTakMessage(const char* data, size_t size, CoTEvent& event, unsigned detailFields = CoTEvent::AllDetail) {
+			event.clear();
+			event.raw = string_view(data, size);
+			Reader message(data, data + size);
+			Reader cot;
+			bool found = false;
+			while (!message.done()) {
+				Field f;
+				if (!message.field(f)) return false;
+				if (f.number == 2 && f.wire == LengthDelimited) {
+					cot = f.bytes;
+					found = true;
+				}
+			}
+			if (!found || !parseCotEvent(cot, event)) return false;
+			return event.uid.empty() ? false : CoTEventParser::ParseDetail(event, detailFields);
+		}
+
+		/** pre-parse fast path, the counterpart of CoTEventParser::ScanKey for every framing
+		*
+		*	For a TAK message, time is the raw varint bytes of sendTime: not readable, but equal exactly when the times are,
+		*	which is all keying needs.
+		*/
+		static bool ScanKey(const char* data, size_t size, string_view& uid, string_view& time) {
+			string_view payload;
+			const Framing framing = Detect(data, size, payload);
+			if (framing == Xml) return CoTEventParser::ScanKey(data, size, uid, time);
+			uid.clear();
+			time.clear();
+			if (framing == Unknown) return false;
+			Reader message(payload.data(), payload.data() + payload.size());
+			while (!message.done()) {
+				Field f;
+				if (!message.field(f)) return false;
+				if (f.number != 2 || f.wire != LengthDelimited) continue;
+				while (!f.bytes.done()) {
+					Field g;
+					if (!f.bytes.field(g)) return false;
+					if (g.number == 5 && g.wire == LengthDelimited) uid = g.bytes.rest(0);
+					else if (g.number == 6 && g.wire == Varint) time = g.raw;
+				}
+			}
+			return !uid.empty();
+		}
+
+		/** read the header of the next stream-framed message in a byte stream
+		*
+		*	@param headerSize receives the length of the magic byte and the length varint
+		*	@param messageSize receives the TakMessage length; the whole message is headerSize + messageSize bytes
+		*	@param maxMessageSize longer messages are Invalid, so a corrupt length cannot make the caller buffer forever
+		*	@returns Incomplete if data ends inside the header, Invalid if it is not a stream header
+		*/
+		static StreamStatus ReadStreamHeader(const char* data, size_t size, size_t& headerSize, size_t& messageSize,
+			size_t maxMessageSize = 1 << 20) {
+			headerSize = messageSize = 0;
+			if (size == 0) return Incomplete;
+			if (static_cast<unsigned char>(data[0]) != Magic) return Invalid;
+			uint64_t length = 0;
+			for (size_t i = 1; i < size && i <= MaxVarintBytes; ++i) {
+				const unsigned char b = static_cast<unsigned char>(data[i]);
+				length |= static_cast<uint64_t>(b & 0x7f) << (7 * (i - 1));
+				if (b & 0x80) continue;
+				if (length > maxMessageSize) return Invalid;
+				headerSize = i + 1;
+				messageSize = static_cast<size_t>(length);
+				return Complete;
+			}
+			return size > MaxVarintBytes ? Invalid : Incomplete;
+		}
+
+	protected:
+		enum WireType { Varint = 0, Fixed64 = 1, LengthDelimited = 2, Fixed32 = 5 };
+
+		enum { MaxVarintBytes = 10 };
+
+		struct Field;
+
+		/// a bounds-checked cursor over protobuf wire format
+		struct Reader {
+			const char* p = nullptr;
+			const char* end = nullptr;
+
+			Reader() {}
+			Reader(const char* p, const char* end) : p(p), end(end) {}
+
+			bool done() const { return p >= end; }
+
+			string_view rest(size_t skip) const {
+				return string_view(p + skip, static_cast<size_t>(end - p) - skip);
+			}
+
+			bool varint(uint64_t& value) {
+				value = 0;
+				for (unsigned shift = 0; shift < 7 * MaxVarintBytes && p < end; shift += 7) {
+					const unsigned char b = static_cast<unsigned char>(*p++);
+					value |= static_cast<uint64_t>(b & 0x7f) << shift;
+					if (!(b & 0x80)) return true;
+				}
+				return false;
+			}
+
+			bool fixed64(uint64_t& value) {
+				if (end - p < 8) return false;
+				value = 0;
+				for (int i = 7; i >= 0; --i) value = (value << 8) | static_cast<unsigned char>(p[i]);
+				p += 8;
+				return true;
+			}
+
+			/// read one field; length-delimited contents, and the raw bytes of any value, are returned without copying
+			bool field(Field& f);
+		};
+
+		struct Field {
+			uint32_t number;
+			uint32_t wire;
+			uint64_t value;	///< Varint, Fixed64 and Fixed32 values
+			Reader bytes;	///< LengthDelimited contents
+			string_view raw;	///< the encoded value
+		};
+
+		static double toDouble(uint64_t bits) {
+			double d;
+			std::memcpy(&d, &bits, sizeof(d));
+			return d;
+		}
+
+		/// milliseconds since the Unix epoch, 0 when not sent, to CoTEvent microseconds
+		static int64_t toTime(uint64_t millis) {
+			return millis == 0 || millis > static_cast<uint64_t>(std::numeric_limits<int64_t>::max() / 1000) ? CoTEvent::NoTime : static_cast<int64_t>(millis) * 1000;
+		}
+
+		static bool parseCotEvent(Reader r, CoTEvent& event) {
+			// an event without lat or lon has no point, as in XML; the rest read as proto3 defaults them
+			event.lat = event.lon = std::numeric_limits<double>::quiet_NaN();
+			event.hae = event.ce = event.le = 0;
+			while (!r.done()) {
+				Field f;
+				if (!r.field(f)) return false;
+				if (f.wire == LengthDelimited) {
+					const string_view s = f.bytes.rest(0);
+					switch (f.number) {
+					case 1: event.type = s; break;
+					case 2: event.access = s; break;
+					case 3: event.qos = s; break;
+					case 4: event.opex = s; break;
+					case 5: event.uid = s; break;
+					case 9: event.how = s; break;
+					case 15: if (!parseDetail(f.bytes, event)) return false; break;
+					}
+				}
+				else if (f.wire == Varint) {
+					switch (f.number) {
+					case 6: event.time = toTime(f.value); break;
+					case 7: event.start = toTime(f.value); break;
+					case 8: event.stale = toTime(f.value); break;
+					}
+				}
+				else if (f.wire == Fixed64) {
+					switch (f.number) {
+					case 10: event.lat = toDouble(f.value); break;
+					case 11: event.lon = toDouble(f.value); break;
+					case 12: event.hae = toDouble(f.value); break;
+					case 13: event.ce = toDouble(f.value); break;
+					case 14: event.le = toDouble(f.value); break;
+					}
+				}
+			}
+			return true;
+		}
+
+		static bool parseDetail(Reader r, CoTEvent& event) {
+			while (!r.done()) {
+				Field f;
+				if (!r.field(f)) return false;
+				if (f.wire != LengthDelimited) continue;
+				switch (f.number) {
+				case 1:
+					event.detail = f.bytes.rest(0);
+					break;
+				case 2:
+					event.detailParsed |= CoTEvent::Contact;
+					if (!parseStrings(f.bytes, event.endpoint, event.callsign)) return false;
+					break;
+				case 3:
+					event.detailParsed |= CoTEvent::Group;
+					if (!parseStrings(f.bytes, event.groupName, event.groupRole)) return false;
+					break;
+				case 7:
+					event.detailParsed |= CoTEvent::Track;
+					event.speed = event.course = 0;
+					while (!f.bytes.done()) {
+						Field g;
+						if (!f.bytes.field(g)) return false;
+						if (g.wire != Fixed64) continue;
+						if (g.number == 1) event.speed = toDouble(g.value);
+						else if (g.number == 2) event.course = toDouble(g.value);
+					}
+					break;
+				}
+			}
+			return true;
+		}
+
+		/// a message whose fields 1 and 2 are strings
+		static bool parseStrings(Reader r, string_view& first, string_view& second) {
+			while (!r.done()) {
+				Field f;
+				if (!r.field(f)) return false;
+				if (f.wire != LengthDelimited) continue;
+				if (f.number == 1) first = f.bytes.rest(0);
+				else if (f.number == 2) second = f.bytes.rest(0);
+			}
+			return true;
+		}
+	};
+
+	inline bool TakProtocolParser::Reader::field(Field& f) {
+		uint64_t key;
+		if (!varint(key) || key >> 32 || (key >> 3) == 0) return false;
+		f.number = static_cast<uint32_t>(key >> 3);
+		f.wire = static_cast<uint32_t>(key & 7);
+		f.value = 0;
+		const char* begin = p;
+		switch (f.wire) {
+		case Varint:
+			if (!varint(f.value)) return false;
+			break;
+		case Fixed64:
+			if (!fixed64(f.value)) return false;
+			break;
+		case Fixed32:
+			if (end - p < 4) return false;
+			for (int i = 3; i >= 0; --i) f.value = (f.value << 8) | static_cast<unsigned char>(p[i]);
+			p += 4;
+			break;
+		case LengthDelimited: {
+			uint64_t length;
+			if (!varint(length) || length > static_cast<uint64_t>(end - p)) return false;
+			begin = p;
+			f.bytes = Reader(p, p + length);
+			p += length;
+			break;
+		}
+		default: // groups are not used by proto3 senders
+			return false;
+		}
+		f.raw = string_view(begin, static_cast<size_t>(p - begin));
+		return true;
+	}
+}
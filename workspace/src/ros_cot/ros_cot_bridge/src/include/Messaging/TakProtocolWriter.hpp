@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <boost/utility/string_view.hpp>
+#include "CoTEventWriter.hpp"
+#include "TakProtocolParser.hpp"
+#include "Messaging/macro.h"
+
+namespace Messaging {
+
+	/** Encodes CoT position reports as TAK Protocol Version 1, the binary counterpart of CoTEventWriter.
+	*
+	*	Takes the same Report and writes the fields TakProtocolParser reads (see there): the event's attributes and point
+	*	as CotEvent fields, course and speed as Detail.track, and Report::detail as Detail.xmlDetail. Times are whole
+	*	milliseconds and an unknown hae, ce or le is sent as CoTEventWriter::Unknown, as TAK clients do.
+	*
+	*	TAK Protocol strings are not XML, so uid, type and how are written as given and must NOT be escaped; detail is
+	*	XML and is. The message is built in reused buffers, so after the first few reports writing allocates nothing.
+	*	Not thread-safe; use a writer per thread.
+	*/
+	class TakProtocolWriter {
+	public:
+		using string_view = boost::string_view;
+		using Report = CoTEventWriter::Report;
+
+		TakProtocolWriter() {
+			mBuffer.reserve(256);
+			mEvent.reserve(256);
+			mDetail.reserve(64);
+		}
+
+		/** encode a report
+		*
+		*	@param framing TakProtocolParser::Mesh for a datagram, or TakProtocolParser::Stream for a TCP stream or a file
+		*	@returns the framed message, valid until the next write
+		*/
+		string_view write(const Report& report, TakProtocolParser::Framing framing = TakProtocolParser::Mesh) {
+			mDetail.clear();
+			if (!report.detail.empty())
+				appendBytes(mDetail, 1, report.detail);
+			if (report.course == report.course) {
+				std::string& track = mBuffer;	// free until the message is assembled
+				track.clear();
+				appendDouble(track, 1, report.speed == report.speed ? report.speed : 0.0);
+				appendDouble(track, 2, report.course);
+				appendBytes(mDetail, 7, track);
+			}
+
+			const uint64_t timeMillis = toMillis(report.timeMicros);
+			mEvent.clear();
+			appendBytes(mEvent, 1, report.type);
+			appendBytes(mEvent, 2, "unrestricted");
+			appendBytes(mEvent, 3, "7-r-c");
+			appendBytes(mEvent, 4, report.simulation ? "s" : "e");
+			appendBytes(mEvent, 5, report.uid);
+			appendVarintField(mEvent, 6, timeMillis);
+			appendVarintField(mEvent, 7, timeMillis);
+			appendVarintField(mEvent, 8, toMillis(report.staleMicros));
+			appendBytes(mEvent, 9, report.how);
+			appendDouble(mEvent, 10, report.lat);
+			appendDouble(mEvent, 11, report.lon);
+			appendDouble(mEvent, 12, report.hae == report.hae ? report.hae : CoTEventWriter::Unknown);
+			appendDouble(mEvent, 13, report.ce == report.ce ? report.ce : CoTEventWriter::Unknown);
+			appendDouble(mEvent, 14, report.le == report.le ? report.le : CoTEventWriter::Unknown);
+			appendBytes(mEvent, 15, mDetail);
+
+			// TakMessage { cotEvent = 2 }, behind the framing's header
+			mBuffer.clear();
+			mBuffer.push_back(static_cast<char>(TakProtocolParser::Magic));
+			if (framing == TakProtocolParser::Stream)
+				appendVarint(mBuffer, 1 + varintSize(mEvent.size()) + mEvent.size());
+			else {
+				appendVarint(mBuffer, TakProtocolParser::MeshVersion);
+				mBuffer.push_back(static_cast<char>(TakProtocolParser::Magic));
+			}
+			appendBytes(mBuffer, 2, mEvent);
+			return string_view(mBuffer);
+		}
+
+	protected:
+		enum WireType { Varint = 0, Fixed64 = 1, LengthDelimited = 2 };
+
+		static uint64_t toMillis(int64_t micros) {
+			return micros > 0 ? static_cast<uint64_t>(micros / 1000) : 0;
+		}
+
+		static size_t varintSize(uint64_t value) {
+			size_t n = 1;
+			while (value >= 0x80) { value >>= 7; ++n; }
+			return n;
+		}
+
+		static void appendVarint(std::string& out, uint64_t value) {
+			while (value >= 0x80) {
+				out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+				value >>= 7;
+			}
+			out.push_back(static_cast<char>(value));
+		}
+
+		static void appendKey(std::string& out, uint32_t field, WireType type) {
+			appendVarint(out, (static_cast<uint64_t>(field) << 3) | type);
+		}
+
+		static void appendVarintField(std::string& out, uint32_t field, uint64_t value) {
+			appendKey(out, field, Varint);
+			appendVarint(out, value);
+		}
+
+		static void appendDouble(std::string& out, uint32_t field, double value) {
+			uint64_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			appendKey(out, field, Fixed64);
+			for (int i = 0; i < 8; ++i)
+				out.push_back(static_cast<char>((bits >> (8 * i)) & 0xFF));
+		}
+
+		/// a string, bytes or embedded message field; empty ones are left out, as proto3 does
+		static void appendBytes(std::string& out, uint32_t field, string_view value) {
+			if (value.empty()) return;
+			appendKey(out, field, LengthDelimited);
+			appendVarint(out, value.size());
+			out.append(value.data(), value.size());
+		}
+
+		std::string mBuffer;	///< the framed message
+		std::string mEvent, mDetail;	///< CotEvent and its Detail, built before their lengths are known
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(TakProtocolWriter);
+	};
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "CoTClient.hpp"
+#include "CompactContactCodec.hpp"
+#include "CoTReceiver.hpp"
+#include "CoTStreamReceiver.hpp"
+#include "ContactSnapshot.hpp"
+#include "FleetTransmitter.hpp"
+#include "TransmitTrace.hpp"
+#include "TrackStore.hpp"
+#include "Ingest/AreaFilter.hpp"
+#include "Ingest/CaptureLog.hpp"
+#include "Ingest/DecodePipeline.hpp"
+#include "Tracking/CourseEstimator.hpp"
+#include "Tracking/FilterBank.hpp"
+#include "Tracking/GeoIndex.hpp"
+#include "Tracking/KdTree.hpp"
+#include "Tracking/TrackAssociator.hpp"
+#include "Utility/LatencyHistogram.hpp"
+#include "Messaging/macro.h"
+
+#include "ros/ros.h"
+#include "ros/callback_queue.h"
+#include "nav_msgs/Odometry.h"
+#include "sensor_msgs/Imu.h"
+#include "sensor_msgs/NavSatFix.h"
+
+#include "ros_cot_msgs/AtakContactList.h"
+#include "ros_cot_msgs/StampedContactList.h"
+#include "ros_cot_msgs/QueryContacts.h"
+
+namespace AIDTR {
+	/** The bridge between ROS and CoT: forwards our fixes and contact lists to the SA multicast group, and publishes
+	*	what is received from it (and from a TAK server stream, or a replayed capture) as contacts, fused tracks,
+	*	smoothed contacts and contact deltas.
+	*
+	*	Everything is set up from the private node handle's parameters (see launch/bridge.launch) when the bridge is
+	*	constructed, and torn down by stop() or the destructor. The same class runs as ros_cot_bridge_node, in its own
+	*	process, and as the ros_cot_bridge/ROSCOTBridgeNodelet nodelet, where messages from publishers in the same
+	*	manager arrive as the publisher's ConstPtr without serialization. Every message published is allocated as a
+	*	shared pointer for the same reason.
+	*
+	*	Fixes and contact lists each have a callback queue served by a thread of their own, so a long contact list never
+	*	holds up our next position report; the fix thread can be pinned and given a real-time priority. In fleet mode
+	*	the fixes of the other vehicles of ours have a third. Timers and the query service stay on the node handle's
+	*	queue. Each queue has one thread, so a callback never runs concurrently with itself; what the callbacks share
+	*	(our pose, the client, the track store, the associator) is locked, so a real-time fix thread can still wait on
+	*	the contacts thread for the length of one report's encoding in the client.
+	*
+	*	Our self-reports can carry our course and speed, from odometry, an IMU and the fixes themselves (see
+	*	Tracking::CourseEstimator, fed on the fix thread), so that ATAK dead-reckons us between reports. A fix whose
+	*	position the last report still predicts to within a tolerance is then not reported at all.
+	*
+	*	ROSCOTBridge
+	*/
+	class ROSCOTBridge {
+	public:
+		/**	@param n handle to advertise and subscribe with
+		*	@param pn handle to read parameters from
+		*	@throws std::exception if the multicast group cannot be joined, or a capture to replay or log cannot be opened
+		*/
+		ROSCOTBridge(ros::NodeHandle& n, ros::NodeHandle& pn);
+		~ROSCOTBridge();
+
+		/// stop receiving, replaying and logging; called by the destructor
+		void stop();
+
+		/// the subscriptions with a callback queue and thread of their own
+		enum Input { FixInput = 0, ContactsInput, FleetInput, NumInputs };
+		/// latency from a message's header stamp to the start of its callback, for messages with a stamp
+		const Utility::LatencyHistogram& getInputLatency(Input input) const { return inputLatency[input]; }
+		/// time from a message's receipt to the start of its callback, i.e. waiting in the input's queue
+		const Utility::LatencyHistogram& getQueueLatency(Input input) const { return queueLatency[input]; }
+		/// how long the input's callbacks run
+		const Utility::LatencyHistogram& getCallbackDuration(Input input) const { return callbackDuration[input]; }
+
+	protected:
+		/// our own position from the latest fix, and our course over ground between fixes
+		struct OwnPose
+		{
+			double lat = std::nan(""), lon = 0, alt = 0;
+			double heading = std::nan("");	///< degrees clockwise from true north
+			double courseLat = std::nan(""), courseLon = 0;	///< where heading was last measured from
+		};
+
+		/// what our last self-report told receivers to dead-reckon from
+		struct SelfReport
+		{
+			double lat = std::nan(""), lon = 0;
+			double course = std::nan(""), speed = 0;
+			int64_t timeNanos = 0;
+		};
+
+		bool associate(boost::string_view uid, boost::string_view type, double lat, double lon, double hae, double ce,
+			int64_t timeMicros, int64_t receivedNanos);
+		void updateOwnPose(double lat, double lon, double alt, double course);
+		bool selfReportDue(double lat, double lon, int64_t nowNanos) const;
+		void enrich(ros_cot_msgs::StampedContactList& msg);
+		void recordInputLatency(Input input, const ros::Time& stamp, const ros::Time& receipt);
+		const TransmitTrace::Origin* traceOrigin(TransmitTrace::Origin& origin, const ros::Time& stamp, int64_t callbackNanos) const;
+
+		void chatterCallback(const ros::MessageEvent<const sensor_msgs::NavSatFix>& event);
+		void atakContactsCallback(const ros::MessageEvent<const ros_cot_msgs::AtakContactList>& event);
+		void stampedContactsCallback(const ros::MessageEvent<const ros_cot_msgs::StampedContactList>& event);
+		void sendContacts(const std::vector<ros_cot_msgs::AtakContact>& contacts, const ros::Time& stamp, const ros::Time& receipt,
+			int64_t callbackNanos);
+		void fleetFixCallback(const ros::MessageEvent<const sensor_msgs::NavSatFix>& event, size_t identity);
+		void odometryCallback(const nav_msgs::Odometry::ConstPtr& msg);
+		void imuCallback(const sensor_msgs::Imu::ConstPtr& msg);
+		void receivedEventCallback(const Messaging::CoTEvent& event);
+		bool queryContactsCallback(ros_cot_msgs::QueryContacts::Request& request, ros_cot_msgs::QueryContacts::Response& response);
+		bool queryNearest(ros_cot_msgs::QueryContacts::Request& request, ros_cot_msgs::QueryContacts::Response& response);
+		void reclaimCallback(const ros::WallTimerEvent&);
+		void smoothingCallback(const ros::WallTimerEvent&);
+		void contactDeltaCallback(const ros::WallTimerEvent&);
+		void contactSnapshotCallback(const ros::WallTimerEvent&);
+		void statsCallback(const ros::WallTimerEvent&);
+
+		void setUp(ros::NodeHandle& n, ros::NodeHandle& pn);
+		void loadAreaOfInterest(ros::NodeHandle& pn);
+		void startInputThread(Input input, int cpu, int priority);
+		void startFleet(ros::NodeHandle& n, ros::NodeHandle& pn);
+		void startCourse(ros::NodeHandle& fixHandle, ros::NodeHandle& pn);
+		void startReplay(ros::NodeHandle& n, ros::NodeHandle& pn, const std::string& file);
+		template <typename Reader>
+		void replayCapture(std::shared_ptr<Reader> reader, double speed, bool transmit, bool shutdownWhenDone);
+
+		boost::asio::io_service io_service;
+		std::unique_ptr<boost::asio::io_service::work> ioWork;	///< keeps ioThread running the client's send completions
+		std::thread ioThread;
+		std::unique_ptr<TransmitTrace> transmitTrace;
+		std::string traceCsv, traceLabel;	///< where to export transmitTrace on stop, and as what
+		std::unique_ptr<Ingest::CaptureLog> captureLog;
+		std::unique_ptr<CoTClient> client;
+		std::unique_ptr<FleetTransmitter> fleet;
+		std::unique_ptr<TrackStore> trackStore;
+		std::unique_ptr<Tracking::GeoIndex> contactIndex;
+		std::unique_ptr<Tracking::KdTree> contactTree;	///< for nearest queries; flushed and queried under contactTreeMutex
+		std::mutex contactTreeMutex;
+		std::vector<Tracking::KdTree::Neighbor> neighbors;	///< under contactTreeMutex
+		Ingest::AreaFilter areaFilter;
+		std::unique_ptr<Tracking::TrackAssociator> associator;
+		std::mutex associatorMutex; // reports arrive from the ROS spinner and from the receiver's sequencer thread
+		std::unique_ptr<Tracking::FilterBank> filterBank;
+		std::vector<Tracking::FilterBank::Estimate> estimates;	///< smoothing timer only
+		std::unique_ptr<ContactSnapshot> contactSnapshot;
+		ContactSnapshot::Delta delta;	///< delta timer only
+		std::unique_ptr<CompactContactEncoder> compactEncoder;	///< delta and snapshot timers only
+		OwnPose ownPose;
+		std::mutex ownPoseMutex; // written by the ROS spinner, read by the receiver's sequencer thread too
+		std::unique_ptr<Tracking::CourseEstimator> courseEstimator;	///< fix thread only
+		SelfReport lastSelfReport;	///< fix thread only
+		double deadReckoningTolerance;	///< meters; 0 reports every fix
+		int64_t maxSelfReportIntervalNanos;
+		std::atomic<uint64_t> selfReportCount, selfReportSkipped;
+		Utility::LatencyHistogram inputLatency[NumInputs], queueLatency[NumInputs], callbackDuration[NumInputs];
+
+		ros::Publisher receivedContactsPub, fusedTracksPub, smoothedContactsPub, contactDeltasPub, contactSnapshotPub;
+		ros::Publisher compactDeltasPub, compactSnapshotPub;
+		ros::CallbackQueue inputQueues[NumInputs];
+		std::unique_ptr<ros::AsyncSpinner> inputSpinners[NumInputs];	///< one thread each, stopped before the queues go
+		ros::Subscriber poseSub, contactSub, stampedContactSub, odometrySub, imuSub;
+		std::vector<ros::Subscriber> fleetSubs;
+		ros::ServiceServer queryService;
+		ros::WallTimer smoothingTimer, contactDeltaTimer, contactSnapshotTimer, reclaimTimer, statsTimer;
+
+		std::unique_ptr<Ingest::DecodePipeline> replayPipeline;
+		std::atomic<bool> replayRunning;
+		std::thread replayThread;
+		std::unique_ptr<CoTReceiver> receiver;
+		std::unique_ptr<CoTStreamReceiver> streamReceiver;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(ROSCOTBridge);
+	};
+}
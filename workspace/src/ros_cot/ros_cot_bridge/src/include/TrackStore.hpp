@@ -0,0 +1,363 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+#include "Messaging/CoTEvent.hpp"
+#include "Messaging/macro.h"
+#include "Utility/CallbackRegister.hpp"
+#include "Utility/FastHash.hpp"
+
+namespace AIDTR {
+
+	/// A snapshot of one entity in the TrackStore. Trivially copyable so readers can take it under a sequence lock.
+	struct TrackRecord {
+		static const size_t MaxUidLength = 63;
+		static const size_t MaxTypeLength = 39;
+		static const size_t MaxHowLength = 7;
+
+		enum Source : uint8_t { Received = 1, Sent = 2 };
+
+		char uid[MaxUidLength + 1];
+		char type[MaxTypeLength + 1];
+		char how[MaxHowLength + 1];
+		uint8_t uidLength;
+		uint8_t sources;		///< bitwise OR of Source values this entity has been seen from
+		uint32_t generation;	///< changes whenever the slot is (re)assigned to a uid
+		uint32_t updates;		///< number of updates since the entity was inserted
+
+		double lat, lon, hae, ce, le;
+		int64_t time, start, stale; ///< microseconds since the Unix epoch, UTC
+
+		boost::string_view getUid() const { return boost::string_view(uid, uidLength); }
+		boost::string_view getType() const { return boost::string_view(type); }
+		boost::string_view getHow() const { return boost::string_view(how); }
+	};
+
+	/// one write to a TrackStore, as passed to its callbacks
+	struct TrackChange {
+		uint32_t handle;
+		const TrackRecord* record;	///< the entity's new state, or nullptr if it was removed
+	};
+
+	/** The central in-memory table of every CoT entity the bridge has received or sent, keyed by uid.
+	*
+	*	Layout: an open-addressed, linearly probed table with a fixed power-of-two capacity. Probing touches only a flat
+	*	array of 64-bit key hashes; records live in a parallel flat array of fixed-size TrackRecords, so there are no
+	*	per-entity allocations (unlike the std::list buckets of ThreadsafeLUT). uids are interned into their slot: the
+	*	slot index is a stable Handle for as long as the entity lives, and TrackRecord::generation tells a holder when a
+	*	handle has been reused.
+	*
+	*	Concurrency: reads (find, read, forEach, getRawEvent) are lock-free and may run on any number of threads. Each
+	*	record is guarded by a sequence lock; readers copy it and retry if a write overlapped. Writes are serialized by an
+	*	internal mutex, so the table behaves as single-writer even when fed from several threads.
+	*
+	*	Staleness: every live entity has one entry in a min-heap ordered by stale time. reclaimStale() pops expired
+	*	entries a bounded number at a time; an entry whose entity was refreshed since it was pushed is re-queued at its new
+	*	stale time instead of being removed, so the heap holds one entry per live entity (plus entries orphaned by
+	*	remove(), which are discarded when they surface).
+	*
+	*	Every insert, update and removal is passed to the registered callbacks as a TrackChange, so derived indexes (see
+	*	Tracking::GeoIndex) can follow the store incrementally. Callbacks run in write order on the writing thread, with
+	*	the write mutex held; they must be quick and must not call the store's writers.
+	*/
+	class TrackStore : public ARL::Utility::CallbackRegister<TrackChange> {
+	public:
+		using string_view = boost::string_view;
+		using Handle = uint32_t;
+		static const Handle InvalidHandle = 0xffffffffu;
+
+		/**
+		*	@param capacity maximum number of slots; rounded up to a power of two. Inserts fail once 7/8 of the slots are used.
+		*	@param keepRawEvents whether to retain a copy of the last raw datagram for each received entity
+		*/
+		explicit TrackStore(size_t capacity = 1 << 17, bool keepRawEvents = true)
+			: mMask(roundUpPow2(capacity) - 1), mKeepRawEvents(keepRawEvents),
+			mKeys(mMask + 1), mSlots(mMask + 1), mRaw(keepRawEvents ? mMask + 1 : 0), mQueuedGeneration(mMask + 1, 0),
+			mUsed(0), mSize(0), mInsertFailures(0), mReclaimed(0) {
+			for (auto& k : mKeys) k.store(Empty, std::memory_order_relaxed);
+		}
+
+		size_t capacity() const { return mMask + 1; }
+		size_t size() const { return mSize.load(std::memory_order_relaxed); }
+		uint64_t getInsertFailureCount() const { return mInsertFailures.load(std::memory_order_relaxed); }
+		uint64_t getReclaimedCount() const { return mReclaimed.load(std::memory_order_relaxed); }
+
+		//---------------------------------------------------------------------------------------------------- writers
+
+		/** insert or update an entity from a received event
+		*
+		*	@returns the entity's handle, or InvalidHandle if the uid is too long or the table is full
+		*/
+		Handle update(const Messaging::CoTEvent& event, TrackRecord::Source source = TrackRecord::Received) {
+			std::lock_guard<std::mutex> lock(mWriteMutex);
+			Handle h = acquire(event.uid);
+			if (h == InvalidHandle) return h;
+			TrackRecord record;
+			mSlots[h].peek(record);
+			copyField(record.type, TrackRecord::MaxTypeLength, event.type);
+			copyField(record.how, TrackRecord::MaxHowLength, event.how);
+			record.sources |= source;
+			++record.updates;
+			record.lat = event.lat; record.lon = event.lon; record.hae = event.hae;
+			record.ce = event.ce; record.le = event.le;
+			record.time = event.time; record.start = event.start; record.stale = event.stale;
+			mSlots[h].write(record);
+			InvokeCallback(TrackChange{ h, &record });
+			if (mKeepRawEvents && !event.raw.empty())
+				std::atomic_store(&mRaw[h], std::make_shared<const std::string>(event.raw.data(), event.raw.size()));
+			queueStale(h, record.stale);
+			return h;
+		}
+
+		/// insert or update an entity we transmit
+		Handle update(string_view uid, string_view type, string_view how,
+			double lat, double lon, double hae, double ce, double le,
+			int64_t time, int64_t stale, TrackRecord::Source source = TrackRecord::Sent) {
+			Messaging::CoTEvent event;
+			event.uid = uid; event.type = type; event.how = how;
+			event.lat = lat; event.lon = lon; event.hae = hae; event.ce = ce; event.le = le;
+			event.time = event.start = time; event.stale = stale;
+			return update(event, source);
+		}
+
+		/// remove an entity; its handle may be reused afterwards
+		bool remove(string_view uid) {
+			std::lock_guard<std::mutex> lock(mWriteMutex);
+			Handle h = find(uid);
+			if (h == InvalidHandle) return false;
+			release(h);
+			return true;
+		}
+
+		/** remove entities whose stale time has passed
+		*
+		*	@param nowMicros current time, microseconds since the Unix epoch
+		*	@param budget maximum number of heap entries to examine in this call
+		*	@param removed optional; receives the uid of every entity removed
+		*	@returns the number of entities removed
+		*/
+		size_t reclaimStale(int64_t nowMicros, size_t budget = 256, std::vector<std::string>* removed = nullptr) {
+			std::lock_guard<std::mutex> lock(mWriteMutex);
+			size_t count = 0;
+			while (budget-- > 0 && !mStaleHeap.empty() && mStaleHeap.top().stale <= nowMicros) {
+				StaleEntry entry = mStaleHeap.top();
+				mStaleHeap.pop();
+				if (mQueuedGeneration[entry.handle] != entry.generation) continue; // entity removed or slot reused
+				mQueuedGeneration[entry.handle] = 0;
+				TrackRecord record;
+				mSlots[entry.handle].peek(record);
+				if (record.stale > nowMicros) {
+					queueStale(entry.handle, record.stale); // refreshed since queued
+					continue;
+				}
+				if (removed) removed->push_back(std::string(record.uid, record.uidLength));
+				release(entry.handle);
+				++count;
+			}
+			mReclaimed.fetch_add(count, std::memory_order_relaxed);
+			return count;
+		}
+
+		//---------------------------------------------------------------------------------------------------- readers
+
+		/// @returns the handle of uid, or InvalidHandle
+		Handle find(string_view uid) const {
+			if (uid.size() > TrackRecord::MaxUidLength) return InvalidHandle;
+			const uint64_t key = keyOf(uid);
+			TrackRecord record;
+			for (size_t i = 0, slot = key & mMask; i <= mMask; ++i, slot = (slot + 1) & mMask) {
+				uint64_t k = mKeys[slot].load(std::memory_order_acquire);
+				if (k == Empty) return InvalidHandle;
+				if (k == key && mSlots[slot].read(record) && record.getUid() == uid)
+					return static_cast<Handle>(slot);
+			}
+			return InvalidHandle;
+		}
+
+		/// take a consistent copy of an entity. @returns false if the handle is not live
+		bool read(Handle h, TrackRecord& out) const {
+			if (h > mMask || mKeys[h].load(std::memory_order_acquire) < Occupied) return false;
+			return mSlots[h].read(out);
+		}
+
+		bool read(string_view uid, TrackRecord& out) const {
+			Handle h = find(uid);
+			return h != InvalidHandle && read(h, out) && out.getUid() == uid;
+		}
+
+		/// @returns the last raw datagram received for the entity, or null
+		std::shared_ptr<const std::string> getRawEvent(Handle h) const {
+			if (!mKeepRawEvents || h > mMask) return nullptr;
+			return std::atomic_load(&mRaw[h]);
+		}
+
+		/// visit a consistent copy of every live entity: f(Handle, const TrackRecord&)
+		template <typename F>
+		void forEach(F&& f) const {
+			TrackRecord record;
+			for (size_t slot = 0; slot <= mMask; ++slot) {
+				if (mKeys[slot].load(std::memory_order_acquire) < Occupied) continue;
+				if (mSlots[slot].read(record) && record.uidLength > 0)
+					f(static_cast<Handle>(slot), record);
+			}
+		}
+
+	protected:
+		static const uint64_t Empty = 0;
+		static const uint64_t Tombstone = 1;
+		static const uint64_t Occupied = 2; ///< keys >= Occupied are live hashes
+
+		/// a TrackRecord guarded by a sequence lock: odd sequence numbers mean a write is in progress
+		struct Slot {
+			std::atomic<uint32_t> sequence{ 0 };
+			TrackRecord record;
+
+			bool read(TrackRecord& out) const {
+				for (int attempt = 0; attempt < 1000; ++attempt) {
+					uint32_t before = sequence.load(std::memory_order_acquire);
+					if (before & 1) continue;
+					std::memcpy(&out, &record, sizeof(TrackRecord));
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (sequence.load(std::memory_order_relaxed) == before) return true;
+				}
+				return false;
+			}
+
+			/// writer-side read; no concurrent writer can exist
+			void peek(TrackRecord& out) const { std::memcpy(&out, &record, sizeof(TrackRecord)); }
+
+			void write(const TrackRecord& in) {
+				uint32_t s = sequence.load(std::memory_order_relaxed);
+				sequence.store(s + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				std::memcpy(&record, &in, sizeof(TrackRecord));
+				sequence.store(s + 2, std::memory_order_release);
+			}
+		};
+
+		struct StaleEntry {
+			int64_t stale;
+			Handle handle;
+			uint32_t generation;
+			bool operator>(const StaleEntry& o) const { return stale > o.stale; }
+		};
+
+		static size_t roundUpPow2(size_t n) {
+			size_t p = 1;
+			while (p < n) p <<= 1;
+			return p;
+		}
+
+		static uint64_t keyOf(string_view uid) {
+			uint64_t h = Utility::FastHash::hash(uid.data(), uid.size());
+			return h < Occupied ? h + Occupied : h;
+		}
+
+		static void copyField(char* dst, size_t maxLength, string_view src) {
+			size_t n = std::min(maxLength, src.size());
+			std::memcpy(dst, src.data(), n);
+			dst[n] = '\0';
+		}
+
+		/// find or claim the slot for uid; caller holds mWriteMutex
+		Handle acquire(string_view uid) {
+			if (uid.empty() || uid.size() > TrackRecord::MaxUidLength) {
+				mInsertFailures.fetch_add(1, std::memory_order_relaxed);
+				return InvalidHandle;
+			}
+			const uint64_t key = keyOf(uid);
+			size_t firstTombstone = mMask + 1;
+			size_t slot = key & mMask;
+			for (size_t i = 0; i <= mMask; ++i, slot = (slot + 1) & mMask) {
+				uint64_t k = mKeys[slot].load(std::memory_order_relaxed);
+				if (k == Empty) break;
+				if (k == Tombstone) {
+					if (firstTombstone > mMask) firstTombstone = slot;
+				}
+				else if (k == key && mSlots[slot].record.uidLength == uid.size()
+					&& std::memcmp(mSlots[slot].record.uid, uid.data(), uid.size()) == 0)
+					return static_cast<Handle>(slot);
+			}
+
+			if (firstTombstone <= mMask) slot = firstTombstone;
+			else if (mKeys[slot].load(std::memory_order_relaxed) != Empty || 8 * (mUsed + 1) > 7 * (mMask + 1)) {
+				mInsertFailures.fetch_add(1, std::memory_order_relaxed);
+				return InvalidHandle;
+			}
+			else ++mUsed;
+
+			TrackRecord record;
+			std::memset(&record, 0, sizeof(record));
+			std::memcpy(record.uid, uid.data(), uid.size());
+			record.uidLength = static_cast<uint8_t>(uid.size());
+			record.generation = ++mGeneration;
+			record.lat = record.lon = record.hae = record.ce = record.le = std::numeric_limits<double>::quiet_NaN();
+			record.time = record.start = record.stale = Messaging::CoTEvent::NoTime;
+			mSlots[slot].write(record);
+			mKeys[slot].store(key, std::memory_order_release); // publish after the record is in place
+			mSize.fetch_add(1, std::memory_order_relaxed);
+			return static_cast<Handle>(slot);
+		}
+
+		/// tombstone a live slot, turning trailing tombstones back into empty slots; caller holds mWriteMutex
+		void release(Handle h) {
+			mKeys[h].store(Tombstone, std::memory_order_release);
+			TrackRecord record;
+			mSlots[h].peek(record);
+			record.uidLength = 0;
+			record.uid[0] = '\0';
+			mSlots[h].write(record);
+			if (mKeepRawEvents) std::atomic_store(&mRaw[h], std::shared_ptr<const std::string>());
+			mSize.fetch_sub(1, std::memory_order_relaxed);
+			mQueuedGeneration[h] = 0;
+			InvokeCallback(TrackChange{ h, nullptr });
+
+			// a tombstone followed by an empty slot ends every probe sequence through it, so it can become empty too
+			size_t slot = h;
+			while (mKeys[slot].load(std::memory_order_relaxed) == Tombstone
+				&& mKeys[(slot + 1) & mMask].load(std::memory_order_relaxed) == Empty) {
+				mKeys[slot].store(Empty, std::memory_order_release);
+				--mUsed;
+				slot = (slot - 1) & mMask;
+			}
+		}
+
+		void queueStale(Handle h, int64_t stale) {
+			if (stale == Messaging::CoTEvent::NoTime) return;
+			TrackRecord record;
+			mSlots[h].peek(record);
+			if (mQueuedGeneration[h] == record.generation) return; // already queued
+			mStaleHeap.push(StaleEntry{ stale, h, record.generation });
+			mQueuedGeneration[h] = record.generation;
+		}
+
+		const size_t mMask;
+		const bool mKeepRawEvents;
+
+		std::vector<std::atomic<uint64_t>> mKeys;	///< Empty, Tombstone or the uid hash of each slot
+		std::vector<Slot> mSlots;
+		std::vector<std::shared_ptr<const std::string>> mRaw; ///< accessed with std::atomic_load/atomic_store
+
+		// writer-only state, guarded by mWriteMutex
+		std::mutex mWriteMutex;
+		std::priority_queue<StaleEntry, std::vector<StaleEntry>, std::greater<StaleEntry>> mStaleHeap;
+		std::vector<uint32_t> mQueuedGeneration;	///< generation of the slot's live entry in mStaleHeap, 0 if none
+		size_t mUsed;						///< live plus tombstoned slots
+		uint32_t mGeneration = 0;
+
+		std::atomic<size_t> mSize;
+		std::atomic<uint64_t> mInsertFailures, mReclaimed;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(TrackStore);
+	};
+}
@@ -0,0 +1,197 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include "Math/GeodeticKernels.hpp"
+#include "Messaging/macro.h"
+#ifdef WITH_ARL_MATH
+#include "Math/Types.hpp"
+#endif
+
+namespace AIDTR {
+	namespace Tracking {
+
+		/** Our own course over ground and speed, derived incrementally from odometry, IMU orientation and fixes, for the
+		*	<track> of our self-reports.
+		*
+		*	The velocity over ground (east, north) is smoothed by a first-order low-pass filter, O(1) per sample:
+		*
+		*		v += (1 - exp(-dt / timeConstant)) * (sample - v)
+		*
+		*	Filtering the vector rather than course and speed keeps it clear of the 359/0 degree wrap, and of the course
+		*	noise of a vehicle at a standstill. Its samples are:
+		*
+		*		odometry: the twist, in the child (body) frame, rotated into the world frame by the pose's orientation
+		*		fixes:    the displacement since the fix fixBaseline or more before, over their time difference; only
+		*		          while there has been no odometry for maxAge
+		*
+		*	An IMU gives orientation but no velocity. While there is no odometry, its heading is taken as the course when
+		*	we are moving (forwards, without crabbing), being far steadier than the course of a few meters between fixes;
+		*	the speed still comes from the fixes.
+		*
+		*	Below minSpeed the speed is reported as 0 and the last course held. Once every source has been silent for
+		*	maxAge there is no estimate. Not thread-safe.
+		*
+		*	CourseEstimator
+		*/
+		class CourseEstimator {
+		public:
+			/// the world frame of orientations and of odometry: ROS' East-North-Up (REP 103), or North-East-Down
+			enum Frame { ENU = 0, NED };
+
+			struct Config {
+				double timeConstant = 1;	///< seconds, of the velocity filter
+				double minSpeed = 0.5;	///< meters/second; slower is stationary
+				double maxAge = 2;	///< seconds
+				double fixBaseline = 1;	///< seconds; differencing closer fixes would mostly measure their noise
+				Frame frame = ENU;
+				double headingOffset = 0;	///< degrees added to IMU headings, e.g. the magnetic declination
+			};
+
+			CourseEstimator() : CourseEstimator(Config()) {}
+
+			explicit CourseEstimator(const Config& config)
+				: mConfig(config), mMaxAgeNanos(static_cast<int64_t>(config.maxAge * 1e9)),
+				mFixBaselineNanos(static_cast<int64_t>(config.fixBaseline * 1e9)) {}
+
+			/** an odometry sample
+			*
+			*	@param qw, qx, qy, qz the orientation of the body in the world frame
+			*	@param vx, vy, vz the velocity in the body frame, meters/second
+			*/
+			void addOdometry(int64_t timeNanos, double qw, double qx, double qy, double qz, double vx, double vy, double vz) {
+				// v + 2w(q x v) + 2 q x (q x v), for a unit quaternion; only the horizontal part is needed
+				const double norm = std::sqrt(qw * qw + qx * qx + qy * qy + qz * qz);
+				if (!(norm > 0))
+					return;
+				qw /= norm; qx /= norm; qy /= norm; qz /= norm;
+				const double tx = 2 * (qy * vz - qz * vy), ty = 2 * (qz * vx - qx * vz), tz = 2 * (qx * vy - qy * vx);
+				const double x = vx + qw * tx + (qy * tz - qz * ty);
+				const double y = vy + qw * ty + (qz * tx - qx * tz);
+				mLastOdometryNanos = timeNanos;
+				if (mConfig.frame == ENU)
+					addVelocity(timeNanos, x, y);
+				else
+					addVelocity(timeNanos, y, x);
+			}
+
+			/// an IMU sample: the orientation of the body in the world frame
+			void addImu(int64_t timeNanos, double qw, double qx, double qy, double qz) {
+				if (!(qw * qw + qx * qx + qy * qy + qz * qz > 0))
+					return;
+				const double yaw = yawOf(qw, qx, qy, qz) * ARL::Math::GeodeticKernels::radToDeg;
+				// ENU yaw is counterclockwise from east, NED yaw clockwise from north
+				mHeading = normalize((mConfig.frame == ENU ? 90 - yaw : yaw) + mConfig.headingOffset);
+				mLastHeadingNanos = timeNanos;
+				update(timeNanos);
+			}
+
+			/// a fix, degrees
+			void addFix(int64_t timeNanos, double lat, double lon) {
+				if (!(lat == lat && lon == lon))
+					return;
+				if (mLastFixNanos != NoTime) {
+					if (timeNanos - mLastFixNanos < std::max<int64_t>(mFixBaselineNanos, 1))
+						return;
+					if (!fresh(mLastOdometryNanos, timeNanos)) {
+						using namespace ARL::Math::GeodeticKernels;
+						const double dt = (timeNanos - mLastFixNanos) * 1e-9;
+						const double north = (lat - mLastLat) * metersPerDegree;
+						const double east = lonDifference(mLastLon, lon) * metersPerDegree * std::cos(0.5 * (lat + mLastLat) * degToRad);
+						addVelocity(timeNanos, east / dt, north / dt);
+					}
+				}
+				mLastFixNanos = timeNanos;
+				mLastLat = lat;
+				mLastLon = lon;
+			}
+
+			/** the estimate at nowNanos
+			*
+			*	@param course degrees clockwise from true north, in [0, 360); NaN until we have moved
+			*	@param speed meters/second
+			*	@returns false, with course and speed NaN, when there is no estimate
+			*/
+			bool get(int64_t nowNanos, double& course, double& speed) const {
+				if (!fresh(mLastVelocityNanos, nowNanos)) {
+					course = speed = std::nan("");
+					return false;
+				}
+				course = mCourse;
+				speed = mSpeed;
+				return true;
+			}
+
+			/// rotation of an orientation about the vertical (its Z-Y-X yaw), radians
+			static double yawOf(double qw, double qx, double qy, double qz) {
+#ifdef WITH_ARL_MATH
+				ARL::Math::EulerAngles3D::Quaternion q(qw, qx, qy, qz);
+				q.normalize();
+				return -ARL::Math::EulerAngles3D(q).yaw;
+#else
+				return std::atan2(2 * (qw * qz + qx * qy), qw * qw + qx * qx - qy * qy - qz * qz);
+#endif
+			}
+
+		protected:
+			static constexpr int64_t NoTime = std::numeric_limits<int64_t>::min();
+
+			bool fresh(int64_t timeNanos, int64_t nowNanos) const {
+				return timeNanos != NoTime && nowNanos - timeNanos <= mMaxAgeNanos;
+			}
+
+			static double normalize(double degrees) {
+				degrees = std::fmod(degrees, 360.0);
+				return degrees < 0 ? degrees + 360 : degrees;
+			}
+
+			void addVelocity(int64_t timeNanos, double east, double north) {
+				if (!(std::isfinite(east) && std::isfinite(north)))
+					return;
+				if (!fresh(mLastVelocityNanos, timeNanos)) {
+					mEast = east;
+					mNorth = north;
+				}
+				else if (timeNanos > mLastVelocityNanos) {
+					const double alpha = 1 - std::exp(-(timeNanos - mLastVelocityNanos) * 1e-9 / mConfig.timeConstant);
+					mEast += alpha * (east - mEast);
+					mNorth += alpha * (north - mNorth);
+				}
+				else
+					return; // out of order, or a second sample at the same time
+				mLastVelocityNanos = timeNanos;
+				update(timeNanos);
+			}
+
+			void update(int64_t nowNanos) {
+				if (mLastVelocityNanos == NoTime)
+					return;
+				const double speed = std::sqrt(mEast * mEast + mNorth * mNorth);
+				if (speed < mConfig.minSpeed) {
+					mSpeed = 0;
+					return;
+				}
+				mSpeed = speed;
+				if (fresh(mLastHeadingNanos, nowNanos) && !fresh(mLastOdometryNanos, nowNanos))
+					mCourse = mHeading;
+				else
+					mCourse = normalize(std::atan2(mEast, mNorth) * ARL::Math::GeodeticKernels::radToDeg);
+			}
+
+			const Config mConfig;
+			const int64_t mMaxAgeNanos, mFixBaselineNanos;
+
+			double mEast = 0, mNorth = 0;	///< filtered velocity, meters/second
+			int64_t mLastVelocityNanos = NoTime;
+			double mCourse = std::nan(""), mSpeed = 0;
+			double mHeading = std::nan("");	///< from the IMU, degrees true
+			int64_t mLastHeadingNanos = NoTime, mLastOdometryNanos = NoTime;
+			double mLastLat = 0, mLastLon = 0;
+			int64_t mLastFixNanos = NoTime;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(CourseEstimator);
+		};
+	}
+}
@@ -0,0 +1,363 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "Math/GeodeticKernels.hpp"
+#include "Messaging/macro.h"
+#include "TrackStore.hpp"
+
+namespace AIDTR {
+	namespace Tracking {
+
+		/** A bank of constant-velocity Kalman filters, one per contact, for smoothed fixed-rate output.
+		*
+		*	Each contact's state is its position and velocity in the East-North-Up frame of a common origin, with a
+		*	per-axis position/velocity covariance driven by white-noise acceleration. East and north see the same
+		*	measurement noise (from CE) and process noise, so they share one covariance; up has its own (from LE). All of
+		*	it is stored as structure-of-arrays over a dense range of live contacts.
+		*
+		*	report() and apply() (register it as a TrackStore callback) only queue a report and may be called from any
+		*	thread. flush() folds the queued reports into the filters, and extrapolate() predicts every filter to one
+		*	instant, e.g. on a 10 Hz timer. flush() and extrapolate() must not be called concurrently with each other.
+		*
+		*	Both are plain scalar loops. Hand-written AVX2 kernels (gathering four filters per update, four-wide
+		*	prediction) measured within run-to-run noise of them in SpatialBenchmark at 1k to 100k contacts: an update
+		*	costs 60-120 ns/report and a tick 25-40 ns/contact either way, dominated by each report's trigonometry and each
+		*	estimate's conversion back to latitude and longitude, not by the filter arithmetic.
+		*
+		*	A report older than the contact's latest is dropped. Until the first report the frame origin is unset; it is
+		*	then placed at that report, unless given to the constructor. ENU is a rigid transform of ECEF, so the origin
+		*	only affects rounding, not the model. Predictions are turned back into latitude and longitude by linearizing
+		*	around the contact's last report rather than by a full ECEF inversion: no trigonometry per output, and
+		*	within centimeters over the few hundred meters a contact coasts.
+		*/
+		class FilterBank {
+		public:
+			using Handle = TrackStore::Handle;
+
+			/// CoT's value for an unknown hae, ce or le
+			static constexpr double Unknown = 9999999;
+
+			struct Config {
+				/** meters/second^2, horizontal maneuvering per axis. Against 5 m per-axis noise at 1 Hz (6.3 m mean error
+				*	for a raw report), 1 gives a mean error of 4.4 m on contacts at constant velocity and 4.9 m on ones
+				*	maneuvering at 1 m/s^2 (2 gave 5.2 m and 5.4 m); SpatialBenchmark's replay, 0.9 s past the last report,
+				*	comes to 4.8 m (5.9 m with 2). 0.5 smooths slow walkers better (3.7 m); set 2 or more for contacts that
+				*	turn hard, which otherwise lag (6.4 m at 2 m/s^2 against 5.9 m).
+				*/
+				double accelSigma = 1;
+				double verticalAccelSigma = 0.5;	///< meters/second^2
+				double initialSpeedSigma = 15;	///< meters/second per axis, for a new contact's unknown velocity
+				double defaultCe = 50;	///< meters, when a report's ce is unknown
+				double defaultLe = 100;	///< meters, when a report's le is unknown
+				int64_t maxCoastMicros = 10000000;	///< extrapolate() skips contacts not reported for this long
+			};
+
+			/// one contact as predicted by extrapolate()
+			struct Estimate {
+				Handle handle;
+				uint32_t generation;	///< the TrackRecord::generation the filter was built from
+				double lat, lon, hae;	///< hae is Unknown if the contact never reported an altitude
+				double ce, le;	///< 90% circular and linear error, meters
+				double velocityEast, velocityNorth, velocityUp;	///< meters/second
+				int64_t lastReportMicros;
+			};
+
+			/**
+			*	@param capacity handles must be below this, e.g. TrackStore::capacity()
+			*	@param originLat, originLon, originAlt the ENU origin; NaN latitude places it at the first report
+			*/
+			FilterBank(size_t capacity, double originLat = std::nan(""), double originLon = 0, double originAlt = 0)
+				: FilterBank(capacity, Config(), originLat, originLon, originAlt) {}
+
+			FilterBank(size_t capacity, const Config& config, double originLat = std::nan(""), double originLon = 0, double originAlt = 0)
+				: mConfig(config), mIndex(capacity, None), mHasOrigin(originLat == originLat), mEpochMicros(Messaging::CoTEvent::NoTime),
+				mFrame(mHasOrigin ? originLat : 0, originLon, originAlt),
+				mQh(config.accelSigma * config.accelSigma), mQv(config.verticalAccelSigma * config.verticalAccelSigma),
+				mStaleReports(0) {}
+
+			/// follow one TrackStore write, releasing the filter of a record removed or left without a position; pass to
+			/// TrackStore::RegisterCallback
+			void apply(const TrackChange& change) {
+				const TrackRecord* r = change.record;
+				if (r && r->lat == r->lat && r->lon == r->lon)
+					report(change.handle, r->generation, r->lat, r->lon, r->hae, r->ce, r->le, r->time);
+				else
+					remove(change.handle);
+			}
+
+			/// queue a position report; a new generation on a handle restarts its filter
+			void report(Handle h, uint32_t generation, double lat, double lon, double hae, double ce, double le, int64_t timeMicros) {
+				if (h >= mIndex.size() || timeMicros == Messaging::CoTEvent::NoTime) return;
+				std::lock_guard<std::mutex> lock(mPendingMutex);
+				mPending.push_back(Report{ h, generation, false, lat, lon, hae, ce, le, timeMicros });
+			}
+
+			void remove(Handle h) {
+				if (h >= mIndex.size()) return;
+				std::lock_guard<std::mutex> lock(mPendingMutex);
+				mPending.push_back(Report{ h, 0, true, 0, 0, 0, 0, 0, 0 });
+			}
+
+			/// fold every queued report into the filters, in the order queued; @returns the number of reports taken
+			size_t flush() {
+				{
+					std::lock_guard<std::mutex> lock(mPendingMutex);
+					mWork.swap(mPending);
+				}
+				for (const Report& r : mWork) {
+					const uint32_t i = mIndex[r.handle];
+					if (r.remove) {
+						if (i != None) erase(i);
+					}
+					else if (i == None || mGeneration[i] != r.generation) {
+						if (i != None) erase(i);
+						initialize(r);
+					}
+					else
+						update(measure(r, i));
+				}
+				const size_t taken = mWork.size();
+				mWork.clear();
+				return taken;
+			}
+
+			/** flush(), then predict every filter reported within Config::maxCoastMicros to one instant
+			*
+			*	@returns the number of estimates written to out (replacing its contents)
+			*/
+			size_t extrapolate(int64_t timeMicros, std::vector<Estimate>& out) {
+				flush();
+				out.clear();
+				const size_t n = mHandle.size();
+				mOutE.resize(n); mOutN.resize(n); mOutU.resize(n); mOutHpp.resize(n); mOutVpp.resize(n);
+				const double t = seconds(timeMicros);
+				for (size_t i = 0; i < n; ++i) {
+					const double dt = std::max(0.0, t - mT[i]);
+					mOutE[i] = mE[i] + mVE[i] * dt;
+					mOutN[i] = mN[i] + mVN[i] * dt;
+					mOutU[i] = mU[i] + mVU[i] * dt;
+					mOutHpp[i] = predictedVariance(mHpp[i], mHpv[i], mHvv[i], mQh, dt);
+					mOutVpp[i] = predictedVariance(mVpp[i], mVpv[i], mVvv[i], mQv, dt);
+				}
+				const double maxCoast = mConfig.maxCoastMicros * 1e-6;
+				for (size_t i = 0; i < n; ++i) {
+					if (t - mT[i] > maxCoast) continue;
+					Estimate e;
+					e.handle = mHandle[i];
+					e.generation = mGeneration[i];
+					toGeodetic(i, e);
+					e.ce = CePerSigma * std::sqrt(mOutHpp[i]);
+					e.le = mHasAltitude[i] ? LePerSigma * std::sqrt(mOutVpp[i]) : Unknown;
+					e.velocityEast = mVE[i];
+					e.velocityNorth = mVN[i];
+					e.velocityUp = mVU[i];
+					e.lastReportMicros = mEpochMicros + static_cast<int64_t>(std::llround(mT[i] * 1e6));
+					out.push_back(e);
+				}
+				return out.size();
+			}
+
+			size_t size() const { return mHandle.size(); }
+			/// reports dropped because they were no newer than the contact's last one
+			uint64_t getStaleReportCount() const { return mStaleReports; }
+
+		protected:
+			enum : uint32_t { None = 0xffffffffu };
+
+			/// CE is the 90% circular error radius and LE the 90% linear error: 2.146 and 1.645 standard deviations
+			static constexpr double CePerSigma = 2.1460;
+			static constexpr double LePerSigma = 1.6449;
+
+			struct Report {
+				Handle handle;
+				uint32_t generation;
+				bool remove;
+				double lat, lon, hae, ce, le;
+				int64_t time;
+			};
+
+			/// a report in filter terms: ENU position and measurement variances, at seconds since mEpochMicros
+			struct Measurement {
+				uint32_t index;
+				double t, e, n, u, rh, rv;
+				double lat, lon, hae, sinLat, cosLat, sinLon, cosLon, latPerMeter, lonPerMeter;	///< the report's local frame
+			};
+
+			double seconds(int64_t micros) const { return (micros - mEpochMicros) * 1e-6; }
+
+			static double predictedVariance(double pp, double pv, double vv, double q, double dt) {
+				return pp + 2 * dt * pv + dt * dt * vv + q * dt * dt * dt / 3;
+			}
+
+			Measurement measure(const Report& r, uint32_t index) {
+				if (!mHasOrigin) {
+					mFrame = ARL::Math::GeodeticKernels::LocalFrame(r.lat, r.lon, hasAltitude(r) ? r.hae : 0);
+					mHasOrigin = true;
+				}
+				if (mEpochMicros == Messaging::CoTEvent::NoTime) mEpochMicros = r.time;
+				using namespace ARL::Math;
+				const double hae = hasAltitude(r) ? r.hae : 0;
+				const double sLat = std::sin(r.lat * GeodeticKernels::degToRad), cLat = std::cos(r.lat * GeodeticKernels::degToRad);
+				const double sLon = std::sin(r.lon * GeodeticKernels::degToRad), cLon = std::cos(r.lon * GeodeticKernels::degToRad);
+				const double w2 = 1 - Geodetic::e2 * sLat * sLat;
+				const double primeVertical = Geodetic::Re_equator / std::sqrt(w2);
+				const double meridian = primeVertical * Geodetic::oneMinus_e2 / w2;
+				Measurement m;
+				m.index = index;
+				m.t = seconds(r.time);
+				mFrame.toENU(GeodeticKernels::ECEF{ (primeVertical + hae) * cLat * cLon, (primeVertical + hae) * cLat * sLon,
+					(Geodetic::oneMinus_e2 * primeVertical + hae) * sLat }, m.e, m.n, m.u);
+				m.lat = r.lat; m.lon = r.lon; m.hae = hae;
+				m.sinLat = sLat; m.cosLat = cLat; m.sinLon = sLon; m.cosLon = cLon;
+				m.latPerMeter = GeodeticKernels::radToDeg / (meridian + hae);
+				m.lonPerMeter = GeodeticKernels::radToDeg / ((primeVertical + hae) * std::max(cLat, 1e-9));
+				const double ce = r.ce > 0 && r.ce < Unknown ? r.ce : mConfig.defaultCe;
+				m.rh = (ce / CePerSigma) * (ce / CePerSigma);
+				// without an altitude the up measurement only holds the track to the ellipsoid, loosely
+				const double le = !hasAltitude(r) ? 1e3 : r.le > 0 && r.le < Unknown ? r.le : mConfig.defaultLe;
+				m.rv = (le / LePerSigma) * (le / LePerSigma);
+				return m;
+			}
+
+			/// make an accepted measurement filter i's linearization point; a stale one must leave the last good point
+			void relinearize(const Measurement& m) {
+				const uint32_t i = m.index;
+				mRefE[i] = m.e; mRefN[i] = m.n; mRefU[i] = m.u;
+				mRefLat[i] = m.lat; mRefLon[i] = m.lon; mRefHae[i] = m.hae;
+				mSinLat[i] = m.sinLat; mCosLat[i] = m.cosLat; mSinLon[i] = m.sinLon; mCosLon[i] = m.cosLon;
+				mLatPerMeter[i] = m.latPerMeter; mLonPerMeter[i] = m.lonPerMeter;
+			}
+
+			static bool hasAltitude(const Report& r) { return r.hae == r.hae && r.hae < Unknown; }
+
+			void initialize(const Report& r) {
+				const uint32_t i = static_cast<uint32_t>(mHandle.size());
+				for (auto* column : columns()) column->push_back(0);
+				mIndex[r.handle] = i;
+				mHandle.push_back(r.handle);
+				mGeneration.push_back(r.generation);
+				mHasAltitude.push_back(hasAltitude(r));
+				const Measurement m = measure(r, i);
+				const double vv = mConfig.initialSpeedSigma * mConfig.initialSpeedSigma;
+				mT[i] = m.t;
+				mE[i] = m.e; mN[i] = m.n; mU[i] = m.u;
+				mHpp[i] = m.rh; mHvv[i] = vv;
+				mVpp[i] = m.rv; mVvv[i] = vv;
+				relinearize(m);
+			}
+
+			/// drop filter i, moving the last one into its place
+			void erase(uint32_t i) {
+				const uint32_t last = static_cast<uint32_t>(mHandle.size() - 1);
+				mIndex[mHandle[i]] = None;
+				if (i != last) {
+					mIndex[mHandle[last]] = i;
+					mHandle[i] = mHandle[last]; mGeneration[i] = mGeneration[last]; mHasAltitude[i] = mHasAltitude[last];
+					for (auto* column : columns()) (*column)[i] = (*column)[last];
+				}
+				for (auto* column : columns()) column->pop_back();
+				mHandle.pop_back();
+				mGeneration.pop_back();
+				mHasAltitude.pop_back();
+			}
+
+			/// every per-filter column of doubles
+			std::array<std::vector<double>*, 25> columns() {
+				return { { &mT, &mE, &mN, &mU, &mVE, &mVN, &mVU, &mHpp, &mHpv, &mHvv, &mVpp, &mVpv, &mVvv,
+					&mRefE, &mRefN, &mRefU, &mRefLat, &mRefLon, &mRefHae, &mSinLat, &mCosLat, &mSinLon, &mCosLon,
+					&mLatPerMeter, &mLonPerMeter } };
+			}
+
+			/// the predicted position of filter i, from its offset to the filter's reference point in the local frame there
+			void toGeodetic(size_t i, Estimate& e) const {
+				const ARL::Math::GeodeticKernels::ECEF p = mFrame.fromENU(mOutE[i], mOutN[i], mOutU[i]);
+				const ARL::Math::GeodeticKernels::ECEF r = mFrame.fromENU(mRefE[i], mRefN[i], mRefU[i]);
+				const double dx = p.x - r.x, dy = p.y - r.y, dz = p.z - r.z;
+				const double east = mCosLon[i] * dy - mSinLon[i] * dx;
+				const double north = mCosLat[i] * dz - mSinLat[i] * mSinLon[i] * dy - mSinLat[i] * mCosLon[i] * dx;
+				const double up = mSinLat[i] * dz + mCosLat[i] * mSinLon[i] * dy + mCosLat[i] * mCosLon[i] * dx;
+				e.lat = mRefLat[i] + north * mLatPerMeter[i];
+				e.lon = mRefLon[i] + east * mLonPerMeter[i];
+				if (e.lon > 180) e.lon -= 360;
+				else if (e.lon < -180) e.lon += 360;
+				e.hae = mHasAltitude[i] ? mRefHae[i] + up : Unknown;
+			}
+
+			/// predict one axis's covariance by dt, then correct it with a measurement of variance r; @returns the gains
+			static void correctCovariance(double& pp, double& pv, double& vv, double q, double dt, double r, double& k1, double& k2) {
+				pp = predictedVariance(pp, pv, vv, q, dt);
+				pv = pv + dt * vv + q * dt * dt / 2;
+				vv = vv + q * dt;
+				const double s = pp + r;
+				k1 = pp / s;
+				k2 = pv / s;
+				vv = vv - k2 * pv;
+				pv = pv - k1 * pv;
+				pp = pp - k1 * pp;
+			}
+
+			static void correctAxis(double& p, double& v, double z, double dt, double k1, double k2) {
+				const double predicted = p + v * dt;
+				const double innovation = z - predicted;
+				p = predicted + k1 * innovation;
+				v = v + k2 * innovation;
+			}
+
+			void update(const Measurement& m) {
+				const uint32_t i = m.index;
+				const double dt = m.t - mT[i];
+				if (!(dt > 0)) {
+					++mStaleReports;
+					return;
+				}
+				double k1, k2;
+				correctCovariance(mHpp[i], mHpv[i], mHvv[i], mQh, dt, m.rh, k1, k2);
+				correctAxis(mE[i], mVE[i], m.e, dt, k1, k2);
+				correctAxis(mN[i], mVN[i], m.n, dt, k1, k2);
+				correctCovariance(mVpp[i], mVpv[i], mVvv[i], mQv, dt, m.rv, k1, k2);
+				correctAxis(mU[i], mVU[i], m.u, dt, k1, k2);
+				mT[i] = m.t;
+				relinearize(m);
+			}
+
+
+			const Config mConfig;
+			std::vector<uint32_t> mIndex;	///< [handle] -> filter index, or None
+
+			// per filter, dense over [0, size())
+			std::vector<Handle> mHandle;
+			std::vector<uint32_t> mGeneration;
+			std::vector<uint8_t> mHasAltitude;
+			std::vector<double> mT;	///< seconds since mEpochMicros of the last report
+			std::vector<double> mE, mN, mU;	///< position, meters
+			std::vector<double> mVE, mVN, mVU;	///< velocity, meters/second
+			std::vector<double> mHpp, mHpv, mHvv;	///< covariance of east (and of north): position, cross, velocity
+			std::vector<double> mVpp, mVpv, mVvv;	///< covariance of up
+			std::vector<double> mRefE, mRefN, mRefU;	///< linearization point for output, the last report
+			std::vector<double> mRefLat, mRefLon, mRefHae;	///< the same point, geodetic
+			std::vector<double> mSinLat, mCosLat, mSinLon, mCosLon;	///< the local frame there
+			std::vector<double> mLatPerMeter, mLonPerMeter;	///< degrees per meter north and east there
+
+			// extrapolate()'s predictions, [filter]
+			std::vector<double> mOutE, mOutN, mOutU, mOutHpp, mOutVpp;
+
+			bool mHasOrigin;
+			int64_t mEpochMicros;	///< time of the first report; filter times are seconds since
+			ARL::Math::GeodeticKernels::LocalFrame mFrame;
+			const double mQh, mQv;	///< acceleration noise spectral densities
+
+			std::mutex mPendingMutex;
+			std::vector<Report> mPending;	///< queued by report() and remove()
+			std::vector<Report> mWork;	///< being folded in by flush()
+
+			uint64_t mStaleReports;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(FilterBank);
+		};
+	}
+}
@@ -0,0 +1,243 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+#include "Math/GeodeticKernels.hpp"
+#include "Messaging/macro.h"
+#include "TrackStore.hpp"
+
+namespace AIDTR {
+	namespace Tracking {
+
+		/** A geohash cell index over the positions in a TrackStore, for radius and bounding-box queries.
+		*
+		*	Each entity with a position sits in the geohash cell of that position at a fixed precision (6 characters, about
+		*	1.2 x 0.6 km, by default). The index follows the store incrementally: register apply() as a TrackStore callback
+		*	and every write moves at most one handle between two cells. A query visits only the cells overlapping its
+		*	area, then refines each candidate exactly (great-circle distance for radius queries, the box itself for box
+		*	queries) and applies an optional type prefix filter, e.g. "a-h" for hostile atoms. When an area covers more
+		*	cells than there are indexed entities, the query scans the entities instead.
+		*
+		*	Queries and updates are serialized by an internal mutex, so queries may run on any thread.
+		*/
+		class GeoIndex {
+		public:
+			using string_view = boost::string_view;
+			using Handle = TrackStore::Handle;
+
+			struct Hit {
+				Handle handle;
+				double distance;	///< meters from the query center; 0 for box queries
+			};
+
+			enum { MaxPrecision = 12 };	///< longest geohash that fits the 64-bit cell keys
+
+			/**
+			*	@param capacity the TrackStore's capacity; handles must be below it
+			*	@param precision geohash length of the cells, 1 to 12
+			*/
+			explicit GeoIndex(size_t capacity, unsigned precision = 6)
+				: mPrecision(std::max(1u, std::min<unsigned>(precision, MaxPrecision))),
+				mLonBits((5 * mPrecision + 1) / 2), mLatBits(5 * mPrecision / 2),
+				mEntries(capacity), mSize(0) {}
+
+			/// follow one TrackStore write; pass to TrackStore::RegisterCallback
+			void apply(const TrackChange& change) {
+				if (change.record && change.record->lat == change.record->lat && change.record->lon == change.record->lon)
+					update(change.handle, change.record->lat, change.record->lon, change.record->getType());
+				else
+					remove(change.handle);
+			}
+
+			void update(Handle h, double lat, double lon, string_view type) {
+				if (h >= mEntries.size()) return;
+				std::lock_guard<std::mutex> lock(mMutex);
+				Entry& e = mEntries[h];
+				const uint64_t cell = cellOf(lat, lon);
+				if (!e.live || e.cell != cell) {
+					if (e.live) unlink(h);
+					else ++mSize;
+					e.live = true;
+					e.cell = cell;
+					auto& members = mCells[cell];
+					e.position = static_cast<uint32_t>(members.size());
+					members.push_back(h);
+				}
+				e.lat = lat;
+				e.lon = lon;
+				e.typeLength = static_cast<uint8_t>(type.size() < TrackRecord::MaxTypeLength ? type.size() : TrackRecord::MaxTypeLength);
+				std::memcpy(e.type, type.data(), e.typeLength);
+			}
+
+			void remove(Handle h) {
+				if (h >= mEntries.size()) return;
+				std::lock_guard<std::mutex> lock(mMutex);
+				if (!mEntries[h].live) return;
+				unlink(h);
+				mEntries[h].live = false;
+				--mSize;
+			}
+
+			/** entities within radius meters of (lat, lon), nearest first
+			*
+			*	@param typePrefix keep only entities whose type starts with this; empty keeps all
+			*	@param maxResults keep at most this many (the nearest); 0 for no limit
+			*	@returns the number of hits appended to out
+			*/
+			size_t queryRadius(double lat, double lon, double radius, string_view typePrefix, std::vector<Hit>& out,
+				size_t maxResults = 0) const {
+				const size_t first = out.size();
+				const double dLat = radius / ARL::Math::GeodeticKernels::metersPerDegree;
+				const double poleward = std::fabs(lat) + dLat;
+				const double dLon = poleward >= 90 ? 180
+					: std::min(180.0, dLat / std::cos(poleward * ARL::Math::GeodeticKernels::degToRad));
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					visit(lat - dLat, lat + dLat, lon - dLon, lon + dLon, [&](Handle h, const Entry& e) {
+						if (!hasPrefix(e, typePrefix)) return;
+						const double d = ARL::Math::GeodeticKernels::greatCircleDistance(lat, lon, e.lat, e.lon);
+						if (d <= radius) out.push_back(Hit{ h, d });
+					});
+				}
+				auto begin = out.begin() + first;
+				auto byDistance = [](const Hit& a, const Hit& b) { return a.distance < b.distance; };
+				if (maxResults && out.size() - first > maxResults) {
+					std::partial_sort(begin, begin + maxResults, out.end(), byDistance);
+					out.resize(first + maxResults);
+				}
+				else std::sort(begin, out.end(), byDistance);
+				return out.size() - first;
+			}
+
+			/** entities inside a lat/lon box, in no particular order
+			*
+			*	@param minLon, maxLon west and east edges; minLon > maxLon selects a box that crosses the antimeridian
+			*	@param typePrefix keep only entities whose type starts with this; empty keeps all
+			*	@param maxResults stop after this many; 0 for no limit
+			*	@returns the number of hits appended to out
+			*/
+			size_t queryBox(double minLat, double minLon, double maxLat, double maxLon, string_view typePrefix,
+				std::vector<Hit>& out, size_t maxResults = 0) const {
+				const size_t first = out.size();
+				const bool wraps = minLon > maxLon;
+				std::lock_guard<std::mutex> lock(mMutex);
+				visit(minLat, maxLat, minLon, wraps ? maxLon + 360 : maxLon, [&](Handle h, const Entry& e) {
+					if (maxResults && out.size() - first >= maxResults) return;
+					if (e.lat < minLat || e.lat > maxLat || !hasPrefix(e, typePrefix)) return;
+					const bool inLon = wraps ? (e.lon >= minLon || e.lon <= maxLon) : (e.lon >= minLon && e.lon <= maxLon);
+					if (inLon) out.push_back(Hit{ h, 0 });
+				});
+				return out.size() - first;
+			}
+
+			size_t size() const { return mSize; }
+			unsigned getPrecision() const { return mPrecision; }
+
+			/// the geohash string of a position, e.g. geohash(57.64911, 10.40744, 6) == "u4pruy"
+			static std::string geohash(double lat, double lon, unsigned precision) {
+				static const char base32[] = "0123456789bcdefghjkmnpqrstuvwxyz";
+				precision = std::max(1u, std::min<unsigned>(precision, MaxPrecision));
+				const unsigned lonBits = (5 * precision + 1) / 2, latBits = 5 * precision / 2;
+				const uint64_t cell = interleave(latIndex(lat, latBits), lonIndex(lon, lonBits), latBits, lonBits);
+				std::string hash(precision, '0');
+				for (unsigned i = 0; i < precision; ++i)
+					hash[i] = base32[(cell >> (5 * (precision - 1 - i))) & 31];
+				return hash;
+			}
+
+		protected:
+			struct Entry {
+				bool live = false;
+				uint8_t typeLength = 0;
+				uint32_t position = 0;	///< index in its cell's handle list
+				uint64_t cell = 0;
+				double lat = 0, lon = 0;
+				char type[TrackRecord::MaxTypeLength];
+			};
+
+			static bool hasPrefix(const Entry& e, string_view prefix) {
+				return prefix.size() <= e.typeLength && std::memcmp(e.type, prefix.data(), prefix.size()) == 0;
+			}
+
+			static int64_t latIndex(double lat, unsigned bits) {
+				const int64_t n = int64_t(1) << bits;
+				return std::max<int64_t>(0, std::min<int64_t>(n - 1, static_cast<int64_t>(std::floor((lat + 90) / 180 * n))));
+			}
+
+			/// longitude column, wrapped onto [0, 2^lonBits)
+			static int64_t lonIndex(double lon, unsigned bits) {
+				const int64_t n = int64_t(1) << bits;
+				const int64_t i = static_cast<int64_t>(std::floor((lon + 180) / 360 * n));
+				return ((i % n) + n) % n;
+			}
+
+			/// the geohash bits of a cell: longitude and latitude bits interleaved, longitude first
+			static uint64_t interleave(int64_t latI, int64_t lonI, unsigned latBits, unsigned lonBits) {
+				uint64_t cell = 0;
+				unsigned la = latBits, lo = lonBits;
+				for (unsigned bit = 0; bit < latBits + lonBits; ++bit) {
+					if (bit % 2 == 0) cell = (cell << 1) | ((lonI >> --lo) & 1);
+					else cell = (cell << 1) | ((latI >> --la) & 1);
+				}
+				return cell;
+			}
+
+			int64_t latIndex(double lat) const { return latIndex(lat, mLatBits); }
+			int64_t lonIndex(double lon) const { return lonIndex(lon, mLonBits); }
+			uint64_t interleave(int64_t latI, int64_t lonI) const { return interleave(latI, lonI, mLatBits, mLonBits); }
+			uint64_t cellOf(double lat, double lon) const { return interleave(latIndex(lat), lonIndex(lon)); }
+
+			/// caller holds mMutex
+			void unlink(Handle h) {
+				Entry& e = mEntries[h];
+				auto cell = mCells.find(e.cell);
+				auto& members = cell->second;
+				const Handle moved = members.back();
+				members[e.position] = moved;
+				mEntries[moved].position = e.position;
+				members.pop_back();
+				if (members.empty()) mCells.erase(cell);
+			}
+
+			/// invoke f(handle, entry) for every entity in a cell overlapping the area (a superset of it); caller holds
+			/// mMutex. maxLon may exceed 180 for an area crossing the antimeridian.
+			template <typename F>
+			void visit(double minLat, double maxLat, double minLon, double maxLon, F&& f) const {
+				const int64_t lat0 = latIndex(std::max(-90.0, minLat)), lat1 = latIndex(std::min(90.0, maxLat));
+				const int64_t columns = int64_t(1) << mLonBits;
+				int64_t lonCount = maxLon - minLon >= 360 ? columns
+					: static_cast<int64_t>(std::floor((maxLon + 180) / 360 * columns)) - static_cast<int64_t>(std::floor((minLon + 180) / 360 * columns)) + 1;
+				lonCount = std::min(lonCount, columns);
+				const double cells = static_cast<double>(lat1 - lat0 + 1) * lonCount;
+				if (cells > static_cast<double>(mSize)) {
+					for (Handle h = 0; h < mEntries.size(); ++h)
+						if (mEntries[h].live) f(h, mEntries[h]);
+					return;
+				}
+				const int64_t lon0 = lonIndex(minLon);
+				for (int64_t la = lat0; la <= lat1; ++la) {
+					for (int64_t i = 0; i < lonCount; ++i) {
+						auto cell = mCells.find(interleave(la, (lon0 + i) % columns));
+						if (cell == mCells.end()) continue;
+						for (Handle h : cell->second) f(h, mEntries[h]);
+					}
+				}
+			}
+
+			const unsigned mPrecision, mLonBits, mLatBits;
+			std::vector<Entry> mEntries;	///< [handle]
+			std::unordered_map<uint64_t, std::vector<Handle>> mCells;	///< geohash bits -> handles in the cell
+			size_t mSize;
+			mutable std::mutex mMutex;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(GeoIndex);
+		};
+	}
+}
@@ -0,0 +1,336 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Math/GeodeticKernels.hpp"
+#include "Messaging/macro.h"
+#include "TrackStore.hpp"
+
+namespace AIDTR {
+	namespace Tracking {
+
+		/** A k-d tree over contact positions in a local East-North-Up frame, for k-nearest-neighbor queries.
+		*
+		*	Positions are converted once into the ENU frame of a fixed origin (GeodeticKernels::LocalFrame, equivalent to
+		*	Geodetic::Origin). ENU is a rotation and translation of ECEF, so Euclidean distances in it are exact straight-line
+		*	distances wherever the contacts are, not only near the origin.
+		*
+		*	The tree is maintained with the logarithmic method: points live in a few balanced sub-trees of geometrically
+		*	growing size, each stored implicitly and built with nth_element, plus an unsorted buffer of at most 64 recent
+		*	points. A full buffer becomes a new sub-tree, merged with the smaller trailing ones, so a point is rebuilt
+		*	O(log n) times in all. A moved or removed point is only marked dead where it was; once a quarter of the points
+		*	are dead (or on rebalance()), everything is rebuilt into one tree. Queries search every sub-tree and the buffer.
+		*
+		*	To follow a TrackStore, register apply() as its callback: it only queues the change, coalesced per handle, and
+		*	flush() applies the queue as one batch of update() and remove(), so the tree is rebuilt per batch rather than
+		*	per write.
+		*
+		*	Updates (flush() included) are not thread-safe and must not overlap queries; queries on their own are read-only
+		*	and nearest() may spread a batch of queries over several threads. apply() may run on any thread at any time.
+		*/
+		class KdTree {
+		public:
+			using Id = uint32_t;
+
+			enum : Id { NoId = 0xffffffffu };
+
+			struct Point {
+				Id id;
+				double east, north, up;	///< meters in the tree's frame
+			};
+
+			struct Neighbor {
+				Id id;
+				double distance;	///< meters
+			};
+
+			/// the frame origin, e.g. the vehicle's operating area
+			KdTree(double originLat, double originLon, double originAlt = 0)
+				: mFrame(originLat, originLon, originAlt), mDead(0), mRebuilds(0) {}
+
+			/// @returns a point for a contact at a geodetic position; NaN altitude is taken as 0
+			Point toPoint(Id id, double lat, double lon, double hae) const {
+				Point p{ id, 0, 0, 0 };
+				mFrame.toENU(ARL::Math::GeodeticKernels::toECEF(lat, lon, hae == hae ? hae : 0), p.east, p.north, p.up);
+				return p;
+			}
+
+			/// insert new points or move existing ones (by id)
+			void update(const std::vector<Point>& points) {
+				for (const auto& p : points) {
+					if (p.id >= mLocation.size()) mLocation.resize(p.id + 1, Location{ Absent, 0 });
+					Location& where = mLocation[p.id];
+					if (where.place == InBuffer) {
+						mBuffer[where.index] = p;
+						continue;
+					}
+					if (where.place == InTree) {
+						mAlive[where.index] = 0;
+						++mDead;
+					}
+					where = Location{ InBuffer, static_cast<uint32_t>(mBuffer.size()) };
+					mBuffer.push_back(p);
+				}
+				maybeRebuild();
+			}
+
+			void remove(const std::vector<Id>& ids) {
+				for (Id id : ids) {
+					if (id >= mLocation.size()) continue;
+					Location& where = mLocation[id];
+					if (where.place == InTree) {
+						mAlive[where.index] = 0;
+						++mDead;
+					}
+					else if (where.place == InBuffer) {
+						mBuffer[where.index] = mBuffer.back();
+						mLocation[mBuffer[where.index].id].index = where.index;
+						mBuffer.pop_back();
+					}
+					where = Location{ Absent, 0 };
+				}
+				maybeRebuild();
+			}
+
+			/** follow one TrackStore write; pass to TrackStore::RegisterCallback
+			*
+			*	The change is queued under its own mutex, replacing any change of the same handle still queued, so the queue
+			*	never outgrows the store.
+			*/
+			void apply(const TrackChange& change) {
+				const TrackRecord* r = change.record;
+				const bool present = r && r->lat == r->lat && r->lon == r->lon;
+				const Point p = present ? toPoint(change.handle, r->lat, r->lon, r->hae) : Point{ change.handle, 0, 0, 0 };
+				std::lock_guard<std::mutex> lock(mPendingMutex);
+				if (change.handle >= mPendingSlot.size()) mPendingSlot.resize(change.handle + 1, NoSlot);
+				uint32_t& slot = mPendingSlot[change.handle];
+				if (slot == NoSlot) {
+					slot = static_cast<uint32_t>(mPending.size());
+					mPending.push_back(Change{ p, present });
+				}
+				else
+					mPending[slot] = Change{ p, present };
+			}
+
+			/// apply the changes queued by apply(); @returns the number of handles that changed
+			size_t flush() {
+				{
+					std::lock_guard<std::mutex> lock(mPendingMutex);
+					mWork.swap(mPending);
+					for (const auto& c : mWork) mPendingSlot[c.point.id] = NoSlot;
+				}
+				mMoved.clear();
+				mRemoved.clear();
+				for (const auto& c : mWork) {
+					if (c.present) mMoved.push_back(c.point);
+					else mRemoved.push_back(c.point.id);
+				}
+				if (!mRemoved.empty()) remove(mRemoved);
+				if (!mMoved.empty()) update(mMoved);
+				const size_t changed = mWork.size();
+				mWork.clear();
+				return changed;
+			}
+
+			/// rebuild every live point into a single balanced tree
+			void rebalance() { rebuildFrom(0); }
+
+			/** the k points nearest to a query point, nearest first
+			*
+			*	@param exclude an id to skip, e.g. the querying vehicle's own contact
+			*/
+			void nearest(const Point& query, size_t k, std::vector<Neighbor>& out, Id exclude = NoId) const {
+				out.clear();
+				if (k == 0) return;
+				Search search(query, k, exclude);
+				search.heap.swap(out); // reuse the caller's capacity
+				search.heap.reserve(k);
+				for (size_t i = 0; i < mSegments.size(); ++i)
+					searchTree(search, mSegments[i], segmentEnd(i));
+				for (const auto& p : mBuffer) search.offer(p);
+				for (auto& n : search.heap) n.distance = std::sqrt(n.distance);
+				std::sort(search.heap.begin(), search.heap.end(), byDistance);
+				out.swap(search.heap);
+			}
+
+			/** nearest() for a batch of query points, spread over up to threads threads
+			*
+			*	@param results resized to queries.size(); results[i] answers queries[i]
+			*/
+			void nearest(const std::vector<Point>& queries, size_t k, std::vector<std::vector<Neighbor>>& results,
+				size_t threads = 1, bool excludeSelf = true) const {
+				results.resize(queries.size());
+				auto run = [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i)
+						nearest(queries[i], k, results[i], excludeSelf ? queries[i].id : Id(NoId));
+				};
+				// below a few hundred queries a thread costs more than it saves
+				threads = std::max<size_t>(1, std::min(threads, queries.size() / 256));
+				if (threads == 1) {
+					run(0, queries.size());
+					return;
+				}
+				std::vector<std::thread> pool;
+				const size_t chunk = (queries.size() + threads - 1) / threads;
+				for (size_t t = 1; t < threads; ++t)
+					pool.emplace_back(run, std::min(queries.size(), t * chunk), std::min(queries.size(), (t + 1) * chunk));
+				run(0, std::min(queries.size(), chunk));
+				for (auto& t : pool) t.join();
+			}
+
+			size_t size() const { return mTree.size() - mDead + mBuffer.size(); }
+			size_t getBufferSize() const { return mBuffer.size(); }
+			size_t getTreeCount() const { return mSegments.size(); }
+			uint64_t getRebuildCount() const { return mRebuilds; }
+
+		protected:
+			enum Place : uint8_t { Absent = 0, InTree, InBuffer };
+
+			enum : uint32_t { NoSlot = 0xffffffffu };
+
+			/// a queued TrackStore write: the handle's new position, or its removal
+			struct Change {
+				Point point;
+				bool present;
+			};
+
+			struct Location {
+				Place place;
+				uint32_t index;
+			};
+
+			/// k best so far as a max-heap on squared distance
+			struct Search {
+				const Point& query;
+				size_t k;
+				Id exclude;
+				std::vector<Neighbor> heap;
+
+				Search(const Point& query, size_t k, Id exclude) : query(query), k(k), exclude(exclude) {}
+
+				double worst() const { return heap.size() < k ? std::numeric_limits<double>::infinity() : heap.front().distance; }
+
+				void offer(const Point& p) {
+					if (p.id == exclude) return;
+					const double de = p.east - query.east, dn = p.north - query.north, du = p.up - query.up;
+					const double d2 = de * de + dn * dn + du * du;
+					if (heap.size() < k) {
+						heap.push_back(Neighbor{ p.id, d2 });
+						std::push_heap(heap.begin(), heap.end(), byDistance);
+					}
+					else if (d2 < heap.front().distance) {
+						std::pop_heap(heap.begin(), heap.end(), byDistance);
+						heap.back() = Neighbor{ p.id, d2 };
+						std::push_heap(heap.begin(), heap.end(), byDistance);
+					}
+				}
+			};
+
+			static bool byDistance(const Neighbor& a, const Neighbor& b) { return a.distance < b.distance; }
+
+			static double coordinate(const Point& p, uint8_t axis) { return axis == 0 ? p.east : axis == 1 ? p.north : p.up; }
+
+			enum { BufferSize = 64 };
+
+			size_t segmentEnd(size_t i) const { return i + 1 < mSegments.size() ? mSegments[i + 1] : mTree.size(); }
+
+			void maybeRebuild() {
+				if (mDead > BufferSize && 4 * mDead > size()) {
+					rebalance();
+					return;
+				}
+				if (mBuffer.size() < BufferSize) return;
+				// merge the buffer with every trailing sub-tree no more than twice the size of what is being merged
+				size_t merged = mBuffer.size(), first = mSegments.size();
+				while (first > 0 && segmentEnd(first - 1) - mSegments[first - 1] <= 2 * merged) {
+					--first;
+					merged += segmentEnd(first) - mSegments[first];
+				}
+				rebuildFrom(first < mSegments.size() ? mSegments[first] : mTree.size());
+			}
+
+			/// rebuild the live points of the tree array from start on, plus the buffer, into one sub-tree
+			void rebuildFrom(size_t start) {
+				size_t end = start;
+				for (size_t i = start; i < mTree.size(); ++i) {
+					if (mAlive[i]) mTree[end++] = mTree[i];
+					else --mDead;
+				}
+				mTree.resize(end);
+				mTree.insert(mTree.end(), mBuffer.begin(), mBuffer.end());
+				mBuffer.clear();
+				mAlive.resize(mTree.size());
+				mAxis.resize(mTree.size());
+				std::fill(mAlive.begin() + start, mAlive.end(), 1);
+				while (!mSegments.empty() && mSegments.back() >= start) mSegments.pop_back();
+				if (start < mTree.size()) mSegments.push_back(start);
+				build(start, mTree.size());
+				for (size_t i = start; i < mTree.size(); ++i)
+					mLocation[mTree[i].id] = Location{ InTree, static_cast<uint32_t>(i) };
+				++mRebuilds;
+			}
+
+			/// the subtree over [begin, end) has its root at the middle, split on the axis of largest extent
+			void build(size_t begin, size_t end) {
+				if (end - begin < 2) return;
+				double lo[3] = { std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+				double hi[3] = { -lo[0], -lo[1], -lo[2] };
+				for (size_t i = begin; i < end; ++i)
+					for (uint8_t a = 0; a < 3; ++a) {
+						lo[a] = std::min(lo[a], coordinate(mTree[i], a));
+						hi[a] = std::max(hi[a], coordinate(mTree[i], a));
+					}
+				uint8_t axis = 0;
+				for (uint8_t a = 1; a < 3; ++a)
+					if (hi[a] - lo[a] > hi[axis] - lo[axis]) axis = a;
+				const size_t mid = begin + (end - begin) / 2;
+				std::nth_element(mTree.begin() + begin, mTree.begin() + mid, mTree.begin() + end,
+					[axis](const Point& a, const Point& b) { return coordinate(a, axis) < coordinate(b, axis); });
+				mAxis[mid] = axis;
+				build(begin, mid);
+				build(mid + 1, end);
+			}
+
+			void searchTree(Search& search, size_t begin, size_t end) const {
+				if (begin >= end) return;
+				const size_t mid = begin + (end - begin) / 2;
+				const Point& p = mTree[mid];
+				if (mAlive[mid]) search.offer(p);
+				if (end - begin == 1) return;
+				const double diff = coordinate(search.query, mAxis[mid]) - coordinate(p, mAxis[mid]);
+				if (diff < 0) {
+					searchTree(search, begin, mid);
+					if (diff * diff < search.worst()) searchTree(search, mid + 1, end);
+				}
+				else {
+					searchTree(search, mid + 1, end);
+					if (diff * diff < search.worst()) searchTree(search, begin, mid);
+				}
+			}
+
+			ARL::Math::GeodeticKernels::LocalFrame mFrame;
+			std::vector<Point> mTree;	///< implicit sub-trees: the root of [begin, end) is at the middle
+			std::vector<size_t> mSegments;	///< where each sub-tree starts in mTree, largest first
+			std::vector<uint8_t> mAxis;	///< split axis of each tree node
+			std::vector<uint8_t> mAlive;	///< 0 once a tree point has moved or been removed
+			std::vector<Point> mBuffer;	///< points added or moved since the last merge
+			std::vector<Location> mLocation;	///< [id]
+			size_t mDead;
+			uint64_t mRebuilds;
+
+			std::mutex mPendingMutex;
+			std::vector<Change> mPending;	///< guarded by mPendingMutex
+			std::vector<uint32_t> mPendingSlot;	///< [handle] its change in mPending, or NoSlot; guarded by mPendingMutex
+			std::vector<Change> mWork;	///< the batch being flushed
+			std::vector<Point> mMoved;
+			std::vector<Id> mRemoved;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(KdTree);
+		};
+	}
+}
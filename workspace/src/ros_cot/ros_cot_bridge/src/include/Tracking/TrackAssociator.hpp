@@ -0,0 +1,483 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+#include "Math/GeodeticKernels.hpp"
+#include "Messaging/macro.h"
+#include "Utility/FastHash.hpp"
+
+namespace AIDTR {
+	namespace Tracking {
+
+		/** Associates contact reports from several reporters into fused tracks, one per physical object.
+		*
+		*	The same object is often reported under different uids (our robots, ATAK users, an MPU5 gateway). Each report is
+		*	gated against nearby fused tracks: a report and a track associate when their types are compatible (see
+		*	typesCompatible) and they are closer than
+		*
+		*	    gate = min(maxGate, minGate + gateSigma * sqrt(ce_report^2 + ce_track^2))
+		*
+		*	The closest track relative to its gate wins; with none, the report starts a new track. A fused track's position
+		*	is the inverse-variance (1/ce^2) weighted mean of its members' latest reports. A uid stays with its track until
+		*	one of its reports falls outside the gate of the other members, when it leaves and is associated afresh.
+		*
+		*	Tracks are found through a spatial hash grid with several levels of cell size, each four times the previous. A
+		*	track lives in the level whose cells are just larger than its own gate radius (from its ce), so a precise track
+		*	sits in small cells and a vague one in large cells, and a report only visits the few cells per occupied level
+		*	that its gate can reach. An update costs O(tracks in those cells), independent of the total number of tracks.
+		*
+		*	Track storage is fixed at construction, so pointers to tracks stay valid until the track is removed. Not
+		*	thread-safe: call from one thread, e.g. the receive callback.
+		*/
+		class TrackAssociator {
+		public:
+			using string_view = boost::string_view;
+
+			struct Config {
+				double gateSigma = 3;	///< gate width in multiples of the combined ce
+				double minGate = 10;	///< meters, added to every gate; also the smallest grid cell
+				double maxGate = 1000;	///< meters; reports farther apart never associate
+				double defaultCe = 100;	///< meters, assumed when a report's ce is absent or the CoT "unknown" 9999999
+				int64_t memberTimeoutMicros = 60000000;	///< a uid not heard from for this long is dropped from its track
+				size_t maxTracks = 1 << 16;
+			};
+
+			/// the latest report of one uid
+			struct Member {
+				std::string uid;
+				std::string type;
+				double lat, lon, hae, ce;
+				int64_t time;	///< report time, microseconds since the Unix epoch
+			};
+
+			struct Track {
+				uint64_t id = 0;	///< unique for the life of the associator; 0 for an unused slot
+				std::string type;	///< the most specific member type, with the most definite affiliation
+				double lat = 0, lon = 0;
+				double hae = std::numeric_limits<double>::quiet_NaN();	///< NaN if no member reports a height
+				double ce = 0;	///< fused circular error, meters
+				int64_t time = 0;	///< newest member report time
+				std::vector<Member> members;
+				size_t primary = 0;	///< index in members of the most precise (smallest ce) reporter
+			};
+
+			enum Change { Updated = 0, Created, Joined, NumChanges };
+
+			struct Result {
+				const Track* track = nullptr;	///< the uid's track; nullptr if the report had no position or storage is full
+				Change change = Updated;	///< Updated: the uid was already a member; Created/Joined: it has just been associated
+				bool fromPrimary = false;	///< the uid is the track's most precise member
+				const Track* left = nullptr;	///< the track the uid has just left, if that track still has members
+			};
+
+			TrackAssociator() : TrackAssociator(Config()) {}
+
+			explicit TrackAssociator(const Config& config)
+				: mConfig(config), mSlots(std::max<size_t>(config.maxTracks, 1)), mNextId(1) {
+				if (mConfig.minGate < 1) mConfig.minGate = 1;
+				if (mConfig.maxGate < mConfig.minGate) mConfig.maxGate = mConfig.minGate;
+				for (double c = mConfig.minGate; mCellSizes.size() < MaxLevels; c *= 4) {
+					mCellSizes.push_back(c);
+					if (c >= mConfig.maxGate) break;
+				}
+				mLevelCounts.assign(mCellSizes.size(), 0);
+				mFree.reserve(mSlots.size());
+				for (size_t i = mSlots.size(); i-- > 0;)
+					mFree.push_back(static_cast<uint32_t>(i));
+			}
+
+			/** associate one report
+			*
+			*	@param ce circular error in meters; NaN or >= 9999999 means unknown
+			*	@param time report time, microseconds since the Unix epoch
+			*/
+			Result update(string_view uid, string_view type, double lat, double lon, double hae, double ce, int64_t time) {
+				Result result;
+				if (!(lat == lat && lon == lon)) return result;
+				++mUpdates;
+				ce = effectiveCe(ce);
+				const uint64_t key = uidKey(uid);
+
+				auto found = mByUid.find(key);
+				if (found != mByUid.end()) {
+					Slot& slot = mSlots[found->second];
+					const size_t m = memberIndex(slot.track, uid);
+					Member& member = slot.track.members[m];
+					member.type.assign(type.data(), type.size());
+					member.lat = lat; member.lon = lon; member.hae = hae; member.ce = ce; member.time = time;
+					if (stillAssociated(slot.track, m)) {
+						refresh(found->second);
+						result.track = &slot.track;
+						result.fromPrimary = slot.track.primary == m;
+						return result;
+					}
+					// the uid has moved away from the others: leave, then associate as a new report
+					const uint32_t leftIndex = found->second;
+					slot.track.members.erase(slot.track.members.begin() + m);
+					--mMembers;
+					mByUid.erase(found);
+					refresh(leftIndex);
+					result.left = &slot.track;
+				}
+
+				uint32_t index = nearest(type, lat, lon, ce);
+				if (index != None) {
+					result.change = Joined;
+				}
+				else {
+					if (mFree.empty()) {
+						++mOverflows;
+						return result;
+					}
+					index = mFree.back();
+					mFree.pop_back();
+					mSlots[index].track.id = mNextId++;
+					mSlots[index].level = None;
+					result.change = Created;
+				}
+				Track& track = mSlots[index].track;
+				track.members.push_back(Member{ std::string(uid.data(), uid.size()), std::string(type.data(), type.size()), lat, lon, hae, ce, time });
+				mByUid[key] = index;
+				++mMembers;
+				refresh(index);
+				result.track = &track;
+				result.fromPrimary = track.members[track.primary].uid == uid;
+				return result;
+			}
+
+			/// drop a uid from its track, e.g. on a CoT delete; @returns false if it was not associated
+			bool remove(string_view uid) {
+				auto found = mByUid.find(uidKey(uid));
+				if (found == mByUid.end()) return false;
+				const uint32_t index = found->second;
+				Track& track = mSlots[index].track;
+				track.members.erase(track.members.begin() + memberIndex(track, uid));
+				--mMembers;
+				mByUid.erase(found);
+				refresh(index);
+				return true;
+			}
+
+			/** drop members whose last report is older than the member timeout, and tracks left without members
+			*
+			*	Visits every track; call periodically (e.g. once a second), not per report.
+			*	@returns the number of members dropped
+			*/
+			size_t expire(int64_t nowMicros) {
+				const int64_t oldest = nowMicros - mConfig.memberTimeoutMicros;
+				size_t dropped = 0;
+				for (uint32_t i = 0; i < mSlots.size(); ++i) {
+					Track& track = mSlots[i].track;
+					if (!track.id) continue;
+					auto& members = track.members;
+					const size_t before = members.size();
+					for (const auto& m : members)
+						if (m.time < oldest) mByUid.erase(uidKey(m.uid));
+					members.erase(std::remove_if(members.begin(), members.end(),
+						[oldest](const Member& m) { return m.time < oldest; }), members.end());
+					if (members.size() != before) {
+						dropped += before - members.size();
+						refresh(i);
+					}
+				}
+				mMembers -= dropped;
+				return dropped;
+			}
+
+			/// @returns the track a uid belongs to, or nullptr
+			const Track* find(string_view uid) const {
+				auto found = mByUid.find(uidKey(uid));
+				return found == mByUid.end() ? nullptr : &mSlots[found->second].track;
+			}
+
+			/// invoke f(const Track&) for every live track
+			template <typename F>
+			void forEach(F&& f) const {
+				for (const auto& slot : mSlots)
+					if (slot.track.id) f(slot.track);
+			}
+
+			size_t size() const { return mSlots.size() - mFree.size(); }
+			size_t getMemberCount() const { return mMembers; }
+			uint64_t getUpdateCount() const { return mUpdates; }
+			/// tracks examined as association candidates, over all updates
+			uint64_t getCandidateCount() const { return mCandidates; }
+			/// reports that needed a new track while storage was full
+			uint64_t getOverflowCount() const { return mOverflows; }
+			const Config& getConfig() const { return mConfig; }
+
+			/** whether two CoT types could describe the same object
+			*
+			*	Both must be atoms (a-...). Affiliations must agree, where friend and assumed friend agree, hostile, suspect,
+			*	joker and faker agree, and pending, unknown, none and other agree with anything. The battle dimension and
+			*	function must be equal or one a refinement of the other (a-f-G agrees with a-f-G-U-C, not with a-f-A).
+			*/
+			static bool typesCompatible(string_view a, string_view b) {
+				if (!isAtom(a) || !isAtom(b)) return false;
+				if (!affiliationsCompatible(a[2], b[2])) return false;
+				const string_view fa = a.substr(4), fb = b.substr(4);
+				const size_t n = std::min(fa.size(), fb.size());
+				if (fa.substr(0, n) != fb.substr(0, n)) return false;
+				return (fa.size() == n || fa[n] == '-') && (fb.size() == n || fb[n] == '-');
+			}
+
+			static const char* toString(Change change) {
+				switch (change) {
+				case Updated: return "updated";
+				case Created: return "created";
+				case Joined: return "joined";
+				default: return "unknown";
+				}
+			}
+
+		protected:
+			static constexpr uint32_t None = std::numeric_limits<uint32_t>::max();
+			static constexpr size_t MaxLevels = 12;
+
+			struct Slot {
+				Track track;
+				uint32_t level = None;	///< grid level, None while not in the grid
+				uint64_t cell = 0;
+				uint32_t next = None;	///< next track in the same cell
+			};
+
+			static uint64_t uidKey(string_view uid) { return Utility::FastHash::hash(uid.data(), uid.size()); }
+
+			static bool isAtom(string_view t) { return t.size() >= 5 && t[0] == 'a' && t[1] == '-' && t[3] == '-'; }
+
+			/// 0 for the affiliations that agree with anything
+			static int affiliationClass(char c) {
+				switch (c) {
+				case 'f': case 'a': return 1;
+				case 'h': case 's': case 'j': case 'k': return 2;
+				case 'n': return 3;
+				default: return 0;
+				}
+			}
+
+			static bool affiliationsCompatible(char a, char b) {
+				const int ca = affiliationClass(a), cb = affiliationClass(b);
+				return ca == 0 || cb == 0 || ca == cb;
+			}
+
+			double effectiveCe(double ce) const { return ce == ce && ce > 0 && ce < 9999999 ? ce : mConfig.defaultCe; }
+
+			double gate(double ceA, double ceB) const {
+				return std::min(mConfig.maxGate, mConfig.minGate + mConfig.gateSigma * std::sqrt(ceA * ceA + ceB * ceB));
+			}
+
+			/// the farthest a track or report with this ce can associate, against a perfectly precise partner
+			double radius(double ce) const { return std::min(mConfig.maxGate, mConfig.minGate + mConfig.gateSigma * ce); }
+
+			static size_t memberIndex(const Track& track, string_view uid) {
+				for (size_t i = 0; i < track.members.size(); ++i)
+					if (track.members[i].uid == uid) return i;
+				return 0; // unreachable while mByUid and the member lists agree
+			}
+
+			/// whether member m is within the gate of the fused estimate of the other members
+			bool stillAssociated(const Track& track, size_t m) const {
+				if (track.members.size() < 2) return true;
+				const Estimate others = estimate(track.members, m);
+				const Member& member = track.members[m];
+				return typesCompatible(member.type, *others.type)
+					&& ARL::Math::GeodeticKernels::flatDistance(member.lat, member.lon, others.lat, others.lon) <= gate(member.ce, others.ce);
+			}
+
+			/// the compatible track whose gate the report is deepest inside, or None
+			uint32_t nearest(string_view type, double lat, double lon, double ce) {
+				uint32_t best = None;
+				double bestScore = std::numeric_limits<double>::infinity();
+				for (size_t level = 0; level < mCellSizes.size(); ++level) {
+					if (!mLevelCounts[level]) continue;
+					const double reach = std::min(mConfig.maxGate, radius(ce) + mCellSizes[level]);
+					forEachCell(level, lat, lon, reach, [&](uint64_t cell) {
+						auto head = mCells.find(cell);
+						if (head == mCells.end()) return;
+						for (uint32_t i = head->second; i != None; i = mSlots[i].next) {
+							++mCandidates;
+							const Track& t = mSlots[i].track;
+							if (!typesCompatible(type, t.type)) continue;
+							const double d = ARL::Math::GeodeticKernels::flatDistance(lat, lon, t.lat, t.lon);
+							const double g = gate(ce, t.ce);
+							if (d <= g && d / g < bestScore) {
+								bestScore = d / g;
+								best = i;
+							}
+						}
+					});
+				}
+				return best;
+			}
+
+			/// recompute a track's fused state after its members changed, and move it in the grid or free it
+			void refresh(uint32_t index) {
+				Slot& slot = mSlots[index];
+				if (slot.track.members.empty()) {
+					unlink(index);
+					slot.track = Track();
+					mFree.push_back(index);
+					return;
+				}
+				fuse(slot.track);
+				const uint32_t level = levelFor(slot.track.ce);
+				const uint64_t cell = cellKey(level, slot.track.lat, slot.track.lon);
+				if (level == slot.level && cell == slot.cell) return;
+				unlink(index);
+				slot.level = level;
+				slot.cell = cell;
+				uint32_t& head = mCells.emplace(cell, uint32_t(None)).first->second;
+				slot.next = head;
+				head = index;
+				++mLevelCounts[level];
+			}
+
+			void unlink(uint32_t index) {
+				Slot& slot = mSlots[index];
+				if (slot.level == None) return;
+				auto head = mCells.find(slot.cell);
+				if (head != mCells.end()) {
+					uint32_t* link = &head->second;
+					while (*link != None && *link != index) link = &mSlots[*link].next;
+					if (*link == index) *link = slot.next;
+					if (head->second == None) mCells.erase(head);
+				}
+				--mLevelCounts[slot.level];
+				slot.level = None;
+				slot.next = None;
+			}
+
+			/// a fused state computed from a track's members
+			struct Estimate {
+				double lat, lon, hae, ce;
+				int64_t time;
+				size_t primary;
+				const std::string* type;	///< the longest member type
+				char affiliation;	///< the first definite member affiliation, 0 if none
+			};
+
+			/// inverse-variance weighted position, fused ce, newest time, most specific type and most precise member,
+			/// over every member but exclude
+			static Estimate estimate(const std::vector<Member>& members, size_t exclude = None) {
+				Estimate e{ 0, 0, 0, 0, std::numeric_limits<int64_t>::min(), 0, nullptr, 0 };
+				double lon0 = 0, w = 0, lat = 0, dLon = 0, hW = 0, hae = 0, bestCe = std::numeric_limits<double>::infinity();
+				for (size_t i = 0; i < members.size(); ++i) {
+					if (i == exclude) continue;
+					const Member& m = members[i];
+					if (!e.type) {
+						lon0 = m.lon;
+						e.type = &m.type;
+					}
+					const double wi = 1 / (m.ce * m.ce);
+					w += wi;
+					lat += wi * m.lat;
+					dLon += wi * ARL::Math::GeodeticKernels::lonDifference(lon0, m.lon);
+					if (m.hae == m.hae && std::fabs(m.hae) < 9999999) {
+						hW += wi;
+						hae += wi * m.hae;
+					}
+					if (m.ce < bestCe) {
+						bestCe = m.ce;
+						e.primary = i;
+					}
+					e.time = std::max(e.time, m.time);
+					if (m.type.size() > e.type->size()) e.type = &m.type;
+					if (!e.affiliation && isAtom(m.type) && affiliationClass(m.type[2])) e.affiliation = m.type[2];
+				}
+				e.lat = lat / w;
+				e.lon = lon0 + dLon / w;
+				if (e.lon > 180) e.lon -= 360;
+				else if (e.lon < -180) e.lon += 360;
+				e.hae = hW > 0 ? hae / hW : std::numeric_limits<double>::quiet_NaN();
+				e.ce = 1 / std::sqrt(w);
+				return e;
+			}
+
+			static void fuse(Track& track) {
+				const Estimate e = estimate(track.members);
+				track.lat = e.lat;
+				track.lon = e.lon;
+				track.hae = e.hae;
+				track.ce = e.ce;
+				track.time = e.time;
+				track.primary = e.primary;
+				track.type = *e.type;
+				if (e.affiliation && isAtom(track.type) && !affiliationClass(track.type[2])) track.type[2] = e.affiliation;
+			}
+
+			uint32_t levelFor(double ce) const {
+				const double r = radius(ce);
+				uint32_t level = 0;
+				while (level + 1 < mCellSizes.size() && mCellSizes[level] < r) ++level;
+				return level;
+			}
+
+			/// cells of a level are rows of equal latitude height, each split into as many equal longitude columns as fit
+			double rowHeight(size_t level) const { return mCellSizes[level] / ARL::Math::GeodeticKernels::metersPerDegree; }
+
+			int64_t columnsInRow(size_t level, int64_t row) const {
+				const double h = rowHeight(level);
+				const double latitude = std::min(90.0, std::fabs(-90 + (row + 0.5) * h));
+				const double circumference = 360 * ARL::Math::GeodeticKernels::metersPerDegree * std::cos(latitude * ARL::Math::GeodeticKernels::degToRad);
+				return std::max<int64_t>(1, static_cast<int64_t>(circumference / mCellSizes[level]));
+			}
+
+			static uint64_t packCell(size_t level, int64_t row, int64_t column) {
+				return (static_cast<uint64_t>(level) << 56) | ((static_cast<uint64_t>(row) & 0xffffff) << 32)
+					| (static_cast<uint64_t>(column) & 0xffffffff);
+			}
+
+			uint64_t cellKey(size_t level, double lat, double lon) const {
+				const int64_t row = static_cast<int64_t>(std::floor((lat + 90) / rowHeight(level)));
+				const int64_t columns = columnsInRow(level, row);
+				int64_t column = static_cast<int64_t>(std::floor((lon + 180) * columns / 360));
+				column = ((column % columns) + columns) % columns;
+				return packCell(level, row, column);
+			}
+
+			/// invoke f(cell) for every cell of a level that has a point within reach meters of (lat, lon)
+			template <typename F>
+			void forEachCell(size_t level, double lat, double lon, double reach, F&& f) const {
+				const double h = rowHeight(level);
+				const double reachDeg = reach / ARL::Math::GeodeticKernels::metersPerDegree;
+				const int64_t firstRow = static_cast<int64_t>(std::floor((std::max(-90.0, lat - reachDeg) + 90) / h));
+				const int64_t lastRow = static_cast<int64_t>(std::floor((std::min(90.0, lat + reachDeg) + 90) / h));
+				// widest longitude span of the reach circle, at its most poleward latitude
+				const double poleward = std::min(89.9, std::fabs(lat) + reachDeg);
+				const double lonSpan = reachDeg / std::cos(poleward * ARL::Math::GeodeticKernels::degToRad);
+				for (int64_t row = firstRow; row <= lastRow; ++row) {
+					const int64_t columns = columnsInRow(level, row);
+					const int64_t first = static_cast<int64_t>(std::floor((lon - lonSpan + 180) * columns / 360));
+					const int64_t last = static_cast<int64_t>(std::floor((lon + lonSpan + 180) * columns / 360));
+					if (last - first + 1 >= columns) {
+						for (int64_t c = 0; c < columns; ++c) f(packCell(level, row, c));
+						continue;
+					}
+					for (int64_t c = first; c <= last; ++c)
+						f(packCell(level, row, ((c % columns) + columns) % columns));
+				}
+			}
+
+			Config mConfig;
+			std::vector<double> mCellSizes;	///< [level], meters
+			std::vector<size_t> mLevelCounts;	///< tracks per level, to skip empty levels
+
+			std::vector<Slot> mSlots;
+			std::vector<uint32_t> mFree;
+			std::unordered_map<uint64_t, uint32_t> mCells;	///< cell key -> first track in the cell
+			std::unordered_map<uint64_t, uint32_t> mByUid;	///< uid hash -> track
+
+			uint64_t mNextId;
+			size_t mMembers = 0;
+			uint64_t mUpdates = 0, mCandidates = 0, mOverflows = 0;
+
+		private:
+			DISALLOW_COPY_AND_ASSIGN(TrackAssociator);
+		};
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include "Messaging/CoTEvent.hpp"
+#include "Messaging/CoTEventParser.hpp"
+#include "Utility/LatencyHistogram.hpp"
+#include "Messaging/macro.h"
+
+namespace AIDTR {
+	/** Where the time goes between a ROS message being stamped and the report made from it leaving the host.
+	*
+	*	Each report carries an Origin (its input's header stamp and when its callback was entered) through encoding and
+	*	the send, and when the send completes the transmitter calls record() with the times it reached each step. The
+	*	differences between consecutive marks are kept as per-stage histograms:
+	*
+	*		Callback: header stamp to callback entry (ROS transport and the input's queue)
+	*		Encode:   callback entry to the event encoded (including waiting for the encoder)
+	*		Queue:    encoded to the send issued (copying the event out, and appending it to a capture log if set)
+	*		Send:     send issued to its completion handler
+	*		Total:    header stamp to completion; callback entry to completion when the input had no stamp
+	*
+	*	All marks are wall clock nanoseconds since the Unix epoch, so the stamp stages are only meaningful when the
+	*	publisher's clock is this host's (not simulated time). Outgoing events may also be tagged with a <__trace>
+	*	detail element carrying a sequence number and the origin stamp, so a listener elsewhere (see TraceListener.cpp)
+	*	can measure stamp to arrival and count what never arrived.
+	*
+	*	record() and nextSequence() may be called from any number of threads.
+	*
+	*	TransmitTrace
+	*/
+	class TransmitTrace {
+	public:
+		enum Stage { Callback = 0, Encode, Queue, Send, Total, NumStages };
+
+		static const char* toString(Stage stage) {
+			static const char* const names[NumStages] = { "callback", "encode", "queue", "send", "total" };
+			return stage >= 0 && stage < NumStages ? names[stage] : "unknown";
+		}
+
+		/// when a report's input was stamped (0 if it had no stamp) and its callback entered
+		struct Origin {
+			int64_t stampNanos = 0;
+			int64_t callbackNanos = 0;
+		};
+
+		/// @param tagEvents whether transmitters add a <__trace> element to the events they send
+		explicit TransmitTrace(bool tagEvents = false) : mTagEvents(tagEvents), mSequence(0) {}
+
+		bool tagsEvents() const { return mTagEvents; }
+
+		/// the next sequence number for a tagged event; the first is 1
+		uint64_t nextSequence() { return mSequence.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+		void record(const Origin& origin, int64_t encodedNanos, int64_t issuedNanos, int64_t completedNanos) {
+			if (origin.stampNanos != 0)
+				mLatency[Callback].record(origin.callbackNanos - origin.stampNanos);
+			mLatency[Encode].record(encodedNanos - origin.callbackNanos);
+			mLatency[Queue].record(issuedNanos - encodedNanos);
+			mLatency[Send].record(completedNanos - issuedNanos);
+			mLatency[Total].record(completedNanos - (origin.stampNanos != 0 ? origin.stampNanos : origin.callbackNanos));
+		}
+
+		const Utility::LatencyHistogram& getLatency(Stage stage) const { return mLatency[stage]; }
+
+		static int64_t wallNanos() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+		}
+
+		/// the <__trace> element tagging an event with its sequence number and origin stamp
+		static std::string tag(uint64_t sequence, int64_t stampNanos) {
+			return "<__trace seq=\"" + std::to_string(sequence) + "\" stamp=\"" + std::to_string(stampNanos) + "\"/>";
+		}
+
+		/// read a received event's <__trace> tag; false if it has none
+		static bool parseTag(const Messaging::CoTEvent& event, uint64_t& sequence, int64_t& stampNanos) {
+			const auto seq = Messaging::CoTEventParser::FindDetailAttribute(event.detail, "__trace", "seq");
+			const auto stamp = Messaging::CoTEventParser::FindDetailAttribute(event.detail, "__trace", "stamp");
+			if (seq.empty() || stamp.empty())
+				return false;
+			sequence = std::strtoull(std::string(seq.data(), seq.size()).c_str(), nullptr, 10);
+			stampNanos = std::strtoll(std::string(stamp.data(), stamp.size()).c_str(), nullptr, 10);
+			return true;
+		}
+
+		/// the columns written by writeCsvRow
+		static void writeCsvHeader(std::ostream& os) {
+			os << "time,label,stage,count,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n";
+		}
+
+		/// one row summarising a histogram, in microseconds, stamped with the current time in seconds since the epoch
+		static void writeCsvRow(std::ostream& os, const std::string& label, const char* stage, const Utility::LatencyHistogram& latency) {
+			os << std::time(nullptr) << ',' << label << ',' << stage << ',' << latency.count() << ',' << latency.mean() / 1e3
+				<< ',' << latency.percentile(0.5) / 1e3 << ',' << latency.percentile(0.9) / 1e3 << ',' << latency.percentile(0.99) / 1e3
+				<< ',' << latency.percentile(0.999) / 1e3 << ',' << latency.max() / 1e3 << '\n';
+		}
+
+		/** append a row per stage to a CSV file, writing the header first if the file is new or empty, so that runs
+		*	under different labels accumulate in one file for comparison
+		*
+		*	@returns false if the file could not be written
+		*/
+		bool exportCsv(const std::string& path, const std::string& label) const {
+			std::ofstream os(path, std::ios::app);
+			if (!os)
+				return false;
+			if (os.tellp() == 0)
+				writeCsvHeader(os);
+			for (int i = 0; i < NumStages; ++i)
+				writeCsvRow(os, label, toString(Stage(i)), mLatency[i]);
+			return static_cast<bool>(os.flush());
+		}
+
+	protected:
+		const bool mTagEvents;
+		std::atomic<uint64_t> mSequence;
+		Utility::LatencyHistogram mLatency[NumStages];
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(TransmitTrace);
+	};
+}
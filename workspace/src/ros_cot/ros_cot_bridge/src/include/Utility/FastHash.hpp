@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Utility {
+
+	/**
+	* Small, fast, non-cryptographic 64-bit hashing for short keys (uids, timestamps, addresses).
+	* Consumes 8 bytes per step and finishes with a murmur3-style avalanche, so it is cheap enough to run on every
+	* datagram before any parsing happens. Results are stable within a process but are not a wire format.
+	*/
+	namespace FastHash {
+
+		inline uint64_t mix(uint64_t h) {
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+			return h;
+		}
+
+		inline uint64_t hash(const void* data, size_t size, uint64_t seed = 0x9e3779b97f4a7c15ULL) {
+			const unsigned char* p = static_cast<const unsigned char*>(data);
+			const uint64_t m = 0x87c37b91114253d5ULL;
+			uint64_t h = seed ^ (size * m);
+			while (size >= 8) {
+				uint64_t k;
+				std::memcpy(&k, p, 8);
+				h = (h ^ mix(k)) * m;
+				p += 8;
+				size -= 8;
+			}
+			uint64_t tail = 0;
+			for (size_t i = 0; i < size; ++i)
+				tail |= static_cast<uint64_t>(p[i]) << (8 * i);
+			h = (h ^ mix(tail)) * m;
+			return mix(h);
+		}
+
+		/// combine two hashes, order-dependent
+		inline uint64_t combine(uint64_t a, uint64_t b) {
+			return mix(a ^ (b + 0x9e3779b97f4a7c15ULL + (a << 6) + (a >> 2)));
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "Messaging/macro.h"
+
+namespace Utility {
+
+	/** A fixed-size, log-linear histogram of durations in nanoseconds.
+	*
+	*	Each power of two is split into 8 linear sub-buckets, so any recorded value is reported within 12.5% of its true
+	*	value, from 1 ns up to several days, in 512 counters. record() is wait-free (relaxed atomic increments) and may be
+	*	called from any number of threads; readers see an approximately consistent view.
+	*/
+	class LatencyHistogram {
+	public:
+		static constexpr size_t SubBucketBits = 3;
+		static constexpr size_t SubBuckets = size_t(1) << SubBucketBits;
+		static constexpr size_t NumBuckets = 64 * SubBuckets;
+
+		LatencyHistogram() { reset(); }
+
+		void record(int64_t nanos) {
+			const uint64_t v = nanos > 0 ? static_cast<uint64_t>(nanos) : 0;
+			mCounts[bucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+			mCount.fetch_add(1, std::memory_order_relaxed);
+			mSum.fetch_add(v, std::memory_order_relaxed);
+			uint64_t max = mMax.load(std::memory_order_relaxed);
+			while (v > max && !mMax.compare_exchange_weak(max, v, std::memory_order_relaxed)) {}
+		}
+
+		/// not atomic with respect to concurrent record() calls; a sample recorded during reset may be partly kept
+		void reset() {
+			for (auto& c : mCounts) c.store(0, std::memory_order_relaxed);
+			mCount.store(0, std::memory_order_relaxed);
+			mSum.store(0, std::memory_order_relaxed);
+			mMax.store(0, std::memory_order_relaxed);
+		}
+
+		uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+		uint64_t max() const { return mMax.load(std::memory_order_relaxed); }
+
+		double mean() const {
+			const uint64_t n = count();
+			return n ? static_cast<double>(mSum.load(std::memory_order_relaxed)) / n : 0.0;
+		}
+
+		/** @param q quantile in [0, 1], e.g. 0.99
+		*	@returns the upper edge of the bucket holding the q-th sample, in nanoseconds; 0 if nothing was recorded
+		*/
+		uint64_t percentile(double q) const {
+			const uint64_t n = count();
+			if (n == 0) return 0;
+			uint64_t rank = static_cast<uint64_t>(q * n + 0.5);
+			if (rank < 1) rank = 1;
+			uint64_t seen = 0;
+			for (size_t i = 0; i < NumBuckets; ++i) {
+				seen += mCounts[i].load(std::memory_order_relaxed);
+				if (seen >= rank) {
+					const uint64_t upper = i + 1 < NumBuckets ? lowerBound(i + 1) - 1 : max();
+					return upper < max() ? upper : max();
+				}
+			}
+			return max();
+		}
+
+		static size_t bucketOf(uint64_t v) {
+			if (v < SubBuckets) return static_cast<size_t>(v);
+			const size_t msb = 63 - static_cast<size_t>(__builtin_clzll(v));
+			const size_t sub = static_cast<size_t>(v >> (msb - SubBucketBits)) & (SubBuckets - 1);
+			return (msb - SubBucketBits + 1) * SubBuckets + sub;
+		}
+
+		/// smallest value that falls in bucket i
+		static uint64_t lowerBound(size_t i) {
+			if (i < SubBuckets) return i;
+			const size_t msb = i / SubBuckets + SubBucketBits - 1;
+			return (SubBuckets + i % SubBuckets) << (msb - SubBucketBits);
+		}
+
+	protected:
+		std::atomic<uint64_t> mCounts[NumBuckets];
+		std::atomic<uint64_t> mCount, mSum, mMax;
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include "Messaging/macro.h"
+
+namespace Utility {
+
+	/** A bounded, lock-free, single-producer single-consumer ring.
+	*
+	*	Slots are preallocated and filled in place: the producer obtains a slot with beginPush(), writes it, and publishes
+	*	it with commitPush(); the consumer reads front() and releases it with pop(). Slot objects are reused rather than
+	*	destroyed, so a T that owns a buffer (e.g. std::vector<char>) keeps its capacity from one lap to the next.
+	*
+	*	Exactly one thread may produce and one thread may consume. size() and getHighWater() may be read from any thread.
+	*/
+	template <typename T>
+	class SpscRing {
+	public:
+		/// @param capacity number of slots; rounded up to a power of two
+		explicit SpscRing(size_t capacity)
+			: mMask(roundUpPow2(capacity < 2 ? 2 : capacity) - 1), mSlots(mMask + 1),
+			mHead(0), mCachedTail(0), mTail(0), mCachedHead(0), mHighWater(0) {}
+
+		size_t capacity() const { return mMask + 1; }
+
+		/// number of slots published and not yet popped; approximate while either side is active
+		size_t size() const {
+			const size_t head = mHead.load(std::memory_order_acquire); // head first, so the difference cannot go negative
+			return mTail.load(std::memory_order_acquire) - head;
+		}
+
+		bool empty() const { return size() == 0; }
+
+		/// high-water mark of size(), as seen by the producer; may overstate by what the consumer popped since the producer last looked
+		size_t getHighWater() const { return mHighWater.load(std::memory_order_relaxed); }
+
+		//---------------------------------------------------------------------------------------------------- producer
+
+		/// @returns the next free slot, or nullptr if the ring is full
+		T* beginPush() {
+			const size_t tail = mTail.load(std::memory_order_relaxed);
+			if (tail - mCachedHead > mMask) {
+				mCachedHead = mHead.load(std::memory_order_acquire);
+				if (tail - mCachedHead > mMask) return nullptr;
+			}
+			return &mSlots[tail & mMask];
+		}
+
+		/// publish the slot returned by the last beginPush()
+		void commitPush() {
+			const size_t tail = mTail.load(std::memory_order_relaxed) + 1;
+			mTail.store(tail, std::memory_order_release);
+			const size_t depth = tail - mCachedHead;
+			if (depth > mHighWater.load(std::memory_order_relaxed))
+				mHighWater.store(depth, std::memory_order_relaxed);
+		}
+
+		//---------------------------------------------------------------------------------------------------- consumer
+
+		/// @returns the oldest published slot, or nullptr if the ring is empty
+		T* front() {
+			const size_t head = mHead.load(std::memory_order_relaxed);
+			if (head == mCachedTail) {
+				mCachedTail = mTail.load(std::memory_order_acquire);
+				if (head == mCachedTail) return nullptr;
+			}
+			return &mSlots[head & mMask];
+		}
+
+		/// release the slot returned by front() back to the producer
+		void pop() {
+			mHead.store(mHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+	protected:
+		static size_t roundUpPow2(size_t n) {
+			size_t p = 1;
+			while (p < n) p <<= 1;
+			return p;
+		}
+
+		// Producer and consumer indices are padded onto separate cache lines so the two sides do not false-share.
+		// Each side keeps a cached copy of the other's index and only re-reads it when the ring looks full/empty.
+		const size_t mMask;
+		std::vector<T> mSlots;
+		char mPad0[64];
+		std::atomic<size_t> mHead;	///< consumer
+		size_t mCachedTail;	///< consumer's copy of mTail
+		char mPad1[64];
+		std::atomic<size_t> mTail;	///< producer
+		size_t mCachedHead;	///< producer's copy of mHead
+		std::atomic<size_t> mHighWater;
+		char mPad2[64];
+
+	private:
+		DISALLOW_COPY_AND_ASSIGN(SpscRing);
+	};
+}
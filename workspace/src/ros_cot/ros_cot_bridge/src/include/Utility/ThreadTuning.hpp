@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+
+namespace Utility {
+
+	/** pin the calling thread to one CPU
+	*
+	*	@returns 0, or the error number if the CPU does not exist or is not allowed to this process
+	*/
+	inline int pinCurrentThread(int cpu) {
+		if (cpu < 0 || cpu >= CPU_SETSIZE) return EINVAL;
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+
+	/** run the calling thread under SCHED_FIFO at priority, so it preempts every normally scheduled thread as soon as
+	*	it is runnable
+	*
+	*	@returns 0, or the error number; EPERM unless the process has CAP_SYS_NICE or an RLIMIT_RTPRIO of at least priority
+	*/
+	inline int setCurrentThreadRealtime(int priority) {
+		sched_param param;
+		param.sched_priority = priority;
+		return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	}
+}
@@ -0,0 +1,137 @@
+// test_stream_framer.cpp : StreamFramer on CoT streams split across reads, with oversized events and garbage between
+// events.
+//
+// Streams are fed the way CoTStreamReceiver reads a socket, through prepare() and commit() in reads of a given size,
+// and every split of a stream must frame the same events as reading it whole.
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "Ingest/StreamFramer.hpp"
+#include "Messaging/TakCorpus.hpp"
+
+using AIDTR::Ingest::StreamFramer;
+
+namespace {
+
+	const std::string Declaration = "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>";
+
+	std::string makeEvent(int i, const std::string& detail = "") {
+		return "<event version=\"2.0\" uid=\"UNIT-" + std::to_string(i) + "\" type=\"a-f-G-U-C\" how=\"h-e\""
+			" time=\"2020-03-12T18:05:41.332Z\" start=\"2020-03-12T18:05:41.332Z\" stale=\"2020-03-12T18:07:41.332Z\">"
+			"<point lat=\"40.45\" lon=\"-79.78\" hae=\"312.4\" ce=\"4.9\" le=\"9999999\"/>"
+			"<detail>" + detail + "<contact callsign=\"UNIT-" + std::to_string(i) + "\"/></detail></event>";
+	}
+
+	/// frame stream through prepare() and commit(), at most read bytes at a time, from the given split on
+	std::vector<std::string> frame(StreamFramer& framer, const std::string& stream, size_t read, size_t split = 0) {
+		std::vector<std::string> events;
+		auto onEvent = [&events](const char* data, size_t size) { events.emplace_back(data, size); };
+		size_t offset = 0;
+		while (offset < stream.size()) {
+			size_t n = std::min(read, stream.size() - offset);
+			if (offset < split) n = std::min(n, split - offset);
+			size_t space;
+			char* p = framer.prepare(space, n);
+			EXPECT_GE(space, n);
+			std::copy(stream.data() + offset, stream.data() + offset + n, p);
+			framer.commit(n, onEvent);
+			offset += n;
+		}
+		return events;
+	}
+}
+
+TEST(StreamFramer, FramesEverySplit) {
+	// markup that may hide an event's end: a quoted '>', comments, CDATA, processing instructions and nested events
+	const std::vector<std::string> expected = {
+		makeEvent(0),
+		makeEvent(1, "<remarks source=\"a>b\" note='&lt;/event>'>x &gt; y</remarks>"),
+		makeEvent(2, "<!-- </event> --><![CDATA[</event><event>]]><?pi </event>?>"),
+		makeEvent(3, "<_flow-tags_><event uid=\"inner\"><detail/></event><event uid=\"empty\"/></_flow-tags_>"),
+		"<event uid=\"self-closing\"/>",
+	};
+	std::string stream;
+	for (const auto& e : expected)
+		stream += Declaration + "\n<!-- between <event> -->\r\n" + e + "\n";
+	for (size_t split = 1; split < stream.size(); ++split) {
+		StreamFramer framer(4096, 64);
+		EXPECT_EQ(expected, frame(framer, stream, 4096, split)) << "split at " << split;
+		EXPECT_EQ(expected.size(), framer.getEventCount());
+		EXPECT_EQ(0u, framer.getErrorCount(StreamFramer::Malformed));
+		EXPECT_EQ(0u, framer.getBuffered());
+	}
+	StreamFramer framer(4096, 1);
+	EXPECT_EQ(expected, frame(framer, stream, 1)) << "one byte per read";
+	EXPECT_EQ(0u, framer.getDiscardedBytes());
+}
+
+TEST(StreamFramer, FramesTakProtocolBetweenEvents) {
+	const auto messages = Messaging::TakCorpus::make(3, false);
+	const std::vector<std::string> expected = { messages[0], makeEvent(0), messages[1], messages[2], makeEvent(1) };
+	std::string stream;
+	for (const auto& e : expected) stream += e;
+	for (size_t read : { size_t(1), size_t(7), size_t(64), stream.size() }) {
+		StreamFramer framer(4096, read);
+		EXPECT_EQ(expected, frame(framer, stream, read)) << read << " bytes per read";
+		EXPECT_EQ(0u, framer.getErrorCount(StreamFramer::Malformed));
+	}
+}
+
+TEST(StreamFramer, DiscardsOversizeEvent) {
+	const std::string big = makeEvent(0, "<remarks>" + std::string(2000, 'x') + "<b>bold</b></remarks>");
+	const std::string stream = makeEvent(1) + Declaration + big + Declaration + makeEvent(2);
+	const std::vector<std::string> expected = { makeEvent(1), makeEvent(2) };
+	// reads shorter than the limit, so the event is buffered across them; one that completes within a read is passed on
+	for (size_t read : { size_t(1), size_t(100), size_t(1000) }) {
+		StreamFramer framer(1024, read);
+		EXPECT_EQ(expected, frame(framer, stream, read)) << read << " bytes per read";
+		EXPECT_EQ(1u, framer.getErrorCount(StreamFramer::Oversize));
+		EXPECT_EQ(0u, framer.getErrorCount(StreamFramer::Malformed)) << "the rest of the oversize event is the same run";
+		EXPECT_GT(framer.getDiscardedBytes(), 1024u);
+		// the buffer holds at most an event's worth plus a read
+		size_t space;
+		framer.prepare(space, 1);
+		EXPECT_LE(framer.getBuffered(), 1024u + read);
+	}
+}
+
+TEST(StreamFramer, ResyncsAfterGarbage) {
+	const std::string event = makeEvent(0);
+	const struct {
+		const char* what;
+		std::string stream;
+		size_t events, malformed;
+	} cases[] = {
+		{ "leading garbage", "HTTP/1.1 200 OK\r\n\r\n" + event, 1, 1 },
+		{ "garbage between events", event + "\x01\x02junk<<>" + event, 2, 1 },
+		{ "unknown element between events", event + "<foo/>" + event, 2, 1 },
+		{ "runs of garbage", "junk" + event + "more junk" + event + "\xff\xfe" + event, 3, 3 },
+		{ "truncated event, next declaration", event.substr(0, 150) + Declaration + event, 1, 1 },
+		{ "truncated tag", event.substr(0, event.find("<point") + 10) + event, 1, 1 },
+		{ "truncated attribute value", event.substr(0, event.find("lat=") + 7) + event, 1, 1 },
+		{ "TAK Protocol length over the limit", std::string("\xbf\xff\xff\x01", 4) + event, 1, 1 },
+	};
+	for (const auto& c : cases) {
+		for (size_t read : { size_t(1), size_t(5), c.stream.size() }) {
+			StreamFramer framer(4096, read);
+			const auto events = frame(framer, c.stream, read);
+			EXPECT_EQ(c.events, events.size()) << c.what << ", " << read << " bytes per read";
+			for (const auto& e : events)
+				EXPECT_EQ(event, e) << c.what << ", " << read << " bytes per read";
+			EXPECT_EQ(c.malformed, framer.getErrorCount(StreamFramer::Malformed)) << c.what << ", " << read << " bytes per read";
+			EXPECT_EQ(0u, framer.getErrorCount(StreamFramer::Oversize)) << c.what;
+		}
+	}
+}
+
+TEST(StreamFramer, ResetDropsPartialEvent) {
+	const std::string event = makeEvent(0);
+	StreamFramer framer;
+	EXPECT_TRUE(frame(framer, event.substr(0, event.size() / 2), 64).empty());
+	EXPECT_NE(0u, framer.getBuffered());
+	framer.reset(); // the connection was reestablished
+	EXPECT_EQ(std::vector<std::string>{ event }, frame(framer, event, 64));
+	EXPECT_EQ(0u, framer.getErrorCount(StreamFramer::Malformed));
+}
@@ -0,0 +1,99 @@
+// test_tak_protocol_parser.cpp : TakProtocolParser on well-formed, truncated and corrupted TAK Protocol messages.
+//
+// Built with AddressSanitizer where the compiler has it (see CMakeLists.txt), so a read past the end of a datagram
+// fails the run even when the parser's result looks right.
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include "Messaging/TakCorpus.hpp"
+#include "Messaging/TakProtocolParser.hpp"
+
+using namespace Messaging;
+
+namespace {
+
+	/// every non-empty view of event lies within [begin, begin + size)
+	::testing::AssertionResult viewsInside(const CoTEvent& event, const char* begin, size_t size) {
+		for (auto v : { event.uid, event.type, event.how, event.detail, event.callsign })
+			if (!v.empty() && (v.data() < begin || v.data() + v.size() > begin + size))
+				return ::testing::AssertionFailure() << "a view of " << v.size() << " bytes lies outside the datagram";
+		return ::testing::AssertionSuccess();
+	}
+}
+
+TEST(TakProtocolParser, ParsesCorpus) {
+	// the values TakCorpus::makeMessage(i) writes
+	const int64_t time = 1584036341332000;
+	for (bool mesh : { true, false }) {
+		const auto corpus = TakCorpus::make(100, mesh);
+		for (size_t i = 0; i < corpus.size(); ++i) {
+			const std::string& d = corpus[i];
+			const std::string n = std::to_string(i);
+			char uid[32];
+			std::snprintf(uid, sizeof(uid), "ANDROID-%08zx", i);
+			CoTEvent event;
+			ASSERT_TRUE(TakProtocolParser::Parse(d.data(), d.size(), event)) << "message " << i;
+			EXPECT_EQ("a-f-G-U-C", event.type);
+			EXPECT_EQ(uid, event.uid);
+			EXPECT_EQ("h-e", event.how);
+			EXPECT_DOUBLE_EQ(40.45 + 0.0001 * (i % 1000), event.lat);
+			EXPECT_DOUBLE_EQ(-79.78 - 0.0001 * (i % 777), event.lon);
+			EXPECT_DOUBLE_EQ(312.4, event.hae);
+			EXPECT_DOUBLE_EQ(4.9, event.ce);
+			EXPECT_DOUBLE_EQ(9999999.0, event.le);
+			EXPECT_EQ(time, event.time);
+			EXPECT_EQ(time, event.start);
+			EXPECT_EQ(time + 120000000, event.stale);
+			EXPECT_EQ("UNIT-" + n, event.callsign);
+			EXPECT_EQ("192.168.1." + std::to_string(i % 250) + ":4242:tcp", event.endpoint);
+			EXPECT_EQ("Cyan", event.groupName);
+			EXPECT_EQ("Team Member", event.groupRole);
+			EXPECT_DOUBLE_EQ(double(i % 360), event.course);
+			EXPECT_DOUBLE_EQ(1.2, event.speed);
+			EXPECT_EQ("<uid Droid=\"UNIT-" + n + "\"/>", event.detail);
+			EXPECT_TRUE(viewsInside(event, d.data(), d.size()));
+		}
+	}
+}
+
+TEST(TakProtocolParser, EventWithoutPointHasNone) {
+	// a CotEvent with a uid, type and hae but no lat or lon, as proto3 sends an event without a point
+	TakCorpus::TakWriter cot, message;
+	cot.bytes(1, "a-f-G-U-C");
+	cot.bytes(5, "ANDROID-nopoint");
+	cot.real(12, 100.0);
+	message.bytes(2, cot.out);
+	const std::string d = std::string(1, char(0xBF)) + char(1) + char(0xBF) + message.out;
+	CoTEvent event;
+	ASSERT_TRUE(TakProtocolParser::Parse(d.data(), d.size(), event));
+	EXPECT_EQ("ANDROID-nopoint", event.uid);
+	EXPECT_FALSE(event.hasPoint());
+	EXPECT_TRUE(event.lat != event.lat);
+	EXPECT_TRUE(event.lon != event.lon);
+	EXPECT_DOUBLE_EQ(100.0, event.hae);
+}
+
+TEST(TakProtocolParser, EveryTruncationStaysInside) {
+	for (bool mesh : { true, false }) {
+		const std::string message = TakCorpus::make(1, mesh).front();
+		for (size_t size = 0; size < message.size(); ++size) {
+			std::unique_ptr<char[]> datagram(new char[size ? size : 1]);
+			std::memcpy(datagram.get(), message.data(), size);
+			CoTEvent event;
+			if (TakProtocolParser::Parse(datagram.get(), size, event)) {
+				EXPECT_TRUE(viewsInside(event, datagram.get(), size)) << "truncated to " << size;
+			}
+		}
+	}
+}
+
+TEST(TakProtocolParser, CorruptedMessagesStayInside) {
+	const size_t count = 200000;
+	const auto result = TakCorpus::fuzz(count, 40);
+	EXPECT_EQ(count, result.accepted + result.rejected);
+	EXPECT_EQ(0u, result.escaped);
+	EXPECT_GT(result.rejected, 0u);
+}